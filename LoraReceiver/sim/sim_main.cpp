@@ -0,0 +1,331 @@
+/**************************************************************************
+LoRa WLAN Bridge host simulation
+
+  Runs setup()/loop() of LoraReceiver.cpp against the simulated E32 link
+  in lib/E32Sim. The peer plays the rain sensor and produces a lora_payload_t
+  every SIM_PEER_INTERVAL_MS, without waiting for an answer. The channel
+  report shows how long the frames sit in the UART buffer before the
+  sketch reads them.
+
+  Every SIM_PEER_CONFIG_EVERY-th message is a SET_CONFIG_RESPONSE
+  (lora_config_payload_t) instead, 0 = none. With SIM_PEER_BATCH_AGE_MS
+  the peer packs messages into lora_batch.h frames, flushed when full or
+  when the oldest message is that old; 0 sends every message on its own.
+  Frames queue in the peer and go out back to back, at most 16 waiting.
+
+  The MQTT broker (a mosquitto stand-in behind the PubSubClient stub)
+  takes SIM_BROKER_LATENCY_MS on average per publish, exponentially
+  distributed, during which the sketch's publish() call blocks. It
+  reports publishes and records per second and the latency from a
+  message's creation in the sensor until it reached the broker.
+  SIM_BROKER_LATENCY_MS=-1 leaves the broker offline. SIM_BROKER_DOWN_AT_S
+  and SIM_BROKER_DOWN_S take it away for a while, the bridge keeps the
+  messages in its flash log (LittleFS stand-in, SIM_FS_DIR) meanwhile;
+  the report counts messages that never arrived and ones that arrived
+  twice.
+
+  SIM_PERF_REQUEST_S > 0 writes a SEND_PROG_PARAMS request to the console
+  every that many seconds, like a host tool on the USB port. The answer
+  is a LOGF_PERF_REPORT record in the console output:
+  SIM_VERBOSE=1 ... | tools/log_decode.
+
+  pio run -e native -t exec
+  Environment: SIM_DURATION_S, SIM_LOSS, SIM_LATENCY_MS, SIM_SEED,
+               SIM_VERBOSE, SIM_PEER_INTERVAL_MS, SIM_PEER_CONFIG_EVERY,
+               SIM_PEER_BATCH_AGE_MS, SIM_BROKER_LATENCY_MS,
+               SIM_BROKER_DOWN_AT_S, SIM_BROKER_DOWN_S, SIM_FS_DIR, SIM_FS_KEEP,
+               SIM_PERF_REQUEST_S
+
+*/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <random>
+
+#include "sim_channel.h"
+#include "PubSubClient.h"
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_checksum.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+
+class SimMqttBroker
+{
+public:
+  void begin()
+  {
+    if (const char *v = getenv("SIM_BROKER_LATENCY_MS"))
+      meanLatencyMs = atof(v);
+    PubSubClient::brokerOnline = meanLatencyMs >= 0;
+    uint32_t downAtS = 0, downS = 0;
+    if (const char *v = getenv("SIM_BROKER_DOWN_AT_S"))
+      downAtS = (uint32_t)atoi(v);
+    if (const char *v = getenv("SIM_BROKER_DOWN_S"))
+      downS = (uint32_t)atoi(v);
+    if (downS > 0 && PubSubClient::brokerOnline)
+    {
+      sim().schedule((sim_time_t)downAtS * 1000000, []
+                     { PubSubClient::brokerOnline = false; });
+      sim().schedule((sim_time_t)(downAtS + downS) * 1000000, []
+                     { PubSubClient::brokerOnline = true; });
+    }
+    PubSubClient::broker = [this](const char *, const uint8_t *payload, unsigned int length)
+    { return publish(payload, length); };
+  }
+
+  // Sensor side: when message id was created
+  void created(uint16_t id)
+  {
+    createdAt[id] = sim().now();
+    seen[id] = false;
+    produced++;
+  }
+
+  void report()
+  {
+    double seconds = sim().now() / 1e6;
+    printf("mqtt broker     : %u publishes, %u records, %.1f bytes per publish%s\n", publishes, records,
+           publishes ? (double)bytes / publishes : 0.0, PubSubClient::brokerOnline ? "" : " (offline)");
+    printf("mqtt throughput : %.3f publishes/s, %.3f records/s, %.2f records per publish\n",
+           seconds > 0 ? publishes / seconds : 0.0, seconds > 0 ? records / seconds : 0.0,
+           publishes ? (double)records / publishes : 0.0);
+    publishCall.print("publish call");
+    toBroker.print("sensor to broker");
+    uint32_t missing = 0;
+    for (uint32_t id = 1; id <= produced && id < seen.size(); ++id)
+      missing += !seen[id];
+    printf("mqtt delivery   : %u of %u messages missing, %u duplicates\n", missing, produced, duplicates);
+  }
+
+private:
+  // Runs in the sketch's publish() call, which blocks for the latency
+  bool publish(const uint8_t *payload, unsigned int length)
+  {
+    sim_time_t start = sim().now();
+    if (meanLatencyMs > 0)
+    {
+      std::exponential_distribution<double> latency(1.0 / meanLatencyMs);
+      delay((uint32_t)latency(sim().rng()));
+    }
+    publishes++;
+    bytes += length;
+    // Every record starts with its messageID
+    std::string text((const char *)payload, length);
+    const char key[] = "\"messageID\":";
+    for (size_t at = text.find(key); at != std::string::npos; at = text.find(key, at + 1))
+    {
+      uint16_t id = (uint16_t)atoi(text.c_str() + at + sizeof(key) - 1);
+      records++;
+      if (seen[id])
+      {
+        duplicates++;
+        continue;
+      }
+      seen[id] = true;
+      toBroker.add(sim().now() - createdAt[id]);
+    }
+    publishCall.add(sim().now() - start);
+    return true;
+  }
+
+  double meanLatencyMs = 20;
+  std::vector<sim_time_t> createdAt = std::vector<sim_time_t>(65536);
+  std::vector<bool> seen = std::vector<bool>(65536);
+  uint32_t produced = 0;
+  uint32_t duplicates = 0;
+  uint32_t publishes = 0;
+  uint32_t records = 0;
+  uint64_t bytes = 0;
+  SimLatency publishCall;
+  SimLatency toBroker;
+};
+
+class RainSensorBeacon : public SimPeer
+{
+public:
+  void begin() override
+  {
+    if (const char *v = getenv("SIM_PEER_INTERVAL_MS"))
+      intervalMs = (uint32_t)atoi(v);
+    if (const char *v = getenv("SIM_PEER_CONFIG_EVERY"))
+      configEvery = (uint32_t)atoi(v);
+    if (const char *v = getenv("SIM_PEER_BATCH_AGE_MS"))
+      batchAgeMs = (uint32_t)atoi(v);
+    batch.begin(batchAgeMs);
+    broker.begin();
+    sim().schedule(sim().now(), [this]
+                   { produce(); });
+    if (const char *v = getenv("SIM_PERF_REQUEST_S"))
+      perfEveryUs = (sim_time_t)atoi(v) * 1000000;
+    if (perfEveryUs > 0)
+      sim().schedule(sim().now() + perfEveryUs, [this]
+                     { requestPerf(); });
+  }
+
+  void onPacket(const uint8_t *, size_t) override
+  {
+    received++;
+  }
+
+  void report() override
+  {
+    double seconds = sim().now() / 1e6;
+    printf("sensor          : %u messages sent (%u config produced) in %u frames, %u dropped, %u packets received\n",
+           sent, configs, frames, dropped, received);
+    if (perfEveryUs > 0)
+      printf("console         : %u perf requests\n", perfRequests);
+    printf("offered load    : %.3f messages/s\n", seconds > 0 ? produced / seconds : 0.0);
+    printf("message rate    : %.3f messages/s, %.2f per frame, %.1f ms airtime per message\n",
+           seconds > 0 ? sent / seconds : 0.0, frames ? (double)sent / frames : 0.0,
+           sent ? airUs / 1000.0 / sent : 0.0);
+    queueWait.print("sensor to air");
+    broker.report();
+  }
+
+private:
+  // A host tool asking for the performance summary on the USB console
+  void requestPerf()
+  {
+    lora_payload_t request = lora_message_init<LORA_EVENT_SEND_PROG_PARAMS>(++perfRequests);
+    lora_frame_t frame;
+    lora_message_encode(&frame, &request);
+    sim().consoleInput(frame.data, frame.len);
+    sim().schedule(sim().now() + perfEveryUs, [this]
+                   { requestPerf(); });
+  }
+
+  struct PendingFrame
+  {
+    lora_frame_t frame;
+    uint32_t messages;
+    std::vector<sim_time_t> created;
+  };
+
+  void produce()
+  {
+    produced++;
+    uint16_t id = (uint16_t)produced;
+    broker.created(id);
+    if (configEvery && produced % configEvery == 0)
+    {
+      lora_config_payload_t config = lora_message_init<LORA_EVENT_SET_CONFIG_RESPONSE>(id);
+      config.ulp_pulses_to_wake_up = CONFIG_DEFAULT_ULP_PULSES;
+      config.wakeup_interval_sec = CONFIG_DEFAULT_WAKEUP_SEC;
+      config.shutdown_delay_ms = CONFIG_DEFAULT_SHUTDOWN_MS;
+      config.lora_receive_delay_ms = CONFIG_DEFAULT_LORA_DELAY_MS;
+      config.checksum = lora_message_checksum(&config);
+      configs++;
+      add(config);
+    }
+    else
+    {
+      lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(id);
+      payload.elapsed_time_ms = (uint32_t)millis();
+      payload.pulse_count = produced;
+      payload.checksum = lora_message_checksum(&payload);
+      add(payload);
+    }
+    sim().schedule(sim().now() + (sim_time_t)intervalMs * 1000, [this]
+                   { produce(); });
+  }
+
+  template <typename T>
+  void add(const T &msg)
+  {
+    uint32_t now = (uint32_t)millis();
+    if (!batch.add(msg, now))
+    {
+      flush();
+      batch.add(msg, now);
+    }
+    created.push_back(sim().now());
+    if (batchAgeMs == 0 || !batch.fits(sizeof(lora_payload_t)))
+    {
+      flush();
+      return;
+    }
+    if (batch.messages() == 1)
+    {
+      uint32_t generation = ++batchGeneration;
+      sim().schedule(sim().now() + (sim_time_t)batchAgeMs * 1000, [this, generation]
+                     {
+        if (generation == batchGeneration && !batch.empty())
+          flush(); });
+    }
+  }
+
+  // Queue the collected messages as one frame, dropped if the queue is full
+  void flush()
+  {
+    batchGeneration++;
+    PendingFrame pending;
+    pending.messages = batch.messages();
+    batch.flush(&pending.frame, nextBatchId++);
+    pending.created.swap(created);
+    if (queue.size() >= 16)
+    {
+      dropped += pending.messages;
+      return;
+    }
+    queue.push_back(pending);
+    if (!busy)
+      transmit();
+  }
+
+  void transmit()
+  {
+    if (queue.empty())
+    {
+      busy = false;
+      return;
+    }
+    busy = true;
+    PendingFrame &pending = queue.front();
+    for (sim_time_t t : pending.created)
+      queueWait.add(sim().now() - t);
+    sim_time_t air = sim().airtimeUs(pending.frame.len);
+    airUs += air;
+    frames++;
+    sent += pending.messages;
+    sim().peerSend(pending.frame.data, pending.frame.len);
+    queue.pop_front();
+    sim().schedule(sim().now() + air, [this]
+                   { transmit(); });
+  }
+
+  uint32_t intervalMs = 2000;
+  uint32_t configEvery = 0;
+  uint32_t batchAgeMs = 0;
+  LoraBatchWriter batch;
+  uint32_t batchGeneration = 0;
+  uint16_t nextBatchId = 1;
+  std::vector<sim_time_t> created;
+  std::deque<PendingFrame> queue;
+  bool busy = false;
+  uint64_t airUs = 0;
+  uint32_t produced = 0;
+  uint32_t sent = 0;
+  uint32_t configs = 0;
+  uint32_t frames = 0;
+  uint32_t dropped = 0;
+  uint32_t received = 0;
+  sim_time_t perfEveryUs = 0;      // SIM_PERF_REQUEST_S
+  uint32_t perfRequests = 0;
+  SimLatency queueWait;
+  SimMqttBroker broker;
+};
+
+int main()
+{
+  static RainSensorBeacon peer;
+  sim().configure(sim_config_from_env());
+  sim().attachPeer(&peer);
+  peer.begin();
+  setup();
+  sim().stats().setup_done_us = sim().now();
+  for (;;)
+    loop();
+}
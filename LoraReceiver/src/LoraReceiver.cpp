@@ -13,6 +13,19 @@ LoRa WLAN Bridge
   History: master if not shown otherwise
   20250405  V0.1: Copy from LoRABridge
   20250407  V0.2: Successfully tested with LoraESPIDF Sender Version 0.5
+  20261016  V0.3: Wait on AUX / UART RX events, decode frames with LoraFrameDecoder instead of delay(1000) + receiveMessage()
+  20261016  V0.4: PIPELINE_MODE: radio task on core 0, output in loop() on core 1, lock-free queue in between
+  20261016  V0.5: Checksum via lora_message_checksum(), optional CRC-16 (LORA_CHECKSUM)
+  20261016  V0.6: Event name and validation from the lora_messages.h schema registry
+  20261016  V0.7: Deferred binary logging (lora_log.h) instead of Serial.print in the receive path
+  20261016  V0.8: Unpack multi-message frames (lora_batch.h) into the receive handler, config messages too
+  20261016  V0.9: Expand compact delta frames (lora_delta.h) into lora_payload_t records
+  20261016  V0.10: MQTT uplink: received messages batched into one JSON publish (lora_mqtt_batch.h), from loop() off the radio task
+  20261016  V0.11: Store and forward: messages go to a log on flash (lora_flash_log.h) while the broker is away, published from there once it is back
+  20261017  V0.12: Fast boot: E32 config written only when the module has another one, cached in RTC memory (lora_e32_config.h)
+  20261017  V0.13: Cycle counts per stage of the receive path in histograms, summary on SEND_PROG_PARAMS over USB (lora_perf.h)
+  20261017  V0.14: Module UART at the fastest rate it takes up to E32_UART_BPS, verified by read-back, 9600 as fallback
+  20261017  V0.15: MQTT uplink and store and forward only with a WIFI_SSID, no flash log without a network
 
 
 
@@ -22,13 +35,32 @@ LoRa WLAN Bridge
 #include <Arduino.h>
 // 1 means debug on 0 means off
 #define DEBUG 1
+// Log records above this level are not compiled in
+#ifndef LORA_LOG_LEVEL
+#define LORA_LOG_LEVEL (DEBUG ? LORA_LOG_LEVEL_DEBUG : LORA_LOG_LEVEL_WARN)
+#endif
 
 #include "LoRa_E32.h"
+#include <WiFi.h>
 #include <PubSubClient.h> //MQTT
+#include <LittleFS.h>
 #include <ArduinoJson.h>
 
 // Data structure for message
 #include <HomeAutomationCommon.h>
+#include "communication.h"
+#include "lora_frame.h"     // Frame decoder, shared with LoraSender
+#include "lora_checksum.h"  // Byte sum or CRC-16 (LORA_CHECKSUM)
+#include "lora_messages.h"  // Message schema registry
+#include "lora_batch.h"     // Several messages per frame
+#include "lora_delta.h"     // Compact sensor readings
+#include "lora_rx_event.h"  // Wake on AUX / UART RX instead of polling
+#include "lora_spsc_queue.h" // Radio task -> loop() hand over
+#include "lora_log.h"       // Deferred logging, drained by a low priority task
+#include "lora_mqtt_batch.h" // Received messages -> one MQTT publish
+#include "lora_flash_log.h" // Backlog on flash while the broker is away
+#include "lora_e32_config.h" // Module parameters written only when they differ
+#include "lora_perf.h"      // Cycle counts of the receive path
 
 // debug macro
 #if DEBUG == 1
@@ -58,41 +90,193 @@ const int ChannelNumber = 6;
 // LoRa_E32 e32ttl(RxD, TxD,AUX, M0, M1, UART_BPS_9600);
 // use hardware serial #1
 LoRa_E32 e32ttl(&Serial1, AUX, M0, M1); // RX, TX
+RTC_DATA_ATTR lora_e32_config_cache_t e32Cache; // Parameters last known to be in the module
+
+const String sSoftware = "LoraSendReceiver V0.15";
+
+// Max time to wait for a message before the loop reports a timeout
+// 0 waits forever
+uint32_t RX_DEADLINE_MS = 2UL * 60 * 1000;
+
+// Pipeline mode: a radio task pinned to core 0 receives and decodes frames
+// and hands them over a lock-free queue to loop() on core 1, which does the
+// output. Slow Serial output or the LED blink no longer delay the next
+// receive. 0 runs everything inline in loop().
+#ifndef PIPELINE_MODE
+#define PIPELINE_MODE 1
+#endif
+const uint32_t LED_BLINK_MS = 500;          // LED on time per message
+const uint32_t STATS_INTERVAL_MS = 60000;   // Queue statistics output interval
+
+// MQTT uplink: every received message goes to the broker as well, up to
+// MQTT_BATCH_RECORDS of them in one JSON publish, sent once that many are
+// collected or the oldest is MQTT_BATCH_AGE_MS old (lora_mqtt_batch.h).
+// Connecting and publishing run in loop(); in PIPELINE_MODE that is off
+// the radio task, so a slow or missing broker delays the output but not
+// the reception. 0 = console output only.
+// WIFI_SSID, WIFI_PASSWORD and MQTT_SERVER via build_flags (extra_secrets.ini);
+// a build without WIFI_SSID has no uplink, with an empty one the uplink
+// stays off at runtime, store and forward included.
+#ifndef MQTT_UPLINK
+#ifdef WIFI_SSID
+#define MQTT_UPLINK 1
+#else
+#define MQTT_UPLINK 0
+#endif
+#endif
+#ifndef WIFI_SSID
+#define WIFI_SSID ""
+#endif
+#ifndef WIFI_PASSWORD
+#define WIFI_PASSWORD ""
+#endif
+#ifndef MQTT_SERVER
+#define MQTT_SERVER "mosquitto"
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+#ifndef MQTT_BATCH_RECORDS
+#define MQTT_BATCH_RECORDS 8        // at most LORA_MQTT_BATCH_RECORDS
+#endif
+#ifndef MQTT_BATCH_AGE_MS
+#define MQTT_BATCH_AGE_MS 5000
+#endif
+const char *const MQTT_TOPIC = "lora/bridge/rx";
+const char *const MQTT_CLIENT_ID = "LoraBridge";
+const uint32_t MQTT_RETRY_MS = 10000;       // Wait after a failed connect or publish
+
+// Store and forward: while the broker is away, received messages go to a
+// ring log on flash (LittleFS, lora_flash_log.h) instead of being dropped.
+// Once a publish goes through again the backlog is published first, in
+// full batches back to back, oldest first; new messages queue behind it.
+// The open log block is written every RXLOG_FLUSH_MS, a power loss takes
+// at most that much. 0 = drop what does not fit the batch.
+#ifndef STORE_FORWARD
+#define STORE_FORWARD MQTT_UPLINK
+#endif
+const char *const RXLOG_PATH = "/rxlog.bin";
+const char *const RXLOG_CURSOR_PATH = "/rxlog.cur";
+const uint32_t RXLOG_BLOCKS = 256;          // Ring of 4 KB blocks, 1 MB
+const uint32_t RXLOG_FLUSH_MS = 10000;
+
+// Boot: the E32 parameters are read and written only when the module has
+// other ones, and not even read while the copy in RTC memory says they
+// are right (lora_e32_config.h). PRINT_PARAMETERS 1 dumps them at every
+// boot; BOOT_SERIAL_WAIT_MS gives a serial monitor time to attach before
+// the first output.
+#ifndef PRINT_PARAMETERS
+#define PRINT_PARAMETERS 0
+#endif
+#ifndef BOOT_SERIAL_WAIT_MS
+#define BOOT_SERIAL_WAIT_MS 0
+#endif
 
-const String sSoftware = "LoraSendReceiver V0.2";
+// Module UART: the fastest rate tried at boot, down to 9600 if the module
+// does not read it back (lora_e32_config_negotiate()). LOGF_UART_STATS
+// has the time each received frame spends on the UART.
+#ifndef E32_UART_BPS
+#define E32_UART_BPS UART_BPS_115200
+#endif
+
+// Performance summary (lora_perf.h, LORA_PERF 0 compiles it out): UART
+// read, decode, checksum, handler and log are timed with the cycle
+// counter. A SEND_PROG_PARAMS message framed like on air and written to
+// the USB console is answered with a LOGF_PERF_REPORT record
+// (tools/log_decode prints it); this firmware only listens, so there is
+// no answer over air. loop() looks at the console at least this often.
+const uint32_t CONSOLE_POLL_MS = 100;
+
+typedef struct
+{
+  union
+  {
+    lora_payload_t payload;       // Sensor data and the other lora_payload_t events
+    lora_config_payload_t config; // SET/RESET_CONFIG(_RESPONSE)
+  };
+  uint32_t received_ms;
+} rx_record_t;
+const size_t RX_MESSAGE_MAX = sizeof(lora_payload_t) > sizeof(lora_config_payload_t) ? sizeof(lora_payload_t) : sizeof(lora_config_payload_t);
+// Messages one frame can carry, a compact frame the most
+const size_t RX_MAX_MESSAGES = LORA_DELTA_MAX_READINGS;
+
+#if PIPELINE_MODE
+LoraSpscQueue<rx_record_t, 16> rxQueue;     // radio task -> loop()
+TaskHandle_t outputTaskHandle = NULL;
+#endif
+uint32_t rxErrors = 0;      // Frames with wrong length
+uint32_t rxTimeouts = 0;    // RX_DEADLINE_MS expired without a message
+uint32_t rxFrames = 0;      // Frames decoded
+LoraPerfHistogram uartFrameUs; // Module UART output per frame, AUX low in µs
+uint32_t rxBatches = 0;     // of which batches
+uint32_t rxMessages = 0;    // Messages unpacked from them
+LoraDeltaDecoder rxDelta;   // Last readings, bases for compact frames
+#if MQTT_UPLINK
+WiFiClient wifiClient;
+PubSubClient mqtt(wifiClient);
+LoraMqttBatch mqttBatch;        // Messages waiting for the next publish
+uint32_t mqttFailures = 0;      // Failed connects and publishes
+uint32_t mqttConnects = 0;
+uint32_t mqttMaxPublishMs = 0;  // Longest publish() call
+bool mqttDown = false;          // Last connect or publish failed
+bool mqttEnabled = false;       // Configured, see mqttBegin()
+#endif
+#if STORE_FORWARD
+File rxLogFile;
+File rxLogCursor;
+LoraFlashLog<File> rxLog;       // Messages waiting for the broker
+bool rxLogPopPending = false;   // The batch holds the last records of rxLog.front()
+#endif
 
 // put function declarations here:
 
 void printParameters(struct Configuration configuration);
-void receiveValuesLoRa();
-void printReceivedData();
+bool receiveValuesLoRa();
+size_t receiveFrameLoRa(rx_record_t *records, size_t max);
+void printReceivedData(const rx_record_t &record);
+void printQueueStats();
+void serveConsole();
+void mqttBegin();
+void mqttQueue(const rx_record_t &record);
+uint32_t mqttService();
+void rxLogBegin();
+void rxLogAppend(const rx_record_t &record, size_t len);
+bool rxLogReplay();
+void radioTask(void *parameter);
 
 void setup()
 {
   Serial.begin(56000);
-  delay(2000);
+  lora_log_begin(Serial);
+  delay(BOOT_SERIAL_WAIT_MS);
   Serial.println();
   Serial.println(sSoftware);
-  Serial1.begin(9600, SERIAL_8N1, RxD, TxD);
+  // Parameter command rate until the module runs its own
+  Serial1.begin(LORA_E32_PROGRAM_BAUD, SERIAL_8N1, RxD, TxD);
   // Explizite Konfiguration setzen
   Configuration config;
   config.ADDH = 0x00;
   config.ADDL = 0x00;
   config.CHAN = 0x06;                             // Kanal 7
   config.SPED.airDataRate = AIR_DATA_RATE_010_24; // 2.4kbps
-  config.SPED.uartBaudRate = UART_BPS_9600;
+  config.SPED.uartBaudRate = E32_UART_BPS;      // Highest tried
   config.SPED.uartParity = MODE_00_8N1;
   config.OPTION.fixedTransmission = FT_TRANSPARENT_TRANSMISSION;
   config.OPTION.fec = FEC_1_ON; // Turn off Forward Error Correction Switch
 
-  delay(500);
-  Serial.println("in setup routine");
-
-  //  Startup all pins and UART
+  //  Startup all pins and UART, waits for AUX
   e32ttl.begin();
-  e32ttl.setConfiguration(config, WRITE_CFG_PWR_DWN_SAVE);
-
-  delay(500);
+  // Write only what the module does not have yet and check it, at the
+  // fastest UART rate it takes; Serial1 follows
+  uint8_t e32Commands = 0;
+  uint8_t e32Fallbacks = 0;
+  lora_e32_config_result_t e32Result =
+      lora_e32_config_negotiate(e32ttl, Serial1, &config, &e32Cache, &e32Commands, &e32Fallbacks);
+  if (e32Result == LORA_E32_CONFIG_FAILED)
+    Serial.println("Error setting configuration");
+
+#if PRINT_PARAMETERS
+  Serial1.updateBaudRate(LORA_E32_PROGRAM_BAUD);
   ResponseStructContainer c;
   c = e32ttl.getConfiguration();
   // It's important get configuration pointer before all other operation
@@ -102,57 +286,529 @@ void setup()
 
   printParameters(configuration);
   c.close();
+  Serial1.updateBaudRate(lora_uart_bps(config.SPED.uartBaudRate));
+#endif
+#if MQTT_UPLINK
+  mqttBegin();
+#endif
+  // Wake the receive loop on AUX / UART RX events
+  lora_rx_begin(Serial1, AUX);
+#if PIPELINE_MODE
+  // setup() and loop() run in the Arduino loop task on core 1
+  outputTaskHandle = xTaskGetCurrentTaskHandle();
+  xTaskCreatePinnedToCore(radioTask, "radio", 4096, NULL, 2, NULL, 0);
+#endif
+  LORA_LOG_INFO(LOGF_E32_CONFIG, e32Result, e32Commands, millis());
+  LORA_LOG_INFO(LOGF_E32_UART, Serial1.baudRate(), lora_uart_bps(E32_UART_BPS), e32Fallbacks);
 }
 
 void loop()
 {
-    Serial.println("Loop Start");
+#if PIPELINE_MODE
+  // Output stage: print what the radio task received, blink without delay()
+  static uint32_t ledOnAt = 0;
+  static bool ledOn = false;
+  static uint32_t lastStats = 0;
+  uint32_t now = millis();
+  uint32_t wait = STATS_INTERVAL_MS - (now - lastStats);
+  if (ledOn && LED_BLINK_MS - (now - ledOnAt) < wait)
+    wait = LED_BLINK_MS - (now - ledOnAt);
+#if MQTT_UPLINK
+  uint32_t mqttWait = mqttService();
+  if (mqttWait < wait)
+    wait = mqttWait;
+#endif
+  if (CONSOLE_POLL_MS < wait)
+    wait = CONSOLE_POLL_MS;
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+  serveConsole();
+
+  rx_record_t record;
+  while (rxQueue.pop(&record))
+  {
+    printReceivedData(record);
+#if MQTT_UPLINK
+    mqttQueue(record);
+#endif
+    neopixelWrite(RGB_BUILTIN, 50, 0, 0);
+    ledOn = true;
+    ledOnAt = millis();
+  }
+  if (ledOn && millis() - ledOnAt >= LED_BLINK_MS)
+  {
+    neopixelWrite(RGB_BUILTIN, 0, 0, 0); // Off
+    ledOn = false;
+  }
+  if (millis() - lastStats >= STATS_INTERVAL_MS)
+  {
+    lastStats = millis();
+    printQueueStats();
+  }
+#else
+    LORA_LOG_DEBUG(LOGF_LOOP_START);
+  uint32_t waitStart = millis();
   while (1)
   {
-    /* code */
-  
-  delay(1000);
- 
 //   Serial.println("Wait for receiving a message");
-  
+  serveConsole();
+  if (receiveValuesLoRa())
+  {
+    waitStart = millis();
+    continue;
+  }
 
-  receiveValuesLoRa();
+  uint32_t waited = millis() - waitStart;
+  if (RX_DEADLINE_MS != 0 && waited >= RX_DEADLINE_MS)
+  {
+    LORA_LOG_WARN(LOGF_RX_DEADLINE, RX_DEADLINE_MS);
+    waitStart = millis();
+    continue;
   }
+  uint32_t wait = RX_DEADLINE_MS != 0 ? RX_DEADLINE_MS - waited : portMAX_DELAY;
+#if MQTT_UPLINK
+  // Publishes from here hold up the reception, PIPELINE_MODE avoids that
+  uint32_t mqttWait = mqttService();
+  if (mqttWait < wait)
+    wait = mqttWait;
+#endif
+  if (CONSOLE_POLL_MS < wait)
+    wait = CONSOLE_POLL_MS;
+  lora_rx_wait(Serial1, wait);
+  }
+#endif
 }
 
-void receiveValuesLoRa()
+#if PIPELINE_MODE
+/**
+ * @brief Radio stage, pinned to core 0: wait for frames and queue them for loop()
+ */
+void radioTask(void *)
 {
-  // LORA_DATA_STRUCTURE sLoRaReceiveData;
-  //  If something available
-  if (e32ttl.available() > 1)
+  uint32_t waitStart = millis();
+  for (;;)
   {
-    // read the String message
-    ResponseContainer rc = e32ttl.receiveMessage();
-   
-    // Is something goes wrong print error
-    if (rc.status.code != 1)
+    rx_record_t records[RX_MAX_MESSAGES];
+    size_t n = receiveFrameLoRa(records, RX_MAX_MESSAGES);
+    if (n > 0)
     {
-      rc.status.getResponseDescription();
-      Serial.println("Error receiving data");
+      uint32_t now = millis();
+      // A full queue counts a drop instead of blocking the radio
+      for (size_t i = 0; i < n; ++i)
+      {
+        records[i].received_ms = now;
+        rxQueue.push(records[i]);
+      }
+      xTaskNotifyGive(outputTaskHandle);
+      waitStart = millis();
+      continue;
     }
-    else
+
+    uint32_t waited = millis() - waitStart;
+    if (RX_DEADLINE_MS != 0 && waited >= RX_DEADLINE_MS)
     {
-      // Print the data received
-      Serial.println(rc.data);
-      neopixelWrite(RGB_BUILTIN, 50, 0, 0);
-      delay(500);
-      neopixelWrite(RGB_BUILTIN, 0, 0, 0); // Off
+      rxTimeouts++;
+      waitStart = millis();
+      continue;
+    }
+    lora_rx_wait(Serial1, RX_DEADLINE_MS != 0 ? RX_DEADLINE_MS - waited : portMAX_DELAY);
+  }
+}
+#endif
+
+/**
+ * @brief Inline receive: decode, print and blink in the calling task
+ */
+bool receiveValuesLoRa()
+{
+  rx_record_t records[RX_MAX_MESSAGES];
+  uint32_t errors = rxErrors;
+  size_t n = receiveFrameLoRa(records, RX_MAX_MESSAGES);
+  if (rxErrors != errors)
+    LORA_LOG_ERROR(LOGF_RX_ERROR, rxErrors);
+  if (n == 0)
+    return false;
+  uint32_t now = millis();
+  for (size_t i = 0; i < n; ++i)
+  {
+    records[i].received_ms = now;
+    printReceivedData(records[i]);
+#if MQTT_UPLINK
+    mqttQueue(records[i]);
+#endif
+  }
+  neopixelWrite(RGB_BUILTIN, 50, 0, 0);
+  delay(LED_BLINK_MS);
+  neopixelWrite(RGB_BUILTIN, 0, 0, 0); // Off
+  return true;
+}
+
+/**
+ * @brief Feed buffered UART bytes into the frame decoder, no output
+ *
+ * A frame holds one message or a batch of them (lora_batch.h); each
+ * message is copied into its own record.
+ * @return number of records filled, 0 if no complete frame yet
+ */
+size_t receiveFrameLoRa(rx_record_t *records, size_t max)
+{
+  // A frame is handled as soon as its last byte arrived
+  static LoraFrameDecoder rxDecoder;
+  static bool rxDecoderInit = false;
+  if (!rxDecoderInit)
+  {
+    rxDecoder.accept(sizeof(lora_payload_t));
+    rxDecoder.accept(sizeof(lora_config_payload_t));
+    rxDecoder.acceptVariable(LORA_EVENT_BATCH, LORA_BATCH_LENGTH_OFFSET);
+    rxDecoder.acceptVariable(LORA_EVENT_SENSOR_DELTA, LORA_DELTA_LENGTH_OFFSET);
+    rxDecoderInit = true;
+  }
+  // Cycles of the frame so far, it may come in over several calls
+  static uint32_t uartCycles = 0, decodeCycles = 0;
+  static uint32_t decoderErrors = 0;
+  bool complete = false;
+  uint32_t readStart = lora_perf_cycles();
+  while (!complete && Serial1.available())
+  {
+    uint8_t b = (uint8_t)Serial1.read();
+    uint32_t decodeStart = lora_perf_cycles();
+    complete = rxDecoder.push(b);
+    decodeCycles += lora_perf_cycles() - decodeStart;
+  }
+  uartCycles += lora_perf_cycles() - readStart;
+  if (rxDecoder.errors != decoderErrors)
+  {
+    lora_perf_errors(rxDecoder.errors - decoderErrors);
+    decoderErrors = rxDecoder.errors;
+  }
+  if (!complete)
+    return 0;
+
+  uint32_t handlerStart = lora_perf_cycles();
+  lora_perf_record(LORA_PERF_UART, uartCycles - decodeCycles);
+  lora_perf_record(LORA_PERF_DECODE, decodeCycles);
+  uartCycles = decodeCycles = 0;
+  uint32_t auxUs;
+  if (lora_rx_aux_pulse(&auxUs))
+    uartFrameUs.record(auxUs);
+  uint32_t errors = rxErrors;
+  rxFrames++;
+  if (rxDecoder.length() >= 4 && lora_message_event(rxDecoder.payload()) == LORA_EVENT_SENSOR_DELTA)
+  {
+    static lora_payload_t readings[LORA_DELTA_MAX_READINGS];
+    size_t n = rxDelta.decode(rxDecoder.payload(), rxDecoder.length(), readings, LORA_DELTA_MAX_READINGS);
+    if (n == 0)
+      rxErrors++;
+    if (n > max)
+      n = max;
+    for (size_t i = 0; i < n; ++i)
+      records[i].payload = readings[i];
+    rxMessages += n;
+    lora_perf_since(LORA_PERF_HANDLER, handlerStart);
+    lora_perf_frame(rxErrors == errors);
+    return n;
+  }
 
-      
+  LoraBatchReader reader(rxDecoder.payload(), rxDecoder.length());
+  if (reader.isBatch())
+    rxBatches++;
+  const uint8_t *msg;
+  size_t len;
+  size_t n = 0;
+  while (n < max && reader.next(&msg, &len))
+  {
+    if (len > RX_MESSAGE_MAX)
+    {
+      rxErrors++;
+      continue;
+    }
+    memcpy(&records[n].payload, msg, len);
+    // Plain sensor readings are keyframes for compact frames
+    if (len == sizeof(lora_payload_t) && records[n].payload.lora_eventID == LORA_EVENT_SENSOR_DATA &&
+        lora_message_validate(lora_message_find(LORA_EVENT_SENSOR_DATA), msg, len) == LORA_MSG_OK)
+      rxDelta.remember(records[n].payload);
+    n++;
+  }
+  if (!reader.isValid())
+    rxErrors++;
+  rxMessages += n;
+  lora_perf_since(LORA_PERF_HANDLER, handlerStart);
+  lora_perf_frame(rxErrors == errors);
+  return n;
+}
+
+void printReceivedData(const rx_record_t &record)
+{
+  const lora_payload_t &payload = record.payload;
+  uint32_t checksumStart = lora_perf_cycles();
+  const lora_message_info_t *info = lora_message_find(payload.lora_eventID);
+  lora_msg_status_t status = lora_message_validate(info, &payload, info ? info->size : sizeof(payload));
+  lora_perf_since(LORA_PERF_CHECKSUM, checksumStart);
+  if (info != NULL && info->fields != lora_payload_fields)
+  {
+    LORA_LOG_INFO(LOGF_RX_MESSAGE, payload.messageID, payload.lora_eventID, info->size, status,
+                  millis() - record.received_ms);
+    return;
+  }
+  LORA_LOG_INFO(LOGF_RX_DATA, payload.messageID, payload.lora_eventID, payload.pulse_count, status,
+                millis() - record.received_ms);
+}
+
+void printQueueStats()
+{
+#if PIPELINE_MODE
+  LORA_LOG_INFO(LOGF_RX_STATS, rxQueue.depth(), rxQueue.highWater(), rxQueue.drops(), rxErrors, rxTimeouts);
+#else
+  LORA_LOG_INFO(LOGF_RX_STATS, 0, 0, 0, rxErrors, rxTimeouts);
+#endif
+  LORA_LOG_INFO(LOGF_RX_FRAMES, rxFrames, rxBatches, rxMessages);
+  LORA_LOG_INFO(LOGF_UART_STATS, Serial1.baudRate(), uartFrameUs.count(), uartFrameUs.percentile(50),
+                uartFrameUs.percentile(99), uartFrameUs.max());
+#if MQTT_UPLINK
+  LORA_LOG_INFO(LOGF_MQTT_STATS, mqttBatch.publishes, mqttBatch.sent, mqttBatch.dropped, mqttFailures, mqttConnects,
+                mqttMaxPublishMs);
+#endif
+#if STORE_FORWARD
+  LORA_LOG_INFO(LOGF_RXLOG_STATS, rxLog.backlog(), rxLog.appended, rxLog.replayed, rxLog.lost, rxLog.corrupt,
+                rxLog.writes);
+#endif
+}
+void serveConsole()
+{
+  // Requests framed like on air; SEND_PROG_PARAMS: the performance summary
+  static LoraFrameDecoder consoleDecoder;
+  static bool consoleDecoderInit = false;
+  if (!consoleDecoderInit)
+  {
+    consoleDecoder.accept(sizeof(lora_payload_t));
+    consoleDecoderInit = true;
+  }
+  while (Serial.available())
+  {
+    if (!consoleDecoder.push((uint8_t)Serial.read()) ||
+        lora_message_event(consoleDecoder.payload()) != LORA_EVENT_SEND_PROG_PARAMS ||
+        lora_message_validate(lora_message_find(LORA_EVENT_SEND_PROG_PARAMS), consoleDecoder.payload(),
+                              consoleDecoder.length()) != LORA_MSG_OK)
+      continue;
+    // The request's messageID, the host matches them
+    uint16_t messageID;
+    memcpy(&messageID, consoleDecoder.payload(), sizeof(messageID));
+    lora_perf_payload_t report = lora_message_init<LORA_EVENT_SEND_PROG_PARAMS_RESPONSE>(messageID);
+    lora_perf_fill(&report);
+    report.checksum = lora_message_checksum(&report);
+    // Asked for, so not subject to LORA_LOG_LEVEL
+    lora_log_data(LORA_LOG_LEVEL_INFO, LOGF_PERF_REPORT, &report, sizeof(report));
+  }
+}
+
+#if MQTT_UPLINK
+void mqttBegin()
+{
+  // No network to join: nothing to publish, and nothing for the flash log
+  if (WIFI_SSID[0] == '\0')
+  {
+    Serial.println("MQTT uplink off, no WIFI_SSID");
+    return;
+  }
+  mqttEnabled = true;
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  mqtt.setServer(MQTT_SERVER, MQTT_PORT);
+  // One buffer for a whole batch, allocated here once
+  mqtt.setBufferSize(LORA_MQTT_TEXT_SIZE + 64);
+  mqttBatch.begin(MQTT_BATCH_RECORDS, MQTT_BATCH_AGE_MS);
+#if STORE_FORWARD
+  rxLogBegin();
+#endif
+}
+
+/**
+ * @brief Add a received message to the next publish
+ */
+void mqttQueue(const rx_record_t &record)
+{
+  if (!mqttEnabled)
+    return;
+  const lora_message_info_t *info = lora_message_find(record.payload.lora_eventID);
+  size_t len = info ? info->size : sizeof(lora_payload_t);
+  // Make room first, dropped (or logged) if the broker is away
+  if (mqttBatch.full() && !mqttDown)
+    mqttService();
+#if STORE_FORWARD
+  // Nothing overtakes the backlog
+  if (mqttDown || mqttBatch.full() || !rxLog.empty())
+  {
+    rxLogAppend(record, len);
+    return;
+  }
+#endif
+  mqttBatch.add(&record.payload, len, record.received_ms);
+}
+
+/**
+ * @brief Keep the broker connection and publish the batch once it is due
+ * @return ms until the next call is needed
+ */
+uint32_t mqttService()
+{
+  static uint32_t holdStart = 0;
+  static bool hold = false;
+  if (!mqttEnabled)
+    return UINT32_MAX;
+#if STORE_FORWARD
+  static uint32_t lastFlush = 0;
+  if (millis() - lastFlush >= RXLOG_FLUSH_MS)
+  {
+    lastFlush = millis();
+    rxLog.flush();
+  }
+#endif
+  if (hold && millis() - holdStart < MQTT_RETRY_MS)
+    return MQTT_RETRY_MS - (millis() - holdStart);
+  hold = false;
+
+  if (!mqtt.connected())
+  {
+    if (WiFi.status() != WL_CONNECTED || !mqtt.connect(MQTT_CLIENT_ID))
+    {
+      mqttFailures++;
+      mqttDown = true;
+      LORA_LOG_WARN(LOGF_MQTT_CONNECT, WiFi.status(), mqtt.state(), MQTT_RETRY_MS);
+      hold = true;
+      holdStart = millis();
+      return MQTT_RETRY_MS;
     }
+    mqttConnects++;
+    mqttDown = false;
+  }
+  mqtt.loop();
 
-   
-      
+  uint32_t due = mqttBatch.dueInMs(millis());
+#if STORE_FORWARD
+  if (rxLogReplay())
+    due = 0;
+  if (mqttBatch.empty() && rxLogPopPending)
+  {
+    // Its records were given up
+    rxLog.pop();
+    rxLogPopPending = false;
+    return 0;
+  }
+#endif
+  if (due != 0)
+    return due;
+  size_t records = mqttBatch.size();
+  size_t len = mqttBatch.serialize(millis());
+  if (len == 0)
+  {
+    mqttBatch.discard();
+    return UINT32_MAX;
+  }
+  uint32_t start = millis();
+  bool ok = mqtt.publish(MQTT_TOPIC, (const uint8_t *)mqttBatch.text(), len);
+  uint32_t took = millis() - start;
+  if (took > mqttMaxPublishMs)
+    mqttMaxPublishMs = took;
+  if (!ok)
+  {
+    // Records stay for the next attempt
+    mqttFailures++;
+    mqttDown = true;
+    LORA_LOG_WARN(LOGF_MQTT_PUBLISH_FAILED, mqttBatch.seq, len, mqtt.state());
+    hold = true;
+    holdStart = millis();
+    return MQTT_RETRY_MS;
   }
+  LORA_LOG_DEBUG(LOGF_MQTT_PUBLISH, mqttBatch.seq, records, len, took);
+  mqttBatch.published();
+#if STORE_FORWARD
+  if (rxLogPopPending)
+  {
+    rxLog.pop();
+    rxLogPopPending = false;
+  }
+  // More backlog: next batch at once
+  if (!rxLog.empty())
+    return 0;
+#endif
+  return mqttBatch.dueInMs(millis());
+}
+#endif
+
+#if STORE_FORWARD
+void rxLogBegin()
+{
+  LittleFS.begin(true);
+  if (!LittleFS.exists(RXLOG_PATH))
+    LittleFS.open(RXLOG_PATH, "w").close();
+  if (!LittleFS.exists(RXLOG_CURSOR_PATH))
+    LittleFS.open(RXLOG_CURSOR_PATH, "w").close();
+  rxLogFile = LittleFS.open(RXLOG_PATH, "r+");
+  rxLogCursor = LittleFS.open(RXLOG_CURSOR_PATH, "r+");
+  bool ready = rxLogFile && rxLogCursor;
+  // Without files every append fails and counts as dropped
+  rxLog.begin(&rxLogFile, &rxLogCursor, RXLOG_BLOCKS);
+  LORA_LOG_INFO(LOGF_RXLOG_BEGIN, ready, RXLOG_BLOCKS, rxLog.backlog());
+}
+
+/**
+ * @brief Keep a message for later: received_ms, then the message
+ */
+void rxLogAppend(const rx_record_t &record, size_t len)
+{
+  uint8_t entry[sizeof(uint32_t) + RX_MESSAGE_MAX];
+  memcpy(entry, &record.received_ms, sizeof(uint32_t));
+  memcpy(entry + sizeof(uint32_t), &record.payload, len);
+  if (!rxLog.append(entry, sizeof(uint32_t) + len))
+    mqttBatch.dropped++;
 }
-void printReceivedData()
+
+/**
+ * @brief Move backlog records into the batch, oldest first
+ *
+ * The log moves past a block only after the batch with its last records
+ * was published, so a reset sends those again instead of losing them.
+ * @return true if the batch should go out now, full or the block done
+ */
+bool rxLogReplay()
 {
+  static uint32_t replaySeq = 0;
+  static size_t replayed = 0;   // Records of the block already in a batch
+  if (rxLogPopPending)
+    return !mqttBatch.empty();
+  if (mqttBatch.full())
+    return true;
+  const uint8_t *block = rxLog.front();
+  if (block == NULL)
+    return false;
+  if (rxLog.frontSeq() != replaySeq)
+  {
+    replaySeq = rxLog.frontSeq();
+    replayed = 0;
+  }
+  // received_ms of an earlier run means nothing now
+  bool thisRun = rxLog.frontFromThisRun();
+  LoraFlashRecordReader reader(block);
+  const uint8_t *entry;
+  size_t len;
+  for (size_t i = 0; reader.next(&entry, &len); ++i)
+  {
+    if (i < replayed)
+      continue;
+    if (mqttBatch.full())
+      return true;
+    replayed++;
+    if (len <= sizeof(uint32_t))
+      continue;
+    uint32_t receivedMs;
+    memcpy(&receivedMs, entry, sizeof(receivedMs));
+    mqttBatch.add(entry + sizeof(uint32_t), len - sizeof(uint32_t), thisRun ? receivedMs : millis());
+  }
+  replayed = 0;
+  rxLogPopPending = true;
+  return true;
 }
+#endif
 
 void printParameters(struct Configuration configuration)
 {
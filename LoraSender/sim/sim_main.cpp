@@ -0,0 +1,987 @@
+/**************************************************************************
+LoraBridge host simulation
+
+  Runs setup()/loop() of LoraSender.cpp against the simulated E32 link in
+  lib/E32Sim. The peer plays the rain sensor: it sends a lora_payload_t
+  framed like the sketch (LORA_FRAMING), waits for the ACK (or times out after the
+  default LoRa receive delay) and sends the next one.
+
+  SIM_PEER_READINGS collects that many readings (60 s apart in
+  elapsed_time_ms) per frame: plain messages in a lora_batch.h frame, or
+  with SIM_PEER_COMPACT=1 a lora_delta.h compact frame. Readings that were
+  not acknowledged are sent again; the compact encoder then falls back to
+  a keyframe.
+
+  SIM_PEER_WINDOW > 0 switches the peer to selective-repeat ARQ
+  (lora_arq.h, bridge built with -DARQ_MODE=1): it keeps up to that many
+  frames of one reading each in flight, back to back, from a backlog that
+  never runs dry, and resends what the bridge's SACK reports missing or
+  what times out. Goodput is readings acknowledged per second.
+
+  SIM_PEER_NODES > 0 plays that many sensors in fixed transmission mode
+  (lora_nodes.h, bridge built with -DFIXED_MODE=1), addresses 0x0101 on.
+  Each wakes every SIM_PEER_INTERVAL_MS on its own clock: a random start
+  phase and a drift of up to +-200 ppm, elapsed_time_ms is that clock.
+  Without a slot a sensor sends when it wakes and, if no ACK addressed to
+  it comes, again after a random 0-2 s backoff (ALOHA), 4 attempts per
+  reading. A slot in the ACK (lora_tdma.h, bridge built with
+  -DTDMA_MODE=1) moves its wake-ups there; an unanswered reading goes
+  again in the next slot and after 10 missed ACKs in a row the sensor
+  goes back to ALOHA.
+
+  A SET_CONFIG in an answer (lora_config_sync.h) is taken over and echoed
+  as SET_CONFIG_RESPONSE in the sensor's next frame, batched with the
+  reading(s); with SIM_PEER_COMPACT with a keyframe.
+
+  SIM_PERF_REQUEST_S > 0: every that many seconds the sensor puts a
+  SEND_PROG_PARAMS request in its frame (not with SIM_PEER_COMPACT); the
+  bridge's lora_perf.h summary that follows the ACK is shown in the
+  report, the last one per stage.
+
+  SIM_LINK_MARGIN_DB sets how much signal the link has to spare at
+  2.4 kbps (lib/E32Sim), losses grow with the air rate. A bridge built
+  with -DLINK_ADAPT=1 then moves the rate (lora_link_adapt.h): the sensor
+  answers a PROPOSE in the ACK with a SET_AIR_RATE_RESPONSE in its next
+  frame (not with SIM_PEER_COMPACT), switches its radio on the COMMIT and
+  sends LORA_LINK_SWITCH_MS later at the new rate. After fallbackFrames
+  timeouts in a row at another rate than the base it goes back to the
+  base rate. SIM_LINK_MARGIN_END_DB ramps the margin over the run.
+
+  SIM_HALL_PULSE_MS > 0 pulses the bridge's Hall sensor input (HSENSD,
+  lora_pulse.h) that often from 5 s on, once the bridge is up. The report
+  compares the count in the last ACK with the pulses made until it came.
+
+  A TIME_SYNC in the ACK (lora_time_sync.h, bridge built with
+  -DTIME_SYNC=1) is answered with a TIME_SYNC_RESPONSE in the sensor's
+  next frame (not with SIM_PEER_COMPACT), its frame's end on air and the
+  ACK's arrival on its clock. From then on it listens for an ACK only in
+  the window the message gave, not from its frame's end on: an ACK that
+  went on air before the window opened is not heard, none until it closed
+  is a timeout. The report has the radio's listening time per frame
+  against listening from the frame's end, and how far the offset and
+  drift the bridge sent are off the sensor's true clock.
+
+  SIM_PEER_LEGACY=1 plays the current RainSensor firmware: it takes a
+  single message per answer, a batch (an ACK with the config of
+  CONFIG_SYNC, the rate handshake or the clock sync) is not its ACK.
+
+  SIM_REPLAY=trace.bin replays a trace the bridge captured in the field
+  instead (CAPTURE_MODE, sim_replay.h).
+
+  pio run -e native -t exec
+  Environment: SIM_DURATION_S, SIM_LOSS, SIM_LATENCY_MS, SIM_SEED,
+               SIM_VERBOSE, SIM_PEER_INTERVAL_MS, SIM_PEER_READINGS,
+               SIM_PEER_COMPACT, SIM_PEER_WINDOW, SIM_PEER_NODES,
+               SIM_PERF_REQUEST_S, SIM_LINK_MARGIN_DB, SIM_LINK_MARGIN_END_DB,
+               SIM_HALL_PULSE_MS, SIM_PEER_LEGACY, SIM_REPLAY, SIM_REPLAY_SPEED
+
+*/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "sim_channel.h"
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_checksum.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+#include "lora_delta.h"
+#include "lora_arq.h"
+#include "lora_nodes.h"
+#include "lora_link_adapt.h"
+#include "lora_time_sync.h"
+#include "lora_tx_scheduler.h"
+#include "LoRa_E32.h"
+#include "sim_replay.h"
+
+// When a sensor listens for the answer to its last frame, on its clock
+struct SimListen
+{
+  LoraTimeSyncClient client;
+  uint32_t frameEndMs = 0;          // The frame went off the air
+  bool windowed = false;            // Listens in the window, not from frameEndMs on
+  uint32_t openMs = 0;
+  uint32_t closeMs = 0;
+  bool responseSent = false;        // The TIME_SYNC_RESPONSE is in the frame
+  uint32_t syncs = 0;
+
+  void sent(uint32_t endMs, uint32_t maxAnswerAirMs)
+  {
+    frameEndMs = endMs;
+    windowed = client.window(endMs, maxAnswerAirMs, &openMs, &closeMs);
+  }
+  // The radio was on when the answer went on air
+  bool heard(uint32_t startMs) const { return !windowed || (int32_t)(startMs - openMs) >= 0; }
+};
+
+// One sensor of SIM_PEER_NODES, on its own clock
+struct SimSensorNode
+{
+  uint16_t address = 0;
+  int32_t driftPpm = 0;             // + runs slow against the sim clock
+  uint32_t clockOffsetMs = 0;
+  uint32_t rng = 1;                 // Own stream, the channel's stays untouched
+  std::vector<lora_payload_t> pending;
+  uint8_t attempts = 0;             // Of the oldest pending reading
+  bool waiting = false;             // For the ACK
+  bool backoff = false;             // Retransmission scheduled
+  uint32_t sendId = 0;
+  sim_time_t sentAt = 0;
+  uint32_t wakeGen = 0;             // Cancels scheduled wake-ups
+  bool slotted = false;
+  uint32_t periodMs = 0;            // Sensor clock
+  uint32_t misses = 0;
+  uint16_t nextId = 1;
+  uint32_t pulses = 0;
+  lora_config_payload_t echo;       // SET_CONFIG_RESPONSE for the bridge
+  bool echoPending = false;
+  bool echoSent = false;            // In the frame waiting for its ACK
+  SimListen listen;
+
+  uint32_t localMs(sim_time_t now) const
+  {
+    return (uint32_t)((double)now / 1000.0 * 1e6 / (1e6 + driftPpm)) + clockOffsetMs;
+  }
+  sim_time_t simUs(uint32_t ms) const { return (sim_time_t)((double)ms * 1000.0 * (1e6 + driftPpm) / 1e6); }
+  uint32_t random(uint32_t n)
+  {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % n;
+  }
+};
+
+class RainSensorPeer : public SimPeer
+{
+public:
+  void begin() override
+  {
+    if (const char *v = getenv("SIM_PEER_INTERVAL_MS"))
+      intervalMs = (uint32_t)atoi(v);
+    if (const char *v = getenv("SIM_PEER_READINGS"))
+      readingsPerFrame = (uint32_t)atoi(v) > 0 ? (uint32_t)atoi(v) : 1;
+    if (const char *v = getenv("SIM_PEER_COMPACT"))
+      compact = atoi(v) != 0;
+    if (const char *v = getenv("SIM_PEER_WINDOW"))
+      window = (uint32_t)atoi(v);
+    if (const char *v = getenv("SIM_PEER_NODES"))
+      nodes = (uint32_t)atoi(v);
+    if (const char *v = getenv("SIM_PERF_REQUEST_S"))
+      perfEveryUs = (sim_time_t)atoi(v) * 1000000;
+    perfDueAt = perfEveryUs;
+    if (const char *v = getenv("SIM_HALL_PULSE_MS"))
+      hallEveryUs = (sim_time_t)atoi(v) * 1000;
+    if (const char *v = getenv("SIM_PEER_LEGACY"))
+      legacy = atoi(v) != 0;
+    if (hallEveryUs > 0)
+      sim().schedule(HALL_START_US, [this]
+                     { hallPulse(); });
+    delta.begin(16);
+    if (nodes > 0)
+    {
+      beginNodes();
+      return;
+    }
+    if (window > 0)
+    {
+      arq.begin(window);
+      sim().schedule(sim().now(), [this]
+                     { pump(); });
+      return;
+    }
+    sim().schedule(sim().now(), [this]
+                   { send(); });
+  }
+
+  void onPacket(const uint8_t *data, size_t len) override
+  {
+    if (nodes > 0)
+    {
+      nodePacket(data, len);
+      return;
+    }
+    // ACK or SACK, with a config if the bridge wants another version
+    bool ack = false, hasSack = false, hasConfig = false, hasRate = false, hasTime = false;
+    lora_sack_payload_t sack;
+    lora_config_payload_t config;
+    lora_rate_payload_t rate;
+    lora_time_payload_t timeMsg;
+    lora_payload_t ackPayload;
+    readAnswer(data, len, [&](uint16_t event, const uint8_t *msg, size_t msgLen)
+               {
+      if (msgLen == sizeof(lora_payload_t))
+      {
+        memcpy(&ackPayload, msg, sizeof(ackPayload));
+        ack = true;
+      }
+      else if (event == LORA_EVENT_SET_AIR_RATE && msgLen == sizeof(rate))
+      {
+        memcpy(&rate, msg, sizeof(rate));
+        hasRate = true;
+      }
+      else if (event == LORA_EVENT_TIME_SYNC && msgLen == sizeof(timeMsg))
+      {
+        memcpy(&timeMsg, msg, sizeof(timeMsg));
+        hasTime = true;
+      }
+      else if (event == LORA_EVENT_SACK && msgLen == sizeof(sack) && window > 0)
+      {
+        memcpy(&sack, msg, sizeof(sack));
+        hasSack = true;
+      }
+      else if (event == LORA_EVENT_SET_CONFIG && msgLen == sizeof(config))
+      {
+        memcpy(&config, msg, sizeof(config));
+        hasConfig = true;
+      }
+      else if (event == LORA_EVENT_RESET_CONFIG)
+        configs++;
+      else if (event == LORA_EVENT_SEND_PROG_PARAMS_RESPONSE && msgLen == sizeof(perf))
+      {
+        memcpy(&perf, msg, sizeof(perf));
+        perfReports++;
+      }
+      else
+        unexpected++; });
+    uint32_t nowMs = (uint32_t)(sim().now() / 1000);
+    if (ack && waiting && !listen.heard((uint32_t)(sim().packetStart() / 1000)))
+    {
+      early++;
+      return;
+    }
+    if (hasSack)
+    {
+      sacks++;
+      arq.acked(sack, (uint32_t)(sim().now() / 1000));
+    }
+    // The next frame waits until the bridge runs the new rate too
+    sim_time_t nextIn = (sim_time_t)intervalMs * 1000;
+    if (hasRate && airRate(rate))
+      nextIn = std::max(nextIn, (sim_time_t)LORA_LINK_SWITCH_MS * 1000);
+    if (ack)
+    {
+      if (!waiting)
+      {
+        unexpected++;
+        return;
+      }
+      waiting = false;
+      acked++;
+      readingsAcked += inFlight;
+      pending.erase(pending.begin(), pending.begin() + inFlight);
+      if (compact)
+        delta.acked();
+      if (echoSent)
+        echoPending = false;
+      if (rateAnswerSent)
+        rateAnswerPending = false;
+      rateMisses = 0;
+      if (listen.responseSent)
+        listen.client.acked();
+      listened(listen, nowMs);
+      if (hasTime && !compact)
+        timeSynced(listen, timeMsg, nowMs, 0, 0);
+      hallAcked = ackPayload.pulse_count;
+      hallMadeAtAck = hallMade;
+      rtt.add(sim().now() - sentAt);
+      sim().schedule(sim().now() + nextIn, [this]
+                     { send(); });
+    }
+    if (hasConfig)
+      applyConfig(config, &echo, &echoPending);
+    if (hasSack)
+      pump();
+  }
+
+  void report() override
+  {
+    double seconds = (sim().now() - firstSend) / 1e6;
+    if (nodes > 0)
+    {
+      uint32_t slotted = 0;
+      for (const SimSensorNode &n : sensors)
+        slotted += n.slotted;
+      printf("nodes           : %u, %u with a slot, %u slots received, %u fallbacks to ALOHA\n", nodes, slotted,
+             slotsReceived, fallbacks);
+      printf("sensor          : %u frames, %u acked, %u timeouts, %u config, %u echoed, %u unexpected, %u late ACKs\n",
+             sent, acked, timeouts, configs, echoes, unexpected, late);
+      NodeCounts c = nodeCounts();
+      c.generated -= warm.generated;
+      c.delivered -= warm.delivered;
+      c.dropped -= warm.dropped;
+      c.packets -= warm.packets;
+      c.collided -= warm.collided;
+      if (warmupS > 0)
+        printf("after warm-up   : %u s\n", warmupS);
+      printf("readings        : %u generated, %u delivered (%.1f %%), %u dropped, %.3f readings/s\n", c.generated,
+             c.delivered, c.generated ? 100.0 * c.delivered / c.generated : 0.0, c.dropped,
+             seconds > 0 ? c.delivered / seconds : 0.0);
+      printf("channel         : %.1f %% of %u packets collided\n",
+             c.packets ? 100.0 * c.collided / c.packets : 0.0, c.packets);
+      rtt.print("round trip");
+      printListening();
+      return;
+    }
+    if (window > 0)
+    {
+      printf("sensor          : window %u, %u frames, %u retransmits, %u sacks, %u failed, %u config, %u echoed, %u unexpected\n",
+             window, arq.frames, arq.retransmits, sacks, arq.failed, configs, echoes, unexpected);
+      printf("goodput         : %.3f readings/s, %u acked, %.1f ms airtime per reading\n",
+             seconds > 0 ? arq.delivered / seconds : 0.0, arq.delivered,
+             arq.delivered ? airUs / 1000.0 / arq.delivered : 0.0);
+      printf("round trip      : srtt %u ms rttvar %u ms rto %u ms\n", arq.srttMs, arq.rttvarMs, arq.rto());
+      return;
+    }
+    printf("sensor          : %u sent, %u acked, %u timeouts, %u config, %u echoed, %u unexpected\n",
+           sent, acked, timeouts, configs, echoes, unexpected);
+    printf("throughput      : %.3f messages/s\n", seconds > 0 ? acked / seconds : 0.0);
+    printf("readings        : %u acked, %.1f bytes and %.1f ms airtime per reading",
+           readingsAcked, readingsAcked ? (double)frameBytes / readingsAcked : 0.0,
+           readingsAcked ? airUs / 1000.0 / readingsAcked : 0.0);
+    if (compact)
+      printf(", %u keyframes, %u compact, %u fallbacks", delta.keyframes, delta.deltas, delta.fallbacks);
+    printf("\n");
+    rtt.print("round trip");
+    if (rateProposals > 0)
+      printf("air rate        : %u proposals, %u switches, %u fallbacks, now %u bps\n", rateProposals, rateSwitches,
+             rateFallbacks, sim().peerAirRate());
+    printListening();
+    if (hallEveryUs > 0)
+      printf("hall pulses     : %u made, the last ACK counted %u of the %u made until it came\n", hallMade, hallAcked,
+             hallMadeAtAck);
+    if (perfEveryUs > 0)
+      printPerf();
+  }
+
+private:
+  // Walk the messages of an answer from the bridge: one message or a
+  // lora_batch.h batch. fn(event, msg, len)
+  template <typename F>
+  void readAnswer(const uint8_t *data, size_t len, F fn)
+  {
+    LoraFrameDecoder decoder;
+    decoder.accept(sizeof(lora_payload_t));
+    decoder.accept(sizeof(lora_config_payload_t));
+    decoder.accept(sizeof(lora_sack_payload_t));
+    decoder.accept(sizeof(lora_perf_payload_t));
+    decoder.acceptVariable(LORA_EVENT_BATCH, LORA_BATCH_LENGTH_OFFSET);
+    bool complete = false;
+    for (size_t k = 0; k < len && !complete; ++k)
+      complete = decoder.push(data[k]);
+    if (!complete)
+    {
+      unexpected++;
+      return;
+    }
+    LoraBatchReader reader(decoder.payload(), decoder.length());
+    if (legacy && reader.isBatch())
+    {
+      // The current firmware knows no batch, not even the ACK in it
+      unexpected++;
+      return;
+    }
+    const uint8_t *msg;
+    size_t msgLen;
+    while (reader.next(&msg, &msgLen))
+      fn(lora_message_event(msg), msg, msgLen);
+    if (!reader.isValid())
+      unexpected++;
+  }
+
+  // The last lora_perf.h summary, microseconds per stage
+  void printPerf() const
+  {
+    printf("perf report     : %u of %u requests answered, bridge counted %u frames, %u errors\n", perfReports,
+           perfRequests, perf.frames, perf.errors);
+    if (perfReports == 0)
+      return;
+#define SIM_PRINT_PERF_STAGE(id, name)                                                                 \
+    printf("  %-14s: p50=%.1f p99=%.1f max=%.1f us\n", #name, lora_perf_decode_ns(perf.name##_p50) / 1e3, \
+           lora_perf_decode_ns(perf.name##_p99) / 1e3, lora_perf_decode_ns(perf.name##_max) / 1e3);
+    LORA_PERF_STAGES(SIM_PRINT_PERF_STAGE)
+#undef SIM_PRINT_PERF_STAGE
+  }
+
+  // Only once the bridge sent a TIME_SYNC
+  void printListening() const
+  {
+    if (syncs == 0)
+      return;
+    printf("receive window  : %u syncs, %u ACKs before the window, %u windows missed, offset off by %d ms, drift by %d ppm at most\n",
+           syncs, early, windowMisses, offsetErrorMs, driftErrorPpm);
+    printf("listening       : %.1f ms per frame, %.1f ms from the frame's end on\n",
+           listenFrames ? (double)listenMs / listenFrames : 0.0,
+           listenFrames ? (double)fromEndMs / listenFrames : 0.0);
+  }
+
+  // The answer of the longest batch at the current air rate
+  uint32_t maxAnswerAirMs() const
+  {
+    return (uint32_t)(sim().airtimeUs(E32_MAX_PACKET_SIZE, sim().peerAirRate()) / 1000);
+  }
+
+  // The radio listened for an answer until endMs, the sensor's clock;
+  // timeoutMs: from the frame's end on it would have until then
+  void listened(const SimListen &l, uint32_t endMs, uint32_t timeoutMs = 0)
+  {
+    uint32_t end = timeoutMs ? timeoutMs : endMs;
+    listenFrames++;
+    listenMs += endMs - (l.windowed ? l.openMs : l.frameEndMs);
+    fromEndMs += end - l.frameEndMs;
+  }
+
+  // A TIME_SYNC came with the answer at nowMs: respond, listen in its
+  // window; the true offset (bridge minus sensor) and drift to compare
+  void timeSynced(SimListen &l, const lora_time_payload_t &msg, uint32_t nowMs, int32_t offsetMs, int32_t driftPpm)
+  {
+    l.client.synced(msg, l.frameEndMs, nowMs);
+    syncs++;
+    // The bridge has an offset from the second sync on, the drift that
+    // carries it forward from the third
+    if (++l.syncs < 3)
+      return;
+    offsetErrorMs = std::max(offsetErrorMs, abs(msg.offsetMs - offsetMs));
+    driftErrorPpm = std::max(driftErrorPpm, abs(msg.driftPpm - driftPpm));
+  }
+
+  // The bridge's air rate handshake (lora_link_adapt.h): a proposal is
+  // answered in the next frame, a commit of the answered proposal
+  // switches the radio. true if it switched.
+  bool airRate(const lora_rate_payload_t &msg)
+  {
+    rateBase = msg.baseRate;
+    rateFallbackFrames = msg.fallbackFrames;
+    if (msg.step == LORA_RATE_PROPOSE)
+    {
+      rateProposals += !rateAnswerPending || rateAnswer.handshake != msg.handshake;
+      rateAnswer = msg;
+      rateAnswer.lora_eventID = LORA_EVENT_SET_AIR_RATE_RESPONSE;
+      rateAnswer.checksum = lora_message_checksum(&rateAnswer);
+      rateAnswerPending = true;
+      return false;
+    }
+    if (msg.step != LORA_RATE_COMMIT || msg.handshake != rateAnswer.handshake || msg.airDataRate == rateCode)
+      return false;
+    rateAnswerPending = false;
+    setRate(msg.airDataRate);
+    rateSwitches++;
+    return true;
+  }
+
+  void setRate(uint8_t code)
+  {
+    rateCode = code;
+    rateMisses = 0;
+    sim().peerAirRate(lora_air_rate_bps(code));
+  }
+
+  // The bridge's Hall sensor, HSENSD of the sketch
+  void hallPulse()
+  {
+    sim_gpio_pulse(GPIO_NUM_8);
+    hallMade++;
+    sim().schedule(sim().now() + hallEveryUs, [this]
+                   { hallPulse(); });
+  }
+
+  // The sensor takes the config over and echoes it, version included,
+  // with its next frame
+  void applyConfig(const lora_config_payload_t &config, lora_config_payload_t *echo, bool *echoPending)
+  {
+    configs++;
+    *echo = config;
+    echo->lora_eventID = LORA_EVENT_SET_CONFIG_RESPONSE;
+    echo->checksum = lora_message_checksum(echo);
+    *echoPending = true;
+  }
+
+  lora_payload_t nextReading()
+  {
+    // Wake-up jitter and a few pulses, without touching the channel's random stream
+    lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(nextId);
+    elapsedMs += CONFIG_DEFAULT_WAKEUP_SEC * 1000 + (nextId * 37u) % 50;
+    pulses += (nextId * 7u) % 6;
+    nextId++;
+    payload.elapsed_time_ms = elapsedMs;
+    payload.pulse_count = pulses;
+    payload.checksum = lora_message_checksum(&payload);
+    return payload;
+  }
+
+  // ARQ: send the next due retransmission or new reading once the
+  // previous frame is off the air, else wait for a SACK or a timer
+  void pump()
+  {
+    sim_time_t now = sim().now();
+    if (now < txEnd)
+      return;
+    uint32_t nowMs = (uint32_t)(now / 1000);
+    uint16_t id;
+    lora_frame_t frame;
+    if (const lora_frame_t *again = arq.due(nowMs, &id))
+    {
+      frame = *again;
+      arq.resent(id, nowMs);
+    }
+    else if (arq.canSend(nextId))
+    {
+      lora_payload_t payload = nextReading();
+      // A config echo rides along, retransmissions repeat it
+      LoraBatchWriter batch;
+      batch.begin(0);
+      batch.add(payload, 0);
+      if (echoPending && batch.add(echo, 0))
+      {
+        echoPending = false;
+        echoes++;
+      }
+      batch.flush(&frame, batchId++);
+      arq.sent(payload.messageID, frame, nowMs);
+    }
+    else
+    {
+      uint32_t wait = arq.nextTimeoutMs(nowMs);
+      sim_time_t at = now + (sim_time_t)(wait + 1) * 1000;
+      if (wait != UINT32_MAX && (timerAt <= now || at < timerAt))
+      {
+        timerAt = at;
+        sim().schedule(at, [this, at]
+                       { if (timerAt == at) pump(); });
+      }
+      return;
+    }
+    if (sent == 0)
+      firstSend = now;
+    sent++;
+    frameBytes += frame.len;
+    airUs += sim().airtimeUs(frame.len);
+    txEnd = now + sim().airtimeUs(frame.len);
+    sim().peerSend(frame.data, frame.len);
+    sim().schedule(txEnd, [this]
+                   { pump(); });
+  }
+
+  void send()
+  {
+    // New readings once the previous ones are acknowledged
+    while (pending.size() < readingsPerFrame)
+      pending.push_back(nextReading());
+
+    lora_frame_t frame;
+    echoSent = false;
+    if (compact)
+    {
+      // Compact frames carry readings only: a config echo goes in a batch
+      // with a keyframe (a plain reading)
+      if (echoPending)
+        delta.lost();
+      inFlight = delta.encode(&frame, pending.data(), pending.size());
+      if (echoPending)
+      {
+        LoraBatchWriter batch;
+        batch.begin(0);
+        batch.add(pending[0], 0);
+        echoSent = batch.add(echo, 0);
+        echoes += echoSent;
+        batch.flush(&frame, batchId++);
+      }
+    }
+    else
+    {
+      LoraBatchWriter batch;
+      batch.begin(0);
+      if (echoPending)
+        echoSent = batch.add(echo, 0);
+      echoes += echoSent;
+      rateAnswerSent = rateAnswerPending && batch.add(rateAnswer, 0);
+      lora_time_response_t timeAnswer;
+      listen.responseSent = listen.client.respond(batchId, &timeAnswer) && batch.add(timeAnswer, 0);
+      batchId += listen.responseSent;
+      if (perfEveryUs > 0 && sim().now() >= perfDueAt)
+      {
+        lora_payload_t request = lora_message_init<LORA_EVENT_SEND_PROG_PARAMS>(perfRequests);
+        request.checksum = lora_message_checksum(&request);
+        if (batch.add(request, 0))
+        {
+          perfRequests++;
+          perfDueAt = sim().now() + perfEveryUs;
+        }
+      }
+      inFlight = 0;
+      while (inFlight < pending.size() && batch.add(pending[inFlight], 0))
+        inFlight++;
+      batch.flush(&frame, batchId++);
+    }
+    frameBytes += frame.len;
+    airUs += sim().airtimeUs(frame.len, sim().peerAirRate());
+
+    if (sent == 0)
+      firstSend = sim().now();
+    sent++;
+    sentAt = sim().now();
+    waiting = true;
+    sim().peerSend(frame.data, frame.len);
+    listen.sent((uint32_t)((sentAt + sim().airtimeUs(frame.len, sim().peerAirRate())) / 1000), maxAnswerAirMs());
+
+    // Until the receive delay is over, or the window closed
+    uint32_t id = sent;
+    uint32_t timeoutMs = (uint32_t)(sentAt / 1000) + CONFIG_DEFAULT_LORA_DELAY_MS;
+    uint32_t giveUpMs = listen.windowed ? listen.closeMs : timeoutMs;
+    sim().schedule((sim_time_t)giveUpMs * 1000, [this, id, giveUpMs, timeoutMs]
+                   {
+      if (waiting && sent == id)
+      {
+        waiting = false;
+        timeouts++;
+        listened(listen, giveUpMs, timeoutMs);
+        if (listen.windowed)
+        {
+          windowMisses++;
+          listen.client.missed();
+        }
+        if (compact)
+          delta.lost();
+        // Lost the bridge at another rate
+        if (rateCode != rateBase && ++rateMisses >= rateFallbackFrames)
+        {
+          setRate(rateBase);
+          rateFallbacks++;
+        }
+        send();
+      } });
+  }
+
+  uint32_t intervalMs = 0;
+  uint32_t readingsPerFrame = 1;
+  bool compact = false;
+  uint32_t window = 0;
+  LoraArqSender<LORA_ARQ_MAX_WINDOW> arq;
+  sim_time_t txEnd = 0;
+  sim_time_t timerAt = 0;
+  uint32_t sacks = 0;
+  // --- SIM_PEER_NODES ---
+
+  static const uint8_t NODE_ATTEMPTS = 4;
+  static const uint32_t NODE_BACKOFF_MS = 2000;
+  static const uint32_t NODE_MAX_MISSES = 10;
+  static const size_t NODE_MAX_PENDING = 4;
+
+  void beginNodes()
+  {
+    uint32_t periodMs = intervalMs ? intervalMs : CONFIG_DEFAULT_WAKEUP_SEC * 1000;
+    sensors.resize(nodes);
+    for (uint32_t i = 0; i < nodes; ++i)
+    {
+      SimSensorNode &n = sensors[i];
+      n.address = (uint16_t)(0x0101 + i);
+      n.rng = (sim().config().seed + 1) * 2654435761u ^ (i + 1) * 40503u;
+      n.rng = n.rng ? n.rng : 1;
+      n.driftPpm = (int32_t)((i * 7919u) % 401) - 200;
+      n.clockOffsetMs = n.random(1000000);
+      n.periodMs = periodMs;
+      sim_time_t phase = (sim_time_t)n.random(periodMs) * 1000;
+      scheduleWake(i, sim().now() + phase);
+    }
+    firstSend = sim().now();
+    if (const char *v = getenv("SIM_PEER_WARMUP_S"))
+      warmupS = (uint32_t)atoi(v);
+    if (warmupS > 0)
+      sim().schedule(sim().now() + (sim_time_t)warmupS * 1000000, [this]
+                     {
+        warm = nodeCounts();
+        firstSend = sim().now(); });
+  }
+
+  struct NodeCounts
+  {
+    uint32_t generated, delivered, dropped, packets, collided;
+  };
+  NodeCounts nodeCounts() const
+  {
+    const SimStats &st = sim().stats();
+    return {generated, readingsAcked, dropped,
+            st.packets_to_peer + st.packets_to_device + st.packets_lost + st.packets_collided, st.packets_collided};
+  }
+
+  void scheduleWake(uint32_t i, sim_time_t at)
+  {
+    uint32_t gen = sensors[i].wakeGen;
+    sim().schedule(at, [this, i, gen, at]
+                   { if (sensors[i].wakeGen == gen) wake(i, at); });
+  }
+
+  // Take a reading, send it unless an exchange is going on, wake again
+  // one period later on the sensor's clock
+  void wake(uint32_t i, sim_time_t at)
+  {
+    SimSensorNode &n = sensors[i];
+    scheduleWake(i, at + n.simUs(n.periodMs));
+    lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(n.nextId++);
+    n.pulses += n.random(6);
+    payload.pulse_count = n.pulses;
+    n.pending.push_back(payload);
+    generated++;
+    if (n.pending.size() > NODE_MAX_PENDING)
+    {
+      n.pending.erase(n.pending.begin());
+      n.attempts = 0;
+      dropped++;
+    }
+    if (!n.waiting && !n.backoff)
+      transmit(i);
+  }
+
+  void transmit(uint32_t i)
+  {
+    SimSensorNode &n = sensors[i];
+    n.backoff = false;
+    if (n.pending.empty())
+      return;
+    // elapsed_time_ms is taken when the message is built
+    lora_payload_t &payload = n.pending.front();
+    payload.elapsed_time_ms = n.localMs(sim().now());
+    payload.checksum = lora_message_checksum(&payload);
+    LoraBatchWriter batch;
+    batch.begin(0, LORA_NODE_MAX_PAYLOAD_SIZE);
+    batch.add(payload, 0);
+    n.echoSent = n.echoPending && batch.add(n.echo, 0);
+    echoes += n.echoSent;
+    lora_time_response_t timeAnswer;
+    n.listen.responseSent = n.listen.client.respond(n.nextId, &timeAnswer) && batch.add(timeAnswer, 0);
+    uint8_t buf[LORA_MAX_PAYLOAD_SIZE];
+    size_t len = batch.take(buf, n.nextId);
+    lora_frame_t frame;
+    lora_frame_encode_from(&frame, n.address, buf, len);
+    frameBytes += frame.len;
+    airUs += sim().airtimeUs(frame.len);
+    n.attempts++;
+    n.waiting = true;
+    n.sendId = ++sent;
+    n.sentAt = sim().now();
+    sim().peerSend(frame.data, frame.len);
+    n.listen.sent(n.localMs(n.sentAt + sim().airtimeUs(frame.len)), maxAnswerAirMs());
+
+    uint32_t id = n.sendId;
+    uint32_t sentMs = n.localMs(n.sentAt);
+    uint32_t giveUpMs = n.listen.windowed ? n.listen.closeMs : sentMs + CONFIG_DEFAULT_LORA_DELAY_MS;
+    sim().schedule(n.sentAt + n.simUs(giveUpMs - sentMs), [this, i, id]
+                   {
+      if (sensors[i].waiting && sensors[i].sendId == id)
+        nodeTimeout(i); });
+  }
+
+  void nodeTimeout(uint32_t i)
+  {
+    SimSensorNode &n = sensors[i];
+    n.waiting = false;
+    timeouts++;
+    uint32_t timeoutMs = n.localMs(n.sentAt) + CONFIG_DEFAULT_LORA_DELAY_MS;
+    listened(n.listen, n.listen.windowed ? n.listen.closeMs : timeoutMs, timeoutMs);
+    if (n.listen.windowed)
+    {
+      windowMisses++;
+      n.listen.client.missed();
+    }
+    bool gaveUp = n.attempts >= NODE_ATTEMPTS;
+    if (gaveUp)
+    {
+      n.pending.erase(n.pending.begin());
+      n.attempts = 0;
+      dropped++;
+    }
+    if (n.slotted && ++n.misses >= NODE_MAX_MISSES)
+    {
+      n.slotted = false;
+      n.misses = 0;
+      n.wakeGen++;
+      fallbacks++;
+      scheduleWake(i, sim().now() + n.simUs(n.periodMs));
+    }
+    // Slotted: the next slot takes it. Without a slot try again, after a
+    // reading was given up only at the next wake-up.
+    if (!n.slotted && !gaveUp)
+      retryLater(i);
+  }
+
+  void retryLater(uint32_t i)
+  {
+    SimSensorNode &n = sensors[i];
+    if (n.pending.empty())
+      return;
+    n.backoff = true;
+    sim().schedule(sim().now() + n.simUs(n.random(NODE_BACKOFF_MS)), [this, i]
+                   { transmit(i); });
+  }
+
+  // Answers from the bridge: the ACK, alone or in a batch with a slot or
+  // config, or a config on its own
+  void nodePacket(const uint8_t *data, size_t len)
+  {
+    uint16_t target = sim().packetTarget();
+    if (target < 0x0101 || target >= 0x0101 + nodes)
+    {
+      unexpected++;
+      return;
+    }
+    uint32_t i = target - 0x0101;
+    SimSensorNode &n = sensors[i];
+    bool ack = false, hasSlot = false, hasConfig = false, hasTime = false;
+    lora_slot_payload_t slot;
+    lora_config_payload_t config;
+    lora_time_payload_t timeMsg;
+    readAnswer(data, len, [&](uint16_t event, const uint8_t *msg, size_t msgLen)
+               {
+      if (event == LORA_EVENT_RESUME_SLEEP_MODE && msgLen == sizeof(lora_payload_t))
+        ack = true;
+      else if (event == LORA_EVENT_SLOT && msgLen == sizeof(slot))
+      {
+        memcpy(&slot, msg, sizeof(slot));
+        hasSlot = true;
+      }
+      else if (event == LORA_EVENT_TIME_SYNC && msgLen == sizeof(timeMsg))
+      {
+        memcpy(&timeMsg, msg, sizeof(timeMsg));
+        hasTime = true;
+      }
+      else if (event == LORA_EVENT_SET_CONFIG && msgLen == sizeof(config))
+      {
+        memcpy(&config, msg, sizeof(config));
+        hasConfig = true;
+      }
+      else if (event == LORA_EVENT_RESET_CONFIG)
+        configs++;
+      else
+        unexpected++; });
+    if (!ack)
+      return;
+    if (!n.waiting)
+    {
+      late++;
+      return;
+    }
+    if (!n.listen.heard(n.localMs(sim().packetStart())))
+    {
+      early++;
+      return;
+    }
+    n.waiting = false;
+    acked++;
+    readingsAcked++;
+    n.pending.erase(n.pending.begin());
+    n.attempts = 0;
+    n.misses = 0;
+    if (n.echoSent)
+      n.echoPending = false;
+    if (n.listen.responseSent)
+      n.listen.client.acked();
+    uint32_t nowMs = n.localMs(sim().now());
+    listened(n.listen, nowMs);
+    if (hasTime)
+      timeSynced(n.listen, timeMsg, nowMs, (int32_t)(sim().now() / 1000 - nowMs), n.driftPpm);
+    if (hasConfig)
+      applyConfig(config, &n.echo, &n.echoPending);
+    rtt.add(sim().now() - n.sentAt);
+    if (hasSlot)
+    {
+      // Wake-ups move to the slot
+      slotsReceived++;
+      n.slotted = true;
+      n.periodMs = slot.periodMs;
+      n.wakeGen++;
+      scheduleWake(i, sim().now() + n.simUs(slot.slotDelayMs));
+    }
+    if (!n.slotted)
+      retryLater(i);
+  }
+
+  uint32_t nodes = 0;
+  uint32_t warmupS = 0;             // Figures leave out the sensors joining
+  NodeCounts warm = {0, 0, 0, 0, 0};
+  std::vector<SimSensorNode> sensors;
+  uint32_t generated = 0;
+  uint32_t dropped = 0;
+  uint32_t late = 0;
+  uint32_t slotsReceived = 0;
+  uint32_t fallbacks = 0;
+  LoraDeltaEncoder delta;
+  std::vector<lora_payload_t> pending;
+  size_t inFlight = 0;
+  uint16_t batchId = 1;
+  uint32_t elapsedMs = 0;
+  uint32_t pulses = 0;
+  uint32_t readingsAcked = 0;
+  uint64_t frameBytes = 0;
+  uint64_t airUs = 0;
+  uint16_t nextId = 1;
+  bool waiting = false;
+  sim_time_t sentAt = 0;
+  sim_time_t firstSend = 0;
+  uint32_t sent = 0;
+  uint32_t acked = 0;
+  uint32_t timeouts = 0;
+  uint32_t configs = 0;
+  uint32_t echoes = 0;
+  lora_config_payload_t echo;       // SET_CONFIG_RESPONSE for the bridge
+  bool echoPending = false;
+  bool echoSent = false;            // In the frame waiting for its ACK
+  uint8_t rateCode = AIR_DATA_RATE_010_24; // SPED.airDataRate, the bridge's boot rate
+  uint8_t rateBase = AIR_DATA_RATE_010_24;
+  uint8_t rateFallbackFrames = LORA_LINK_FALLBACK_FRAMES;
+  uint32_t rateMisses = 0;          // Timeouts in a row
+  lora_rate_payload_t rateAnswer = {}; // SET_AIR_RATE_RESPONSE for the bridge
+  bool rateAnswerPending = false;
+  bool rateAnswerSent = false;
+  uint32_t rateProposals = 0;
+  uint32_t rateSwitches = 0;
+  uint32_t rateFallbacks = 0;
+  uint32_t unexpected = 0;
+  bool legacy = false;              // SIM_PEER_LEGACY
+  SimLatency rtt;
+  sim_time_t perfEveryUs = 0;       // SIM_PERF_REQUEST_S
+  sim_time_t perfDueAt = 0;
+  uint32_t perfRequests = 0;
+  uint32_t perfReports = 0;
+  lora_perf_payload_t perf = {};
+  static const sim_time_t HALL_START_US = 5000000;
+  sim_time_t hallEveryUs = 0;       // SIM_HALL_PULSE_MS
+  uint32_t hallMade = 0;
+  uint32_t hallAcked = 0;           // pulse_count of the last ACK
+  uint32_t hallMadeAtAck = 0;
+  SimListen listen;                 // The one sensor's (TIME_SYNC)
+  uint32_t syncs = 0;
+  uint32_t early = 0;               // ACKs that went on air before the window opened
+  uint32_t windowMisses = 0;
+  int32_t offsetErrorMs = 0;
+  int32_t driftErrorPpm = 0;
+  uint32_t listenFrames = 0;
+  uint64_t listenMs = 0;            // Radio on for the answer
+  uint64_t fromEndMs = 0;           // The same, had it listened from the frame's end on
+};
+
+int main()
+{
+  static RainSensorPeer sensor;
+  SimPeer *peer = &sensor;
+  SimLinkConfig cfg = sim_config_from_env();
+  if (const char *trace = getenv("SIM_REPLAY"))
+  {
+    static TraceReplayPeer replay(trace);
+    if (!replay.load())
+      return 1;
+    peer = &replay;
+    // The trace sets the end
+    if (getenv("SIM_DURATION_S") == NULL)
+      cfg.duration_ms = UINT32_MAX;
+  }
+  sim().configure(cfg);
+  sim().attachPeer(peer);
+  peer->begin();
+  setup();
+  sim().stats().setup_done_us = sim().now();
+  for (;;)
+    loop();
+}
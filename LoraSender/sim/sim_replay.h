@@ -0,0 +1,300 @@
+#pragma once
+/**************************************************************************
+Trace replay for the LoraBridge host simulation
+
+  SIM_REPLAY=trace.bin plays a trace captured by the bridge with
+  -DCAPTURE_MODE=1 (lora_capture.h, the binary console output) instead of
+  the simulated sensors: every received frame goes to the bridge again,
+  the same bytes, and whatever the bridge answers is compared with what it
+  answered in the field.
+
+  SIM_REPLAY_SPEED divides the recorded gaps between the frames: 1 keeps
+  the recorded timing, 10 replays ten times faster to see where the bridge
+  saturates. Like a sensor, a frame that was answered in the trace waits
+  for the answer to the previous one (or CONFIG_DEFAULT_LORA_DELAY_MS).
+  The run ends with the trace. A trace of the simulation itself: build
+  with -DCAPTURE_MODE=1 and run with SIM_VERBOSE=1 > trace.bin.
+
+  Report: frames replayed per second of virtual and wall time, the
+  bridge's time from frame to answer in the trace (the replayed one is
+  rx to handler plus handler to tx), the round trip of the replay, and per
+  answer whether it is
+  identical, carries the same messages (times, counters differ), carries
+  other messages, is missing or is extra. The first divergences are
+  listed with their trace time. Build the bridge with the flags of the
+  firmware that recorded the trace.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "sim_channel.h"
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+#include "lora_capture.h"
+
+class TraceReplayPeer : public SimPeer
+{
+public:
+  explicit TraceReplayPeer(const char *path_) : path(path_) {}
+
+  // Reads the trace before the run, false if there is nothing to replay
+  bool load()
+  {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+      perror(path);
+      return false;
+    }
+    LoraCaptureReader reader;
+    lora_capture_entry_t e;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+      if (!reader.push((uint8_t)c, &e))
+        continue;
+      if (!e.tx)
+      {
+        exchanges.push_back(Exchange());
+        exchanges.back().rx = e;
+        rxStatus[e.status & 0x0F]++;
+        truncated += (e.status & LORA_CAPTURE_TRUNCATED) != 0;
+      }
+      else if (e.status == LORA_CAPTURE_TX_SENT && !exchanges.empty())
+        exchanges.back().answers.push_back(e);
+      else if (e.status == LORA_CAPTURE_TX_SENT)
+        recordedUnsolicited++;
+      else
+        recordedNotSent++;
+    }
+    fclose(f);
+    boots = reader.boots;
+    printf("trace           : %s, %u log records, %zu frames received, %u boots\n", path, reader.records,
+           exchanges.size(), boots);
+    return !exchanges.empty();
+  }
+
+  void begin() override
+  {
+    if (const char *v = getenv("SIM_REPLAY_SPEED"))
+      speed = atof(v) > 0 ? atof(v) : 1.0;
+    // The recorded time since boot, but not before the bridge is up
+    sim_time_t first = (sim_time_t)(sentTime(0) / speed);
+    sim().schedule(std::max(first, (sim_time_t)1000000), [this]
+                   { sendNext(); });
+  }
+
+  void onPacket(const uint8_t *data, size_t len) override
+  {
+    if (current < 0)
+    {
+      unsolicited++;
+      return;
+    }
+    Exchange &x = exchanges[current];
+    if (x.replayed++ == 0)
+    {
+      answerTime.add(sim().now() - sentAt);
+      compare(x, data, len);
+    }
+    else if (x.replayed > x.answers.size())
+      extra++;
+    if (waitingAnswer && x.replayed >= x.answers.size())
+    {
+      waitingAnswer = false;
+      sim().schedule(std::max(nextAt, sim().now()), [this]
+                     { sendNext(); });
+    }
+  }
+
+  void report() override
+  {
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    double virt = (sim().now() - firstSentAt) / 1e6;
+    printf("replay          : %zu frames at %.1fx, %.2f frames/s virtual, %.0f frames/s wall\n", sentCount, speed,
+           virt > 0 ? sentCount / virt : 0.0, wall > 0 ? sentCount / wall : 0.0);
+    printf("recorded rx     : %u ok, %u bad size, %u bad batch, %u delta dropped, %u truncated\n",
+           rxStatus[LORA_CAPTURE_RX_OK], rxStatus[LORA_CAPTURE_RX_BAD_SIZE], rxStatus[LORA_CAPTURE_RX_BAD_BATCH],
+           rxStatus[LORA_CAPTURE_RX_DELTA_DROPPED], truncated);
+    SimLatency recorded;
+    for (const Exchange &x : exchanges)
+    {
+      if (!x.answers.empty())
+        recorded.add(x.answers[0].us - x.rx.us);
+    }
+    recorded.print("rx to tx, trace");
+    answerTime.print("round trip");
+    printf("answers         : %u identical, %u same messages, %u diverged, %u missing, %u extra\n", identical,
+           sameMessages, diverged, missing, extra);
+    printf("unsolicited     : %u recorded, %u replayed; %u recorded frames not sent\n", recordedUnsolicited,
+           unsolicited, recordedNotSent);
+    for (const Divergence &d : divergences)
+      printf("  %9.3f s  frame %u: %s\n", d.us / 1e6, d.frame, d.what);
+  }
+
+private:
+  struct Exchange
+  {
+    lora_capture_entry_t rx;
+    std::vector<lora_capture_entry_t> answers; // Sent until the next frame came in
+    size_t replayed = 0;
+  };
+
+  struct Divergence
+  {
+    uint64_t us;
+    uint32_t frame;
+    const char *what;
+  };
+
+  static const size_t MAX_LISTED = 10;
+
+  void sendNext()
+  {
+    closeCurrent();
+    size_t i = (size_t)(current + 1);
+    if (i >= exchanges.size())
+      sim().finish();
+    current = (int32_t)i;
+    const Exchange &x = exchanges[i];
+    if (sentCount == 0)
+    {
+      firstSentAt = sim().now();
+      wallStart = std::chrono::steady_clock::now();
+    }
+    sentCount++;
+    sentAt = sim().now();
+    sim().peerSend(x.rx.data, x.rx.len);
+
+    // After the last frame only its answer
+    bool last = i + 1 >= exchanges.size();
+    nextAt = sentAt + (last ? (sim_time_t)CONFIG_DEFAULT_LORA_DELAY_MS * 1000
+                            : (sim_time_t)((sentTime(i + 1) - sentTime(i)) / speed));
+    waitingAnswer = !x.answers.empty();
+    if (!waitingAnswer)
+    {
+      sim().schedule(nextAt, [this]
+                     { sendNext(); });
+      return;
+    }
+    // Like the sensor: on with the next one once answered or timed out
+    uint32_t id = (uint32_t)i;
+    sim().schedule(std::max(nextAt, sentAt + (sim_time_t)CONFIG_DEFAULT_LORA_DELAY_MS * 1000), [this, id]
+                   {
+      if (waitingAnswer && current == (int32_t)id)
+      {
+        waitingAnswer = false;
+        sendNext();
+      } });
+  }
+
+  // When the sensor sent frame i: the trace has the time the bridge read
+  // it, after air time, module latency and the UART
+  double sentTime(size_t i) const
+  {
+    const lora_capture_entry_t &rx = exchanges[i].rx;
+    sim_time_t lead = sim().airtimeUs(rx.len) + sim().config().latency_us +
+                      (sim_time_t)rx.len * 10000000ULL / sim().moduleBaud();
+    return rx.us > lead ? (double)(rx.us - lead) : 0.0;
+  }
+
+  // The frame before the next one: count what did not come
+  void closeCurrent()
+  {
+    if (current < 0)
+      return;
+    const Exchange &x = exchanges[current];
+    if (x.replayed == 0 && !x.answers.empty())
+    {
+      missing++;
+      note(x, "answer missing");
+    }
+    else if (x.replayed < x.answers.size())
+      missing += (uint32_t)(x.answers.size() - x.replayed);
+  }
+
+  void compare(const Exchange &x, const uint8_t *data, size_t len)
+  {
+    if (x.answers.empty())
+    {
+      extra++;
+      note(x, "answered, not in the trace");
+      return;
+    }
+    const lora_capture_entry_t &want = x.answers[0];
+    if (want.len == len && memcmp(want.data, data, len) == 0)
+    {
+      identical++;
+      return;
+    }
+    std::vector<uint16_t> a, b;
+    events(want.data, want.len, &a);
+    events(data, len, &b);
+    if (!a.empty() && a == b)
+    {
+      sameMessages++;
+      return;
+    }
+    diverged++;
+    note(x, a.empty() ? "recorded answer not decodable" : "other messages in the answer");
+  }
+
+  // The events of the messages in an answer, a batch or one message
+  static void events(const uint8_t *data, size_t len, std::vector<uint16_t> *out)
+  {
+    LoraFrameDecoder decoder;
+    decoder.accept(sizeof(lora_payload_t));
+    decoder.accept(sizeof(lora_config_payload_t));
+    decoder.accept(sizeof(lora_sack_payload_t));
+    decoder.accept(sizeof(lora_perf_payload_t));
+    decoder.acceptVariable(LORA_EVENT_BATCH, LORA_BATCH_LENGTH_OFFSET);
+    bool complete = false;
+    for (size_t k = 0; k < len && !complete; ++k)
+      complete = decoder.push(data[k]);
+    if (!complete)
+      return;
+    LoraBatchReader reader(decoder.payload(), decoder.length());
+    const uint8_t *msg;
+    size_t msgLen;
+    while (reader.next(&msg, &msgLen))
+      out->push_back(lora_message_event(msg));
+  }
+
+  void note(const Exchange &x, const char *what)
+  {
+    if (divergences.size() < MAX_LISTED)
+      divergences.push_back({x.rx.us, (uint32_t)(&x - exchanges.data()), what});
+  }
+
+  const char *path;
+  double speed = 1.0;
+  std::vector<Exchange> exchanges;
+  int32_t current = -1;
+  size_t sentCount = 0;
+  sim_time_t sentAt = 0;
+  sim_time_t firstSentAt = 0;
+  sim_time_t nextAt = 0;
+  bool waitingAnswer = false;
+  std::chrono::steady_clock::time_point wallStart;
+  SimLatency answerTime;
+  uint32_t rxStatus[16] = {0};
+  uint32_t truncated = 0;
+  uint32_t boots = 0;
+  uint32_t recordedUnsolicited = 0;
+  uint32_t recordedNotSent = 0;
+  uint32_t unsolicited = 0;
+  uint32_t identical = 0;
+  uint32_t sameMessages = 0;
+  uint32_t diverged = 0;
+  uint32_t missing = 0;
+  uint32_t extra = 0;
+  std::vector<Divergence> divergences;
+};
@@ -30,6 +30,28 @@ RainSensor
   20260311  V0.13: Add send_config function and counter to delay send config
   20260312  V0.14: Extract ACK message send to sendAckMessage() function
   20260312  V0.15: Call sendAckMessage only if no config messages sent
+  20261016  V0.16: Build frames in a static buffer with lora_frame_encode(), no String per message
+  20261016  V0.17: Streaming frame decoder, optional COBS framing (LORA_FRAMING)
+  20261016  V0.18: Wait for messages on AUX / UART RX events with deadline instead of delay(100) polling
+  20261016  V0.19: PIPELINE_MODE: receive/ACK in a radio task on core 0, output in loop() on core 1
+  20261016  V0.20: Checksums via lora_message_checksum(), optional CRC-16 (LORA_CHECKSUM)
+  20261016  V0.21: Build, validate and print messages from the lora_messages.h schema registry
+  20261016  V0.22: Deferred binary logging (lora_log.h) instead of Serial.print chains in the radio path
+  20261016  V0.23: Airtime based transmit scheduling with duty-cycle budget instead of delay(10)/delay(1000)
+  20261016  V0.24: Accept multi-message frames (lora_batch.h), one ACK per frame
+  20261016  V0.25: Accept compact delta frames (lora_delta.h), ACK only what could be expanded
+  20261016  V0.26: ARQ_MODE: selective ACK per burst and duplicate suppression (lora_arq.h)
+  20261016  V0.27: FIXED_MODE: many sensors by E32 address, per node state in a node table (lora_nodes.h)
+  20261016  V0.28: TDMA_MODE: time slot per sensor with the ACK, guard from measured clock drift (lora_tdma.h)
+  20261016  V0.29: CONFIG_SYNC: versioned config with the ACK while the sensor runs another version (lora_config_sync.h)
+  20261017  V0.30: Fast boot: E32 config written only when the module has another one, cached in RTC memory (lora_e32_config.h)
+  20261017  V0.31: CAPTURE_MODE: raw received and sent frames with status to the console, replayed by sim SIM_REPLAY (lora_capture.h)
+  20261017  V0.32: Cycle counts per stage of the radio path in histograms, summary on SEND_PROG_PARAMS over air or USB (lora_perf.h)
+  20261017  V0.33: Module UART at the fastest rate it takes up to E32_UART_BPS, verified by read-back, 9600 as fallback
+  20261017  V0.34: LINK_ADAPT: air data rate follows the losses seen, switched with the sensor by a handshake in the ACK (lora_link_adapt.h)
+  20261017  V0.35: Hall sensor pulses in the PCNT unit or a lock-free ISR, extended to 32/64 bit, snapshot per ACK (lora_pulse.h)
+  20261017  V0.36: TIME_SYNC: sensor clock offset and drift from a two-way exchange in the ACK, answers held to a delay the sensor listens for (lora_time_sync.h)
+  20261017  V0.37: CONFIG_SYNC off by default, the current sensor firmware takes plain ACKs only
 
 
 
@@ -37,16 +59,40 @@ RainSensor
 */
  
 #include <Arduino.h>
+#include <atomic>
 // 1 means debug on 0 means off
 #define DEBUG 1
+// Log records above this level are not compiled in
+#ifndef LORA_LOG_LEVEL
+#define LORA_LOG_LEVEL (DEBUG ? LORA_LOG_LEVEL_DEBUG : LORA_LOG_LEVEL_WARN)
+#endif
 #include "LoRa_E32.h"
 
 #include "communication.h"  //Now same file as RainSensor uses
+#include "lora_frame.h"     // Frame encoder/decoder, shared with LoraReceiver
+#include "lora_checksum.h"  // Byte sum or CRC-16 (LORA_CHECKSUM)
+#include "lora_messages.h"  // Message schema registry
+#include "lora_batch.h"     // Several messages per frame
+#include "lora_delta.h"     // Compact sensor readings
+#include "lora_arq.h"       // Selective-repeat ARQ
+#include "lora_nodes.h"     // Per sensor state in fixed transmission mode
+#include "lora_tdma.h"      // Time slots for many sensors
+#include "lora_config_sync.h" // Versioned sensor config
+#include "lora_e32_config.h" // Module parameters written only when they differ
+#include "lora_capture.h"   // Raw frame trace for host replay
+#include "lora_perf.h"      // Cycle counts of the radio path
+#include "lora_link_adapt.h" // Air rate following the link
+#include "lora_pulse.h"     // Hall sensor pulse count
+#include "lora_time_sync.h" // Sensor clocks and the answer delay
+#include "lora_rx_event.h"  // Wake on AUX / UART RX instead of polling
+#include "lora_log.h"       // Deferred logging, drained by a low priority task
+#include "lora_tx_scheduler.h" // Airtime and duty-cycle budget
+#include "lora_spsc_queue.h" // Radio task -> loop() hand over
 
 
 // Data structure for message
 #include <HomeAutomationCommon.h>
-const String sSoftware = "LoraBridge V0.15";
+const String sSoftware = "LoraBridge V0.37";
 
 // debug macro
 #if DEBUG == 1
@@ -90,23 +136,189 @@ uint16_t CONFIG_WAKEUP_SEC = 60;          // Wakeup interval in seconds (1-3600)
 uint16_t CONFIG_SHUTDOWN_MS = 1000;       // Shutdown delay in ms (100-10000)
 uint16_t CONFIG_LORA_DELAY_MS = 500;      // LoRa receive delay in ms (100-5000)
 
-// Configuration message timing control
+// Config sync: the config carries a version (lora_config_sync.h) and the
+// sensor echoes the version it applied in its SET_CONFIG_RESPONSE. The
+// config goes in the ACK frame, and only while the sensor runs another
+// version; nothing is sent for a config the sensor already has. Until a
+// sensor has echoed a version every ACK is a batch frame (lora_batch.h),
+// which the current RainSensor firmware does not take (sim:
+// SIM_PEER_LEGACY=1), so this is for updated sensors only. 0 sends the
+// whole config in a frame of its own every CONFIG_MSG_INTERVAL messages,
+// in place of that cycle's ACK, as the current firmware expects.
+#ifndef CONFIG_SYNC
+#define CONFIG_SYNC 0
+#endif
+
+// Configuration message timing control (CONFIG_SYNC 0)
 // Defines after how many normal messages a config message should be sent
 // Valid range: 1-65535 (uint16_t max), 0 disables automatic config sending
 const uint16_t CONFIG_MSG_INTERVAL = 5;   // Send config every N messages (0=disabled)
 int configMessageCounter = 0;            // Counter for config message interval
 // Runtime control flags - Set to true to send config messages
-bool SEND_CONFIG_MESSAGE = false;
+// (CONFIG_SYNC: to take over changed CONFIG_* values)
+// Atomic: set from any task, taken by the radio task (PIPELINE_MODE)
+std::atomic<bool> SEND_CONFIG_MESSAGE{false};
 
 // Set to true to send RESET_CONFIG message
-bool SEND_RESET_CONFIG = false;
+// (CONFIG_SYNC: the sensor defaults become the config)
+std::atomic<bool> SEND_RESET_CONFIG{false};
+
+// Max time loop() waits for a message from the sensor before starting over
+// 0 waits forever
+uint32_t RX_DEADLINE_MS = 2UL * 60 * 1000; // 2 missed sensor wakeups
+
+// Transmit scheduling: frames go out back to back as far as the channel
+// and the duty-cycle budget allow, computed from the module's air rate,
+// FEC and UART rate. E32-900 channel 6 is 868 MHz: 1 % per hour in the EU.
+// 0 disables the budget (915 MHz).
+#ifndef TX_DUTY_CYCLE_PERMILLE
+#define TX_DUTY_CYCLE_PERMILLE 10
+#endif
+const uint32_t TX_DUTY_WINDOW_MS = 60UL * 60 * 1000;
+
+// Pipeline mode: a radio task pinned to core 0 receives, ACKs and sends
+// config messages, loop() on core 1 only reports statistics. 0 runs the
+// radio side inline in loop(). Either way received payloads and sent
+// frames are logged with lora_log.h and written by the log task, so
+// Serial output never delays the ACK.
+#ifndef PIPELINE_MODE
+#define PIPELINE_MODE 1
+#endif
+const uint32_t STATS_INTERVAL_MS = 60000;   // Log statistics output interval
+
+// ARQ mode: the sensor keeps a window of frames in flight (lora_arq.h).
+// The bridge handles every messageID once and answers each burst with one
+// selective ACK (LORA_EVENT_SACK) instead of the RESUME_SLEEP_MODE ACK per
+// message, sent once no further frame arrived for two frame times plus
+// ARQ_QUIET_MARGIN_MS: one frame of the burst may be lost without the
+// SACK colliding with the one after it. Both ends must be built with the same
+// setting; 0 keeps the ACK the current sensor firmware expects.
+#ifndef ARQ_MODE
+#define ARQ_MODE 0
+#endif
+const uint32_t ARQ_QUIET_MARGIN_MS = 50;
+
+// Fixed transmission mode: every sensor has its own E32 address and sends
+// to BRIDGE_ADDH/BRIDGE_ADDL with its address in front of the frame
+// (lora_nodes.h). ACK and config go to that sensor only; last messageID,
+// pending config and link statistics are kept per sensor in a node table
+// of NODE_TABLE_SIZE slots (3/4 of them usable). 0 keeps the transparent
+// one-sensor link the current firmware expects.
+#ifndef FIXED_MODE
+#define FIXED_MODE 0
+#endif
+#if FIXED_MODE && ARQ_MODE
+#error "ARQ_MODE keeps one receive window, for a single sensor"
+#endif
+#ifndef NODE_TABLE_SIZE
+#define NODE_TABLE_SIZE 64
+#endif
+const uint8_t BRIDGE_ADDH = 0x00;
+const uint8_t BRIDGE_ADDL = 0x00;
+const uint32_t NODE_EXPIRE_MS = 24UL * 60 * 60 * 1000;  // Forget sensors silent for a day
+const uint16_t NODE_DUPLICATE_SPAN = 32;  // messageIDs up to this far back are repeats
+
+// TDMA mode (needs FIXED_MODE): the wake-up period is cut into one slot per
+// sensor (lora_tdma.h). The ACK batch carries a sensor its slot when it has
+// none, the slots moved or its frame came off the slot; otherwise it
+// carries the sensor's pending config, which then needs no frame of its
+// own. The guard grows with the largest clock drift measured. Sensors that
+// got no slot (all taken) keep sending whenever they like.
+#ifndef TDMA_MODE
+#define TDMA_MODE 0
+#endif
+#if TDMA_MODE && !FIXED_MODE
+#error "TDMA_MODE needs FIXED_MODE to tell the sensors apart"
+#endif
+// The sensors' wake-up interval, cut into the slots
+#ifndef TDMA_PERIOD_MS
+#define TDMA_PERIOD_MS (CONFIG_WAKEUP_SEC * 1000UL)
+#endif
+// Sensor frame and answer on air, with the 3 address bytes
+const size_t TDMA_FRAME_LEN = LORA_NODE_HEADER_SIZE + sizeof(lora_payload_t) + E32_MSG_DELIMITER_LEN + 3;
+const size_t TDMA_ANSWER_LEN = LORA_BATCH_OVERHEAD + sizeof(lora_payload_t) + sizeof(lora_slot_payload_t) + E32_MSG_DELIMITER_LEN + 3;
+
+// Boot: the E32 parameters are read and written only when the module has
+// other ones, and not even read while the copy in RTC memory says they
+// are right (lora_e32_config.h). PRINT_PARAMETERS 1 dumps them at every
+// boot; BOOT_SERIAL_WAIT_MS gives a serial monitor time to attach before
+// the first output. Both slow down the time until the bridge can receive.
+#ifndef PRINT_PARAMETERS
+#define PRINT_PARAMETERS 0
+#endif
+#ifndef BOOT_SERIAL_WAIT_MS
+#define BOOT_SERIAL_WAIT_MS 0
+#endif
+
+// Module UART: the fastest rate tried at boot. The module gets it if it
+// reads it back; otherwise the next lower one is tried, down to 9600
+// (lora_e32_config_negotiate()). Parameter commands always run at 9600.
+// The rate each frame spends on the UART is in the LOGF_UART_STATS record.
+#ifndef E32_UART_BPS
+#define E32_UART_BPS UART_BPS_115200
+#endif
+
+// Link adaptation: the air rate follows the losses the bridge sees, one
+// step at a time between LINK_ADAPT_MIN_RATE and LINK_ADAPT_MAX_RATE; the
+// boot rate (2.4 kbps) is where both ends go back when they lose each
+// other (lora_link_adapt.h). The sensor switches with the bridge by a
+// handshake in the ACK batch and must be built for it. Runtime switches
+// are not written to the module's EEPROM. Needs the one sensor of
+// transparent mode and its ACK per frame; 0 keeps the rate fixed.
+#ifndef LINK_ADAPT
+#define LINK_ADAPT 0
+#endif
+#if LINK_ADAPT && (FIXED_MODE || ARQ_MODE)
+#error "LINK_ADAPT needs transparent mode and the ACK per frame"
+#endif
+#ifndef LINK_ADAPT_MIN_RATE
+#define LINK_ADAPT_MIN_RATE AIR_DATA_RATE_001_12
+#endif
+#ifndef LINK_ADAPT_MAX_RATE
+#define LINK_ADAPT_MAX_RATE AIR_DATA_RATE_101_192
+#endif
+// Back to the boot rate after this long without a frame at least: the
+// sensor goes back after LORA_LINK_FALLBACK_FRAMES receive timeouts
+const uint32_t LINK_ADAPT_SILENCE_MS = (LORA_LINK_FALLBACK_FRAMES + 1) * CONFIG_DEFAULT_LORA_DELAY_MS;
+
+// Clock sync: now and then the ACK batch carries the sensor its clock
+// against ours and the delay its answers come at; the sensor answers with
+// its times of that exchange, which give its offset, drift and the round
+// trip (lora_time_sync.h). Once it confirmed a delay every answer is held
+// to it, so the sensor can keep its module asleep until just before and
+// stop listening right after, not for CONFIG_LORA_DELAY_MS. The sensor
+// must be built for it. Needs the ACK per frame and room for the message
+// next to it (not TDMA_MODE); 0 answers as soon as it can.
+#ifndef TIME_SYNC
+#define TIME_SYNC 0
+#endif
+#if TIME_SYNC && (TDMA_MODE || ARQ_MODE)
+#error "TIME_SYNC needs the ACK per frame, without the TDMA slot"
+#endif
+
+// Capture mode: every frame read from the module and every frame handed to
+// it goes to the console with a time stamp and what became of it
+// (lora_capture.h). The trace replays against the sim build (SIM_REPLAY)
+// to chase a regression seen in the field. Needs the binary log output.
+#ifndef CAPTURE_MODE
+#define CAPTURE_MODE 0
+#endif
+#if CAPTURE_MODE && LORA_LOG_OUTPUT != LORA_LOG_OUTPUT_BINARY
+#error "CAPTURE_MODE needs LORA_LOG_OUTPUT_BINARY"
+#endif
+
+// Performance summary (lora_perf.h, LORA_PERF 0 compiles it out): UART
+// read, decode, checksum, handler, log, answer and TX are timed with the
+// cycle counter. A SEND_PROG_PARAMS message from a sensor is answered with
+// the summary right after its ACK; the same message framed like on air
+// and written to the USB console is answered with a LOGF_PERF_REPORT
+// record (tools/log_decode prints it). loop() looks at the console this
+// often, or after each exchange without PIPELINE_MODE.
+const uint32_t CONSOLE_POLL_MS = 100;
 
 // global data
 
 float fTemp, fRelHum, fRainMM;
-volatile int interruptCounter = 0; // indicator an interrupt has occured
-int numberOfInterrupts = 0;
-portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
 
 // --- Event ID Configuration ---
 // List of event IDs to cycle through during testing
@@ -134,33 +346,93 @@ unsigned long lastEventSwitchTime = 0;
 // LoRa_E32 e32ttl(RxD, TxD,AUX, M0, M1, UART_BPS_9600);
 
 RTC_DATA_ATTR int bootCount = 0;
+RTC_DATA_ATTR lora_e32_config_cache_t e32Cache; // Parameters last known to be in the module
+Configuration e32Running;   // Parameters the module runs (LINK_ADAPT changes the air rate)
 LoRa_E32 e32ttl(&Serial1, AUX, M0, M1); // RX, TX
+LoraTxScheduler txScheduler;
+LoraDeltaDecoder rxDelta;   // Last readings, bases for compact frames
+LoraArqReceiver rxArq;      // messageIDs seen, SACK state
+size_t rxFrameLen = 0;      // Length of the last frame received
+bool rxWaited = false;      // The receive loop slept since the last frame
+bool rxOnTime = false;      // Last frame was read as it arrived, not from a backlog
+LoraNodeTable<NODE_TABLE_SIZE> nodes;  // Sensors by address (FIXED_MODE)
+lora_node_t *rxNode = NULL; // Sender of the last frame, NULL in transparent mode
+uint32_t nodesExpired = 0;
+LoraTdmaSchedule tdma;      // Slots of the sensors (TDMA_MODE)
+LoraConfigSync configSync;  // Config the sensors should run (CONFIG_SYNC)
+uint16_t rxConfigVersion = 0; // Config version the sensor echoed, transparent mode
+uint32_t rxHandlerStart = 0; // Cycle count when the last frame was complete
+LoraPerfHistogram uartFrameUs; // Module UART output per received frame, AUX low in µs
+LoraLinkAdapt linkAdapt;    // Air rate from the losses seen (LINK_ADAPT)
+bool perfRequested = false; // The last frame asked for the performance summary
+lora_clock_t rxClock;       // The sensor's clock, transparent mode (TIME_SYNC)
+uint32_t rxEndMs = 0;       // When the last frame was complete in the module (TIME_SYNC)
+uint32_t txStartMs = 0;     // When the last frame sent went to the module
+#if CAPTURE_MODE
+uint8_t rxRaw[LORA_CAPTURE_MAX_DATA + 1]; // UART bytes since the last frame (CAPTURE_MODE)
+size_t rxRawLen = 0;
+#endif
+
+// Statistics of the radio side, taken by the task that owns it: in
+// PIPELINE_MODE loop() on core 1 gets a copy through statsQueue instead of
+// reading the scheduler, histogram and tables the radio task writes.
+typedef struct
+{
+  uint32_t txFrames, airMs, utilisationPermille, budgetUsedPermille, deferred, skips;
+  uint32_t uartBaud, uartFrames, uartP50, uartP99, uartMax;
+#if FIXED_MODE
+  uint32_t nodes, nodeCapacity, nodesAdded, nodesEvicted, nodesExpired, maxProbes;
+#endif
+#if LINK_ADAPT
+  uint32_t linkBps, lossPermille, ups, downs, fallbacks, refused;
+#endif
+} bridge_stats_t;
+#if PIPELINE_MODE
+LoraSpscQueue<bridge_stats_t, 2> statsQueue; // radio task -> loop()
+#endif
 
 // forward declarations
 void printParameters(struct Configuration configuration);
 void measureTempHumi();
 void sendValuesLoRa();
 void sendSingleData(LORA_DATA_STRUCTURE data);
-void receiveValuesLoRa();
-void IRAM_ATTR handleInterrupt();
-static void format_time(uint32_t ms, int *hours, int *minutes, int *seconds);
-void printPayloadHex(const uint8_t *data, size_t len);
+bool receiveValuesLoRa();
+void bridgeCycle();
+void radioTask(void *parameter);
+void logReceivedPayload(const lora_payload_t &payload);
+void logReceivedMessage(const uint8_t *msg, size_t len);
+bool acceptReading(const lora_payload_t &payload);
+void sendSackMessage();
+void takeStats(bridge_stats_t *stats);
+void logStats(const bridge_stats_t &stats);
+bool transmitFrame(const lora_frame_t &frame, uint32_t maxWaitMs, uint16_t address = LORA_NODE_BROADCAST);
+void countNodeError();
+void sendNodeConfig(lora_node_t &node);
+bool sendTdmaAck(lora_payload_t &ack, uint32_t answerStart);
+void collectSlots();
+bool finishFrame(uint8_t status);
+void sendPerfReport();
+void serveConsole();
+uint16_t &sensorConfigVersion();
+bool addConfig(LoraBatchWriter &batch, lora_config_payload_t *config);
+uint16_t batchMessageId(const LoraBatchWriter &batch);
+lora_clock_t &sensorClock();
+uint32_t answerLeadMs(size_t airLen);
+void logConfig(const lora_config_payload_t &config);
 void sendAckMessage();
+void setAirRate(uint8_t rate, uint8_t reason, uint16_t lossPermille);
+void commitPulses(const lora_pulse_snapshot_t &pulses);
 
 // Configuration message functions
-void sendConfigMessage();
-void sendResetConfigMessage();
-void printConfigPayloadHex(const uint8_t *data, size_t len);
+bool sendConfigMessage();
+bool sendResetConfigMessage();
+bool sendConfigPayload(lora_config_payload_t &config);
 
 // --- Magic Bytes Config ---
 #define USE_MAGIC_BYTES 0                                 // Set to 0 to disable magic bytes
 static const uint8_t MAGIC_BYTES[3] = {0xAA, 0xBB, 0xCC}; // Example magic bytes
 const size_t MAGIC_BYTES_LEN = sizeof(MAGIC_BYTES);
 
-// Message delimiter constants
-#define E32_MSG_DELIMITER_1 0x0C    // First byte of message delimiter
-#define E32_MSG_DELIMITER_2 0x0C    // Second byte of message delimiter
-
 uint16_t messageIdCounter = 1;
 
 String addMagicBytes(const String &payload)
@@ -181,51 +453,53 @@ String addMagicBytes(const String &payload)
 void setup()
 {
   Serial.begin(115200);
+  lora_log_begin(Serial);
 #ifdef DEBUG
-  delay(4000);
+  delay(BOOT_SERIAL_WAIT_MS);
   Serial.println("START");
   Serial.print("Software Version: ");
   Serial.println(sSoftware);
 #endif
-  // Serial1 connects to LoRa module
-  Serial1.begin(9600, SERIAL_8N1, RxD, TxD);
-  delay(500);
-  Serial.println("in setup routine");
+  // Serial1 connects to LoRa module, at the parameter command rate until
+  // the module runs its own
+  Serial1.begin(LORA_E32_PROGRAM_BAUD, SERIAL_8N1, RxD, TxD);
   pinMode(HSENSD, INPUT_PULLUP);
-  // attachInterrupt(digitalPinToInterrupt(HSENSD), handleInterrupt, CHANGE);
+  // Hall sensor pulses, counted from here on (LORA_PULSE_PCNT)
+  if (!lora_pulse_begin(HSENSD))
+    Serial.println("Pulse counter not available");
   // Serial.println("Boot Nr.: " + String(bootCount));
   // esp_sleep_enable_timer_wakeup(90e+6);
   //  Startup all pins and UART
-  // Initialize LoRa E32 before configuration
+  // Initialize LoRa E32 before configuration, waits for AUX
   e32ttl.begin();
 
   // Explizite Konfiguration setzen
   Configuration config;
-  config.ADDH = 0x00;
-  config.ADDL = 0x00;
+  config.ADDH = BRIDGE_ADDH;
+  config.ADDL = BRIDGE_ADDL;
   config.CHAN = 0x06;                             // Kanal 7
   config.SPED.airDataRate = AIR_DATA_RATE_010_24; // 2.4kbps
-  config.SPED.uartBaudRate = UART_BPS_9600;
+  config.SPED.uartBaudRate = E32_UART_BPS;      // Highest tried, see below
   config.SPED.uartParity = MODE_00_8N1;
-  // Ensure transparent transmission mode
-  config.OPTION.fixedTransmission = FT_TRANSPARENT_TRANSMISSION;
+  // Transparent transmission mode unless the sensors are addressed
+  config.OPTION.fixedTransmission = FIXED_MODE ? FT_FIXED_TRANSMISSION : FT_TRANSPARENT_TRANSMISSION;
   config.OPTION.fec = FEC_1_ON; // Turn off Forward Error Correction Switch
 
-  // Save configuration and check status
-  ResponseStatus setCfgStatus = e32ttl.setConfiguration(config, WRITE_CFG_PWR_DWN_SAVE);
-  if (setCfgStatus.code != 1)
+  // Write only what the module does not have yet and check it, at the
+  // fastest UART rate it takes; Serial1 follows
+  uint8_t e32Commands = 0;
+  uint8_t e32Fallbacks = 0;
+  lora_e32_config_result_t e32Result =
+      lora_e32_config_negotiate(e32ttl, Serial1, &config, &e32Cache, &e32Commands, &e32Fallbacks);
+  if (e32Result == LORA_E32_CONFIG_FAILED)
   {
-    Serial.print("Error setting configuration: ");
-    Serial.println(setCfgStatus.getResponseDescription());
+    Serial.println("Error setting configuration");
   }
 
-  delay(500);
-  Serial.println("in setup routine");
-  e32ttl.setConfiguration(config, WRITE_CFG_PWR_DWN_SAVE);
-
   neopixelWrite(RGB_BUILTIN, 0, 0, 0); // BLUE
   fRainMM = 0;
-  delay(500);
+#if PRINT_PARAMETERS
+  Serial1.updateBaudRate(LORA_E32_PROGRAM_BAUD);
   ResponseStructContainer c;
   c = e32ttl.getConfiguration();
   // It's important get configuration pointer before all other operation
@@ -238,33 +512,123 @@ void setup()
   printParameters(configuration);
   // Free the container to prevent memory leaks
   c.close();
+  Serial1.updateBaudRate(lora_uart_bps(config.SPED.uartBaudRate));
+#endif
+  // The module runs config now, verified by lora_e32_config_apply()
+  e32Running = config;
+  txScheduler.begin(lora_air_rate_bps(config.SPED.airDataRate), lora_uart_bps(config.SPED.uartBaudRate),
+                    config.OPTION.fec == FEC_1_ON, TX_DUTY_CYCLE_PERMILLE, TX_DUTY_WINDOW_MS, millis());
+#if TDMA_MODE
+  tdma.begin(TDMA_PERIOD_MS, lora_air_rate_bps(config.SPED.airDataRate),
+             lora_uart_bps(config.SPED.uartBaudRate), config.OPTION.fec == FEC_1_ON, TDMA_FRAME_LEN,
+             TDMA_ANSWER_LEN, millis());
+  LORA_LOG_INFO(LOGF_TDMA_LAYOUT, tdma.slots(), tdma.slotMs(), tdma.guardMs(), tdma.driftPpm, tdma.epoch);
+#endif
+#if LINK_ADAPT
+  linkAdapt.begin(config.SPED.airDataRate, LINK_ADAPT_MIN_RATE, LINK_ADAPT_MAX_RATE, LINK_ADAPT_SILENCE_MS,
+                  millis());
+#endif
+#if CONFIG_SYNC
+  // The sensors get it with their first ACK and echo its version
+  sendConfigMessage();
+#endif
+  // Wake the receive loop on AUX / UART RX events
+  lora_rx_begin(Serial1, AUX);
+#if PIPELINE_MODE
+  // setup() and loop() run in the Arduino loop task on core 1
+  xTaskCreatePinnedToCore(radioTask, "radio", 4096, NULL, 2, NULL, 0);
+#endif
+  LORA_LOG_INFO(LOGF_E32_CONFIG, e32Result, e32Commands, millis());
+  LORA_LOG_INFO(LOGF_E32_UART, Serial1.baudRate(), lora_uart_bps(E32_UART_BPS), e32Fallbacks);
 }
 
 void loop()
 {
-   Serial.println("Loop Start");
+  bridge_stats_t stats;
+#if PIPELINE_MODE
+  // The radio task does the work, loop() only reports and answers the console
+  vTaskDelay(pdMS_TO_TICKS(CONSOLE_POLL_MS));
+  if (statsQueue.pop(&stats))
+    logStats(stats);
+#else
+  bridgeCycle();
+  static uint32_t lastStats = 0;
+  if (millis() - lastStats >= STATS_INTERVAL_MS)
+  {
+    lastStats = millis();
+    takeStats(&stats);
+    logStats(stats);
+  }
+#endif
+  serveConsole();
+}
+
+#if PIPELINE_MODE
+/**
+ * @brief Radio stage, pinned to core 0: receive, ACK, config messages
+ */
+void radioTask(void *)
+{
+  // Statistics between exchanges, at most RX_DEADLINE_MS late
+  uint32_t lastStats = 0;
+  for (;;)
+  {
+    bridgeCycle();
+    if (millis() - lastStats >= STATS_INTERVAL_MS)
+    {
+      lastStats = millis();
+      bridge_stats_t stats;
+      takeStats(&stats);
+      statsQueue.push(stats);
+    }
+  }
+}
+#endif
+
+/**
+ * @brief One receive/ACK exchange, or one config message
+ */
+void bridgeCycle()
+{
+   LORA_LOG_DEBUG(LOGF_LOOP_START);
+#if FIXED_MODE
+   nodesExpired += nodes.expire(millis(), NODE_EXPIRE_MS);
+   rxNode = NULL;
+#endif
  
-   if(configMessageCounter > CONFIG_MSG_INTERVAL) SEND_CONFIG_MESSAGE = true;
-   // Check if we should send a config message
-   if (SEND_CONFIG_MESSAGE) {
+#if CONFIG_SYNC
+   // A new config version only; it goes out with the ACKs
+   if (SEND_CONFIG_MESSAGE.exchange(false))
      sendConfigMessage();
-     SEND_CONFIG_MESSAGE = false;  // Reset flag after sending
-     configMessageCounter = 0;
-     delay(1000);
-     return;
+   if (SEND_RESET_CONFIG.exchange(false))
+     sendResetConfigMessage();
+#else
+   if(configMessageCounter > CONFIG_MSG_INTERVAL) SEND_CONFIG_MESSAGE = true;
+   // Check if we should send a config message, clear the flag with it.
+   // No room in the duty-cycle budget: pending for the next cycle, this
+   // one receives and ACKs as usual.
+   if (SEND_CONFIG_MESSAGE.exchange(false)) {
+     if (sendConfigMessage()) {
+       configMessageCounter = 0;
+       return;
+     }
+     SEND_CONFIG_MESSAGE = true;
    }
 
    // Check if we should send a reset config message
-   if (SEND_RESET_CONFIG) {
-     sendResetConfigMessage();
-     SEND_RESET_CONFIG = false;  // Reset flag after sending
-     delay(1000);
-     configMessageCounter = 0;
-     return;
+   if (SEND_RESET_CONFIG.exchange(false)) {
+     if (sendResetConfigMessage()) {
+       configMessageCounter = 0;
+       return;
+     }
+     SEND_RESET_CONFIG = true;
    }
+#endif
 
-   // Normal operation: Wait for a message from LoRa
+   // Normal operation: Wait for a message from LoRa. Sleeps until AUX or
+   // the UART signals data, handles the frame as soon as it is complete.
    bool messageReceived = false;
+   uint32_t waitStart = millis();
    while (!messageReceived)
    {
 /*     // Check if it's time to switch to the next event
@@ -282,21 +646,66 @@ void loop()
      } */
   //Serial.println("Wait for incomming message");
      // Check for incoming LoRa message
-     if (e32ttl.available() > 1)
+     if (receiveValuesLoRa())
      {
-       receiveValuesLoRa();
        messageReceived = true;
+       continue;
      }
 
-     delay(100); // Small delay to avoid busy loop
+     uint32_t waited = millis() - waitStart;
+     if (RX_DEADLINE_MS != 0 && waited >= RX_DEADLINE_MS)
+     {
+       LORA_LOG_WARN(LOGF_RX_DEADLINE, RX_DEADLINE_MS);
+       return;
+     }
+     uint32_t waitMs = RX_DEADLINE_MS != 0 ? RX_DEADLINE_MS - waited : portMAX_DELAY;
+#if LINK_ADAPT
+     // Lost the sensor at another rate: both go back to the boot rate
+     uint8_t rate;
+     if (linkAdapt.silent(millis(), &rate))
+       setAirRate(rate, LORA_LINK_FALLBACK, linkAdapt.lossPermille);
+     if (linkAdapt.silenceLeftMs(millis()) < waitMs)
+       waitMs = linkAdapt.silenceLeftMs(millis());
+#endif
+     lora_rx_wait(Serial1, waitMs);
+     rxWaited = true;
    }
    
-   delay(10); // Wait a bit before sending the next message
    ++bootCount;
    ++configMessageCounter;
-   
+
+#if ARQ_MODE
+   // The sensor may have more frames of its window on the way: answer
+   // once it pauses, one SACK for the whole burst
+   uint32_t quietMs = 2 * txScheduler.txTimeUs(rxFrameLen) / 1000 + ARQ_QUIET_MARGIN_MS;
+   uint32_t quietStart = millis();
+   for (;;)
+   {
+     if (receiveValuesLoRa())
+     {
+       quietStart = millis();
+       continue;
+     }
+     uint32_t quiet = millis() - quietStart;
+     if (quiet >= quietMs)
+       break;
+     lora_rx_wait(Serial1, quietMs - quiet);
+   }
+   sendSackMessage();
+#else
    // Send ACK message only if no config messages are being sent
    sendAckMessage();
+#endif
+   // Right after the ACK, while the sensor still listens
+   if (perfRequested)
+   {
+     sendPerfReport();
+     perfRequested = false;
+   }
+#if FIXED_MODE && !TDMA_MODE && !CONFIG_SYNC
+   if (rxNode != NULL && rxNode->configPending)
+     sendNodeConfig(*rxNode);
+#endif
 }
 
 void printParameters(struct Configuration configuration)
@@ -373,70 +782,297 @@ void printModuleInformation(struct ModuleInformation moduleInformation)
   Serial.println(moduleInformation.features, HEX);
   Serial.println("----------------------------------------");
 }
-void IRAM_ATTR handleInterrupt()
-{
-  portENTER_CRITICAL_ISR(&mux);
-  interruptCounter++;
-  portEXIT_CRITICAL_ISR(&mux);
-}
-
-void receiveValuesLoRa()
+bool receiveValuesLoRa()
 {
-  uint32_t ms = 0;
-  int hours = 0, minutes = 0, seconds = 0;
-  char elapsed_time_str[9];
-  if (e32ttl.available() > 1)
+  // Feed what the UART has buffered into the frame decoder; a frame is
+  // handled as soon as its last byte arrived, no stream timeout
+  static LoraFrameDecoder rxDecoder;
+  static bool rxDecoderInit = false;
+  if (!rxDecoderInit)
+  {
+    rxDecoder.accept(sizeof(lora_payload_t));
+    rxDecoder.acceptVariable(LORA_EVENT_BATCH, LORA_BATCH_LENGTH_OFFSET);
+    rxDecoder.acceptVariable(LORA_EVENT_SENSOR_DELTA, LORA_DELTA_LENGTH_OFFSET);
+#if CONFIG_SYNC
+    // SET_CONFIG_RESPONSE on its own
+    rxDecoder.accept(sizeof(lora_config_payload_t));
+#endif
+#if FIXED_MODE
+    rxDecoder.header(LORA_NODE_HEADER_SIZE);
+#endif
+    rxDecoderInit = true;
+  }
+  // Cycles of the frame so far, it may come in over several calls
+  static uint32_t uartCycles = 0, decodeCycles = 0;
+  static uint32_t decoderErrors = 0;
+  bool complete = false;
+  uint32_t readStart = lora_perf_cycles();
+  while (!complete && Serial1.available())
+  {
+    uint8_t b = (uint8_t)Serial1.read();
+#if CAPTURE_MODE
+    // One more than fits a record: marked truncated
+    if (rxRawLen < sizeof(rxRaw))
+      rxRaw[rxRawLen++] = b;
+#endif
+    uint32_t decodeStart = lora_perf_cycles();
+    complete = rxDecoder.push(b);
+    decodeCycles += lora_perf_cycles() - decodeStart;
+  }
+  uartCycles += lora_perf_cycles() - readStart;
+  if (rxDecoder.errors != decoderErrors)
+  {
+    lora_perf_errors(rxDecoder.errors - decoderErrors);
+    decoderErrors = rxDecoder.errors;
+  }
+  if (complete)
+  {
+    rxHandlerStart = lora_perf_cycles();
+    lora_perf_record(LORA_PERF_UART, uartCycles - decodeCycles);
+    lora_perf_record(LORA_PERF_DECODE, decodeCycles);
+    uartCycles = decodeCycles = 0;
+    uint32_t auxUs, auxFellUs;
+    bool aux = lora_rx_aux_pulse(&auxUs, &auxFellUs);
+    if (aux)
+      uartFrameUs.record(auxUs);
+    rxFrameLen = rxDecoder.length() + E32_MSG_DELIMITER_LEN;
+#if TIME_SYNC
+    // AUX fell when the module had the frame; without the pulse its UART
+    // output and the lead before the first byte back from now
+    rxEndMs = aux ? millis() - ((uint32_t)micros() - auxFellUs) / 1000
+                  : millis() - rxFrameLen * 10000UL / Serial1.baudRate() - 2;
+#endif
+#if LINK_ADAPT
+    linkAdapt.frame(millis());
+#endif
+    rxOnTime = rxWaited;
+    rxWaited = false;
+#if FIXED_MODE
+    lora_node_header_t from;
+    memcpy(&from, rxDecoder.header(), sizeof(from));
+    rxNode = nodes.lookup(from.address, millis());
+    rxNode->frames++;
+    rxNode->lastSeenMs = millis();
+    LORA_LOG_DEBUG(LOGF_RX_NODE, from.address, rxNode->frames, rxNode->duplicates, rxNode->errors);
+#endif
+  }
+  if (complete && rxDecoder.length() >= 4 && lora_message_event(rxDecoder.payload()) == LORA_EVENT_SENSOR_DELTA)
   {
-    ResponseContainer rc = e32ttl.receiveMessage();
-    if (rc.status.code != 1)
+    // No ACK if the base is unknown: the sensor falls back to a keyframe
+    static lora_payload_t readings[LORA_DELTA_MAX_READINGS];
+    size_t n = rxDelta.decode(rxDecoder.payload(), rxDecoder.length(), readings, LORA_DELTA_MAX_READINGS);
+    if (n == 0)
     {
-      Serial.print("LoRa receive error: ");
-      Serial.println(rc.status.getResponseDescription());
-      return;
+      LORA_LOG_WARN(LOGF_RX_DELTA_DROPPED, rxDelta.missingBase, rxDelta.malformed);
+      countNodeError();
+      return finishFrame(LORA_CAPTURE_RX_DELTA_DROPPED);
     }
-    // Expect binary payload matching lora_payload_t
-    if (rc.data.length() != sizeof(lora_payload_t) + 2) // Account for 2 byte delimiter
+    LORA_LOG_DEBUG(LOGF_RX_DELTA, n, rxDecoder.length());
+    for (size_t i = 0; i < n; ++i)
     {
-      Serial.print("Error: Received payload size ");
-      Serial.print(rc.data.length());
-      Serial.print(" does not match expected size ");
-      Serial.println(sizeof(lora_payload_t));
-      return;
+      if (acceptReading(readings[i]))
+        logReceivedPayload(readings[i]);
     }
-    // Copy buffer into struct
+    return finishFrame(LORA_CAPTURE_RX_OK);
+  }
+  if (complete)
+  {
+    // A lora_payload_t or a batch of messages, one ACK either way
+    LoraBatchReader reader(rxDecoder.payload(), rxDecoder.length());
+    if (!reader.isBatch() && rxDecoder.length() != sizeof(lora_payload_t) &&
+        !(CONFIG_SYNC && rxDecoder.length() == sizeof(lora_config_payload_t)))
+    {
+      LORA_LOG_ERROR(LOGF_RX_BAD_SIZE, rxDecoder.length(), sizeof(lora_payload_t));
+      countNodeError();
+      return finishFrame(LORA_CAPTURE_RX_BAD_SIZE);
+    }
+    const uint8_t *msg;
+    size_t len;
+    uint32_t count = 0;
+    while (reader.next(&msg, &len))
+    {
+      logReceivedMessage(msg, len);
+      // Plain sensor readings are keyframes for compact frames
+      if (len == sizeof(lora_payload_t) && lora_message_event(msg) == LORA_EVENT_SENSOR_DATA)
+      {
+        lora_payload_t reading;
+        memcpy(&reading, msg, sizeof(reading));
+        if (lora_message_validate(lora_message_find(LORA_EVENT_SENSOR_DATA), &reading, sizeof(reading)) == LORA_MSG_OK)
+          rxDelta.remember(reading);
+      }
+      count++;
+    }
+    if (reader.isBatch())
+      LORA_LOG_DEBUG(LOGF_RX_BATCH, reader.messageID(), count);
+    if (!reader.isValid())
+    {
+      LORA_LOG_ERROR(LOGF_RX_BAD_SIZE, rxDecoder.length(), sizeof(lora_payload_t));
+      countNodeError();
+      return finishFrame(LORA_CAPTURE_RX_BAD_BATCH);
+    }
+    return finishFrame(LORA_CAPTURE_RX_OK);
+  }
+  return false;
+}
+
+/**
+ * @brief Time and count the frame just handled, capture its UART bytes (CAPTURE_MODE)
+ * @return true if the frame is answered, i.e. status is LORA_CAPTURE_RX_OK
+ */
+bool finishFrame(uint8_t status)
+{
+  lora_perf_since(LORA_PERF_HANDLER, rxHandlerStart);
+  lora_perf_frame(status == LORA_CAPTURE_RX_OK);
+#if CAPTURE_MODE
+  lora_capture_rx(status, rxRaw, rxRawLen);
+  rxRawLen = 0;
+#endif
+  return status == LORA_CAPTURE_RX_OK;
+}
+
+/**
+ * @brief Log one received message of any registered type
+ */
+void logReceivedMessage(const uint8_t *msg, size_t len)
+{
+  const lora_message_info_t *info;
+  uint32_t checksumStart = lora_perf_cycles();
+  lora_msg_status_t status = lora_message_decode(msg, len, &info);
+  lora_perf_since(LORA_PERF_CHECKSUM, checksumStart);
+  if (info != NULL && info->eventID == LORA_EVENT_SEND_PROG_PARAMS && status == LORA_MSG_OK)
+    perfRequested = true;
+#if LINK_ADAPT
+  if (status == LORA_MSG_BAD_CHECKSUM)
+    linkAdapt.corrupt();
+  if (info != NULL && info->eventID == LORA_EVENT_SET_AIR_RATE_RESPONSE && status == LORA_MSG_OK)
+  {
+    // The sensor can run the proposed rate: the next ACK commits it
+    lora_rate_payload_t response;
+    memcpy(&response, msg, sizeof(response));
+    linkAdapt.response(response);
+  }
+#endif
+#if TIME_SYNC
+  if (info != NULL && info->eventID == LORA_EVENT_TIME_SYNC_RESPONSE && status == LORA_MSG_OK)
+  {
+    // The sensor's times of the last sync: its clock, and the delay it
+    // listens for from now on
+    lora_time_response_t response;
+    memcpy(&response, msg, sizeof(response));
+    lora_clock_t &clock = sensorClock();
+    if (lora_time_measure(&clock, response))
+      LORA_LOG_INFO(LOGF_TIME_SYNC, rxNode ? rxNode->address : LORA_NODE_BROADCAST, clock.offsetMs, clock.driftPpm,
+                    clock.roundTripMs, clock.answerDelayMs, clock.late);
+  }
+#endif
+  if (info != NULL && info->fields == lora_payload_fields && len == sizeof(lora_payload_t))
+  {
     lora_payload_t payload;
-    memcpy(&payload, rc.data.c_str(), sizeof(lora_payload_t));
-    // Validate checksum
-    uint16_t calc_checksum = lora_payload_checksum(&payload);
-    bool checksum_ok = (calc_checksum == payload.checksum);
-    // calculate elapsed time to string
-    Serial.print("Calculated time string: ");
-    format_time(payload.elapsed_time_ms, &hours, &minutes, &seconds);
-    snprintf(elapsed_time_str, sizeof(elapsed_time_str), "%02d:%02d:%02d", hours, minutes, seconds);
-    Serial.println(elapsed_time_str);
-
-    // Print all fields
-    Serial.print("Message ID: ");
-    Serial.println(payload.messageID);
-    Serial.print("Event ID: ");
-    Serial.println(payload.lora_eventID);
-    Serial.print("Elapsed time (ms): ");
-    Serial.println(payload.elapsed_time_ms);
-    Serial.print("Pulse count: ");
-    Serial.println(payload.pulse_count);
-    Serial.print("Checksum: 0x");
-    Serial.println((uint16_t)payload.checksum, HEX);
-    Serial.print("Checksum valid: ");
-    Serial.println(checksum_ok ? "YES" : "NO");
-    if (!checksum_ok)
+    memcpy(&payload, msg, sizeof(payload));
+    if (acceptReading(payload))
+      logReceivedPayload(payload);
+    return;
+  }
+#if CONFIG_SYNC
+  if (info != NULL && info->eventID == LORA_EVENT_SET_CONFIG_RESPONSE &&
+      (status == LORA_MSG_OK || status == LORA_MSG_OUT_OF_RANGE))
+  {
+    // The config the sensor applied
+    lora_config_payload_t response;
+    memcpy(&response, msg, sizeof(response));
+    sensorConfigVersion() = LoraConfigSync::echoed(response);
+    LORA_LOG_INFO(LOGF_RX_CONFIG_VERSION, rxNode ? rxNode->address : LORA_NODE_BROADCAST, sensorConfigVersion(),
+                  configSync.version());
+  }
+#endif
+  // Messages come from the registry, at least messageID and lora_eventID
+  uint16_t messageID;
+  memcpy(&messageID, msg, sizeof(messageID));
+  LORA_LOG_INFO(LOGF_RX_MESSAGE, messageID, lora_message_event(msg), len, status, 0);
+}
+
+/**
+ * @brief Duplicate suppression for sensor readings in ARQ_MODE and FIXED_MODE
+ *
+ * A reading whose (S)ACK got lost comes again; it is acknowledged again but
+ * not handled twice. Readings with a bad checksum are not recorded.
+ * In FIXED_MODE a reading is a repeat if its messageID is at most
+ * NODE_DUPLICATE_SPAN behind the last one of the same sensor; anything
+ * further back is a sensor that started counting again.
+ * @return false if this messageID was handled before
+ */
+bool acceptReading(const lora_payload_t &payload)
+{
+#if !LINK_ADAPT && !ARQ_MODE && !FIXED_MODE
+  // Every reading is new
+  (void)payload;
+#endif
+#if LINK_ADAPT
+  // Repeats and gaps in the messageIDs are what the link lost
+  if (payload.lora_eventID == LORA_EVENT_SENSOR_DATA &&
+      lora_message_validate(lora_message_find(LORA_EVENT_SENSOR_DATA), &payload, sizeof(payload)) == LORA_MSG_OK)
+    linkAdapt.reading(payload.messageID);
+#endif
+#if ARQ_MODE || FIXED_MODE
+  if (payload.lora_eventID != LORA_EVENT_SENSOR_DATA ||
+      lora_message_validate(lora_message_find(LORA_EVENT_SENSOR_DATA), &payload, sizeof(payload)) != LORA_MSG_OK)
+    return true;
+#if ARQ_MODE
+  bool repeat = !rxArq.accept(payload.messageID);
+#else
+  bool repeat = rxNode->hasMessageID && (uint16_t)(rxNode->lastMessageID - payload.messageID) < NODE_DUPLICATE_SPAN;
+  if (repeat)
+  {
+    rxNode->duplicates++;
+  }
+  else
+  {
+    rxNode->lastMessageID = payload.messageID;
+    rxNode->hasMessageID = true;
+#if TDMA_MODE
+    // elapsed_time_ms against our clock: the sensor's drift. Frames that
+    // waited in the UART while we answered someone else arrived earlier
+    // than we can tell.
+    if (rxOnTime && lora_tdma_measure(rxNode, payload.elapsed_time_ms, rxNode->lastSeenMs, tdma.period()) &&
+        tdma.observeDrift(rxNode->driftPpm))
     {
-      Serial.print("Expected checksum: 0x");
-      Serial.println(calc_checksum, HEX);
+      collectSlots();
+      LORA_LOG_INFO(LOGF_TDMA_LAYOUT, tdma.slots(), tdma.slotMs(), tdma.guardMs(), tdma.driftPpm, tdma.epoch);
     }
-    neopixelWrite(RGB_BUILTIN, 0, 0, 0);
-    delay(500);
-    neopixelWrite(RGB_BUILTIN, 0, 0, 0); // Off
+#endif
+  }
+#endif
+  if (repeat)
+  {
+    LORA_LOG_DEBUG(LOGF_RX_DUPLICATE, payload.messageID);
+    return false;
   }
+#endif
+  return true;
+}
+
+/**
+ * @brief Count a frame that could not be handled for its sensor (FIXED_MODE)
+ * and against the link (LINK_ADAPT)
+ */
+void countNodeError()
+{
+#if FIXED_MODE
+  rxNode->errors++;
+#endif
+#if LINK_ADAPT
+  linkAdapt.corrupt();
+#endif
+}
+
+/**
+ * @brief Log a received payload with its validation result
+ */
+void logReceivedPayload(const lora_payload_t &payload)
+{
+  lora_msg_status_t status = lora_message_validate(lora_message_find(payload.lora_eventID), &payload, sizeof(payload));
+  LORA_LOG_INFO(LOGF_RX_PAYLOAD, payload.messageID, payload.lora_eventID, payload.elapsed_time_ms,
+                payload.pulse_count, payload.checksum, status);
 }
 
 /**
@@ -444,58 +1080,438 @@ void receiveValuesLoRa()
  */
 void sendAckMessage()
 {
-  Serial.println("Hi, I'm going to send message!");
-  lora_payload_t payload;
-  payload.messageID = bootCount;
-  // Use the current event from the list
-  payload.lora_eventID = LORA_EVENT_RESUME_SLEEP_MODE;
+  uint32_t answerStart = lora_perf_cycles();
+  lora_payload_t payload = lora_message_init<LORA_EVENT_RESUME_SLEEP_MODE>(bootCount);
   payload.elapsed_time_ms = millis();
-  payload.pulse_count = interruptCounter;
-  payload.checksum = lora_payload_checksum(&payload);     // Calculate checksum
+  // The total modulo 2^32; pulses of an ACK that does not go out come
+  // with the next one
+  lora_pulse_snapshot_t pulses = lora_pulse_snapshot();
+  payload.pulse_count = (uint32_t)pulses.total;
+#if TDMA_MODE
+  if (rxNode != NULL)
+  {
+    if (sendTdmaAck(payload, answerStart))
+      commitPulses(pulses);
+    return;
+  }
+#endif
 
-    // 2) Binärdaten in String sicher verpacken (Byte-für-Byte)
-  String msg;
-  msg.reserve(sizeof(payload) + 2); // +2 für die Delimiter
-  const uint8_t* p = reinterpret_cast<const uint8_t*>(&payload);
-  for (size_t i = 0; i < sizeof(payload); ++i) {
-    msg += (char)p[i];  // explizit jedes Byte anhängen (inkl. 0x00)
+  // Checksum + frame in statischen Puffer (Empfänger wartet auf Delimiter)
+  static lora_frame_t frame;
+  uint16_t firstId = messageIdCounter;
+#if CONFIG_SYNC || LINK_ADAPT || TIME_SYNC
+  // The config goes along if the sensor runs another version, the air
+  // rate handshake while one is going on, the clock sync when due
+  LoraBatchWriter batch;
+  batch.begin(0, LORA_MAX_PAYLOAD_SIZE - (FIXED_MODE ? 3 : 0));
+  payload.checksum = lora_message_checksum(&payload);
+  batch.add(payload, 0);
+#if CONFIG_SYNC
+  lora_config_payload_t config;
+  bool withConfig = addConfig(batch, &config);
+#endif
+#if LINK_ADAPT
+  lora_rate_payload_t rateMsg;
+  if (batch.fits(sizeof(rateMsg)) && linkAdapt.message(messageIdCounter, &rateMsg))
+  {
+    messageIdCounter++;
+    batch.add(rateMsg, 0);
+  }
+#endif
+#if TIME_SYNC
+  lora_clock_t &clock = sensorClock();
+  lora_time_payload_t syncMsg;
+  bool withSync = false;
+  if (rxOnTime && lora_time_due(&clock) && batch.fits(sizeof(syncMsg)))
+  {
+    // Not for a frame from the backlog, its AUX pulse is another's.
+    // Ready as if it went out now, a full frame on the UART
+    syncMsg = lora_message_init<LORA_EVENT_TIME_SYNC>(messageIdCounter++);
+    lora_time_fill(&clock, &syncMsg, rxEndMs, millis() + answerLeadMs(E32_MAX_PACKET_SIZE) - rxEndMs);
+    syncMsg.checksum = lora_message_checksum(&syncMsg);
+    withSync = batch.add(syncMsg, 0);
+  }
+#endif
+  batch.flush(&frame, batchMessageId(batch));
+#else
+  lora_message_encode(&frame, &payload);
+#endif
+  lora_perf_since(LORA_PERF_ANSWER, answerStart);
+
+  // The sensor only listens for CONFIG_LORA_DELAY_MS after its message
+  uint32_t txMs = txScheduler.txTimeUs(frame.len) / 1000;
+  uint32_t maxWaitMs = CONFIG_LORA_DELAY_MS > txMs ? CONFIG_LORA_DELAY_MS - txMs : 0;
+#if TIME_SYNC
+  // Not before the delay it listens for, and past its window not at all
+  size_t airLen = frame.len + (FIXED_MODE ? 3 : 0);
+  uint32_t holdMs = lora_time_hold_ms(&clock, rxEndMs, millis(), answerLeadMs(airLen));
+  if (holdMs)
+    delay(holdMs);
+  if (clock.answerDelayMs != 0 && maxWaitMs > LORA_TIME_SYNC_JITTER_MS)
+    maxWaitMs = LORA_TIME_SYNC_JITTER_MS;
+#endif
+  bool sent = transmitFrame(frame, maxWaitMs, rxNode ? rxNode->address : LORA_NODE_BROADCAST);
+#if TIME_SYNC
+  // The sync's exchange ends when the ACK is off the air
+  if (sent)
+    lora_time_sent(&clock, withSync, txStartMs + txScheduler.txTimeUs(airLen) / 1000);
+#endif
+  if (sent)
+  {
+    LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_ACK, frame.data, frame.len);
+    commitPulses(pulses);
+#if CONFIG_SYNC
+    if (withConfig)
+      logConfig(config);
+#endif
+  }
+  else
+  {
+    // None of its messages went out: the sensor sees no gap in the IDs
+    messageIdCounter = firstId;
   }
+#if LINK_ADAPT
+  // Once the COMMIT is out the sensor switches with it; without an ACK
+  // its repeat is our doing, not the link's
+  uint8_t rate;
+  if (!sent)
+    linkAdapt.answerSkipped();
+  else if (linkAdapt.committed(&rate))
+    setAirRate(rate, rate > linkAdapt.previousRate() ? LORA_LINK_UP : LORA_LINK_DOWN, linkAdapt.lossPermille);
+#endif
+}
 
-  // 3) Delimiter *danach* anhängen (Empfänger wartet darauf)
-  msg += (char)E32_MSG_DELIMITER_1;
-  msg += (char)E32_MSG_DELIMITER_2;
+/**
+ * @brief The pulses of a snapshot went out with an ACK
+ */
+void commitPulses(const lora_pulse_snapshot_t &pulses)
+{
+  if (pulses.delta != 0)
+    LORA_LOG_INFO(LOGF_TX_PULSES, (uint32_t)pulses.delta, (uint32_t)pulses.total, lora_pulse_bounces());
+  lora_pulse_commit(pulses);
+}
 
-  
-  ResponseStatus rs = e32ttl.sendMessage(msg);
+/**
+ * @brief Run the module at another air rate (LINK_ADAPT)
+ *
+ * A parameter command at 9600 baud without the EEPROM write: a power cycle
+ * brings back the boot rate. The RTC cache no longer describes what the
+ * module runs, so a reset reads the parameters again.
+ */
+void setAirRate(uint8_t rate, uint8_t reason, uint16_t lossPermille)
+{
+  uint32_t from = lora_air_rate_bps(e32Running.SPED.airDataRate);
+  e32Running.SPED.airDataRate = rate;
+  Serial1.updateBaudRate(LORA_E32_PROGRAM_BAUD);
+  ResponseStatus rs = e32ttl.setConfiguration(e32Running, WRITE_CFG_PWR_DWN_LOSE);
+  Serial1.updateBaudRate(lora_uart_bps(e32Running.SPED.uartBaudRate));
+  e32Cache.magic = 0;
+  txScheduler.setAirRate(lora_air_rate_bps(rate));
+  LORA_LOG_INFO(LOGF_LINK_RATE, from, lora_air_rate_bps(rate), reason, lossPermille, rs.code);
+}
 
-  Serial.print("message sent: ");
+/**
+ * @brief ACK a sensor in TDMA_MODE, with its slot or its pending config
+ *
+ * The slot goes along if the sensor has none, the slots moved since it got
+ * it (epoch) or its frame came outside the slot (LoraTdmaSchedule::onSlot). ACK,
+ * slot and config do not fit one packet together, so a pending config
+ * (CONFIG_SYNC: a config version the sensor does not run) waits for the
+ * next ACK then.
+ * @param answerStart cycle count when the ACK was started (lora_perf.h)
+ * @return true if the module accepted the frame
+ */
+bool sendTdmaAck(lora_payload_t &ack, uint32_t answerStart)
+{
+  lora_node_t &node = *rxNode;
+  int32_t offset = node.slot != 0 ? tdma.offsetMs(node.slot - 1, node.lastSeenMs) : 0;
+  bool needSlot = node.slot == 0 || node.slotEpoch != tdma.epoch || !tdma.onSlot(node.slot - 1, node.lastSeenMs);
+  if (node.slot == 0)
+  {
+    int slot = tdma.assign();
+    if (slot < 0)
+    {
+      // Slots of expired and evicted sensors are free again
+      collectSlots();
+      slot = tdma.assign();
+    }
+    node.slot = (uint16_t)(slot + 1);
+    needSlot = slot >= 0;
+  }
 
-printPayloadHex((const uint8_t*)msg.c_str(), msg.length());
-  Serial.println("Message sent. Waiting for next receive...");
+  uint16_t firstId = messageIdCounter;
+  LoraBatchWriter batch;
+  batch.begin(0, LORA_MAX_PAYLOAD_SIZE - 3);
+  ack.checksum = lora_message_checksum(&ack);
+  batch.add(ack, 0);
+  lora_slot_payload_t slotMsg;
+  lora_config_payload_t config;
+  bool withSlot = false, withConfig = false;
+  if (needSlot)
+  {
+    slotMsg = lora_message_init<LORA_EVENT_SLOT>(messageIdCounter++);
+    tdma.fill(&slotMsg, node.slot - 1, millis(), node.driftPpm);
+    slotMsg.checksum = lora_message_checksum(&slotMsg);
+    withSlot = batch.add(slotMsg, 0);
+  }
+  else
+  {
+#if CONFIG_SYNC
+    withConfig = addConfig(batch, &config);
+#else
+    config = node.config;
+    withConfig = node.configPending && batch.add(config, 0);
+#endif
+  }
+  static lora_frame_t frame;
+  batch.flush(&frame, batchMessageId(batch));
+  lora_perf_since(LORA_PERF_ANSWER, answerStart);
+
+  uint32_t txMs = txScheduler.txTimeUs(frame.len) / 1000;
+  uint32_t listenMs = CONFIG_LORA_DELAY_MS > txMs ? CONFIG_LORA_DELAY_MS - txMs : 0;
+  if (node.slot == 0 || (uint32_t)(offset < 0 ? -offset : offset) >= tdma.slotMs() / 2)
+  {
+    // Not in its slot: answer in a free one while the sensor listens
+    uint32_t wait = tdma.nextFreeMs(millis());
+    if (wait < listenMs)
+    {
+      delay(wait);
+      listenMs -= wait;
+    }
+  }
+  if (!transmitFrame(frame, listenMs, node.address))
+  {
+    messageIdCounter = firstId;
+    return false;
+  }
+  LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_ACK, frame.data, frame.len);
+  if (withSlot)
+  {
+    node.slotEpoch = tdma.epoch;
+    LORA_LOG_INFO(LOGF_TX_SLOT, node.slot - 1, tdma.slots(), node.address, slotMsg.slotDelayMs, offset);
+  }
+  if (withConfig)
+  {
+#if CONFIG_SYNC
+    logConfig(config);
+#else
+    node.configPending = false;
+#endif
+  }
+  return true;
 }
 
-// Function to convert milliseconds into hours, minutes, and seconds
-static void format_time(uint32_t ms, int *hours, int *minutes, int *seconds)
+/**
+ * @brief Mark the slots of the sensors in the node table as taken again
+ *
+ * After the slots moved (fewer fit) or to free those of sensors that left
+ * the table. Sensors whose slot no longer exists get a new one.
+ */
+void collectSlots()
 {
-  *hours = ms / 3600000;             // Calculate hours (ms / 3600000)
-  *minutes = (ms % 3600000) / 60000; // Calculate minutes ((ms % 3600000) / 60000)
-  *seconds = (ms % 60000) / 1000;    // Calculate seconds ((ms % 60000) / 1000)
+  tdma.releaseAll();
+  nodes.forEach([](lora_node_t &node)
+                {
+    if (node.slot > tdma.slots())
+      node.slot = 0;
+    if (node.slot != 0)
+      tdma.take(node.slot - 1); });
 }
 
-void printPayloadHex(const uint8_t *data, size_t len)
+/**
+ * @brief Acknowledge everything received so far with one selective ACK
+ */
+void sendSackMessage()
 {
-  Serial.print("Payload [");
-  Serial.print(len);
-  Serial.println(" bytes]:");
+  uint32_t answerStart = lora_perf_cycles();
+  uint16_t firstId = messageIdCounter;
+  lora_sack_payload_t sack = lora_message_init<LORA_EVENT_SACK>(messageIdCounter++);
+  rxArq.sack(&sack);
+  static lora_frame_t frame;
+#if CONFIG_SYNC
+  LoraBatchWriter batch;
+  batch.begin(0);
+  sack.checksum = lora_message_checksum(&sack);
+  batch.add(sack, 0);
+  lora_config_payload_t config;
+  bool withConfig = addConfig(batch, &config);
+  batch.flush(&frame, batchMessageId(batch));
+#else
+  lora_message_encode(&frame, &sack);
+#endif
+  lora_perf_since(LORA_PERF_ANSWER, answerStart);
 
-  for (size_t i = 0; i < len; i++)
+  uint32_t txMs = txScheduler.txTimeUs(frame.len) / 1000;
+  if (transmitFrame(frame, CONFIG_LORA_DELAY_MS > txMs ? CONFIG_LORA_DELAY_MS - txMs : 0))
+  {
+    LORA_LOG_INFO(LOGF_TX_SACK, sack.ackNext, sack.ackBitmap, rxArq.duplicates);
+#if CONFIG_SYNC
+    if (withConfig)
+      logConfig(config);
+#endif
+  }
+  else
   {
-    if (data[i] < 0x10)
-      Serial.print('0'); // führende Null
-    Serial.print(data[i], HEX);
-    Serial.print(' ');
+    messageIdCounter = firstId;
   }
-  Serial.println();
+}
+
+/**
+ * @brief Answer SEND_PROG_PARAMS with the performance summary (lora_perf.h)
+ *
+ * A frame of its own after the ACK, to the sensor that asked
+ */
+void sendPerfReport()
+{
+  uint32_t answerStart = lora_perf_cycles();
+  lora_perf_payload_t report = lora_message_init<LORA_EVENT_SEND_PROG_PARAMS_RESPONSE>(messageIdCounter++);
+  lora_perf_fill(&report);
+  static lora_frame_t frame;
+  lora_message_encode(&frame, &report);
+  lora_perf_since(LORA_PERF_ANSWER, answerStart);
+
+  uint32_t txMs = txScheduler.txTimeUs(frame.len) / 1000;
+  if (transmitFrame(frame, CONFIG_LORA_DELAY_MS > txMs ? CONFIG_LORA_DELAY_MS - txMs : 0,
+                    rxNode ? rxNode->address : LORA_NODE_BROADCAST))
+    LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_FRAME, frame.data, frame.len);
+}
+
+/**
+ * @brief Answer requests on the USB console, framed like on air
+ *
+ * SEND_PROG_PARAMS: the performance summary as a LOGF_PERF_REPORT record
+ */
+void serveConsole()
+{
+  static LoraFrameDecoder consoleDecoder;
+  static bool consoleDecoderInit = false;
+  if (!consoleDecoderInit)
+  {
+    consoleDecoder.accept(sizeof(lora_payload_t));
+    consoleDecoderInit = true;
+  }
+  while (Serial.available())
+  {
+    if (!consoleDecoder.push((uint8_t)Serial.read()) ||
+        lora_message_event(consoleDecoder.payload()) != LORA_EVENT_SEND_PROG_PARAMS ||
+        lora_message_validate(lora_message_find(LORA_EVENT_SEND_PROG_PARAMS), consoleDecoder.payload(),
+                              consoleDecoder.length()) != LORA_MSG_OK)
+      continue;
+    // The request's messageID, the host matches them
+    uint16_t messageID;
+    memcpy(&messageID, consoleDecoder.payload(), sizeof(messageID));
+    lora_perf_payload_t report = lora_message_init<LORA_EVENT_SEND_PROG_PARAMS_RESPONSE>(messageID);
+    lora_perf_fill(&report);
+    report.checksum = lora_message_checksum(&report);
+    // Asked for, so not subject to LORA_LOG_LEVEL
+    lora_log_data(LORA_LOG_LEVEL_INFO, LOGF_PERF_REPORT, &report, sizeof(report));
+  }
+}
+
+/**
+ * @brief Send a frame once the channel and the duty-cycle budget allow
+ *
+ * Waits up to maxWaitMs; if the frame would have to wait longer it is not
+ * sent and counted as skipped. In FIXED_MODE the frame goes to address
+ * (LORA_NODE_BROADCAST: every sensor), the 3 address bytes go on air too.
+ * @return true if the module accepted the frame
+ */
+bool transmitFrame(const lora_frame_t &frame, uint32_t maxWaitMs, uint16_t address)
+{
+  size_t airLen = frame.len + (FIXED_MODE ? 3 : 0);
+  uint32_t wait = txScheduler.delayMs(airLen, millis());
+  if (wait > maxWaitMs)
+  {
+    txScheduler.skipped();
+    LORA_LOG_WARN(LOGF_TX_SKIPPED, airLen, wait);
+#if CAPTURE_MODE
+    lora_capture_tx(LORA_CAPTURE_TX_SKIPPED, frame.data, frame.len);
+#endif
+    return false;
+  }
+  if (wait)
+  {
+    delay(wait);
+    txScheduler.waited(wait);
+  }
+  uint32_t start = millis();
+  txStartMs = start;
+  uint32_t txStart = lora_perf_cycles();
+#if FIXED_MODE
+  ResponseStatus rs = e32ttl.sendFixedMessage(address >> 8, address & 0xFF, ChannelNumber, frame.data, frame.len);
+#else
+  (void)address; // Transparent mode: every module in range hears it
+  ResponseStatus rs = e32ttl.sendMessage(frame.data, frame.len);
+#endif
+  lora_perf_since(LORA_PERF_TX, txStart);
+  // AUX was low for our own frame, not a received one
+  uint32_t auxUs;
+  lora_rx_aux_pulse(&auxUs);
+  txScheduler.sent(airLen, start);
+#if CAPTURE_MODE
+  lora_capture_tx(rs.code == 1 ? LORA_CAPTURE_TX_SENT : LORA_CAPTURE_TX_ERROR, frame.data, frame.len);
+#endif
+  if (rs.code != 1)
+  {
+    LORA_LOG_ERROR(LOGF_TX_ERROR, rs.code);
+    lora_perf_errors();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Statistics of the radio side; call from the task that runs bridgeCycle()
+ */
+void takeStats(bridge_stats_t *stats)
+{
+  uint32_t now = millis();
+  stats->txFrames = txScheduler.frames;
+  stats->airMs = (uint32_t)(txScheduler.airUs / 1000);
+  stats->utilisationPermille = txScheduler.utilisationPermille(now);
+  stats->budgetUsedPermille = txScheduler.budgetUsedPermille(now);
+  stats->deferred = txScheduler.deferred;
+  stats->skips = txScheduler.skips;
+  stats->uartBaud = Serial1.baudRate();
+  stats->uartFrames = uartFrameUs.count();
+  stats->uartP50 = uartFrameUs.percentile(50);
+  stats->uartP99 = uartFrameUs.percentile(99);
+  stats->uartMax = uartFrameUs.max();
+#if FIXED_MODE
+  stats->nodes = nodes.size();
+  stats->nodeCapacity = nodes.capacity();
+  stats->nodesAdded = nodes.added;
+  stats->nodesEvicted = nodes.evicted;
+  stats->nodesExpired = nodesExpired;
+  stats->maxProbes = nodes.maxProbes;
+#endif
+#if LINK_ADAPT
+  stats->linkBps = lora_air_rate_bps(linkAdapt.rate());
+  stats->lossPermille = linkAdapt.lossPermille;
+  stats->ups = linkAdapt.ups;
+  stats->downs = linkAdapt.downs;
+  stats->fallbacks = linkAdapt.fallbacks;
+  stats->refused = linkAdapt.refused;
+#endif
+}
+
+/**
+ * @brief Log statistics: log buffer, airtime and duty-cycle budget, module UART, link
+ */
+void logStats(const bridge_stats_t &stats)
+{
+  LORA_LOG_INFO(LOGF_LOG_STATS, lora_log_records(), lora_log_drops(), lora_log_high_water());
+  LORA_LOG_INFO(LOGF_TX_STATS, stats.txFrames, stats.airMs, stats.utilisationPermille, stats.budgetUsedPermille,
+                stats.deferred, stats.skips);
+  LORA_LOG_INFO(LOGF_UART_STATS, stats.uartBaud, stats.uartFrames, stats.uartP50, stats.uartP99, stats.uartMax);
+#if FIXED_MODE
+  LORA_LOG_INFO(LOGF_NODE_STATS, stats.nodes, stats.nodeCapacity, stats.nodesAdded, stats.nodesEvicted,
+                stats.nodesExpired, stats.maxProbes);
+#endif
+#if LINK_ADAPT
+  LORA_LOG_INFO(LOGF_LINK_STATS, stats.linkBps, stats.lossPermille, stats.ups, stats.downs, stats.fallbacks,
+                stats.refused);
+#endif
 }
 
 /* ============================================================================
@@ -504,125 +1520,164 @@ void printPayloadHex(const uint8_t *data, size_t len)
 
 /**
  * @brief Send configuration message with current values
+ * @return false if it could not go out now
  */
-void sendConfigMessage()
+bool sendConfigMessage()
 {
-  Serial.println("\nSending SET_CONFIG message...");
-
-  lora_config_payload_t config;
-  config.messageID = messageIdCounter++;
-  config.lora_eventID = LORA_EVENT_SET_CONFIG;
+  lora_config_payload_t config = lora_message_init<LORA_EVENT_SET_CONFIG>(messageIdCounter);
   config.ulp_pulses_to_wake_up = CONFIG_ULP_PULSES;
-  config.reserved1 = 0;
   config.wakeup_interval_sec = CONFIG_WAKEUP_SEC;
   config.shutdown_delay_ms = CONFIG_SHUTDOWN_MS;
   config.lora_receive_delay_ms = CONFIG_LORA_DELAY_MS;
-  config.reserved2 = 0;
-  config.checksum = lora_config_payload_checksum(&config);
-
-  // Log configuration
-  Serial.println("Configuration payload:");
-  Serial.print("  messageID: ");
-  Serial.println(config.messageID);
-  Serial.print("  eventID: 0x");
-  Serial.println(config.lora_eventID, HEX);
-  Serial.print("  ulp_pulses: ");
-  Serial.println(config.ulp_pulses_to_wake_up);
-  Serial.print("  wakeup_sec: ");
-  Serial.println(config.wakeup_interval_sec);
-  Serial.print("  shutdown_ms: ");
-  Serial.println(config.shutdown_delay_ms);
-  Serial.print("  lora_delay_ms: ");
-  Serial.println(config.lora_receive_delay_ms);
-  Serial.print("  checksum: 0x");
-  Serial.println(config.checksum, HEX);
-
-  // Pack into message with delimiters
-  String msg;
-  msg.reserve(sizeof(config) + 2);
-  const uint8_t* p = reinterpret_cast<const uint8_t*>(&config);
-  for (size_t i = 0; i < sizeof(config); ++i) {
-    msg += (char)p[i];
-  }
-  msg += (char)E32_MSG_DELIMITER_1;
-  msg += (char)E32_MSG_DELIMITER_2;
-
-  // Send message
-  ResponseStatus rs = e32ttl.sendMessage(msg);
-  if (rs.code == 1) {
-    Serial.println("SET_CONFIG message sent successfully.");
-    Serial.print("Payload hex: ");
-    printConfigPayloadHex((const uint8_t*)msg.c_str(), msg.length());
-  } else {
-    Serial.print("ERROR sending SET_CONFIG: ");
-    Serial.println(rs.getResponseDescription());
-  }
+  return sendConfigPayload(config);
 }
 
 /**
  * @brief Send reset configuration message
+ *
+ * CONFIG_SYNC: the sensor defaults become the config, a SET_CONFIG that
+ * every sensor gets with its next ACK like any other version.
+ * @return false if it could not go out now
  */
-void sendResetConfigMessage()
+bool sendResetConfigMessage()
 {
-  Serial.println("\nSending RESET_CONFIG message...");
-
-  lora_config_payload_t config;
-  config.messageID = messageIdCounter++;
-  config.lora_eventID = LORA_EVENT_RESET_CONFIG;
-  config.ulp_pulses_to_wake_up = 0;  // Not used for reset
-  config.reserved1 = 0;
-  config.wakeup_interval_sec = 0;    // Not used for reset
-  config.shutdown_delay_ms = 0;      // Not used for reset
-  config.lora_receive_delay_ms = 0;  // Not used for reset
-  config.reserved2 = 0;
-  config.checksum = lora_config_payload_checksum(&config);
-
-  // Log configuration
-  Serial.println("Reset configuration payload:");
-  Serial.print("  messageID: ");
-  Serial.println(config.messageID);
-  Serial.print("  eventID: 0x");
-  Serial.println(config.lora_eventID, HEX);
-  Serial.print("  checksum: 0x");
-  Serial.println(config.checksum, HEX);
-
-  // Pack into message with delimiters
-  String msg;
-  msg.reserve(sizeof(config) + 2);
-  const uint8_t* p = reinterpret_cast<const uint8_t*>(&config);
-  for (size_t i = 0; i < sizeof(config); ++i) {
-    msg += (char)p[i];
-  }
-  msg += (char)E32_MSG_DELIMITER_1;
-  msg += (char)E32_MSG_DELIMITER_2;
-
-  // Send message
-  ResponseStatus rs = e32ttl.sendMessage(msg);
-  if (rs.code == 1) {
-    Serial.println("RESET_CONFIG message sent successfully.");
-    Serial.print("Payload hex: ");
-    printConfigPayloadHex((const uint8_t*)msg.c_str(), msg.length());
-  } else {
-    Serial.print("ERROR sending RESET_CONFIG: ");
-    Serial.println(rs.getResponseDescription());
-  }
+#if CONFIG_SYNC
+  lora_config_payload_t config = lora_message_init<LORA_EVENT_SET_CONFIG>(messageIdCounter);
+  config.ulp_pulses_to_wake_up = CONFIG_DEFAULT_ULP_PULSES;
+  config.wakeup_interval_sec = CONFIG_DEFAULT_WAKEUP_SEC;
+  config.shutdown_delay_ms = CONFIG_DEFAULT_SHUTDOWN_MS;
+  config.lora_receive_delay_ms = CONFIG_DEFAULT_LORA_DELAY_MS;
+#else
+  // Config values are not used for reset and stay 0
+  lora_config_payload_t config = lora_message_init<LORA_EVENT_RESET_CONFIG>(messageIdCounter);
+#endif
+  return sendConfigPayload(config);
 }
 
 /**
- * @brief Print configuration payload in hex format
+ * @brief Checksum, validate, log and send a SET_CONFIG / RESET_CONFIG message
+ *
+ * Values outside CONFIG_MIN_* / CONFIG_MAX_* are logged but still sent,
+ * the receiver decides what to do with them. CONFIG_SYNC: the values
+ * become the current config version, sent with the ACKs (addConfig()).
+ * The messageID is taken once the message is sent or queued.
+ * @return false if the duty-cycle budget had no room for it
  */
-void printConfigPayloadHex(const uint8_t *data, size_t len)
+bool sendConfigPayload(lora_config_payload_t &config)
 {
-  Serial.print("Config Payload [");
-  Serial.print(len);
-  Serial.println(" bytes]:");
+  uint32_t answerStart = lora_perf_cycles();
+  static lora_frame_t frame;
+  lora_message_encode(&frame, &config);
+  lora_perf_since(LORA_PERF_ANSWER, answerStart);
+
+  const lora_field_t *badField = NULL;
+  const lora_message_info_t *info = lora_message_find(config.lora_eventID);
+  if (lora_message_validate(info, &config, sizeof(config), &badField) == LORA_MSG_OUT_OF_RANGE)
+    LORA_LOG_WARN(LOGF_TX_CONFIG_RANGE, badField - info->fields, lora_field_value(*badField, &config),
+                  badField->min, badField->max);
+
+#if CONFIG_SYNC
+  // Nothing on air here; sensors running another version get it with their ACK
+  if (configSync.set(config.ulp_pulses_to_wake_up, config.wakeup_interval_sec, config.shutdown_delay_ms,
+                     config.lora_receive_delay_ms))
+    LORA_LOG_INFO(LOGF_CONFIG_VERSION, configSync.version(), config.ulp_pulses_to_wake_up,
+                  config.wakeup_interval_sec, config.shutdown_delay_ms, config.lora_receive_delay_ms);
+#else
+  LORA_LOG_INFO(LOGF_TX_CONFIG, config.messageID, config.lora_eventID, config.ulp_pulses_to_wake_up,
+                config.wakeup_interval_sec, config.shutdown_delay_ms, config.lora_receive_delay_ms);
+#if FIXED_MODE
+  // Every sensor gets it after its next ACK, while it listens
+  nodes.forEach([&](lora_node_t &node)
+                {
+    node.config = config;
+    node.configPending = true; });
+  LORA_LOG_INFO(LOGF_NODE_CONFIG, config.messageID, nodes.size());
+#else
+  // Not held up longer than a sensor listens, the caller retries
+  uint32_t txMs = txScheduler.txTimeUs(frame.len) / 1000;
+  if (!transmitFrame(frame, CONFIG_LORA_DELAY_MS > txMs ? CONFIG_LORA_DELAY_MS - txMs : 0))
+    return false;
+  LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_FRAME, frame.data, frame.len);
+#endif
+#endif
+  messageIdCounter++;
+  return true;
+}
 
-  for (size_t i = 0; i < len; i++)
+/**
+ * @brief Send a sensor the config queued for it (FIXED_MODE)
+ */
+void sendNodeConfig(lora_node_t &node)
+{
+  uint32_t answerStart = lora_perf_cycles();
+  static lora_frame_t frame;
+  lora_message_encode(&frame, &node.config);
+  lora_perf_since(LORA_PERF_ANSWER, answerStart);
+  // Only while the sensor listens, else it stays pending for its next frame
+  uint32_t txMs = txScheduler.txTimeUs(frame.len) / 1000;
+  if (transmitFrame(frame, CONFIG_LORA_DELAY_MS > txMs ? CONFIG_LORA_DELAY_MS - txMs : 0, node.address))
   {
-    if (data[i] < 0x10)
-      Serial.print('0');
-    Serial.print(data[i], HEX);
-    Serial.print(' ');
+    node.configPending = false;
+    LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_FRAME, frame.data, frame.len);
   }
-  Serial.println();
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Config version the sensor of the last frame runs (CONFIG_SYNC)
+ *
+ * Per node in FIXED_MODE, else the one sensor's. 0 until it echoed one.
+ */
+uint16_t &sensorConfigVersion()
+{
+  return rxNode != NULL ? rxNode->configVersion : rxConfigVersion;
+}
+
+/**
+ * @brief Clock of the sensor of the last frame (TIME_SYNC)
+ *
+ * Per node in FIXED_MODE, else the one sensor's.
+ */
+lora_clock_t &sensorClock()
+{
+  return rxNode != NULL ? rxNode->clock : rxClock;
+}
+
+/**
+ * @brief Milliseconds from handing a frame of airLen bytes to the module until it is on air
+ */
+uint32_t answerLeadMs(size_t airLen)
+{
+  return (txScheduler.txTimeUs(airLen) - txScheduler.airtimeUs(airLen) + 999) / 1000;
+}
+
+/**
+ * @brief Add the current config to an answer if the sensor runs another version
+ * @return true if it was added (and fits)
+ */
+bool addConfig(LoraBatchWriter &batch, lora_config_payload_t *config)
+{
+  if (!configSync.due(sensorConfigVersion()) || !batch.fits(sizeof(*config)))
+    return false;
+  *config = configSync.message(messageIdCounter++);
+  return batch.add(*config, 0);
+}
+
+/**
+ * @brief messageID for flushing an answer batch
+ *
+ * Only a frame of several messages carries a batch header; a lone message
+ * goes out as itself and takes no ID, so the sensor sees no gap.
+ */
+uint16_t batchMessageId(const LoraBatchWriter &batch)
+{
+  return batch.messages() > 1 ? messageIdCounter++ : 0;
+}
+
+/**
+ * @brief Log a config sent with an answer
+ */
+void logConfig(const lora_config_payload_t &config)
+{
+  LORA_LOG_INFO(LOGF_TX_CONFIG, config.messageID, config.lora_eventID, config.ulp_pulses_to_wake_up,
+                config.wakeup_interval_sec, config.shutdown_delay_ms, config.lora_receive_delay_ms);
+}
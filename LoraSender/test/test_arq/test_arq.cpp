@@ -0,0 +1,207 @@
+// LoraArqSender/Receiver: messageID wraparound, SACK bitmap, sender restart
+// Run: pio test -e native
+#include <unity.h>
+
+#include <string.h>
+
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_arq.h"
+
+static LoraArqSender<8> sender;
+static LoraArqReceiver receiver;
+static lora_frame_t frame;
+static uint32_t now;
+
+void setUp()
+{
+  sender = LoraArqSender<8>();
+  sender.begin(8, 1000);
+  receiver = LoraArqReceiver();
+  memset(&frame, 0, sizeof(frame));
+  now = 0;
+}
+
+void tearDown() {}
+
+static lora_sack_payload_t sackNow()
+{
+  lora_sack_payload_t sack = lora_message_init<LORA_EVENT_SACK>(1);
+  receiver.sack(&sack);
+  return sack;
+}
+
+// Bit of id in the SACK, for ids after ackNext
+static bool bitSet(const lora_sack_payload_t &sack, uint16_t id)
+{
+  uint16_t bit = (uint16_t)(id - sack.ackNext - 1);
+  return bit < 32 && (sack.ackBitmap >> bit) & 1;
+}
+
+void test_repeat_not_accepted()
+{
+  TEST_ASSERT_TRUE(receiver.accept(10));
+  TEST_ASSERT_TRUE(receiver.accept(11));
+  TEST_ASSERT_FALSE(receiver.accept(10));
+  TEST_ASSERT_FALSE(receiver.accept(11));
+  TEST_ASSERT_EQUAL(2, receiver.accepted);
+  TEST_ASSERT_EQUAL(2, receiver.duplicates);
+}
+
+void test_wraparound()
+{
+  // Bursts of 8 from 0xFFE0 across 0xFFFF to 0x0040, every frame arrives
+  uint16_t id = 0xFFE0;
+  for (int burst = 0; burst < 12; ++burst)
+  {
+    for (int i = 0; i < 8; ++i, ++id)
+    {
+      TEST_ASSERT_TRUE(sender.canSend(id));
+      TEST_ASSERT_TRUE(sender.sent(id, frame, now));
+      TEST_ASSERT_TRUE(receiver.accept(id));
+    }
+    TEST_ASSERT_FALSE(sender.canSend(id));
+    now += 300;
+    TEST_ASSERT_EQUAL(8, sender.acked(sackNow(), now));
+    TEST_ASSERT_EQUAL(0, sender.outstanding());
+  }
+  TEST_ASSERT_EQUAL(0x0040, id);
+  TEST_ASSERT_EQUAL(96, sender.delivered);
+  TEST_ASSERT_EQUAL(0, sender.retransmits);
+  TEST_ASSERT_EQUAL(1, receiver.restarts);
+  TEST_ASSERT_EQUAL(0, receiver.duplicates);
+  // Serial order across the wrap
+  TEST_ASSERT_TRUE(lora_arq_before(0xFFFF, 0x0000));
+  TEST_ASSERT_FALSE(lora_arq_before(0x0000, 0xFFFF));
+}
+
+void test_window_spans_ids_across_wrap()
+{
+  // The oldest outstanding frame holds the window: 0xFFFA + 8 is 0x0002
+  TEST_ASSERT_TRUE(sender.sent(0xFFFA, frame, now));
+  TEST_ASSERT_TRUE(sender.canSend(0x0001));
+  TEST_ASSERT_FALSE(sender.canSend(0x0002));
+}
+
+void test_sack_bitmap_gap_resent_at_once()
+{
+  for (uint16_t id = 100; id < 104; ++id)
+    sender.sent(id, frame, now);
+  // 101 lost on air
+  receiver.accept(100);
+  receiver.accept(102);
+  receiver.accept(103);
+  lora_sack_payload_t sack = sackNow();
+  TEST_ASSERT_TRUE(lora_arq_before(sack.ackNext, 100));
+  TEST_ASSERT_TRUE(bitSet(sack, 100));
+  TEST_ASSERT_FALSE(bitSet(sack, 101));
+  TEST_ASSERT_TRUE(bitSet(sack, 102));
+  TEST_ASSERT_TRUE(bitSet(sack, 103));
+
+  now += 300;
+  TEST_ASSERT_EQUAL(3, sender.acked(sack, now));
+  TEST_ASSERT_EQUAL(1, sender.outstanding());
+  // A later frame got through: no need to wait for the timer
+  uint16_t id = 0;
+  TEST_ASSERT_TRUE(sender.due(now, &id) != NULL);
+  TEST_ASSERT_EQUAL(101, id);
+  TEST_ASSERT_EQUAL(0, sender.nextTimeoutMs(now));
+  sender.resent(id, now);
+  TEST_ASSERT_TRUE(sender.due(now, &id) == NULL);
+
+  TEST_ASSERT_TRUE(receiver.accept(101));
+  sack = sackNow();
+  TEST_ASSERT_TRUE(bitSet(sack, 101));
+  TEST_ASSERT_EQUAL(1, sender.acked(sack, now + 300));
+  TEST_ASSERT_EQUAL(0, sender.outstanding());
+}
+
+void test_sack_covers_last_bitmap_bit()
+{
+  // ackNext + 32 is bit 31, the last one the bitmap has
+  lora_sack_payload_t sack = lora_message_init<LORA_EVENT_SACK>(1);
+  sack.ackNext = 0xFFF0;
+  sack.ackBitmap = 0x80000000UL;
+  TEST_ASSERT_TRUE(sender.sent(0x000F, frame, now));
+  TEST_ASSERT_TRUE(sender.sent(0x0010, frame, now));
+  TEST_ASSERT_EQUAL(1, sender.acked(sack, now));
+  uint16_t id = 0;
+  TEST_ASSERT_TRUE(sender.due(now, &id) != NULL);
+  TEST_ASSERT_EQUAL(0x000F, id);
+}
+
+void test_old_gaps_given_up_beyond_bitmap()
+{
+  receiver.accept(1000);
+  // 1001 never arrives; 1001 + 33 no longer fits behind it
+  for (uint16_t id = 1002; id <= 1034; ++id)
+    TEST_ASSERT_TRUE(receiver.accept(id));
+  lora_sack_payload_t sack = sackNow();
+  TEST_ASSERT_EQUAL(1035, sack.ackNext);
+  TEST_ASSERT_FALSE(receiver.accept(1001));
+}
+
+void test_restart_far_jump()
+{
+  for (uint16_t id = 500; id < 510; ++id)
+    receiver.accept(id);
+  TEST_ASSERT_EQUAL(1, receiver.restarts);
+  // Within RESTART_DISTANCE behind: a late repeat, not a new session
+  TEST_ASSERT_FALSE(receiver.accept(20));
+  TEST_ASSERT_EQUAL(1, receiver.restarts);
+  // Sender rebooted with its counter far off: a new session
+  TEST_ASSERT_TRUE(receiver.accept(40000));
+  TEST_ASSERT_EQUAL(2, receiver.restarts);
+  TEST_ASSERT_TRUE(receiver.accept(40001));
+  TEST_ASSERT_FALSE(receiver.accept(40000));
+  // The frames of the burst before it may still come
+  TEST_ASSERT_TRUE(receiver.accept(39999));
+  TEST_ASSERT_EQUAL(2, receiver.restarts);
+}
+
+void test_restart_across_wrap()
+{
+  // 0xFF00 to 0x0100 is 512 forward: the same session
+  receiver.accept(0xFF00);
+  TEST_ASSERT_TRUE(receiver.accept(0x0100));
+  TEST_ASSERT_EQUAL(1, receiver.restarts);
+  // 0x0100 to 0x8000 is beyond RESTART_DISTANCE
+  TEST_ASSERT_TRUE(receiver.accept(0x8000));
+  TEST_ASSERT_EQUAL(2, receiver.restarts);
+}
+
+void test_retries_back_off_then_give_up()
+{
+  sender.begin(8, 1000, 200, 60000, 2);
+  sender.sent(7, frame, now);
+  uint16_t id = 0;
+  TEST_ASSERT_TRUE(sender.due(now + 999, &id) == NULL);
+  TEST_ASSERT_TRUE(sender.due(now + 1000, &id) != NULL);
+  now += 1000;
+  sender.resent(id, now);
+  // Twice the RTO after the first retry
+  TEST_ASSERT_EQUAL(2000, sender.nextTimeoutMs(now));
+  now += 2000;
+  TEST_ASSERT_TRUE(sender.due(now, &id) != NULL);
+  sender.resent(id, now);
+  now += 4000;
+  TEST_ASSERT_TRUE(sender.due(now, &id) == NULL);
+  TEST_ASSERT_EQUAL(1, sender.failed);
+  TEST_ASSERT_EQUAL(0, sender.outstanding());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_repeat_not_accepted);
+  RUN_TEST(test_wraparound);
+  RUN_TEST(test_window_spans_ids_across_wrap);
+  RUN_TEST(test_sack_bitmap_gap_resent_at_once);
+  RUN_TEST(test_sack_covers_last_bitmap_bit);
+  RUN_TEST(test_old_gaps_given_up_beyond_bitmap);
+  RUN_TEST(test_restart_far_jump);
+  RUN_TEST(test_restart_across_wrap);
+  RUN_TEST(test_retries_back_off_then_give_up);
+  return UNITY_END();
+}
@@ -0,0 +1,114 @@
+// LoraBatchReader: a batch whose count does not add up to its bytes
+// Run: pio test -e native
+#include <unity.h>
+
+#include <string.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+
+static uint8_t payload[LORA_MAX_PAYLOAD_SIZE];
+static size_t len;
+
+// Three readings, as LoraBatchWriter frames them
+void setUp()
+{
+  LoraBatchWriter batch;
+  batch.begin(0);
+  for (uint16_t id = 1; id <= 3; ++id)
+  {
+    lora_payload_t reading = lora_message_init<LORA_EVENT_SENSOR_DATA>(id);
+    reading.checksum = lora_message_checksum(&reading);
+    batch.add(reading, 0);
+  }
+  len = batch.take(payload, 9);
+}
+
+void tearDown() {}
+
+// Header changed, length and checksum made to fit again
+static void patch(uint8_t count, size_t newLen)
+{
+  lora_batch_header_t header;
+  memcpy(&header, payload, sizeof(header));
+  header.count = count;
+  header.length = (uint8_t)newLen;
+  memcpy(payload, &header, sizeof(header));
+  uint16_t checksum = lora_checksum(payload, newLen - sizeof(checksum));
+  memcpy(payload + newLen - sizeof(checksum), &checksum, sizeof(checksum));
+  len = newLen;
+}
+
+static unsigned readAll(LoraBatchReader &reader)
+{
+  const uint8_t *msg;
+  size_t msgLen;
+  unsigned n = 0;
+  while (reader.next(&msg, &msgLen))
+    n++;
+  return n;
+}
+
+void test_batch_reads_all()
+{
+  LoraBatchReader reader(payload, len);
+  TEST_ASSERT_TRUE(reader.isBatch());
+  TEST_ASSERT_EQUAL(3, readAll(reader));
+  TEST_ASSERT_TRUE(reader.isValid());
+}
+
+void test_count_too_low()
+{
+  // Checksum holds, the third reading is not counted
+  patch(2, len);
+  LoraBatchReader reader(payload, len);
+  TEST_ASSERT_FALSE(reader.isValid());
+  TEST_ASSERT_EQUAL(0, readAll(reader));
+}
+
+void test_count_too_high()
+{
+  patch(4, len);
+  LoraBatchReader reader(payload, len);
+  TEST_ASSERT_FALSE(reader.isValid());
+  TEST_ASSERT_EQUAL(0, readAll(reader));
+}
+
+void test_count_zero()
+{
+  patch(0, len);
+  LoraBatchReader reader(payload, len);
+  TEST_ASSERT_FALSE(reader.isValid());
+  TEST_ASSERT_EQUAL(0, readAll(reader));
+}
+
+void test_truncated_message()
+{
+  // The last reading cut short, header and checksum fitted to that
+  patch(3, len - 5);
+  LoraBatchReader reader(payload, len);
+  TEST_ASSERT_FALSE(reader.isValid());
+  TEST_ASSERT_EQUAL(0, readAll(reader));
+}
+
+void test_bytes_after_the_count()
+{
+  // Count of two and the bytes of two and a half readings
+  patch(2, len - 7);
+  LoraBatchReader reader(payload, len);
+  TEST_ASSERT_FALSE(reader.isValid());
+  TEST_ASSERT_EQUAL(0, readAll(reader));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_batch_reads_all);
+  RUN_TEST(test_count_too_low);
+  RUN_TEST(test_count_too_high);
+  RUN_TEST(test_count_zero);
+  RUN_TEST(test_truncated_message);
+  RUN_TEST(test_bytes_after_the_count);
+  return UNITY_END();
+}
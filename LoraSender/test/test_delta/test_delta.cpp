@@ -0,0 +1,165 @@
+// LoraDeltaEncoder/Decoder: compact frames, keyframe after a lost base
+// Run: pio test -e native
+#include <unity.h>
+
+#include <string.h>
+
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_delta.h"
+
+static LoraDeltaEncoder encoder;
+static LoraDeltaDecoder decoder;
+static LoraFrameDecoder frames;
+static lora_payload_t readings[64];
+static lora_payload_t out[LORA_DELTA_MAX_READINGS];
+
+void setUp()
+{
+  encoder = LoraDeltaEncoder();
+  encoder.begin(16);
+  decoder = LoraDeltaDecoder();
+  // As rxDecoder of LoraSender
+  frames = LoraFrameDecoder();
+  frames.accept(sizeof(lora_payload_t));
+  frames.acceptVariable(LORA_EVENT_SENSOR_DELTA, LORA_DELTA_LENGTH_OFFSET);
+  for (uint16_t i = 0; i < 64; ++i)
+  {
+    readings[i] = lora_message_init<LORA_EVENT_SENSOR_DATA>(100 + i);
+    readings[i].elapsed_time_ms = 60000u * i + 7 * i;
+    readings[i].pulse_count = 3u * i;
+    readings[i].checksum = lora_message_checksum(&readings[i]);
+  }
+}
+
+void tearDown() {}
+
+// The receiving side of a frame: keyframes are remembered, compact frames
+// expanded. Returns the readings it yields, 0 for no ACK.
+static size_t receive(const lora_frame_t &frame)
+{
+  bool complete = false;
+  for (size_t i = 0; i < frame.len; ++i)
+    complete = frames.push(frame.data[i]);
+  if (!complete)
+    return 0;
+  if (lora_message_event(frames.payload()) == LORA_EVENT_SENSOR_DELTA)
+    return decoder.decode(frames.payload(), frames.length(), out, LORA_DELTA_MAX_READINGS);
+  if (frames.length() != sizeof(lora_payload_t))
+    return 0;
+  memcpy(&out[0], frames.payload(), sizeof(lora_payload_t));
+  decoder.remember(out[0]);
+  return 1;
+}
+
+static void assertReadings(const lora_payload_t *expected, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+  {
+    TEST_ASSERT_EQUAL(expected[i].messageID, out[i].messageID);
+    TEST_ASSERT_EQUAL_UINT32(expected[i].elapsed_time_ms, out[i].elapsed_time_ms);
+    TEST_ASSERT_EQUAL_UINT32(expected[i].pulse_count, out[i].pulse_count);
+    TEST_ASSERT_EQUAL(expected[i].checksum, out[i].checksum);
+  }
+}
+
+void test_keyframe_then_compact()
+{
+  lora_frame_t frame;
+  TEST_ASSERT_EQUAL(1, encoder.encode(&frame, readings, 5));
+  TEST_ASSERT_EQUAL(1, receive(frame));
+  encoder.acked();
+  size_t n = encoder.encode(&frame, readings + 1, 4);
+  TEST_ASSERT_EQUAL(4, n);
+  TEST_ASSERT_EQUAL(4, receive(frame));
+  assertReadings(readings + 1, 4);
+  encoder.acked();
+  TEST_ASSERT_EQUAL(1, encoder.keyframes);
+  TEST_ASSERT_EQUAL(1, encoder.deltas);
+}
+
+void test_lost_base_resyncs_with_keyframe()
+{
+  // The receiver missed the keyframe, the sender saw its ACK
+  lora_frame_t frame;
+  encoder.encode(&frame, readings, 1);
+  encoder.acked();
+  encoder.encode(&frame, readings + 1, 3);
+  TEST_ASSERT_EQUAL(0, receive(frame));
+  TEST_ASSERT_EQUAL(1, decoder.missingBase);
+
+  // No ACK: the next frame is a keyframe, the compact one after it decodes
+  encoder.lost();
+  TEST_ASSERT_EQUAL(1, encoder.fallbacks);
+  TEST_ASSERT_EQUAL(1, encoder.encode(&frame, readings + 1, 3));
+  TEST_ASSERT_EQUAL(1, receive(frame));
+  assertReadings(readings + 1, 1);
+  encoder.acked();
+  TEST_ASSERT_EQUAL(2, encoder.encode(&frame, readings + 2, 2));
+  TEST_ASSERT_EQUAL(2, receive(frame));
+  assertReadings(readings + 2, 2);
+}
+
+void test_base_out_of_history()
+{
+  // The sender's base is older than the receiver's LORA_DELTA_HISTORY
+  lora_frame_t frame;
+  encoder.encode(&frame, readings, 1);
+  receive(frame);
+  encoder.acked();
+  for (uint16_t i = 1; i <= LORA_DELTA_HISTORY; ++i)
+    decoder.remember(readings[20 + i]);
+  encoder.encode(&frame, readings + 1, 1);
+  TEST_ASSERT_EQUAL(0, receive(frame));
+  TEST_ASSERT_EQUAL(1, decoder.missingBase);
+}
+
+void test_keyframe_interval()
+{
+  encoder.begin(3);
+  lora_frame_t frame;
+  size_t at = 0;
+  unsigned keyframes = 0;
+  for (int i = 0; i < 12; ++i)
+  {
+    size_t n = encoder.encode(&frame, readings + at, 1);
+    TEST_ASSERT_EQUAL(1, receive(frame));
+    keyframes += lora_message_event(frames.payload()) != LORA_EVENT_SENSOR_DELTA;
+    encoder.acked();
+    at += n;
+  }
+  // One keyframe, then three compact frames, and again
+  TEST_ASSERT_EQUAL(3, keyframes);
+  TEST_ASSERT_EQUAL(3, encoder.keyframes);
+  TEST_ASSERT_EQUAL(9, encoder.deltas);
+}
+
+void test_corrupt_frame_not_acked()
+{
+  lora_frame_t frame;
+  encoder.encode(&frame, readings, 1);
+  receive(frame);
+  encoder.acked();
+  encoder.encode(&frame, readings + 1, 3);
+  bool complete = false;
+  for (size_t i = 0; i < frame.len; ++i)
+    complete = frames.push(frame.data[i]);
+  TEST_ASSERT_TRUE(complete);
+  uint8_t payload[LORA_MAX_PAYLOAD_SIZE];
+  memcpy(payload, frames.payload(), frames.length());
+  payload[sizeof(lora_delta_header_t) + 1] ^= 0x01;
+  TEST_ASSERT_EQUAL(0, decoder.decode(payload, frames.length(), out, LORA_DELTA_MAX_READINGS));
+  TEST_ASSERT_EQUAL(1, decoder.malformed);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_keyframe_then_compact);
+  RUN_TEST(test_lost_base_resyncs_with_keyframe);
+  RUN_TEST(test_base_out_of_history);
+  RUN_TEST(test_keyframe_interval);
+  RUN_TEST(test_corrupt_frame_not_acked);
+  return UNITY_END();
+}
@@ -0,0 +1,204 @@
+// LoraFlashLog: replay after a reset, CRC recovery after a torn block
+// Run: pio test -e native
+#include <unity.h>
+
+#include <string.h>
+
+#include <vector>
+
+#include "lora_flash_log.h"
+
+// The fs::File calls the log uses, on memory that outlives the log object
+class MemFile
+{
+public:
+  bool seek(uint32_t to)
+  {
+    pos = to;
+    return true;
+  }
+  size_t read(uint8_t *buf, size_t size)
+  {
+    size_t n = pos < data.size() ? data.size() - pos : 0;
+    n = n < size ? n : size;
+    memcpy(buf, data.data() + pos, n);
+    pos += n;
+    return n;
+  }
+  size_t write(const uint8_t *buf, size_t size)
+  {
+    if (data.size() < pos + size)
+      data.resize(pos + size);
+    memcpy(data.data() + pos, buf, size);
+    pos += size;
+    return size;
+  }
+  void flush() {}
+  size_t size() { return data.size(); }
+
+  std::vector<uint8_t> data;
+  size_t pos = 0;
+};
+
+static const uint32_t BLOCKS = 4;
+static const size_t RECORD_LEN = 100;
+// Records a block holds: length byte and record each
+static const uint32_t PER_BLOCK = LORA_FLASH_LOG_SPACE / (1 + RECORD_LEN);
+
+static MemFile data, cursor;
+static LoraFlashLog<MemFile> rxLog;
+
+void setUp()
+{
+  data = MemFile();
+  cursor = MemFile();
+  rxLog = LoraFlashLog<MemFile>();
+  rxLog.begin(&data, &cursor, BLOCKS);
+}
+
+void tearDown() {}
+
+static void append(uint32_t first, uint32_t count)
+{
+  uint8_t record[RECORD_LEN];
+  for (uint32_t i = first; i < first + count; ++i)
+  {
+    memset(record, (uint8_t)i, sizeof(record));
+    memcpy(record, &i, sizeof(i));
+    TEST_ASSERT_TRUE(rxLog.append(record, sizeof(record)));
+  }
+}
+
+// Power loss and boot: a new log object on the same files
+static void reboot()
+{
+  rxLog = LoraFlashLog<MemFile>();
+  rxLog.begin(&data, &cursor, BLOCKS);
+}
+
+// Replay everything, the record numbers in order into ids
+static std::vector<uint32_t> replay()
+{
+  std::vector<uint32_t> ids;
+  while (const uint8_t *block = rxLog.front())
+  {
+    LoraFlashRecordReader reader(block);
+    const uint8_t *record;
+    size_t len;
+    while (reader.next(&record, &len))
+    {
+      uint32_t id;
+      memcpy(&id, record, sizeof(id));
+      ids.push_back(id);
+    }
+    rxLog.pop();
+  }
+  return ids;
+}
+
+static bool counting(const std::vector<uint32_t> &ids, uint32_t from, uint32_t to)
+{
+  if (ids.size() != to - from)
+    return false;
+  for (size_t i = 0; i < ids.size(); ++i)
+  {
+    if (ids[i] != from + i)
+      return false;
+  }
+  return true;
+}
+
+void test_replay_after_reboot()
+{
+  append(0, 2 * PER_BLOCK + 5);
+  rxLog.flush();
+  reboot();
+  TEST_ASSERT_EQUAL(3, rxLog.backlog());
+  TEST_ASSERT_FALSE(rxLog.frontFromThisRun());
+  TEST_ASSERT_TRUE(counting(replay(), 0, 2 * PER_BLOCK + 5));
+  TEST_ASSERT_TRUE(rxLog.empty());
+  TEST_ASSERT_EQUAL(0, rxLog.corrupt);
+}
+
+void test_torn_block_skipped()
+{
+  append(0, 3 * PER_BLOCK);
+  rxLog.flush();
+  // Power lost while the second block was rewritten: its tail is erased
+  memset(data.data.data() + LORA_FLASH_LOG_BLOCK + LORA_FLASH_LOG_BLOCK / 2, 0xFF, LORA_FLASH_LOG_BLOCK / 2);
+  reboot();
+  std::vector<uint32_t> ids = replay();
+  TEST_ASSERT_EQUAL(1, rxLog.corrupt);
+  TEST_ASSERT_EQUAL(2 * PER_BLOCK, ids.size());
+  TEST_ASSERT_EQUAL(PER_BLOCK - 1, ids[PER_BLOCK - 1]);
+  TEST_ASSERT_EQUAL(2 * PER_BLOCK, ids[PER_BLOCK]);
+}
+
+void test_torn_newest_block_rewritten()
+{
+  append(0, PER_BLOCK + 3);
+  rxLog.flush();
+  // The open block flipped a bit as it was written
+  data.data[LORA_FLASH_LOG_BLOCK + sizeof(lora_flash_block_t) + 10] ^= 0x01;
+  reboot();
+  // Its seq is free again: the new records go to the same place
+  append(1000, 2);
+  rxLog.flush();
+  std::vector<uint32_t> ids = replay();
+  TEST_ASSERT_EQUAL(0, rxLog.corrupt);
+  TEST_ASSERT_EQUAL(PER_BLOCK + 2, ids.size());
+  TEST_ASSERT_EQUAL(PER_BLOCK - 1, ids[PER_BLOCK - 1]);
+  TEST_ASSERT_EQUAL(1000, ids[PER_BLOCK]);
+}
+
+void test_bad_cursor_replays_from_oldest()
+{
+  append(0, 2 * PER_BLOCK);
+  rxLog.flush();
+  TEST_ASSERT_TRUE(rxLog.front() != NULL);
+  rxLog.pop();
+  reboot();
+  TEST_ASSERT_TRUE(counting(replay(), PER_BLOCK, 2 * PER_BLOCK));
+  // The cursor file torn: at least once, from the oldest block
+  cursor.data[5] ^= 0x40;
+  reboot();
+  TEST_ASSERT_TRUE(counting(replay(), 0, 2 * PER_BLOCK));
+}
+
+void test_full_ring_counts_lost()
+{
+  // One block more than the ring holds, then the open one
+  append(0, (BLOCKS + 1) * PER_BLOCK + 1);
+  TEST_ASSERT_EQUAL(2 * PER_BLOCK, rxLog.lost);
+  rxLog.flush();
+  reboot();
+  TEST_ASSERT_TRUE(counting(replay(), 2 * PER_BLOCK, (BLOCKS + 1) * PER_BLOCK + 1));
+}
+
+void test_record_reader_stops_at_bad_length()
+{
+  uint8_t block[LORA_FLASH_LOG_BLOCK] = {};
+  lora_flash_block_t *header = (lora_flash_block_t *)block;
+  header->used = 6;
+  uint8_t *records = block + sizeof(lora_flash_block_t);
+  records[0] = 2;
+  records[3] = 9;
+  LoraFlashRecordReader reader(block);
+  const uint8_t *record;
+  size_t len;
+  TEST_ASSERT_TRUE(reader.next(&record, &len));
+  TEST_ASSERT_EQUAL(2, len);
+  TEST_ASSERT_FALSE(reader.next(&record, &len));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_after_reboot);
+  RUN_TEST(test_torn_block_skipped);
+  RUN_TEST(test_torn_newest_block_rewritten);
+  RUN_TEST(test_bad_cursor_replays_from_oldest);
+  RUN_TEST(test_full_ring_counts_lost);
+  RUN_TEST(test_record_reader_stops_at_bad_length);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+// LoraFrameDecoder, delimiter framing: back in step after garbage
+// Run: pio test -e native
+#include <unity.h>
+
+#include <string.h>
+
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+#include "lora_delta.h"
+#include "lora_nodes.h"
+
+static LoraFrameDecoder decoder;
+static uint32_t decoded;
+static uint16_t lastID;
+static bool inOrder;
+
+void setUp()
+{
+  // As rxDecoder of LoraSender
+  decoder = LoraFrameDecoder();
+  decoder.accept(sizeof(lora_payload_t));
+  decoder.acceptVariable(LORA_EVENT_BATCH, LORA_BATCH_LENGTH_OFFSET);
+  decoder.acceptVariable(LORA_EVENT_SENSOR_DELTA, LORA_DELTA_LENGTH_OFFSET);
+  decoder.accept(sizeof(lora_config_payload_t));
+  decoded = 0;
+  lastID = 0;
+  inOrder = true;
+}
+
+void tearDown() {}
+
+static lora_frame_t reading(uint16_t id)
+{
+  lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(id);
+  payload.elapsed_time_ms = 1000u * id;
+  payload.pulse_count = id * 3u;
+  lora_frame_t frame;
+  lora_message_encode(&frame, &payload);
+  return frame;
+}
+
+static void feed(const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (!decoder.push(data[i]))
+      continue;
+    lora_payload_t payload;
+    if (decoder.length() != sizeof(payload))
+      continue;
+    memcpy(&payload, decoder.payload(), sizeof(payload));
+    if (lora_message_checksum(&payload) != payload.checksum)
+      continue;
+    inOrder = inOrder && payload.messageID > lastID;
+    lastID = payload.messageID;
+    decoded++;
+  }
+}
+
+static void feedReadings(uint16_t first, uint16_t count)
+{
+  for (uint16_t id = first; id < first + count; ++id)
+  {
+    lora_frame_t frame = reading(id);
+    feed(frame.data, frame.len);
+  }
+}
+
+void test_clean_stream()
+{
+  feedReadings(1, 2000);
+  TEST_ASSERT_EQUAL(2000, decoded);
+  TEST_ASSERT_EQUAL(0, decoder.errors);
+}
+
+void test_garbage_byte_then_frames()
+{
+  uint8_t garbage = 0x55;
+  feed(&garbage, 1);
+  feedReadings(1, 2000);
+  TEST_ASSERT_EQUAL(2000, decoded);
+  TEST_ASSERT_TRUE(inOrder);
+  TEST_ASSERT_EQUAL(1, decoder.errors);
+}
+
+void test_long_garbage_then_frames()
+{
+  uint8_t garbage[200];
+  for (size_t i = 0; i < sizeof(garbage); ++i)
+    garbage[i] = (uint8_t)(i * 37 + 11);
+  feed(garbage, sizeof(garbage));
+  feedReadings(1, 100);
+  TEST_ASSERT_EQUAL(100, decoded);
+  TEST_ASSERT_TRUE(inOrder);
+}
+
+void test_truncated_frame_then_frames()
+{
+  lora_frame_t frame = reading(1);
+  feed(frame.data, 7);
+  feedReadings(2, 100);
+  TEST_ASSERT_EQUAL(100, decoded);
+  TEST_ASSERT_TRUE(inOrder);
+}
+
+void test_truncated_frame_with_delimiter_then_frames()
+{
+  // Bytes lost in the middle, the delimiter came through
+  lora_frame_t frame = reading(1);
+  feed(frame.data, 5);
+  feed(frame.data + 9, frame.len - 9);
+  feedReadings(2, 100);
+  TEST_ASSERT_EQUAL(100, decoded);
+  TEST_ASSERT_TRUE(inOrder);
+}
+
+void test_delimiter_inside_payload()
+{
+  // messageID 0x0C0C: the delimiter bytes at the start of the payload
+  feedReadings(0x0C0A, 5);
+  TEST_ASSERT_EQUAL(5, decoded);
+  TEST_ASSERT_EQUAL(0, decoder.errors);
+}
+
+void test_garbage_then_batch()
+{
+  LoraBatchWriter batch;
+  batch.begin(0);
+  for (uint16_t id = 1; id <= 3; ++id)
+  {
+    lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(id);
+    payload.checksum = lora_message_checksum(&payload);
+    batch.add(payload, 0);
+  }
+  lora_frame_t frame;
+  batch.flush(&frame, 9);
+  uint8_t garbage[3] = {0x01, 0x0C, 0x0C};
+  feed(garbage, sizeof(garbage));
+  bool complete = false;
+  for (size_t i = 0; i < frame.len; ++i)
+    complete = decoder.push(frame.data[i]);
+  TEST_ASSERT_TRUE(complete);
+  TEST_ASSERT_EQUAL(frame.len - E32_MSG_DELIMITER_LEN, decoder.length());
+  TEST_ASSERT_EQUAL_MEMORY(frame.data, decoder.payload(), decoder.length());
+}
+
+void test_garbage_then_frame_with_header()
+{
+  decoder.header(LORA_NODE_HEADER_SIZE);
+  lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(5);
+  payload.checksum = lora_message_checksum(&payload);
+  lora_node_header_t from = {0x0102};
+  uint8_t wire[2 + sizeof(from) + sizeof(payload) + E32_MSG_DELIMITER_LEN] = {0x33, 0x44};
+  memcpy(wire + 2, &from, sizeof(from));
+  memcpy(wire + 2 + sizeof(from), &payload, sizeof(payload));
+  wire[sizeof(wire) - 2] = E32_MSG_DELIMITER_1;
+  wire[sizeof(wire) - 1] = E32_MSG_DELIMITER_2;
+  bool complete = false;
+  for (size_t i = 0; i < sizeof(wire); ++i)
+    complete = decoder.push(wire[i]);
+  TEST_ASSERT_TRUE(complete);
+  TEST_ASSERT_EQUAL(sizeof(payload), decoder.length());
+  TEST_ASSERT_EQUAL_MEMORY(&from, decoder.header(), sizeof(from));
+  TEST_ASSERT_EQUAL_MEMORY(&payload, decoder.payload(), sizeof(payload));
+}
+
+void test_unpack_rejects_garbage_prefix()
+{
+  lora_frame_t frame = reading(1);
+  uint8_t wire[E32_MAX_PACKET_SIZE + 1] = {0x55};
+  memcpy(wire + 1, frame.data, frame.len);
+  lora_payload_t payload;
+  TEST_ASSERT_TRUE(lora_frame_decode(frame.data, frame.len, &payload));
+  TEST_ASSERT_FALSE(lora_frame_decode(wire, frame.len + 1, &payload));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+#if LORA_FRAMING == LORA_FRAMING_DELIMITER
+  RUN_TEST(test_clean_stream);
+  RUN_TEST(test_garbage_byte_then_frames);
+  RUN_TEST(test_long_garbage_then_frames);
+  RUN_TEST(test_truncated_frame_then_frames);
+  RUN_TEST(test_truncated_frame_with_delimiter_then_frames);
+  RUN_TEST(test_delimiter_inside_payload);
+  RUN_TEST(test_garbage_then_batch);
+  RUN_TEST(test_garbage_then_frame_with_header);
+  RUN_TEST(test_unpack_rejects_garbage_prefix);
+#endif
+  return UNITY_END();
+}
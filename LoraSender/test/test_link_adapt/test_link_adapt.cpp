@@ -0,0 +1,180 @@
+// LoraLinkAdapt: loss windows, rate handshake, holdoff, silence fallback
+// Run: pio test -e native
+#include <unity.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+#include "lora_link_adapt.h"
+
+// SPED.airDataRate codes: 1 = 1.2k, 2 = 2.4k (base), 5 = 19.2k
+static const uint8_t BASE = 2;
+static LoraLinkAdapt adapt;
+static uint16_t nextId;
+static uint32_t now;
+
+void setUp()
+{
+  adapt = LoraLinkAdapt();
+  adapt.begin(BASE, 1, 5, 24000, 0);
+  nextId = 1;
+  now = 0;
+}
+
+void tearDown() {}
+
+// n readings a minute apart, every lossEvery-th one lost on air (0: none)
+static void readings(unsigned n, unsigned lossEvery = 0)
+{
+  for (unsigned i = 1; i <= n; ++i)
+  {
+    uint16_t id = nextId++;
+    if (lossEvery && i % lossEvery == 0)
+      continue;
+    now += 60000;
+    adapt.frame(now);
+    adapt.reading(id);
+  }
+}
+
+// Run the handshake the sensor answers; the rate switched to
+static uint8_t handshake()
+{
+  lora_rate_payload_t msg;
+  if (!adapt.message(nextId, &msg) || msg.step != LORA_RATE_PROPOSE)
+    return 0;
+  adapt.response(msg);
+  if (!adapt.message(nextId, &msg) || msg.step != LORA_RATE_COMMIT)
+    return 0;
+  uint8_t rate = 0;
+  adapt.committed(&rate);
+  return rate;
+}
+
+void test_clean_link_goes_up_after_holdoff()
+{
+  lora_rate_payload_t msg;
+  readings(LORA_LINK_WINDOW);
+  TEST_ASSERT_EQUAL(0, adapt.lossPermille);
+  TEST_ASSERT_FALSE(adapt.message(nextId, &msg));
+  readings(LORA_LINK_WINDOW);
+  TEST_ASSERT_EQUAL(BASE + 1, handshake());
+  TEST_ASSERT_EQUAL(BASE + 1, adapt.rate());
+  TEST_ASSERT_EQUAL(BASE, adapt.previousRate());
+  TEST_ASSERT_EQUAL(1, adapt.ups);
+}
+
+void test_lossy_link_goes_down()
+{
+  // Every third reading lost: 10 of the first 32
+  readings(48, 3);
+  TEST_ASSERT_EQUAL(10 * 1000 / LORA_LINK_WINDOW, adapt.lossPermille);
+  TEST_ASSERT_EQUAL(BASE - 1, handshake());
+  TEST_ASSERT_EQUAL(1, adapt.downs);
+  // Not below the lowest rate
+  readings(48, 3);
+  lora_rate_payload_t msg;
+  TEST_ASSERT_FALSE(adapt.message(nextId, &msg));
+}
+
+void test_repeats_count_unless_excused()
+{
+  readings(1);
+  // The sensor did not get our ACK and sends the reading again
+  for (int i = 0; i < LORA_LINK_WINDOW / 2; ++i)
+    adapt.reading(nextId - 1);
+  TEST_ASSERT_EQUAL(LORA_LINK_WINDOW / 2, adapt.repeats);
+  readings(LORA_LINK_WINDOW / 2 - 1);
+  TEST_ASSERT_EQUAL(500, adapt.lossPermille);
+
+  // We did not answer (duty cycle): its repeat is not a loss
+  setUp();
+  readings(1);
+  for (int i = 0; i < LORA_LINK_WINDOW - 1; ++i)
+  {
+    adapt.answerSkipped();
+    adapt.reading(nextId - 1);
+  }
+  TEST_ASSERT_EQUAL(0, adapt.lossPermille);
+}
+
+void test_sensor_restart_is_no_gap()
+{
+  readings(10);
+  // Counter far off: a new count, not thousands lost
+  nextId = 30000;
+  readings(LORA_LINK_WINDOW - 10);
+  TEST_ASSERT_EQUAL(0, adapt.lossPermille);
+}
+
+void test_unanswered_proposal_backs_off()
+{
+  readings(2 * LORA_LINK_WINDOW);
+  lora_rate_payload_t msg;
+  for (int i = 0; i < LORA_LINK_PROPOSE_TRIES; ++i)
+    TEST_ASSERT_TRUE(adapt.message(nextId, &msg));
+  TEST_ASSERT_FALSE(adapt.message(nextId, &msg));
+  TEST_ASSERT_EQUAL(1, adapt.refused);
+  TEST_ASSERT_EQUAL(BASE, adapt.rate());
+  // Holdoff 2 now: two clean windows pass before the next try
+  readings(2 * LORA_LINK_WINDOW);
+  TEST_ASSERT_FALSE(adapt.message(nextId, &msg));
+  readings(LORA_LINK_WINDOW);
+  TEST_ASSERT_TRUE(adapt.message(nextId, &msg));
+  TEST_ASSERT_EQUAL(BASE + 1, msg.airDataRate);
+}
+
+void test_stale_response_ignored()
+{
+  readings(2 * LORA_LINK_WINDOW);
+  lora_rate_payload_t msg;
+  adapt.message(nextId, &msg);
+  lora_rate_payload_t old = msg;
+  old.handshake--;
+  TEST_ASSERT_FALSE(adapt.response(old));
+  TEST_ASSERT_TRUE(adapt.response(msg));
+}
+
+void test_rate_that_does_not_hold_flaps_less()
+{
+  readings(2 * LORA_LINK_WINDOW);
+  TEST_ASSERT_EQUAL(BASE + 1, handshake());
+  // Lossy at the higher rate: down again
+  readings(48, 3);
+  TEST_ASSERT_EQUAL(BASE, handshake());
+  // Holdoff 2 + the window it went down in: no try for three clean windows
+  lora_rate_payload_t msg;
+  readings(2 * LORA_LINK_WINDOW);
+  TEST_ASSERT_FALSE(adapt.message(nextId, &msg));
+  readings(LORA_LINK_WINDOW);
+  TEST_ASSERT_TRUE(adapt.message(nextId, &msg));
+}
+
+void test_silence_falls_back_to_base()
+{
+  uint8_t rate = 0;
+  TEST_ASSERT_EQUAL(UINT32_MAX, adapt.silenceLeftMs(now));
+  readings(2 * LORA_LINK_WINDOW);
+  handshake();
+  // Four mean intervals between frames without one
+  TEST_ASSERT_EQUAL_UINT32(4 * 60000, adapt.silenceLeftMs(now));
+  TEST_ASSERT_FALSE(adapt.silent(now + 4 * 60000 - 1, &rate));
+  TEST_ASSERT_TRUE(adapt.silent(now + 4 * 60000, &rate));
+  TEST_ASSERT_EQUAL(BASE, rate);
+  TEST_ASSERT_EQUAL(BASE, adapt.rate());
+  TEST_ASSERT_EQUAL(1, adapt.fallbacks);
+  TEST_ASSERT_EQUAL(UINT32_MAX, adapt.silenceLeftMs(now));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_link_goes_up_after_holdoff);
+  RUN_TEST(test_lossy_link_goes_down);
+  RUN_TEST(test_repeats_count_unless_excused);
+  RUN_TEST(test_sensor_restart_is_no_gap);
+  RUN_TEST(test_unanswered_proposal_backs_off);
+  RUN_TEST(test_stale_response_ignored);
+  RUN_TEST(test_rate_that_does_not_hold_flaps_less);
+  RUN_TEST(test_silence_falls_back_to_base);
+  return UNITY_END();
+}
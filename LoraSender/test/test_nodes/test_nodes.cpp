@@ -0,0 +1,114 @@
+// LoraNodeTable: eviction of the oldest node, probe runs after removals
+// Run: pio test -e native
+#include <unity.h>
+
+#include <set>
+
+#include "communication.h"
+#include "lora_nodes.h"
+
+// 8 slots, 6 nodes at most: every run of probes wraps and collides
+static LoraNodeTable<8> nodes;
+
+void setUp()
+{
+  nodes = LoraNodeTable<8>();
+}
+
+void tearDown() {}
+
+void test_lookup_adds_once()
+{
+  lora_node_t *a = nodes.lookup(0x0102, 1000);
+  TEST_ASSERT_EQUAL(0x0102, a->address);
+  TEST_ASSERT_EQUAL_UINT32(1000, a->firstSeenMs);
+  TEST_ASSERT_TRUE(nodes.lookup(0x0102, 2000) == a);
+  TEST_ASSERT_TRUE(nodes.find(0x0102) == a);
+  TEST_ASSERT_TRUE(nodes.find(0x0103) == NULL);
+  TEST_ASSERT_EQUAL(1, nodes.size());
+  TEST_ASSERT_EQUAL(1, nodes.added);
+}
+
+void test_full_table_evicts_oldest()
+{
+  TEST_ASSERT_EQUAL(6, nodes.capacity());
+  for (uint16_t a = 1; a <= 6; ++a)
+    nodes.lookup(a, 1000 * a);
+  // 3 heard from last, 1 the longest ago after it
+  nodes.find(3)->lastSeenMs = 9000;
+  nodes.lookup(7, 10000);
+  TEST_ASSERT_EQUAL(6, nodes.size());
+  TEST_ASSERT_EQUAL(1, nodes.evicted);
+  TEST_ASSERT_TRUE(nodes.find(1) == NULL);
+  for (uint16_t a = 2; a <= 7; ++a)
+    TEST_ASSERT_TRUE(nodes.find(a) != NULL);
+  nodes.lookup(8, 11000);
+  TEST_ASSERT_TRUE(nodes.find(2) == NULL);
+  TEST_ASSERT_TRUE(nodes.find(3) != NULL);
+}
+
+void test_eviction_across_millis_wrap()
+{
+  // Ages, not timestamps: 0xFFFFF000 is older than 0x00000100
+  for (uint16_t a = 1; a <= 5; ++a)
+    nodes.lookup(a, 0x00000100);
+  nodes.lookup(6, 0xFFFFF000);
+  nodes.lookup(7, 0x00000200);
+  TEST_ASSERT_TRUE(nodes.find(6) == NULL);
+  TEST_ASSERT_EQUAL(1, nodes.evicted);
+}
+
+void test_remove_keeps_probe_runs()
+{
+  // Random adds and removes against a reference set: every node in the
+  // table must stay reachable after the entries behind a hole moved up
+  std::set<uint16_t> expected;
+  uint32_t seed = 12345;
+  for (int step = 0; step < 5000; ++step)
+  {
+    seed = seed * 1103515245u + 12345u;
+    uint16_t address = (uint16_t)((seed >> 16) % 24);
+    if ((seed >> 8) & 1)
+    {
+      if (expected.size() < nodes.capacity())
+      {
+        nodes.lookup(address, step);
+        expected.insert(address);
+      }
+    }
+    else
+    {
+      TEST_ASSERT_EQUAL(expected.erase(address), nodes.remove(address));
+    }
+    TEST_ASSERT_EQUAL(expected.size(), nodes.size());
+    for (uint16_t a = 0; a < 24; ++a)
+      TEST_ASSERT_EQUAL(expected.count(a), nodes.find(a) != NULL);
+  }
+  TEST_ASSERT_EQUAL(0, nodes.evicted);
+  TEST_ASSERT_TRUE(nodes.maxProbes >= 2);
+  TEST_ASSERT_TRUE(nodes.maxProbes <= 8);
+}
+
+void test_expire_old_nodes()
+{
+  for (uint16_t a = 1; a <= 6; ++a)
+    nodes.lookup(a * 257, a <= 3 ? 1000 : 50000);
+  TEST_ASSERT_EQUAL(3, nodes.expire(70000, 30000));
+  TEST_ASSERT_EQUAL(3, nodes.size());
+  for (uint16_t a = 1; a <= 6; ++a)
+    TEST_ASSERT_EQUAL(a > 3, nodes.find(a * 257) != NULL);
+  unsigned visited = 0;
+  nodes.forEach([&](lora_node_t &) { visited++; });
+  TEST_ASSERT_EQUAL(3, visited);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_lookup_adds_once);
+  RUN_TEST(test_full_table_evicts_oldest);
+  RUN_TEST(test_eviction_across_millis_wrap);
+  RUN_TEST(test_remove_keeps_probe_runs);
+  RUN_TEST(test_expire_old_nodes);
+  return UNITY_END();
+}
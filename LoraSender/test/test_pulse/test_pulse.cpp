@@ -0,0 +1,71 @@
+// LoraPulseExtender: narrow counter wraps into the wide total
+// Run: pio test -e native
+#include <unity.h>
+
+#include "lora_pulse.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_counts_up()
+{
+  LoraPulseExtender pulses(LORA_PULSE_PCNT_LIMIT);
+  TEST_ASSERT_EQUAL(0, pulses.update(0));
+  TEST_ASSERT_EQUAL(5, pulses.update(5));
+  TEST_ASSERT_EQUAL(5, pulses.update(5));
+  TEST_ASSERT_EQUAL(1000, pulses.update(1000));
+  TEST_ASSERT_EQUAL(1000, pulses.value());
+}
+
+void test_pcnt_wrap()
+{
+  // The unit clears at 32767: it reads 0 to 32766
+  LoraPulseExtender pulses(LORA_PULSE_PCNT_LIMIT);
+  pulses.update(32760);
+  TEST_ASSERT_EQUAL(32760 + 7 + 3, pulses.update(3));
+  // Landing on 0 itself
+  pulses.update(32766);
+  TEST_ASSERT_EQUAL(LORA_PULSE_PCNT_LIMIT * 2, pulses.update(0));
+}
+
+void test_pcnt_wrap_almost_a_wrap_apart()
+{
+  LoraPulseExtender pulses(LORA_PULSE_PCNT_LIMIT);
+  pulses.update(100);
+  // 32766 pulses between two reads, the most it tells apart
+  TEST_ASSERT_EQUAL(100 + LORA_PULSE_PCNT_LIMIT - 1, pulses.update(99));
+}
+
+void test_pcnt_many_wraps()
+{
+  // A million pulses read in uneven steps below the limit
+  LoraPulseExtender pulses(LORA_PULSE_PCNT_LIMIT);
+  uint32_t seed = 1;
+  uint32_t counted = 0;
+  while (counted < 1000000)
+  {
+    seed = seed * 1103515245u + 12345u;
+    counted += (seed >> 16) % LORA_PULSE_PCNT_LIMIT;
+    TEST_ASSERT_EQUAL_UINT32(counted, (uint32_t)pulses.update(counted % LORA_PULSE_PCNT_LIMIT));
+  }
+}
+
+void test_atomic_counter_wrap()
+{
+  // Modulus 0: the 32 bit interrupt counter wraps at 2^32
+  LoraPulseExtender pulses;
+  pulses.update(0xFFFFFFF0u);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFF0u + 0x20, (uint32_t)pulses.update(0x10));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_counts_up);
+  RUN_TEST(test_pcnt_wrap);
+  RUN_TEST(test_pcnt_wrap_almost_a_wrap_apart);
+  RUN_TEST(test_pcnt_many_wraps);
+  RUN_TEST(test_atomic_counter_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,151 @@
+// LoraTdmaSchedule: slot layout, assignment, slot windows, drift
+// Run: pio test -e native
+#include <unity.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+#include "lora_nodes.h"
+#include "lora_tdma.h"
+
+static LoraTdmaSchedule tdma;
+static const uint32_t PERIOD_MS = 60000;
+static const uint32_t ORIGIN_MS = 1000;
+
+void setUp()
+{
+  // As LoraSender: 2400 bps air, 9600 baud, FEC, ACK batch with a slot
+  tdma.begin(PERIOD_MS, 2400, 9600, true, 21, 40, ORIGIN_MS);
+}
+
+void tearDown() {}
+
+// Transmit start of slot counted from the origin
+static uint32_t slotStart(size_t slot)
+{
+  return ORIGIN_MS + tdma.nextStartMs(slot, ORIGIN_MS, 0);
+}
+
+void test_layout()
+{
+  // 20 ms jitter and 100 ppm of a minute
+  TEST_ASSERT_EQUAL(26, tdma.guardMs());
+  TEST_ASSERT_EQUAL(PERIOD_MS / tdma.slotMs(), tdma.slots());
+  TEST_ASSERT_TRUE(tdma.slotMs() > 2 * tdma.guardMs() + tdma.answerTimeMs());
+  for (size_t i = 0; i + 1 < tdma.slots(); ++i)
+    TEST_ASSERT_EQUAL(tdma.slotMs(), slotStart(i + 1) - slotStart(i));
+  TEST_ASSERT_EQUAL(ORIGIN_MS + tdma.guardMs(), slotStart(0));
+}
+
+void test_assign_even_slots_first()
+{
+  size_t n = tdma.slots();
+  for (size_t i = 0; i < (n + 1) / 2; ++i)
+    TEST_ASSERT_EQUAL(2 * i, tdma.assign());
+  TEST_ASSERT_EQUAL(1, tdma.assign());
+  for (size_t i = (n + 1) / 2 + 1; i < n; ++i)
+    tdma.assign();
+  TEST_ASSERT_EQUAL(-1, tdma.assign());
+  TEST_ASSERT_EQUAL(UINT32_MAX, tdma.nextFreeMs(ORIGIN_MS));
+  tdma.release(4);
+  TEST_ASSERT_EQUAL(4, tdma.assign());
+  tdma.releaseAll();
+  TEST_ASSERT_EQUAL(0, tdma.assign());
+}
+
+void test_next_start_every_period()
+{
+  uint32_t start = slotStart(3);
+  TEST_ASSERT_EQUAL(start - 500, tdma.nextStartMs(3, 500, 0));
+  // Just past it: the one a period later
+  TEST_ASSERT_EQUAL(PERIOD_MS - 1, tdma.nextStartMs(3, start + 1, 0));
+  // At least the lead away
+  TEST_ASSERT_EQUAL(PERIOD_MS, tdma.nextStartMs(3, start, 1));
+  TEST_ASSERT_EQUAL(0, tdma.nextStartMs(3, start + 5 * PERIOD_MS, 0));
+}
+
+void test_slot_window()
+{
+  uint32_t start = slotStart(2);
+  // Sent at the slot start, the frame is complete a frame time later
+  uint32_t frameMs = (uint32_t)-tdma.offsetMs(2, start);
+  uint32_t arrival = start + frameMs;
+  TEST_ASSERT_EQUAL(0, tdma.offsetMs(2, arrival));
+  TEST_ASSERT_EQUAL(-7, tdma.offsetMs(2, arrival + PERIOD_MS - 7));
+  uint32_t guard = tdma.guardMs();
+  TEST_ASSERT_TRUE(tdma.onSlot(2, arrival + guard / 2));
+  TEST_ASSERT_FALSE(tdma.onSlot(2, arrival + guard / 2 + 1));
+  TEST_ASSERT_TRUE(tdma.onSlot(2, arrival - frameMs / 2 - guard / 2));
+  TEST_ASSERT_FALSE(tdma.onSlot(2, arrival - frameMs / 2 - guard / 2 - 1));
+}
+
+void test_long_uptime()
+{
+  // 60 days of a frame every day, beyond the signed 24 days and the
+  // millis() wrap: the origin moves along, the slots keep their phase
+  uint32_t start = slotStart(5);
+  uint32_t frameMs = (uint32_t)-tdma.offsetMs(5, start);
+  for (uint32_t day = 1; day <= 60; ++day)
+  {
+    uint32_t later = start + day * 1440u * PERIOD_MS;
+    TEST_ASSERT_EQUAL(10, tdma.nextStartMs(5, later - 10, 0));
+    TEST_ASSERT_EQUAL(0, tdma.offsetMs(5, later + frameMs));
+  }
+}
+
+void test_drift_grows_guard()
+{
+  uint32_t guard = tdma.guardMs();
+  uint8_t epoch = tdma.epoch;
+  TEST_ASSERT_FALSE(tdma.observeDrift(-80));
+  TEST_ASSERT_EQUAL(guard, tdma.guardMs());
+  // A slow or a fast clock alike, with a quarter to spare
+  TEST_ASSERT_TRUE(tdma.observeDrift(-400));
+  TEST_ASSERT_EQUAL_UINT32(500, tdma.driftPpm);
+  TEST_ASSERT_EQUAL(20 + 30, tdma.guardMs());
+  TEST_ASSERT_EQUAL(epoch + 1, tdma.epoch);
+  TEST_ASSERT_FALSE(tdma.observeDrift(450));
+}
+
+void test_fill_in_sensor_clock()
+{
+  lora_slot_payload_t slow = lora_message_init<LORA_EVENT_SLOT>(1);
+  lora_slot_payload_t fast = lora_message_init<LORA_EVENT_SLOT>(2);
+  tdma.fill(&slow, 3, ORIGIN_MS, 1000);
+  tdma.fill(&fast, 3, ORIGIN_MS, -1000);
+  // A slow sensor clock counts fewer milliseconds for the same wait
+  TEST_ASSERT_EQUAL_UINT32(59940, slow.periodMs);
+  TEST_ASSERT_EQUAL_UINT32(60060, fast.periodMs);
+  TEST_ASSERT_TRUE(slow.slotDelayMs < fast.slotDelayMs);
+  TEST_ASSERT_EQUAL(tdma.slotMs(), slow.slotMs);
+}
+
+void test_measure_drift_sign()
+{
+  lora_node_t node = {};
+  TEST_ASSERT_FALSE(lora_tdma_measure(&node, 0, 10000, PERIOD_MS));
+  // The sensor counts 60000 ms while 60030 ms pass here: slow, positive
+  TEST_ASSERT_TRUE(lora_tdma_measure(&node, 60000, 70030, PERIOD_MS));
+  TEST_ASSERT_EQUAL(500, node.driftPpm);
+  node = {};
+  lora_tdma_measure(&node, 0, 10000, PERIOD_MS);
+  TEST_ASSERT_TRUE(lora_tdma_measure(&node, 60000, 69970, PERIOD_MS));
+  TEST_ASSERT_EQUAL(-500, node.driftPpm);
+  // Too close together for a figure, or a repeated reading
+  TEST_ASSERT_FALSE(lora_tdma_measure(&node, 70000, 79970, PERIOD_MS));
+  TEST_ASSERT_FALSE(lora_tdma_measure(&node, 130000, 200000, PERIOD_MS));
+  TEST_ASSERT_EQUAL(-500, node.driftPpm);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_layout);
+  RUN_TEST(test_assign_even_slots_first);
+  RUN_TEST(test_next_start_every_period);
+  RUN_TEST(test_slot_window);
+  RUN_TEST(test_long_uptime);
+  RUN_TEST(test_drift_grows_guard);
+  RUN_TEST(test_fill_in_sensor_clock);
+  RUN_TEST(test_measure_drift_sign);
+  return UNITY_END();
+}
@@ -0,0 +1,176 @@
+// lora_time_sync.h: two-way offset, drift sign, answer delay, sensor window
+// Run: pio test -e native
+#include <unity.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+#include "lora_time_sync.h"
+
+// A sensor whose clock was started sensorOffsetMs after ours and runs
+// sensorDriftPpm slow (+) or fast (-); the modules add LATENCY_MS each way
+static int32_t sensorOffsetMs;
+static int32_t sensorDriftPpm;
+static const uint32_t LATENCY_MS = 40;
+static const uint32_t ANSWER_MS = 300;
+
+static lora_clock_t bridgeClock;
+static LoraTimeSyncClient client;
+static uint16_t nextId;
+
+void setUp()
+{
+  bridgeClock = {};
+  client = LoraTimeSyncClient();
+  sensorOffsetMs = 5000;
+  sensorDriftPpm = 0;
+  nextId = 1;
+}
+
+void tearDown() {}
+
+static uint32_t sensorMs(uint32_t bridgeMs)
+{
+  return bridgeMs - sensorOffsetMs - (int32_t)((int64_t)sensorDriftPpm * bridgeMs / 1000000);
+}
+
+// One exchange on the frame that came out of our module at rxEndMs; true
+// if the bridge took an offset sample from it
+static bool exchange(uint32_t rxEndMs, uint16_t *syncID = NULL)
+{
+  lora_time_payload_t msg = lora_message_init<LORA_EVENT_TIME_SYNC>(nextId++);
+  lora_time_fill(&bridgeClock, &msg, rxEndMs, 60);
+  uint32_t txEndMs = rxEndMs + ANSWER_MS;
+  lora_time_sent(&bridgeClock, true, txEndMs);
+  client.synced(msg, sensorMs(rxEndMs - LATENCY_MS), sensorMs(txEndMs + LATENCY_MS));
+  lora_time_response_t response;
+  client.respond(nextId++, &response);
+  client.acked();
+  if (syncID)
+    response.syncID = *syncID;
+  return lora_time_measure(&bridgeClock, response);
+}
+
+void test_offset_and_round_trip()
+{
+  TEST_ASSERT_TRUE(exchange(100000));
+  TEST_ASSERT_EQUAL(5000, bridgeClock.offsetMs);
+  TEST_ASSERT_EQUAL(2 * LATENCY_MS, bridgeClock.roundTripMs);
+  TEST_ASSERT_EQUAL(1, bridgeClock.samples);
+  TEST_ASSERT_EQUAL_UINT32(100000, lora_time_to_bridge(&bridgeClock, 95000));
+}
+
+// Exchanges a minute apart for ten minutes
+static void syncTenMinutes()
+{
+  for (uint32_t t = 100000; t <= 700000; t += 60000)
+    TEST_ASSERT_TRUE(exchange(t));
+}
+
+void test_slow_sensor_positive_drift()
+{
+  sensorDriftPpm = 500;
+  syncTenMinutes();
+  TEST_ASSERT_INT32_WITHIN(20, 500, bridgeClock.driftPpm);
+  // An hour on, its time still maps onto ours
+  uint32_t later = 700000 + 3600000;
+  TEST_ASSERT_UINT32_WITHIN(5, later, lora_time_to_bridge(&bridgeClock, sensorMs(later)));
+}
+
+void test_fast_sensor_negative_drift()
+{
+  sensorDriftPpm = -500;
+  syncTenMinutes();
+  TEST_ASSERT_INT32_WITHIN(20, -500, bridgeClock.driftPpm);
+  uint32_t later = 700000 + 3600000;
+  TEST_ASSERT_UINT32_WITHIN(5, later, lora_time_to_bridge(&bridgeClock, sensorMs(later)));
+}
+
+void test_close_samples_keep_base()
+{
+  sensorDriftPpm = 500;
+  TEST_ASSERT_TRUE(exchange(100000));
+  TEST_ASSERT_TRUE(exchange(110000));
+  TEST_ASSERT_EQUAL_UINT32(100000, bridgeClock.sampleMs);
+  TEST_ASSERT_EQUAL(0, bridgeClock.driftPpm);
+  // The span counts from the kept sample
+  TEST_ASSERT_TRUE(exchange(130000));
+  TEST_ASSERT_EQUAL_UINT32(130000, bridgeClock.sampleMs);
+  TEST_ASSERT_TRUE(bridgeClock.driftPpm > 0);
+}
+
+void test_sensor_restart_new_offset()
+{
+  sensorDriftPpm = 500;
+  syncTenMinutes();
+  int32_t drift = bridgeClock.driftPpm;
+  // It rebooted: its bridgeClock starts again from 0
+  sensorOffsetMs = 760000;
+  TEST_ASSERT_TRUE(exchange(760000));
+  TEST_ASSERT_INT32_WITHIN(1, sensorOffsetMs + 380, bridgeClock.offsetMs);
+  TEST_ASSERT_EQUAL(1, bridgeClock.samples);
+  TEST_ASSERT_EQUAL(drift, bridgeClock.driftPpm);
+}
+
+void test_stale_response_ignored()
+{
+  uint16_t stale = 999;
+  TEST_ASSERT_FALSE(exchange(100000, &stale));
+  TEST_ASSERT_EQUAL(0, bridgeClock.samples);
+  TEST_ASSERT_EQUAL(0, bridgeClock.answerDelayMs);
+}
+
+void test_answer_held_to_confirmed_delay()
+{
+  // Nothing confirmed: no hold, a bridgeClock every few ACKs
+  TEST_ASSERT_EQUAL(0, lora_time_hold_ms(&bridgeClock, 1000, 1020, 30));
+  TEST_ASSERT_FALSE(lora_time_due(&bridgeClock));
+  for (int i = 0; i < LORA_TIME_SYNC_RETRY; ++i)
+    lora_time_sent(&bridgeClock, false, 0);
+  TEST_ASSERT_TRUE(lora_time_due(&bridgeClock));
+
+  TEST_ASSERT_TRUE(exchange(100000));
+  TEST_ASSERT_EQUAL(60 + LORA_TIME_SYNC_MARGIN_MS, bridgeClock.answerDelayMs);
+  TEST_ASSERT_FALSE(lora_time_due(&bridgeClock));
+  TEST_ASSERT_EQUAL(15, lora_time_hold_ms(&bridgeClock, 200000, 200020, 30));
+  TEST_ASSERT_EQUAL(0, bridgeClock.late);
+  // Slower than confirmed: out at once, counted, a longer delay next
+  TEST_ASSERT_EQUAL(0, lora_time_hold_ms(&bridgeClock, 200000, 200050, 30));
+  TEST_ASSERT_EQUAL(1, bridgeClock.late);
+  TEST_ASSERT_TRUE(lora_time_due(&bridgeClock));
+}
+
+void test_sensor_listen_window()
+{
+  uint32_t openMs, closeMs;
+  TEST_ASSERT_FALSE(client.window(1000, 200, &openMs, &closeMs));
+  // The second bridgeClock message knows the round trip
+  TEST_ASSERT_TRUE(exchange(100000));
+  TEST_ASSERT_TRUE(exchange(160000));
+  uint16_t delay = client.answerDelayMs;
+  uint16_t window = client.windowMs;
+  // The sensor counts from its frame on air, before our module had it
+  TEST_ASSERT_EQUAL(bridgeClock.answerDelayMs + LATENCY_MS, delay);
+  TEST_ASSERT_TRUE(client.window(1000, 200, &openMs, &closeMs));
+  TEST_ASSERT_EQUAL_UINT32(1000 + delay - window, openMs);
+  TEST_ASSERT_EQUAL_UINT32(1000 + delay + 2 * window + 200, closeMs);
+  // Too many missed: the usual receive delay again
+  for (int i = 0; i < LORA_TIME_SYNC_MISSES - 1; ++i)
+    client.missed();
+  TEST_ASSERT_TRUE(client.active);
+  client.missed();
+  TEST_ASSERT_FALSE(client.active);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_offset_and_round_trip);
+  RUN_TEST(test_slow_sensor_positive_drift);
+  RUN_TEST(test_fast_sensor_negative_drift);
+  RUN_TEST(test_close_samples_keep_base);
+  RUN_TEST(test_sensor_restart_new_offset);
+  RUN_TEST(test_stale_response_ignored);
+  RUN_TEST(test_answer_held_to_confirmed_delay);
+  RUN_TEST(test_sensor_listen_window);
+  return UNITY_END();
+}
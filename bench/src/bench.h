@@ -0,0 +1,56 @@
+#pragma once
+// Minimal benchmark harness for the host build
+//
+// BENCH(name) { while (state.keepRunning()) { ...code under test... } }
+//
+// Every case is run until BENCH_MIN_TIME_MS of wall time has been measured.
+// BENCH_FILTER runs only the cases with that in their name, BENCH_OUTPUT
+// also writes the results to a .json or .csv file, labelled BENCH_LABEL.
+// Heap allocations are taken from the String stand-in (sim_heap), so they
+// show what the same code costs on the ESP32 heap.
+#include <stdint.h>
+#include <stddef.h>
+
+class BenchState
+{
+public:
+  // Returns true while the loop body should run once more
+  bool keepRunning();
+  // Bytes processed per iteration, reported as MB/s
+  void setBytesPerOp(size_t bytes) { bytesPerOp = bytes; }
+
+  uint64_t iterations = 0;
+  uint64_t elapsedNs = 0;
+  uint64_t cycles = 0;
+  uint32_t allocs = 0;
+  uint64_t heapBytes = 0;
+  size_t bytesPerOp = 0;
+
+private:
+  bool started = false;
+  uint64_t startNs = 0;
+  uint64_t startCycles = 0;
+  uint32_t startAllocs = 0;
+  uint64_t startHeapBytes = 0;
+  uint64_t budgetNs = 0;
+};
+
+typedef void (*BenchFunction)(BenchState &state);
+
+class BenchRegistrar
+{
+public:
+  BenchRegistrar(const char *name, BenchFunction fn);
+};
+
+#define BENCH(name)                                           \
+  static void name(BenchState &state);                        \
+  static BenchRegistrar name##_registrar(#name, name);        \
+  static void name(BenchState &state)
+
+// Keep the compiler from dropping a result
+template <typename T>
+inline void bench_do_not_optimize(const T &value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
@@ -0,0 +1,119 @@
+// Per-frame integrity check cost: the byte sum used today against the
+// table driven CRC-16 from lora_checksum.h (and its bitwise reference).
+#include "bench.h"
+
+#include <string.h>
+
+#include "communication.h"
+#include "lora_checksum.h"
+#include "lora_frame.h"
+
+static lora_payload_t benchPayload()
+{
+  lora_payload_t payload;
+  payload.messageID = 42;
+  payload.lora_eventID = LORA_EVENT_RESUME_SLEEP_MODE;
+  payload.elapsed_time_ms = 123456;
+  payload.pulse_count = 17;
+  payload.checksum = 0;
+  return payload;
+}
+
+static lora_config_payload_t benchConfig()
+{
+  lora_config_payload_t config;
+  memset(&config, 0, sizeof(config));
+  config.messageID = 7;
+  config.lora_eventID = LORA_EVENT_SET_CONFIG;
+  config.ulp_pulses_to_wake_up = 12;
+  config.wakeup_interval_sec = 60;
+  config.shutdown_delay_ms = 1000;
+  config.lora_receive_delay_ms = 500;
+  return config;
+}
+
+BENCH(checksum_payload_sum)
+{
+  lora_payload_t payload = benchPayload();
+  state.setBytesPerOp(sizeof(payload) - sizeof(uint16_t));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(payload);
+    uint16_t sum = lora_payload_checksum(&payload);
+    bench_do_not_optimize(sum);
+  }
+}
+
+BENCH(checksum_payload_crc16)
+{
+  lora_payload_t payload = benchPayload();
+  state.setBytesPerOp(sizeof(payload) - sizeof(uint16_t));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(payload);
+    uint16_t crc = lora_crc16((const uint8_t *)&payload, sizeof(payload) - sizeof(uint16_t));
+    bench_do_not_optimize(crc);
+  }
+}
+
+BENCH(checksum_config_macro)
+{
+  lora_config_payload_t config = benchConfig();
+  state.setBytesPerOp(sizeof(config) - sizeof(uint16_t));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(config);
+    uint16_t sum = LORA_CALCULATE_CHECKSUM(&config, lora_config_payload_t);
+    bench_do_not_optimize(sum);
+  }
+}
+
+BENCH(checksum_config_crc16)
+{
+  lora_config_payload_t config = benchConfig();
+  state.setBytesPerOp(sizeof(config) - sizeof(uint16_t));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(config);
+    uint16_t crc = lora_crc16((const uint8_t *)&config, sizeof(config) - sizeof(uint16_t));
+    bench_do_not_optimize(crc);
+  }
+}
+
+// Largest payload that fits into one E32 packet
+static uint8_t maxPayload[LORA_MAX_PAYLOAD_SIZE];
+
+BENCH(checksum_max_sum)
+{
+  for (size_t i = 0; i < sizeof(maxPayload); ++i)
+    maxPayload[i] = (uint8_t)(i * 37);
+  state.setBytesPerOp(sizeof(maxPayload));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(maxPayload);
+    uint16_t sum = lora_sum16(maxPayload, sizeof(maxPayload));
+    bench_do_not_optimize(sum);
+  }
+}
+
+BENCH(checksum_max_crc16)
+{
+  state.setBytesPerOp(sizeof(maxPayload));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(maxPayload);
+    uint16_t crc = lora_crc16(maxPayload, sizeof(maxPayload));
+    bench_do_not_optimize(crc);
+  }
+}
+
+BENCH(checksum_max_crc16_bitwise)
+{
+  state.setBytesPerOp(sizeof(maxPayload));
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(maxPayload);
+    uint16_t crc = lora_crc16_bitwise(maxPayload, sizeof(maxPayload));
+    bench_do_not_optimize(crc);
+  }
+}
@@ -0,0 +1,92 @@
+// Compact delta frames (lora_delta.h) for 3 readings against the plain
+// messages packed into a lora_batch.h frame: CPU per frame on the
+// sensor and bridge side. Bytes per op are the frame length on air.
+#include "bench.h"
+
+#include <string.h>
+
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+#include "lora_delta.h"
+
+static const size_t READINGS = 3;
+
+static void benchReadings(lora_payload_t *readings, uint16_t firstID)
+{
+  uint32_t elapsed = 3600000;
+  uint32_t pulses = 1000;
+  for (size_t i = 0; i < READINGS + 1; ++i)
+  {
+    readings[i] = lora_message_init<LORA_EVENT_SENSOR_DATA>((uint16_t)(firstID + i));
+    elapsed += 60000 + 17 * i;
+    pulses += 3;
+    readings[i].elapsed_time_ms = elapsed;
+    readings[i].pulse_count = pulses;
+    readings[i].checksum = lora_message_checksum(&readings[i]);
+  }
+}
+
+BENCH(delta_encode_3)
+{
+  static lora_payload_t readings[READINGS + 1];
+  benchReadings(readings, 100);
+  static lora_frame_t frame;
+  LoraDeltaEncoder encoder;
+  encoder.begin(0);
+  encoder.encode(&frame, readings, 1);
+  encoder.acked();
+  state.setBytesPerOp(READINGS * sizeof(lora_payload_t));
+  while (state.keepRunning())
+  {
+    size_t n = encoder.encode(&frame, readings + 1, READINGS);
+    bench_do_not_optimize(n);
+  }
+}
+
+BENCH(delta_decode_3)
+{
+  static lora_payload_t readings[READINGS + 1];
+  benchReadings(readings, 100);
+  static lora_frame_t frame;
+  LoraDeltaEncoder encoder;
+  encoder.begin(0);
+  encoder.encode(&frame, readings, 1);
+  encoder.acked();
+  encoder.encode(&frame, readings + 1, READINGS);
+  static LoraFrameDecoder frameDecoder;
+  frameDecoder.acceptVariable(LORA_EVENT_SENSOR_DELTA, LORA_DELTA_LENGTH_OFFSET);
+  for (size_t i = 0; i < frame.len; ++i)
+    frameDecoder.push(frame.data[i]);
+  const uint8_t *payload = frameDecoder.payload();
+  size_t len = frameDecoder.length();
+  LoraDeltaDecoder decoder;
+  decoder.remember(readings[0]);
+  static lora_payload_t out[LORA_DELTA_MAX_READINGS];
+  state.setBytesPerOp(READINGS * sizeof(lora_payload_t));
+  while (state.keepRunning())
+  {
+    // Put the base back as newest entry for the next round
+    size_t n = decoder.decode(payload, len, out, LORA_DELTA_MAX_READINGS);
+    decoder.remember(readings[0]);
+    bench_do_not_optimize(n);
+  }
+}
+
+BENCH(batch_encode_3)
+{
+  static lora_payload_t readings[READINGS + 1];
+  benchReadings(readings, 100);
+  static lora_frame_t frame;
+  LoraBatchWriter batch;
+  batch.begin(0);
+  state.setBytesPerOp(READINGS * sizeof(lora_payload_t));
+  while (state.keepRunning())
+  {
+    for (size_t i = 1; i <= READINGS; ++i)
+      batch.add(readings[i], 0);
+    size_t n = batch.flush(&frame, 1);
+    bench_do_not_optimize(n);
+  }
+}
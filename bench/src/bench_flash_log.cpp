@@ -0,0 +1,105 @@
+// Store-and-forward log of the bridge (lora_flash_log.h) on a host file:
+// one op is one received message (received_ms + lora_payload_t) appended,
+// or read back and checked on replay. Block writes go through stdio to
+// the page cache, so this is the CPU cost of the log itself (copy, CRC-32)
+// plus the host's file calls; on the ESP32 the 4 KB sector erase and
+// program come on top, about 50 ms per block.
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_flash_log.h"
+
+// The fs::File calls the log uses, on a stdio temporary file
+class BenchFile
+{
+public:
+  BenchFile() : file(tmpfile()) {}
+  ~BenchFile() { fclose(file); }
+  bool seek(uint32_t pos) { return fseek(file, (long)pos, SEEK_SET) == 0; }
+  size_t read(uint8_t *buf, size_t size) { return fread(buf, 1, size, file); }
+  size_t write(const uint8_t *buf, size_t size) { return fwrite(buf, 1, size, file); }
+  void flush() {}
+  size_t size()
+  {
+    long at = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    fseek(file, at, SEEK_SET);
+    return (size_t)end;
+  }
+
+private:
+  FILE *file;
+};
+
+static const uint32_t BLOCKS = 256;
+
+static void benchEntry(uint8_t *entry, uint32_t i)
+{
+  lora_payload_t payload = {};
+  payload.messageID = (uint16_t)i;
+  payload.elapsed_time_ms = i * 60000;
+  payload.pulse_count = i;
+  memcpy(entry, &i, sizeof(i));
+  memcpy(entry + sizeof(i), &payload, sizeof(payload));
+}
+
+BENCH(flash_log_append)
+{
+  BenchFile data, cursor;
+  static LoraFlashLog<BenchFile> log;
+  log.begin(&data, &cursor, BLOCKS);
+  uint8_t entry[sizeof(uint32_t) + sizeof(lora_payload_t)];
+  uint32_t i = 0;
+  state.setBytesPerOp(sizeof(entry));
+  while (state.keepRunning())
+  {
+    benchEntry(entry, i++);
+    log.append(entry, sizeof(entry));
+  }
+  bench_do_not_optimize(log.writes);
+}
+
+BENCH(flash_log_replay)
+{
+  BenchFile data, cursor;
+  static LoraFlashLog<BenchFile> log;
+  log.begin(&data, &cursor, BLOCKS);
+  uint8_t entry[sizeof(uint32_t) + sizeof(lora_payload_t)];
+  // A full ring, replayed over and over: once it is done the cursor is
+  // wiped and begin() scans the ring again, like after a reset
+  for (uint32_t i = 0; log.backlog() < BLOCKS; ++i)
+  {
+    benchEntry(entry, i);
+    log.append(entry, sizeof(entry));
+  }
+  log.flush();
+  const uint8_t noCursor[sizeof(lora_flash_cursor_t)] = {};
+  state.setBytesPerOp(sizeof(entry));
+  const uint8_t *block = NULL;
+  LoraFlashRecordReader reader(entry);
+  uint32_t sum = 0;
+  while (state.keepRunning())
+  {
+    const uint8_t *record;
+    size_t len;
+    while (block == NULL || !reader.next(&record, &len))
+    {
+      if (block != NULL)
+        log.pop();
+      if ((block = log.front()) == NULL)
+      {
+        cursor.seek(0);
+        cursor.write(noCursor, sizeof(noCursor));
+        log.begin(&data, &cursor, BLOCKS);
+        block = log.front();
+      }
+      reader = LoraFlashRecordReader(block);
+    }
+    sum += record[sizeof(uint32_t)];
+  }
+  bench_do_not_optimize(sum);
+}
@@ -0,0 +1,283 @@
+// Frame assembly before/after: String byte-by-byte packing as in
+// LoraSender V0.15 against lora_frame_encode() into a static buffer, and
+// the streaming LoraFrameDecoder. Build with -D LORA_FRAMING=1 for COBS.
+// The answer_ cases assemble the bridge's ACK frame the way
+// sendAckMessage() of LoraSender does, alone and with what the build
+// options put into the batch with it.
+#include "bench.h"
+
+#include <string.h>
+
+#include "WString.h"
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_checksum.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+#include "lora_time_sync.h"
+
+static lora_payload_t benchPayload()
+{
+  lora_payload_t payload;
+  payload.messageID = 42;
+  payload.lora_eventID = LORA_EVENT_RESUME_SLEEP_MODE;
+  payload.elapsed_time_ms = 123456;
+  payload.pulse_count = 17;
+  payload.checksum = lora_message_checksum(&payload);
+  return payload;
+}
+
+static lora_config_payload_t benchConfig()
+{
+  lora_config_payload_t config;
+  memset(&config, 0, sizeof(config));
+  config.messageID = 7;
+  config.lora_eventID = LORA_EVENT_SET_CONFIG;
+  config.ulp_pulses_to_wake_up = 12;
+  config.wakeup_interval_sec = 60;
+  config.shutdown_delay_ms = 1000;
+  config.lora_receive_delay_ms = 500;
+  config.checksum = lora_message_checksum(&config);
+  return config;
+}
+
+// Old sendAckMessage()/sendConfigMessage() packing
+template <typename T>
+static void packString(const T &payload)
+{
+  String msg;
+  msg.reserve(sizeof(payload) + 2);
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(&payload);
+  for (size_t i = 0; i < sizeof(payload); ++i)
+  {
+    msg += (char)p[i];
+  }
+  msg += (char)E32_MSG_DELIMITER_1;
+  msg += (char)E32_MSG_DELIMITER_2;
+  bench_do_not_optimize(msg);
+}
+
+BENCH(frame_ack_string)
+{
+  lora_payload_t payload = benchPayload();
+  state.setBytesPerOp(sizeof(payload) + E32_MSG_DELIMITER_LEN);
+  while (state.keepRunning())
+    packString(payload);
+}
+
+BENCH(frame_ack_encode)
+{
+  lora_payload_t payload = benchPayload();
+  static lora_frame_t frame;
+  state.setBytesPerOp(sizeof(payload) + E32_MSG_DELIMITER_LEN);
+  while (state.keepRunning())
+  {
+    lora_frame_encode(&frame, payload);
+    bench_do_not_optimize(frame);
+  }
+}
+
+BENCH(frame_config_string)
+{
+  lora_config_payload_t config = benchConfig();
+  state.setBytesPerOp(sizeof(config) + E32_MSG_DELIMITER_LEN);
+  while (state.keepRunning())
+    packString(config);
+}
+
+BENCH(frame_config_encode)
+{
+  lora_config_payload_t config = benchConfig();
+  static lora_frame_t frame;
+  state.setBytesPerOp(sizeof(config) + E32_MSG_DELIMITER_LEN);
+  while (state.keepRunning())
+  {
+    lora_frame_encode(&frame, config);
+    bench_do_not_optimize(frame);
+  }
+}
+
+// Old receive path: readString() grows a String per byte, then memcpy
+BENCH(frame_rx_string)
+{
+  static lora_frame_t frame;
+  lora_frame_encode(&frame, benchPayload());
+  state.setBytesPerOp(frame.len);
+  while (state.keepRunning())
+  {
+    String data;
+    for (size_t i = 0; i < frame.len; ++i)
+      data += (char)frame.data[i];
+    lora_payload_t payload;
+    if (data.length() == sizeof(lora_payload_t) + 2)
+      memcpy(&payload, data.c_str(), sizeof(lora_payload_t));
+    bench_do_not_optimize(payload);
+  }
+}
+
+BENCH(frame_rx_decode)
+{
+  static lora_frame_t frame;
+  lora_frame_encode(&frame, benchPayload());
+  state.setBytesPerOp(frame.len);
+  while (state.keepRunning())
+  {
+    lora_payload_t payload;
+    lora_frame_decode(frame.data, frame.len, &payload);
+    bench_do_not_optimize(payload);
+  }
+}
+
+// Streaming decoder fed byte by byte as from the UART, both framings
+BENCH(frame_rx_stream)
+{
+  static lora_frame_t frame;
+  lora_frame_encode(&frame, benchPayload());
+  static LoraFrameDecoder decoder;
+  decoder.accept(sizeof(lora_payload_t));
+  state.setBytesPerOp(frame.len);
+  while (state.keepRunning())
+  {
+    for (size_t i = 0; i < frame.len; ++i)
+    {
+      if (decoder.push(frame.data[i]))
+        bench_do_not_optimize(decoder.payload()[0]);
+    }
+  }
+}
+
+// A frame behind 200 bytes of noise: the decoder's buffer is full for
+// most of it and drops the oldest byte with each new one
+BENCH(frame_rx_after_garbage)
+{
+  static uint8_t wire[200 + E32_MAX_PACKET_SIZE];
+  static lora_frame_t frame;
+  lora_frame_encode(&frame, benchPayload());
+  for (size_t i = 0; i < 200; ++i)
+    wire[i] = (uint8_t)(i * 37 + 11);
+  memcpy(wire + 200, frame.data, frame.len);
+  size_t len = 200 + frame.len;
+  static LoraFrameDecoder decoder;
+  decoder.accept(sizeof(lora_payload_t));
+  state.setBytesPerOp(len);
+  while (state.keepRunning())
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      if (decoder.push(wire[i]))
+        bench_do_not_optimize(decoder.payload()[0]);
+    }
+  }
+}
+
+BENCH(frame_cobs_encode)
+{
+  static uint8_t out[E32_MAX_PACKET_SIZE];
+  lora_payload_t payload = benchPayload();
+  state.setBytesPerOp(sizeof(payload));
+  while (state.keepRunning())
+  {
+    size_t len = lora_cobs_encode((const uint8_t *)&payload, sizeof(payload), out, sizeof(out));
+    bench_do_not_optimize(len);
+  }
+}
+
+// sendAckMessage() without CONFIG_SYNC, LINK_ADAPT or TIME_SYNC
+BENCH(answer_ack)
+{
+  static lora_frame_t frame;
+  uint16_t id = 0;
+  while (state.keepRunning())
+  {
+    lora_payload_t payload = lora_message_init<LORA_EVENT_RESUME_SLEEP_MODE>(id++);
+    payload.elapsed_time_ms = 123456;
+    payload.pulse_count = 17;
+    lora_message_encode(&frame, &payload);
+    bench_do_not_optimize(frame);
+  }
+  state.setBytesPerOp(frame.len);
+}
+
+// With one of those options built in but nothing to add: the ACK goes
+// through the batch and out as the plain message
+BENCH(answer_ack_batch)
+{
+  static lora_frame_t frame;
+  uint16_t id = 0;
+  while (state.keepRunning())
+  {
+    LoraBatchWriter batch;
+    batch.begin(0);
+    lora_payload_t payload = lora_message_init<LORA_EVENT_RESUME_SLEEP_MODE>(id++);
+    payload.elapsed_time_ms = 123456;
+    payload.pulse_count = 17;
+    payload.checksum = lora_message_checksum(&payload);
+    batch.add(payload, 0);
+    batch.flush(&frame, id++);
+    bench_do_not_optimize(frame);
+  }
+  state.setBytesPerOp(frame.len);
+}
+
+// CONFIG_SYNC: the config along with the ACK
+BENCH(answer_ack_config)
+{
+  static lora_frame_t frame;
+  lora_config_payload_t config = benchConfig();
+  uint16_t id = 0;
+  while (state.keepRunning())
+  {
+    LoraBatchWriter batch;
+    batch.begin(0);
+    lora_payload_t payload = lora_message_init<LORA_EVENT_RESUME_SLEEP_MODE>(id++);
+    payload.elapsed_time_ms = 123456;
+    payload.pulse_count = 17;
+    payload.checksum = lora_message_checksum(&payload);
+    batch.add(payload, 0);
+    if (batch.fits(sizeof(config)))
+    {
+      config.messageID = id++;
+      config.checksum = lora_message_checksum(&config);
+      batch.add(config, 0);
+    }
+    batch.flush(&frame, id++);
+    bench_do_not_optimize(frame);
+  }
+  state.setBytesPerOp(frame.len);
+}
+
+// TIME_SYNC: the clock sync along with the ACK
+BENCH(answer_ack_time_sync)
+{
+  static lora_frame_t frame;
+  lora_clock_t clock;
+  memset(&clock, 0, sizeof(clock));
+  clock.samples = 3;
+  clock.offsetMs = 1500;
+  clock.sampleMs = 980000;
+  clock.driftPpm = -120;
+  clock.answerDelayMs = 40;
+  uint16_t id = 0;
+  uint32_t rxEndMs = 1000000;
+  while (state.keepRunning())
+  {
+    LoraBatchWriter batch;
+    batch.begin(0);
+    lora_payload_t payload = lora_message_init<LORA_EVENT_RESUME_SLEEP_MODE>(id++);
+    payload.elapsed_time_ms = rxEndMs + 3;
+    payload.pulse_count = 17;
+    payload.checksum = lora_message_checksum(&payload);
+    batch.add(payload, 0);
+    if (batch.fits(sizeof(lora_time_payload_t)))
+    {
+      lora_time_payload_t syncMsg = lora_message_init<LORA_EVENT_TIME_SYNC>(id++);
+      lora_time_fill(&clock, &syncMsg, rxEndMs, 25);
+      syncMsg.checksum = lora_message_checksum(&syncMsg);
+      batch.add(syncMsg, 0);
+    }
+    batch.flush(&frame, id++);
+    bench_do_not_optimize(frame);
+    rxEndMs += 20000;
+  }
+  state.setBytesPerOp(frame.len);
+}
@@ -0,0 +1,134 @@
+// Console output per bridge exchange (received payload + sent ACK):
+// the Serial.print chains of LoraSender V0.21 against lora_log.h records.
+// The print cases write to a byte counting Print, so they show the CPU
+// cost only; on the device every byte also occupies the console UART.
+// The record case includes the drain into the binary wire format (a
+// flush every 8 exchanges), so it is an upper bound for what the radio
+// task pays.
+#include "bench.h"
+
+#include <string.h>
+
+#include <Arduino.h>
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_log.h"
+
+class CountingPrint : public Print
+{
+public:
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    bytes += size;
+    bench_do_not_optimize(buffer);
+    return size;
+  }
+  uint64_t bytes = 0;
+};
+
+static CountingPrint console;
+
+static lora_payload_t benchPayload()
+{
+  lora_payload_t payload = lora_message_init<LORA_EVENT_SENSOR_DATA>(42);
+  payload.elapsed_time_ms = 123456;
+  payload.pulse_count = 17;
+  payload.checksum = lora_message_checksum(&payload);
+  return payload;
+}
+
+// Old printPayloadHex()
+static void printPayloadHex(const lora_frame_t &ack)
+{
+  console.print("Payload [");
+  console.print((unsigned)ack.len);
+  console.println(" bytes]:");
+  for (size_t i = 0; i < ack.len; i++)
+  {
+    if (ack.data[i] < 0x10)
+      console.print('0');
+    console.print(ack.data[i], HEX);
+    console.print(' ');
+  }
+  console.println();
+}
+
+// Old printReceivedPayload() / printRecord(RECORD_TX_ACK) / printPayloadHex()
+static void printExchange(const lora_payload_t &payload, const lora_frame_t &ack)
+{
+  const lora_message_info_t *info = lora_message_find(payload.lora_eventID);
+  lora_msg_status_t status = lora_message_validate(info, &payload, sizeof(payload));
+  lora_message_print(console, *info, &payload);
+  console.print("Message valid: ");
+  console.println(lora_msg_status_name(status));
+
+  console.println("Hi, I'm going to send message!");
+  console.print("message sent: ");
+  printPayloadHex(ack);
+  console.println("Message sent. Waiting for next receive...");
+}
+
+static void logExchange(const lora_payload_t &payload, const lora_frame_t &ack)
+{
+  lora_msg_status_t status = lora_message_validate(lora_message_find(payload.lora_eventID), &payload, sizeof(payload));
+  LORA_LOG_INFO(LOGF_RX_PAYLOAD, payload.messageID, payload.lora_eventID, payload.elapsed_time_ms,
+                payload.pulse_count, payload.checksum, status);
+  LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_ACK, ack.data, ack.len);
+}
+
+static lora_frame_t benchAck()
+{
+  lora_payload_t ack = lora_message_init<LORA_EVENT_RESUME_SLEEP_MODE>(42);
+  ack.elapsed_time_ms = 123789;
+  lora_frame_t frame;
+  lora_message_encode(&frame, &ack);
+  return frame;
+}
+
+BENCH(log_exchange_print)
+{
+  lora_payload_t payload = benchPayload();
+  lora_frame_t ack = benchAck();
+  while (state.keepRunning())
+    printExchange(payload, ack);
+}
+
+BENCH(log_exchange_record)
+{
+  lora_payload_t payload = benchPayload();
+  lora_frame_t ack = benchAck();
+  lora_log_begin(console, false);
+  uint32_t n = 0;
+  while (state.keepRunning())
+  {
+    logExchange(payload, ack);
+    if (++n % (LORA_LOG_SLOTS / 4) == 0)
+      lora_log_flush();
+  }
+  lora_log_flush();
+}
+
+// The hex dump of the sent ACK alone, printed or as a data record
+BENCH(log_ack_hex_print)
+{
+  lora_frame_t ack = benchAck();
+  state.setBytesPerOp(ack.len);
+  while (state.keepRunning())
+    printPayloadHex(ack);
+}
+
+BENCH(log_ack_hex_record)
+{
+  lora_frame_t ack = benchAck();
+  state.setBytesPerOp(ack.len);
+  lora_log_begin(console, false);
+  uint32_t n = 0;
+  while (state.keepRunning())
+  {
+    LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_ACK, ack.data, ack.len);
+    if (++n % (LORA_LOG_SLOTS / 4) == 0)
+      lora_log_flush();
+  }
+  lora_log_flush();
+}
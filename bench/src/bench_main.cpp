@@ -0,0 +1,146 @@
+#include "bench.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "WString.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t benchCycles() { return __rdtsc(); }
+#else
+static inline uint64_t benchCycles() { return 0; }
+#endif
+
+struct BenchCase
+{
+  const char *name;
+  BenchFunction fn;
+};
+
+static std::vector<BenchCase> &benchCases()
+{
+  static std::vector<BenchCase> cases;
+  return cases;
+}
+
+static uint64_t benchNowNs()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static uint64_t benchMinTimeNs = 200000000ULL;
+
+BenchRegistrar::BenchRegistrar(const char *name, BenchFunction fn)
+{
+  benchCases().push_back(BenchCase{name, fn});
+}
+
+bool BenchState::keepRunning()
+{
+  if (!started)
+  {
+    started = true;
+    budgetNs = benchMinTimeNs;
+    startAllocs = sim_heap.allocs;
+    startHeapBytes = sim_heap.bytes;
+    startCycles = benchCycles();
+    startNs = benchNowNs();
+    return true;
+  }
+  ++iterations;
+  // Check the clock only every 1024 iterations
+  if ((iterations & 1023) != 0)
+    return true;
+  uint64_t now = benchNowNs();
+  if (now - startNs < budgetNs)
+    return true;
+  cycles = benchCycles() - startCycles;
+  elapsedNs = now - startNs;
+  allocs = sim_heap.allocs - startAllocs;
+  heapBytes = sim_heap.bytes - startHeapBytes;
+  return false;
+}
+
+struct BenchResult
+{
+  const char *name;
+  uint64_t iterations;
+  double nsPerOp;
+  double cyclesPerOp;
+  double allocsPerOp;
+  double heapBytesPerOp;
+  double bytesPerSec;
+};
+
+// BENCH_OUTPUT: one row per case, JSON if the name ends in .json, else CSV.
+// BENCH_LABEL (e.g. the commit) goes into every row, so the files of two
+// builds can be put side by side (tools/bench_compare).
+static bool writeResults(const char *path, const char *label, const std::vector<BenchResult> &results)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+    return false;
+  size_t len = strlen(path);
+  bool json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+  if (json)
+    fprintf(f, "{\"label\": \"%s\", \"min_time_ms\": %llu, \"benchmarks\": [\n", label,
+            (unsigned long long)(benchMinTimeNs / 1000000ULL));
+  else
+    fprintf(f, "label,benchmark,iterations,ns_per_op,cycles_per_op,allocs_per_op,heap_bytes_per_op,bytes_per_sec\n");
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    const BenchResult &r = results[i];
+    if (json)
+      fprintf(f, "  {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"cycles_per_op\": %.2f, "
+                 "\"allocs_per_op\": %.3f, \"heap_bytes_per_op\": %.1f, \"bytes_per_sec\": %.0f}%s\n",
+              r.name, (unsigned long long)r.iterations, r.nsPerOp, r.cyclesPerOp, r.allocsPerOp,
+              r.heapBytesPerOp, r.bytesPerSec, i + 1 < results.size() ? "," : "");
+    else
+      fprintf(f, "%s,%s,%llu,%.2f,%.2f,%.3f,%.1f,%.0f\n", label, r.name, (unsigned long long)r.iterations,
+              r.nsPerOp, r.cyclesPerOp, r.allocsPerOp, r.heapBytesPerOp, r.bytesPerSec);
+  }
+  if (json)
+    fprintf(f, "]}\n");
+  return fclose(f) == 0;
+}
+
+int main()
+{
+  if (const char *v = getenv("BENCH_MIN_TIME_MS"))
+    benchMinTimeNs = (uint64_t)atoi(v) * 1000000ULL;
+  // Only the cases whose name contains this
+  const char *filter = getenv("BENCH_FILTER");
+  const char *label = getenv("BENCH_LABEL");
+
+  std::vector<BenchResult> results;
+  printf("%-36s %12s %10s %10s %10s %10s %10s\n", "benchmark", "iterations", "ns/op", "cycles/op", "allocs/op", "heapB/op", "MB/s");
+  for (const BenchCase &c : benchCases())
+  {
+    if (filter != NULL && strstr(c.name, filter) == NULL)
+      continue;
+    BenchState state;
+    c.fn(state);
+    double n = state.iterations ? (double)state.iterations : 1.0;
+    double nsPerOp = state.elapsedNs / n;
+    BenchResult r = {c.name, state.iterations, nsPerOp, state.cycles / n, state.allocs / n, state.heapBytes / n,
+                     state.bytesPerOp && nsPerOp > 0 ? state.bytesPerOp * 1e9 / nsPerOp : 0.0};
+    printf("%-36s %12llu %10.1f %10.1f %10.2f %10.1f %10.1f\n", r.name,
+           (unsigned long long)r.iterations, r.nsPerOp, r.cyclesPerOp,
+           r.allocsPerOp, r.heapBytesPerOp, r.bytesPerSec / 1e6);
+    results.push_back(r);
+  }
+
+  const char *output = getenv("BENCH_OUTPUT");
+  if (output != NULL && !writeResults(output, label ? label : "", results))
+  {
+    fprintf(stderr, "cannot write %s\n", output);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Codec cost per message type of LORA_MESSAGE_LIST, so a change to the
+// registry, the checksum or the framing shows which messages it moves:
+//   msg_<NAME>_checksum  lora_message_checksum()
+//   msg_<NAME>_encode    checksum + frame (lora_message_encode())
+//   msg_<NAME>_decode    lookup, length, checksum and ranges (lora_message_decode())
+//   msg_<NAME>_print     lora_message_print() to a byte counting sink
+// Bytes per op are the payload's, the frame's for encode.
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+#include "lora_batch.h"
+
+struct CountingOut
+{
+  void println(const char *line)
+  {
+    bytes += strlen(line) + 2;
+    bench_do_not_optimize(line);
+  }
+  uint64_t bytes = 0;
+};
+
+static CountingOut out;
+
+// Every field in its valid range (mid-range) or a value of its size, so
+// decode checks all of them and print formats real numbers
+template <uint16_t EventID>
+static typename LoraMessage<EventID>::type benchMessage()
+{
+  typename LoraMessage<EventID>::type msg = lora_message_init<EventID>(42);
+  const lora_message_info_t *info = lora_message_find(EventID);
+  for (uint8_t i = 0; i < info->fieldCount; ++i)
+  {
+    const lora_field_t &field = info->fields[i];
+    if (field.offset < 4 || field.offset + field.size == sizeof(msg))
+      continue;
+    uint32_t value = field.min <= field.max ? field.min + (field.max - field.min) / 2 : 123456789u;
+    memcpy((uint8_t *)&msg + field.offset, &value, field.size); // little endian
+  }
+  msg.checksum = lora_message_checksum(&msg);
+  return msg;
+}
+
+#define BENCH_MESSAGE(event, name, type, fields)                                    \
+  BENCH(msg_##name##_checksum)                                                      \
+  {                                                                                 \
+    type msg = benchMessage<event>();                                               \
+    state.setBytesPerOp(sizeof(msg));                                               \
+    while (state.keepRunning())                                                     \
+    {                                                                               \
+      bench_do_not_optimize(msg);                                                   \
+      uint16_t checksum = lora_message_checksum(&msg);                              \
+      bench_do_not_optimize(checksum);                                              \
+    }                                                                               \
+  }                                                                                 \
+  BENCH(msg_##name##_encode)                                                        \
+  {                                                                                 \
+    type msg = benchMessage<event>();                                               \
+    static lora_frame_t frame;                                                      \
+    state.setBytesPerOp(lora_message_encode(&frame, &msg));                         \
+    while (state.keepRunning())                                                     \
+    {                                                                               \
+      bench_do_not_optimize(msg);                                                   \
+      lora_message_encode(&frame, &msg);                                            \
+      bench_do_not_optimize(frame);                                                 \
+    }                                                                               \
+  }                                                                                 \
+  BENCH(msg_##name##_decode)                                                        \
+  {                                                                                 \
+    type msg = benchMessage<event>();                                               \
+    state.setBytesPerOp(sizeof(msg));                                               \
+    if (lora_message_validate(lora_message_find(event), &msg, sizeof(msg)) != LORA_MSG_OK) \
+      fprintf(stderr, "msg_" #name "_decode: sample message not valid\n");         \
+    while (state.keepRunning())                                                     \
+    {                                                                               \
+      bench_do_not_optimize(msg);                                                   \
+      const lora_message_info_t *info;                                              \
+      lora_msg_status_t status = lora_message_decode((const uint8_t *)&msg, sizeof(msg), &info); \
+      bench_do_not_optimize(status);                                                \
+    }                                                                               \
+  }                                                                                 \
+  BENCH(msg_##name##_print)                                                         \
+  {                                                                                 \
+    type msg = benchMessage<event>();                                               \
+    const lora_message_info_t *info = lora_message_find(event);                     \
+    state.setBytesPerOp(sizeof(msg));                                               \
+    while (state.keepRunning())                                                     \
+      lora_message_print(out, *info, &msg);                                         \
+  }
+LORA_MESSAGE_LIST(BENCH_MESSAGE)
+#undef BENCH_MESSAGE
+
+// The old format_time(): hh:mm:ss of an elapsed_time_ms, as printed per
+// received reading
+BENCH(msg_format_time)
+{
+  uint32_t ms = 123456789u;
+  char line[16];
+  while (state.keepRunning())
+  {
+    bench_do_not_optimize(ms);
+    int hours, minutes, seconds;
+    lora_format_time(ms, &hours, &minutes, &seconds);
+    snprintf(line, sizeof(line), "%02d:%02d:%02d", hours % 100, minutes, seconds);
+    bench_do_not_optimize(line);
+    ms += 997;
+  }
+}
+
+// A batch frame of three readings, unpacked and each message validated
+// as the bridge does per received frame
+BENCH(msg_batch_decode)
+{
+  LoraBatchWriter batch;
+  batch.begin(0);
+  for (uint16_t i = 0; i < 3; ++i)
+  {
+    lora_payload_t reading = benchMessage<LORA_EVENT_SENSOR_DATA>();
+    reading.messageID = 42 + i;
+    reading.checksum = lora_message_checksum(&reading);
+    batch.add(reading, 0);
+  }
+  uint8_t payload[LORA_MAX_PAYLOAD_SIZE];
+  size_t len = batch.take(payload, 41);
+  state.setBytesPerOp(len);
+  while (state.keepRunning())
+  {
+    LoraBatchReader reader(payload, len);
+    const uint8_t *msg;
+    size_t msgLen;
+    while (reader.next(&msg, &msgLen))
+    {
+      const lora_message_info_t *info;
+      lora_msg_status_t status = lora_message_decode(msg, msgLen, &info);
+      bench_do_not_optimize(status);
+    }
+  }
+}
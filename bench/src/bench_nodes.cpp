@@ -0,0 +1,96 @@
+// Per-sensor state lookup on the bridge (lora_nodes.h) with hundreds of
+// nodes: the open addressing table against a linear scan of an array,
+// what keeping a list of sensors would cost. One op is the lookup for one
+// received frame; addresses come in a shuffled order like sensors whose
+// wake-up intervals drift apart.
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_nodes.h"
+
+static const size_t NODES = 500;
+
+static void benchAddresses(uint16_t *addresses, size_t n)
+{
+  // Consecutive addresses from a few blocks, shuffled
+  for (size_t i = 0; i < n; ++i)
+    addresses[i] = (uint16_t)(0x0100 * (1 + i / 100) + i % 100);
+  uint32_t seed = 12345;
+  for (size_t i = n - 1; i > 0; --i)
+  {
+    seed = seed * 1103515245u + 12345u;
+    size_t j = (seed >> 8) % (i + 1);
+    uint16_t t = addresses[i];
+    addresses[i] = addresses[j];
+    addresses[j] = t;
+  }
+}
+
+BENCH(node_lookup_500)
+{
+  static uint16_t addresses[NODES];
+  benchAddresses(addresses, NODES);
+  static LoraNodeTable<1024> table;
+  table.clear();
+  for (size_t i = 0; i < NODES; ++i)
+    table.lookup(addresses[i], 0);
+  size_t i = 0;
+  uint32_t now = 0;
+  while (state.keepRunning())
+  {
+    lora_node_t *node = table.lookup(addresses[i], now++);
+    node->frames++;
+    node->lastSeenMs = now;
+    i = i + 1 < NODES ? i + 1 : 0;
+  }
+  bench_do_not_optimize(table);
+}
+
+BENCH(node_scan_500)
+{
+  static uint16_t addresses[NODES];
+  benchAddresses(addresses, NODES);
+  static lora_node_t list[NODES];
+  static size_t count;
+  count = 0;
+  memset(list, 0, sizeof(list));
+  for (size_t i = 0; i < NODES; ++i)
+    list[count++].address = addresses[i];
+  size_t i = 0;
+  uint32_t now = 0;
+  while (state.keepRunning())
+  {
+    lora_node_t *node = NULL;
+    for (size_t k = 0; k < count && node == NULL; ++k)
+    {
+      if (list[k].address == addresses[i])
+        node = &list[k];
+    }
+    node->frames++;
+    node->lastSeenMs = now++;
+    i = i + 1 < NODES ? i + 1 : 0;
+  }
+  bench_do_not_optimize(list);
+}
+
+// More sensors than the table holds: every lookup of a node not seen for
+// a while evicts the oldest one
+BENCH(node_churn_500_in_256)
+{
+  static uint16_t addresses[NODES];
+  benchAddresses(addresses, NODES);
+  static LoraNodeTable<256> table;
+  table.clear();
+  size_t i = 0;
+  uint32_t now = 0;
+  while (state.keepRunning())
+  {
+    lora_node_t *node = table.lookup(addresses[i], now);
+    node->lastSeenMs = now++;
+    i = i + 1 < NODES ? i + 1 : 0;
+  }
+  bench_do_not_optimize(table);
+}
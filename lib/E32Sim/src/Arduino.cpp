@@ -0,0 +1,114 @@
+#include "Arduino.h"
+
+#include <time.h>
+
+#include "sim_channel.h"
+#include "driver/pcnt.h"
+
+static int auxPin = -1;
+// Interrupts on the other pins, fired by sim_gpio_pulse()
+static void (*pinHandler[GPIO_NUM_MAX])(void);
+static int pinEdgeMode[GPIO_NUM_MAX];
+
+EspClass ESP;
+
+unsigned long millis()
+{
+  return (unsigned long)(sim().now() / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)sim().now();
+}
+
+void delay(uint32_t ms)
+{
+  sim().advance((sim_time_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  sim().advance(us);
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin == auxPin)
+    return sim().auxLevel() ? HIGH : LOW;
+  return HIGH; // inputs are pulled up
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+  if (pin != auxPin)
+  {
+    if (pin < GPIO_NUM_MAX)
+    {
+      pinHandler[pin] = handler;
+      pinEdgeMode[pin] = mode;
+    }
+    return;
+  }
+  sim().auxOnEdge([handler, mode](bool level)
+                  {
+    if (mode == CHANGE || (mode == RISING && level) || (mode == FALLING && !level))
+      handler(); });
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  if (pin == auxPin)
+    sim().auxOnEdge(nullptr);
+  else if (pin < GPIO_NUM_MAX)
+    pinHandler[pin] = nullptr;
+}
+
+void neopixelWrite(uint8_t, uint8_t, uint8_t, uint8_t)
+{
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+  return SIM_CPU_MHZ;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  // Each task is a thread, its CPU time is its own
+  struct timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  uint64_t cpuNs = (uint64_t)cpu.tv_sec * 1000000000ULL + (uint64_t)cpu.tv_nsec;
+  return (uint32_t)(sim().now() * SIM_CPU_MHZ + cpuNs * SIM_CPU_MHZ / 1000);
+}
+
+void sim_gpio_bind_aux(uint8_t pin)
+{
+  auxPin = pin;
+}
+
+void sim_gpio_pulse(uint8_t pin)
+{
+  if (pin >= GPIO_NUM_MAX)
+    return;
+  // Falling, then rising
+  for (bool level : {false, true})
+  {
+    sim_pcnt_edge(pin, level);
+    int mode = pinEdgeMode[pin];
+    if (pinHandler[pin] && (mode == CHANGE || (mode == RISING && level) || (mode == FALLING && !level)))
+      pinHandler[pin]();
+  }
+}
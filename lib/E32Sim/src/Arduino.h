@@ -0,0 +1,84 @@
+#pragma once
+// Host stand-in for the parts of the ESP32 Arduino core the sketches use.
+// Time is virtual, see sim_channel.h.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "WString.h"
+#include "HardwareSerial.h"
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define RGB_BUILTIN 48
+
+#define F(string_literal) (string_literal)
+#define IRAM_ATTR
+// Kept in a section of its own, saved at the end of a run (SIM_RTC_KEEP)
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+
+typedef enum {
+  GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5,
+  GPIO_NUM_6, GPIO_NUM_7, GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11,
+  GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15, GPIO_NUM_16, GPIO_NUM_17,
+  GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20, GPIO_NUM_21, GPIO_NUM_MAX = 49
+} gpio_num_t;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+// Edges come from the AUX pin (sim_gpio_bind_aux) and sim_gpio_pulse()
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+void neopixelWrite(uint8_t pin, uint8_t red, uint8_t green, uint8_t blue);
+
+// CPU clock of an ESP32-S3 at full speed
+#define SIM_CPU_MHZ 240
+uint32_t getCpuFrequencyMhz();
+
+// getCycleCount() counts SIM_CPU_MHZ cycles per µs of virtual time (what
+// blocks: delay(), UART and module waits) plus per µs of host CPU time of
+// the calling task (what computes, free on the virtual clock)
+class EspClass
+{
+public:
+  uint32_t getCycleCount();
+};
+
+extern EspClass ESP;
+
+// Wire a GPIO to the AUX output of the simulated E32 module
+void sim_gpio_bind_aux(uint8_t pin);
+// One low pulse on an input (e.g. the Hall sensor): its interrupts fire,
+// a pulse counter unit on it counts (driver/pcnt.h)
+void sim_gpio_pulse(uint8_t pin);
+
+// Provided by the sketch
+void setup();
+void loop();
@@ -0,0 +1,9 @@
+#pragma once
+// Host stand-in for the Arduino Client interface (TCP connection)
+#include "Arduino.h"
+
+class Client
+{
+public:
+  virtual ~Client() {}
+};
@@ -0,0 +1,52 @@
+#pragma once
+// Host stand-in for the Arduino fs::File API, backed by a stdio file
+#include "Arduino.h"
+#include <memory>
+#include <string>
+
+namespace fs
+{
+
+enum SeekMode
+{
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+class File
+{
+public:
+  File() {}
+  explicit File(FILE *f) : file(f, fclose) {}
+
+  explicit operator bool() const { return file != nullptr; }
+  size_t write(const uint8_t *buf, size_t size);
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t read(uint8_t *buf, size_t size);
+  int read();
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  void flush();
+  void close() { file.reset(); }
+
+private:
+  std::shared_ptr<FILE> file;
+};
+
+class FS
+{
+public:
+  File open(const char *path, const char *mode = "r", bool create = false);
+  bool exists(const char *path);
+  bool remove(const char *path);
+
+protected:
+  std::string dir;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,163 @@
+#include "HardwareSerial.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "sim_channel.h"
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+
+size_t Print::write(const char *str)
+{
+  return str ? write((const uint8_t *)str, strlen(str)) : 0;
+}
+
+size_t Print::printNumber(unsigned long long n, int base)
+{
+  char buf[8 * sizeof(n) + 1];
+  char *p = &buf[sizeof(buf) - 1];
+  *p = 0;
+  if (base < 2)
+    base = 10;
+  do
+  {
+    int digit = (int)(n % base);
+    *--p = (char)(digit < 10 ? '0' + digit : 'A' + digit - 10);
+    n /= base;
+  } while (n);
+  return write(p);
+}
+
+size_t Print::printSigned(long long n, int base)
+{
+  if (base != DEC)
+    return printNumber((uint32_t)n, base); // 32 bit long like the ESP32
+  if (n < 0)
+    return print('-') + printNumber(0ULL - (unsigned long long)n, DEC);
+  return printNumber((unsigned long long)n, DEC);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (n < 0)
+    return 0;
+  return write((const uint8_t *)buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+int Stream::timedRead()
+{
+  const sim_time_t deadline = sim().now() + (sim_time_t)_timeout * 1000;
+  sim().waitUntil(deadline, [this]
+                  { return available() > 0; });
+  return read();
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length)
+  {
+    int c = timedRead();
+    if (c < 0)
+      break;
+    buffer[count++] = (uint8_t)c;
+  }
+  return count;
+}
+
+String Stream::readString()
+{
+  String ret;
+  int c = timedRead();
+  while (c >= 0)
+  {
+    ret += (char)c;
+    c = timedRead();
+  }
+  return ret;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+  String ret;
+  int c = timedRead();
+  while (c >= 0 && c != terminator)
+  {
+    ret += (char)c;
+    c = timedRead();
+  }
+  return ret;
+}
+
+void HardwareSerial::begin(unsigned long b, uint32_t, int8_t, int8_t)
+{
+  baud = b;
+  if (uart == 0)
+    sim().consoleBegin((uint32_t)b);
+  else
+    sim().uartBegin((uint32_t)b);
+}
+
+void HardwareSerial::updateBaudRate(unsigned long b)
+{
+  begin(b);
+}
+
+void HardwareSerial::onReceive(OnReceiveCb function, bool)
+{
+  rxCallback = function;
+  if (uart != 0)
+    sim().uartOnReceive(rxCallback, rxTimeout);
+}
+
+bool HardwareSerial::setRxTimeout(uint8_t symbols_timeout)
+{
+  rxTimeout = symbols_timeout;
+  if (uart != 0)
+    sim().uartOnReceive(rxCallback, rxTimeout);
+  return true;
+}
+
+int HardwareSerial::available()
+{
+  return uart == 0 ? sim().consoleAvailable() : sim().uartAvailable();
+}
+
+int HardwareSerial::read()
+{
+  return uart == 0 ? sim().consoleRead() : sim().uartRead();
+}
+
+int HardwareSerial::peek()
+{
+  return uart == 0 ? sim().consolePeek() : sim().uartPeek();
+}
+
+void HardwareSerial::flush()
+{
+  if (uart != 0)
+    sim().uartDrain();
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  if (uart == 0)
+    sim().consoleWrite(buffer, size);
+  else
+    sim().uartWrite(buffer, size);
+  return size;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define SERIAL_8N1 0x800001c
+
+// Subset of the Arduino Print class
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  size_t write(const char *str);
+
+  size_t print(const char *str) { return write(str); }
+  size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+  size_t print(int n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+  size_t print(long n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+  size_t print(long long n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned long long n, int base = DEC) { return printNumber(n, base); }
+  size_t print(double n, int digits = 2);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T &v) { size_t n = print(v); return n + println(); }
+  template <typename T>
+  size_t println(const T &v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  size_t printNumber(unsigned long long n, int base);
+  size_t printSigned(long long n, int base);
+};
+
+// Subset of the Arduino Stream class with the usual millis() based timeout
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() const { return _timeout; }
+  size_t readBytes(uint8_t *buffer, size_t length);
+  size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+  String readString();
+  String readStringUntil(char terminator);
+
+protected:
+  int timedRead();
+  unsigned long _timeout = 1000;
+};
+
+typedef std::function<void(void)> OnReceiveCb;
+
+// Serial is the USB console, Serial1 the UART wired to the E32 module.
+// Both run on the simulated clock, see sim_channel.h.
+class HardwareSerial : public Stream
+{
+public:
+  explicit HardwareSerial(int uart_nr) : uart(uart_nr) {}
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+  void end() {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  void flush();
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  unsigned long baudRate() const { return baud; }
+  void updateBaudRate(unsigned long baud);
+  // RX event callback, runs after setRxTimeout() idle symbols (Serial1 only)
+  void onReceive(OnReceiveCb function, bool onlyOnTimeout = false);
+  bool setRxTimeout(uint8_t symbols_timeout);
+  operator bool() const { return true; }
+
+private:
+  int uart;
+  unsigned long baud = 0;
+  OnReceiveCb rxCallback;
+  uint8_t rxTimeout = 2;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
@@ -0,0 +1,108 @@
+#include "LittleFS.h"
+
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+
+#include "sim_channel.h"
+
+fs::LittleFSFS LittleFS;
+
+namespace fs
+{
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+  if (!file)
+    return 0;
+  sim().advance((sim_time_t)size * SIM_FLASH_WRITE_US);
+  return fwrite(buf, 1, size, file.get());
+}
+
+size_t File::read(uint8_t *buf, size_t size)
+{
+  if (!file)
+    return 0;
+  size_t n = fread(buf, 1, size, file.get());
+  sim().advance((sim_time_t)n * SIM_FLASH_READ_US);
+  return n;
+}
+
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+  return file && fseek(file.get(), (long)pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+}
+
+size_t File::position() const
+{
+  return file ? (size_t)ftell(file.get()) : 0;
+}
+
+size_t File::size() const
+{
+  if (!file)
+    return 0;
+  long at = ftell(file.get());
+  fseek(file.get(), 0, SEEK_END);
+  long end = ftell(file.get());
+  fseek(file.get(), at, SEEK_SET);
+  return (size_t)end;
+}
+
+void File::flush()
+{
+  if (file)
+    fflush(file.get());
+}
+
+File FS::open(const char *path, const char *mode, bool)
+{
+  std::string m = mode;
+  m += "b";
+  FILE *f = fopen((dir + path).c_str(), m.c_str());
+  return f ? File(f) : File();
+}
+
+bool FS::exists(const char *path)
+{
+  struct stat st;
+  return stat((dir + path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+  return ::remove((dir + path).c_str()) == 0;
+}
+
+bool LittleFSFS::begin(bool, const char *, uint8_t, const char *)
+{
+  // Paths passed to open() start with "/"
+  dir = sim_fs_path("");
+  dir.pop_back();
+  if (!sim_fs_keep())
+    format();
+  return true;
+}
+
+bool LittleFSFS::format()
+{
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return false;
+  while (struct dirent *entry = readdir(d))
+  {
+    // Dot files are the module's EEPROM and RTC memory, not LittleFS
+    if (entry->d_name[0] != '.')
+      ::remove((dir + "/" + entry->d_name).c_str());
+  }
+  closedir(d);
+  return true;
+}
+
+} // namespace fs
@@ -0,0 +1,27 @@
+#pragma once
+// Host stand-in for the ESP32 LittleFS partition. Files live in the host
+// directory SIM_FS_DIR (default .sim_fs), emptied by begin() like a fresh
+// flash unless SIM_FS_KEEP=1, which keeps them across runs (power loss,
+// see sim_fs_path()).
+// Flash writes cost SIM_FLASH_WRITE_US per byte of virtual time (sector
+// erase and program), reads SIM_FLASH_READ_US.
+#include "FS.h"
+
+#define SIM_FLASH_WRITE_US 12
+#define SIM_FLASH_READ_US 1
+
+namespace fs
+{
+
+class LittleFSFS : public FS
+{
+public:
+  bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10,
+             const char *partitionLabel = "spiffs");
+  bool format();
+  size_t totalBytes() { return 3 * 1024 * 1024; }
+};
+
+} // namespace fs
+
+extern fs::LittleFSFS LittleFS;
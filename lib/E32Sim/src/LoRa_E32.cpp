@@ -0,0 +1,339 @@
+#include "LoRa_E32.h"
+
+#include "sim_channel.h"
+
+// Parameters stored in the module; survive for the whole simulation run
+static Configuration moduleConfig;
+
+// Mode switches wait 40 ms plus the AUX/settle time of the real library
+static const uint32_t MODE_SWITCH_MS = 60;
+// Program command round trip (6 bytes out, 6 bytes back at 9600 baud)
+static const uint32_t PROGRAM_COMMAND_MS = 15;
+// Extra time the module needs to persist parameters in its EEPROM
+static const uint32_t EEPROM_SAVE_MS = 40;
+// The module takes program commands at this rate only
+static const uint32_t PROGRAM_BAUD = 9600;
+
+uint32_t e32_uart_baud(uint8_t uartBaudRate)
+{
+  static const uint32_t rates[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200};
+  return rates[uartBaudRate & 0x07];
+}
+
+uint32_t e32_air_rate(uint8_t airDataRate)
+{
+  static const uint32_t rates[] = {300, 1200, 2400, 4800, 9600, 19200, 19200, 19200};
+  return rates[airDataRate & 0x07];
+}
+
+// The module's EEPROM outlives the run with SIM_FS_KEEP
+static void loadModuleConfig()
+{
+  static bool loaded = false;
+  if (loaded)
+    return;
+  loaded = true;
+  if (!sim_fs_keep())
+    return;
+  if (FILE *f = fopen(sim_fs_path(".e32_eeprom").c_str(), "rb"))
+  {
+    Configuration saved;
+    if (fread(&saved, 1, sizeof(saved), f) == sizeof(saved))
+      moduleConfig = saved;
+    fclose(f);
+  }
+}
+
+static void saveModuleConfig()
+{
+  if (FILE *f = fopen(sim_fs_path(".e32_eeprom").c_str(), "wb"))
+  {
+    fwrite(&moduleConfig, 1, sizeof(moduleConfig), f);
+    fclose(f);
+  }
+}
+
+// A program command at another UART rate is garbage to the module
+static bool programBaudOk(HardwareSerial *hs)
+{
+  if (hs->baudRate() == PROGRAM_BAUD)
+    return true;
+  sim().stats().uart_baud_mismatch++;
+  return false;
+}
+
+static void applyModuleConfig()
+{
+  sim().moduleConfigure(e32_air_rate(moduleConfig.SPED.airDataRate),
+                        e32_uart_baud(moduleConfig.SPED.uartBaudRate),
+                        moduleConfig.OPTION.fec == FEC_1_ON,
+                        moduleConfig.OPTION.fixedTransmission == FT_FIXED_TRANSMISSION);
+}
+
+String Speed::getUARTParityDescription()
+{
+  switch (uartParity)
+  {
+  case MODE_01_8O1:
+    return F("8O1");
+  case MODE_10_8E1:
+    return F("8E1");
+  default:
+    return F("8N1 (Default)");
+  }
+}
+
+String Speed::getUARTBaudRate()
+{
+  return String(e32_uart_baud(uartBaudRate)) + F("bps");
+}
+
+String Speed::getAirDataRate()
+{
+  return String(e32_air_rate(airDataRate)) + F("bps");
+}
+
+String Option::getFECDescription()
+{
+  return fec == FEC_1_ON ? F("Turn on Forward Error Correction Switch (Default)") : F("Turn off Forward Error Correction Switch");
+}
+
+String Option::getFixedTransmissionDescription()
+{
+  return fixedTransmission == FT_FIXED_TRANSMISSION ? F("Fixed transmission (first three bytes can be used as high/low address and channel)") : F("Transparent transmission (default)");
+}
+
+String Option::getIODroveModeDescription()
+{
+  return ioDriveMode == IO_D_MODE_PUSH_PULLS_PULL_UPS ? F("TXD, RXD, AUX are push-pulls/pull-ups") : F("TXD, AUX are open-collectors");
+}
+
+String Option::getTransmissionPowerDescription()
+{
+  static const char *power[] = {"30dBm (Default)", "27dBm", "24dBm", "21dBm"};
+  return power[transmissionPower & 0x03];
+}
+
+String Option::getWirelessWakeUPTimeDescription()
+{
+  return String((unsigned int)(wirelessWakeupTime + 1) * 250) + F("ms");
+}
+
+String Configuration::getChannelDescription()
+{
+  return String(CHAN + OPERATING_FREQUENCY) + F("MHz");
+}
+
+String ResponseStatus::getResponseDescription()
+{
+  switch (code)
+  {
+  case E32_SUCCESS:
+    return F("Success");
+  case ERR_E32_TIMEOUT:
+    return F("Timeout!!");
+  case ERR_E32_INVALID_PARAM:
+    return F("Invalid param!");
+  case ERR_E32_DATA_SIZE_NOT_MATCH:
+    return F("Data size not match!");
+  case ERR_E32_PACKET_TOO_BIG:
+    return F("The device support only 58byte of data transmission!");
+  default:
+    return F("Unknown error!");
+  }
+}
+
+LoRa_E32::LoRa_E32(HardwareSerial *serial, UART_BPS_RATE) : hs(serial)
+{
+}
+
+LoRa_E32::LoRa_E32(HardwareSerial *serial, byte aux, UART_BPS_RATE) : hs(serial), auxPin(aux)
+{
+  sim_gpio_bind_aux(aux);
+}
+
+LoRa_E32::LoRa_E32(HardwareSerial *serial, byte aux, byte, byte, UART_BPS_RATE) : hs(serial), auxPin(aux)
+{
+  sim_gpio_bind_aux(aux);
+}
+
+bool LoRa_E32::begin()
+{
+  loadModuleConfig();
+  applyModuleConfig();
+  setMode(MODE_0_NORMAL);
+  return true;
+}
+
+Status LoRa_E32::setMode(MODE_TYPE m)
+{
+  delay(MODE_SWITCH_MS);
+  mode = m;
+  return E32_SUCCESS;
+}
+
+Status LoRa_E32::waitCompleteResponse(unsigned long timeout)
+{
+  unsigned long t = millis();
+  if (auxPin != -1)
+  {
+    while (digitalRead(auxPin) == LOW)
+    {
+      if ((millis() - t) > timeout)
+        return ERR_E32_TIMEOUT;
+      sim().waitForEvent(sim().now() + 1000);
+    }
+  }
+  delay(20);
+  return E32_SUCCESS;
+}
+
+void LoRa_E32::cleanUARTBuffer()
+{
+  while (hs->available())
+    hs->read();
+}
+
+ResponseStructContainer LoRa_E32::getConfiguration()
+{
+  ResponseStructContainer rc;
+  MODE_TYPE prev = mode;
+  setMode(MODE_3_PROGRAM);
+  delay(PROGRAM_COMMAND_MS);
+  rc.data = malloc(sizeof(Configuration));
+  *(Configuration *)rc.data = moduleConfig;
+  ((Configuration *)rc.data)->HEAD = READ_CONFIGURATION;
+  rc.status.code = programBaudOk(hs) ? E32_SUCCESS : ERR_E32_NO_RESPONSE_FROM_DEVICE;
+  setMode(prev);
+  return rc;
+}
+
+ResponseStatus LoRa_E32::setConfiguration(Configuration configuration, PROGRAM_COMMAND saveType)
+{
+  ResponseStatus rs;
+  MODE_TYPE prev = mode;
+  setMode(MODE_3_PROGRAM);
+  delay(PROGRAM_COMMAND_MS);
+  if (!programBaudOk(hs))
+  {
+    rs.code = ERR_E32_NO_RESPONSE_FROM_DEVICE;
+    setMode(prev);
+    return rs;
+  }
+  // SIM_E32_MAX_BAUD: a faster UART rate is not taken, the read-back shows
+  // the old one
+  if (e32_uart_baud(configuration.SPED.uartBaudRate) > sim().config().max_uart_baud)
+    configuration.SPED.uartBaudRate = moduleConfig.SPED.uartBaudRate;
+  if (saveType == WRITE_CFG_PWR_DWN_SAVE)
+  {
+    delay(EEPROM_SAVE_MS);
+    sim().stats().config_writes++;
+  }
+  configuration.HEAD = saveType;
+  moduleConfig = configuration;
+  if (saveType == WRITE_CFG_PWR_DWN_SAVE)
+    saveModuleConfig();
+  applyModuleConfig();
+  rs.code = E32_SUCCESS;
+  setMode(prev);
+  return rs;
+}
+
+ResponseStructContainer LoRa_E32::getModuleInformation()
+{
+  ResponseStructContainer rc;
+  MODE_TYPE prev = mode;
+  setMode(MODE_3_PROGRAM);
+  delay(PROGRAM_COMMAND_MS);
+  ModuleInformation *info = (ModuleInformation *)malloc(sizeof(ModuleInformation));
+  info->HEAD = READ_MODULE_VERSION;
+  info->frequency = 0x45;
+  info->version = 0x14;
+  info->features = 0x0A;
+  rc.data = info;
+  rc.status.code = programBaudOk(hs) ? E32_SUCCESS : ERR_E32_NO_RESPONSE_FROM_DEVICE;
+  setMode(prev);
+  return rc;
+}
+
+ResponseStatus LoRa_E32::resetModule()
+{
+  ResponseStatus rs;
+  setMode(MODE_3_PROGRAM);
+  delay(PROGRAM_COMMAND_MS + 1000);
+  setMode(MODE_0_NORMAL);
+  rs.code = E32_SUCCESS;
+  return rs;
+}
+
+ResponseStatus LoRa_E32::sendMessage(const void *message, const uint8_t size)
+{
+  ResponseStatus status;
+  if (size > MAX_SIZE_TX_PACKET + 2)
+  {
+    status.code = ERR_E32_PACKET_TOO_BIG;
+    return status;
+  }
+  // Like the library: write, wait for AUX, then wait once more for AUX
+  // after the module has taken the packet
+  hs->write((const uint8_t *)message, size);
+  status.code = waitCompleteResponse(1000);
+  if (status.code == E32_SUCCESS)
+    status.code = waitCompleteResponse(1000);
+  return status;
+}
+
+ResponseStatus LoRa_E32::sendFixedMessage(byte ADDH, byte ADDL, byte CHAN, const void *message, const uint8_t size)
+{
+  // Like the library: address and channel in front, one write
+  uint8_t packet[3 + MAX_SIZE_TX_PACKET + 2];
+  if (size > sizeof(packet) - 3)
+  {
+    ResponseStatus status;
+    status.code = ERR_E32_PACKET_TOO_BIG;
+    return status;
+  }
+  packet[0] = ADDH;
+  packet[1] = ADDL;
+  packet[2] = CHAN;
+  memcpy(packet + 3, message, size);
+  return sendMessage(packet, (uint8_t)(3 + size));
+}
+
+ResponseStatus LoRa_E32::sendMessage(const String message)
+{
+  return sendMessage(message.c_str(), (uint8_t)message.length());
+}
+
+ResponseContainer LoRa_E32::receiveMessage()
+{
+  ResponseContainer rc;
+  rc.status.code = E32_SUCCESS;
+  // Stream::readString() returns only after the stream timeout has expired
+  rc.data = hs->readString();
+  cleanUARTBuffer();
+  return rc;
+}
+
+ResponseStructContainer LoRa_E32::receiveMessage(const uint8_t size)
+{
+  ResponseStructContainer rc;
+  rc.data = malloc(size);
+  size_t len = hs->readBytes((uint8_t *)rc.data, size);
+  rc.status.code = len == size ? E32_SUCCESS : ERR_E32_DATA_SIZE_NOT_MATCH;
+  cleanUARTBuffer();
+  return rc;
+}
+
+ResponseContainer LoRa_E32::receiveMessageUntil(char delimiter)
+{
+  ResponseContainer rc;
+  rc.status.code = E32_SUCCESS;
+  rc.data = hs->readStringUntil(delimiter);
+  return rc;
+}
+
+int LoRa_E32::available()
+{
+  return hs->available();
+}
@@ -0,0 +1,217 @@
+#pragma once
+// Host stand-in for xreef's EByte LoRa E32 library. Same names and call
+// semantics as the real library for the parts the sketches use; the module
+// itself is modelled in sim_channel.h.
+#include "Arduino.h"
+
+#define MAX_SIZE_TX_PACKET 58
+#define OPERATING_FREQUENCY 862
+
+enum Status {
+  E32_SUCCESS = 1,
+  ERR_E32_UNKNOWN,
+  ERR_E32_NOT_SUPPORT,
+  ERR_E32_NOT_IMPLEMENT,
+  ERR_E32_NOT_INITIAL,
+  ERR_E32_INVALID_PARAM,
+  ERR_E32_DATA_SIZE_NOT_MATCH,
+  ERR_E32_BUF_TOO_SMALL,
+  ERR_E32_TIMEOUT,
+  ERR_E32_HARDWARE,
+  ERR_E32_HEAD_NOT_RECOGNIZED,
+  ERR_E32_NO_RESPONSE_FROM_DEVICE,
+  ERR_E32_WRONG_UART_CONFIG,
+  ERR_E32_PACKET_TOO_BIG
+};
+
+enum MODE_TYPE {
+  MODE_0_NORMAL = 0,
+  MODE_1_WAKE_UP = 1,
+  MODE_2_POWER_SAVING = 2,
+  MODE_3_SLEEP = 3,
+  MODE_3_PROGRAM = 3,
+  MODE_INIT = 0xFF
+};
+
+enum PROGRAM_COMMAND {
+  WRITE_CFG_PWR_DWN_SAVE = 0xC0,
+  READ_CONFIGURATION = 0xC1,
+  WRITE_CFG_PWR_DWN_LOSE = 0xC2,
+  READ_MODULE_VERSION = 0xC3,
+  WRITE_RESET_MODULE = 0xC4
+};
+
+enum E32_UART_PARITY {
+  MODE_00_8N1 = 0b00,
+  MODE_01_8O1 = 0b01,
+  MODE_10_8E1 = 0b10,
+  MODE_11_8N1 = 0b11
+};
+
+enum UART_BPS_TYPE {
+  UART_BPS_1200 = 0b000,
+  UART_BPS_2400 = 0b001,
+  UART_BPS_4800 = 0b010,
+  UART_BPS_9600 = 0b011,
+  UART_BPS_19200 = 0b100,
+  UART_BPS_38400 = 0b101,
+  UART_BPS_57600 = 0b110,
+  UART_BPS_115200 = 0b111
+};
+
+enum UART_BPS_RATE {
+  UART_BPS_RATE_1200 = 1200,
+  UART_BPS_RATE_2400 = 2400,
+  UART_BPS_RATE_4800 = 4800,
+  UART_BPS_RATE_9600 = 9600,
+  UART_BPS_RATE_19200 = 19200,
+  UART_BPS_RATE_38400 = 38400,
+  UART_BPS_RATE_57600 = 57600,
+  UART_BPS_RATE_115200 = 115200
+};
+
+enum AIR_DATA_RATE {
+  AIR_DATA_RATE_000_03 = 0b000,
+  AIR_DATA_RATE_001_12 = 0b001,
+  AIR_DATA_RATE_010_24 = 0b010,
+  AIR_DATA_RATE_011_48 = 0b011,
+  AIR_DATA_RATE_100_96 = 0b100,
+  AIR_DATA_RATE_101_192 = 0b101,
+  AIR_DATA_RATE_110_192 = 0b110,
+  AIR_DATA_RATE_111_192 = 0b111
+};
+
+enum FIDEX_TRANSMISSION {
+  FT_TRANSPARENT_TRANSMISSION = 0b0,
+  FT_FIXED_TRANSMISSION = 0b1
+};
+
+enum IO_DRIVE_MODE {
+  IO_D_MODE_OPEN_COLLECTOR = 0b0,
+  IO_D_MODE_PUSH_PULLS_PULL_UPS = 0b1
+};
+
+enum WIRELESS_WAKE_UP_TIME {
+  WAKE_UP_250 = 0b000,
+  WAKE_UP_500 = 0b001,
+  WAKE_UP_750 = 0b010,
+  WAKE_UP_1000 = 0b011,
+  WAKE_UP_1250 = 0b100,
+  WAKE_UP_1500 = 0b101,
+  WAKE_UP_1750 = 0b110,
+  WAKE_UP_2000 = 0b111
+};
+
+enum FORWARD_ERROR_CORRECTION_SWITCH {
+  FEC_0_OFF = 0b0,
+  FEC_1_ON = 0b1
+};
+
+enum TRANSMISSION_POWER {
+  POWER_30 = 0b00,
+  POWER_27 = 0b01,
+  POWER_24 = 0b10,
+  POWER_21 = 0b11
+};
+
+// Baud rate in bit/s for a UART_BPS_TYPE value
+uint32_t e32_uart_baud(uint8_t uartBaudRate);
+// Air data rate in bit/s for an AIR_DATA_RATE value
+uint32_t e32_air_rate(uint8_t airDataRate);
+
+struct Speed {
+  uint8_t airDataRate : 3;
+  uint8_t uartBaudRate : 3;
+  uint8_t uartParity : 2;
+
+  String getUARTParityDescription();
+  String getUARTBaudRate();
+  String getAirDataRate();
+};
+
+struct Option {
+  byte fec : 1;
+  byte fixedTransmission : 1;
+  byte ioDriveMode : 1;
+  byte transmissionPower : 2;
+  byte wirelessWakeupTime : 3;
+
+  String getFECDescription();
+  String getFixedTransmissionDescription();
+  String getIODroveModeDescription();
+  String getTransmissionPowerDescription();
+  String getWirelessWakeUPTimeDescription();
+};
+
+struct Configuration {
+  byte HEAD = 0;
+  byte ADDH = 0;
+  byte ADDL = 0;
+  struct Speed SPED = {AIR_DATA_RATE_010_24, UART_BPS_9600, MODE_00_8N1};
+  byte CHAN = 0;
+  struct Option OPTION = {FEC_1_ON, FT_TRANSPARENT_TRANSMISSION, IO_D_MODE_PUSH_PULLS_PULL_UPS, POWER_30, WAKE_UP_250};
+
+  String getChannelDescription();
+};
+
+struct ModuleInformation {
+  byte HEAD = 0;
+  byte frequency = 0;
+  byte version = 0;
+  byte features = 0;
+};
+
+struct ResponseStatus {
+  Status code;
+  String getResponseDescription();
+};
+
+struct ResponseStructContainer {
+  void *data;
+  ResponseStatus status;
+  void close()
+  {
+    if (data)
+      free(data);
+    data = nullptr;
+  }
+};
+
+struct ResponseContainer {
+  String data;
+  ResponseStatus status;
+};
+
+class LoRa_E32
+{
+public:
+  LoRa_E32(HardwareSerial *serial, UART_BPS_RATE bpsRate = UART_BPS_RATE_9600);
+  LoRa_E32(HardwareSerial *serial, byte auxPin, UART_BPS_RATE bpsRate = UART_BPS_RATE_9600);
+  LoRa_E32(HardwareSerial *serial, byte auxPin, byte m0Pin, byte m1Pin, UART_BPS_RATE bpsRate = UART_BPS_RATE_9600);
+
+  bool begin();
+  Status setMode(MODE_TYPE mode);
+  MODE_TYPE getMode() { return mode; }
+
+  ResponseStructContainer getConfiguration();
+  ResponseStatus setConfiguration(Configuration configuration, PROGRAM_COMMAND saveType = WRITE_CFG_PWR_DWN_LOSE);
+  ResponseStructContainer getModuleInformation();
+  ResponseStatus resetModule();
+
+  ResponseStatus sendMessage(const void *message, const uint8_t size);
+  ResponseStatus sendMessage(const String message);
+  ResponseStatus sendFixedMessage(byte ADDH, byte ADDL, byte CHAN, const void *message, const uint8_t size);
+  ResponseContainer receiveMessage();
+  ResponseStructContainer receiveMessage(const uint8_t size);
+  ResponseContainer receiveMessageUntil(char delimiter = '\0');
+
+  int available();
+
+private:
+  Status waitCompleteResponse(unsigned long timeout = 1000);
+  void cleanUARTBuffer();
+
+  HardwareSerial *hs;
+  int auxPin = -1;
+  MODE_TYPE mode = MODE_0_NORMAL;
+};
@@ -0,0 +1,4 @@
+#include "PubSubClient.h"
+
+PubSubClient::SimBroker PubSubClient::broker;
+bool PubSubClient::brokerOnline = true;
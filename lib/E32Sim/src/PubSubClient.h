@@ -0,0 +1,66 @@
+#pragma once
+// Host stand-in for knolleary's PubSubClient. Publishes are handed to a
+// broker callback instead of a TCP connection.
+#include "Arduino.h"
+#include "Client.h"
+#include <functional>
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+class PubSubClient
+{
+public:
+  // Broker side of the stand-in; returns false to reject the publish
+  typedef std::function<bool(const char *topic, const uint8_t *payload, unsigned int length)> SimBroker;
+
+  PubSubClient() {}
+  explicit PubSubClient(Client &) {}
+
+  PubSubClient &setServer(const char *, uint16_t) { return *this; }
+  PubSubClient &setClient(Client &) { return *this; }
+  bool setBufferSize(uint16_t size) { bufferSize = size; return true; }
+  uint16_t getBufferSize() const { return bufferSize; }
+
+  bool connect(const char *) { return doConnect(); }
+  bool connect(const char *, const char *, const char *) { return doConnect(); }
+  void disconnect() { state_ = MQTT_DISCONNECTED; }
+  bool connected() const { return state_ == MQTT_CONNECTED; }
+  int state() const { return state_; }
+  bool loop()
+  {
+    if (connected() && !brokerOnline)
+      state_ = MQTT_CONNECTION_LOST;
+    return connected();
+  }
+
+  bool publish(const char *topic, const char *payload) { return publish(topic, (const uint8_t *)payload, (unsigned int)strlen(payload), false); }
+  bool publish(const char *topic, const char *payload, bool retained) { return publish(topic, (const uint8_t *)payload, (unsigned int)strlen(payload), retained); }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length) { return publish(topic, payload, length, false); }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool)
+  {
+    if (connected() && !brokerOnline)
+      state_ = MQTT_CONNECTION_LOST;
+    if (!connected() || strlen(topic) + length + 7 > bufferSize)
+      return false;
+    return broker ? broker(topic, payload, length) : true;
+  }
+
+  static SimBroker broker;
+  static bool brokerOnline;
+
+private:
+  bool doConnect()
+  {
+    state_ = brokerOnline ? MQTT_CONNECTED : MQTT_CONNECT_FAILED;
+    return connected();
+  }
+
+  uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+  int state_ = MQTT_DISCONNECTED;
+};
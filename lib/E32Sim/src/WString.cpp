@@ -0,0 +1,173 @@
+#include "WString.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+SimHeapStats sim_heap;
+
+String::String(const char *cstr)
+{
+  if (cstr)
+    concat(cstr);
+}
+
+String::String(const String &str)
+{
+  concat(str);
+}
+
+String::String(String &&str) : buffer(str.buffer), capacity(str.capacity), len(str.len)
+{
+  str.buffer = nullptr;
+  str.capacity = 0;
+  str.len = 0;
+}
+
+String::String(char c)
+{
+  concat(c);
+}
+
+String::String(int value, unsigned char base) : String((long)value, base)
+{
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base)
+{
+}
+
+String::String(long value, unsigned char base)
+{
+  char buf[34];
+  if (base == 10)
+    snprintf(buf, sizeof(buf), "%ld", value);
+  else if (base == 16)
+    snprintf(buf, sizeof(buf), "%lx", (unsigned long)value);
+  else
+    snprintf(buf, sizeof(buf), "%lo", (unsigned long)value);
+  concat(buf);
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+  char buf[34];
+  snprintf(buf, sizeof(buf), base == 16 ? "%lx" : base == 8 ? "%lo" : "%lu", value);
+  concat(buf);
+}
+
+String::~String()
+{
+  if (buffer)
+  {
+    sim_heap.frees++;
+    free(buffer);
+  }
+}
+
+String &String::operator=(const String &rhs)
+{
+  if (this != &rhs)
+  {
+    len = 0;
+    concat(rhs);
+  }
+  return *this;
+}
+
+String &String::operator=(String &&rhs)
+{
+  if (this != &rhs)
+  {
+    if (buffer)
+    {
+      sim_heap.frees++;
+      free(buffer);
+    }
+    buffer = rhs.buffer;
+    capacity = rhs.capacity;
+    len = rhs.len;
+    rhs.buffer = nullptr;
+    rhs.capacity = 0;
+    rhs.len = 0;
+  }
+  return *this;
+}
+
+String &String::operator=(const char *cstr)
+{
+  len = 0;
+  concat(cstr);
+  return *this;
+}
+
+bool String::grow(unsigned int size)
+{
+  if (buffer && capacity >= size)
+    return true;
+  char *p = (char *)realloc(buffer, size + 1);
+  if (!p)
+    return false;
+  sim_heap.allocs++;
+  sim_heap.bytes += size + 1;
+  if (!buffer)
+    p[0] = 0;
+  buffer = p;
+  capacity = size;
+  return true;
+}
+
+bool String::reserve(unsigned int size)
+{
+  return grow(size);
+}
+
+bool String::concat(const char *cstr, unsigned int length)
+{
+  if (!cstr)
+    return false;
+  if (length == 0)
+    return true;
+  if (!grow(len + length))
+    return false;
+  memcpy(buffer + len, cstr, length);
+  len += length;
+  buffer[len] = 0;
+  return true;
+}
+
+bool String::concat(const char *cstr)
+{
+  return cstr ? concat(cstr, (unsigned int)strlen(cstr)) : false;
+}
+
+bool String::equals(const String &s) const
+{
+  return len == s.len && (len == 0 || memcmp(buffer, s.buffer, len) == 0);
+}
+
+long String::toInt() const
+{
+  return buffer ? atol(buffer) : 0;
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+  String s(lhs);
+  s += rhs;
+  return s;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+  String s(lhs);
+  s += rhs;
+  return s;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+  String s(lhs);
+  s += rhs;
+  return s;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Heap counters of the String stand-in, used by the benchmarks to show the
+// per-message heap churn of String based frame assembly
+struct SimHeapStats {
+  uint32_t allocs = 0;
+  uint32_t frees = 0;
+  uint64_t bytes = 0;
+};
+extern SimHeapStats sim_heap;
+
+// Subset of the Arduino String class. Like the ESP32 core it keeps the text
+// in a heap buffer that grows with realloc().
+class String
+{
+public:
+  String(const char *cstr = "");
+  String(const String &str);
+  String(String &&str);
+  explicit String(char c);
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  ~String();
+
+  String &operator=(const String &rhs);
+  String &operator=(String &&rhs);
+  String &operator=(const char *cstr);
+
+  bool reserve(unsigned int size);
+  unsigned int length() const { return len; }
+  const char *c_str() const { return buffer ? buffer : ""; }
+
+  bool concat(const char *cstr, unsigned int length);
+  bool concat(const String &str) { return concat(str.c_str(), str.len); }
+  bool concat(const char *cstr);
+  bool concat(char c) { return concat(&c, 1); }
+
+  String &operator+=(const String &rhs) { concat(rhs); return *this; }
+  String &operator+=(const char *cstr) { concat(cstr); return *this; }
+  String &operator+=(char c) { concat(c); return *this; }
+
+  char operator[](unsigned int index) const { return index < len ? buffer[index] : 0; }
+  char charAt(unsigned int index) const { return (*this)[index]; }
+  bool equals(const String &s) const;
+  bool operator==(const String &rhs) const { return equals(rhs); }
+  bool operator!=(const String &rhs) const { return !equals(rhs); }
+  long toInt() const;
+
+private:
+  bool grow(unsigned int size);
+
+  char *buffer = nullptr;
+  unsigned int capacity = 0;
+  unsigned int len = 0;
+};
+
+String operator+(const String &lhs, const String &rhs);
+String operator+(const String &lhs, const char *rhs);
+String operator+(const char *lhs, const String &rhs);
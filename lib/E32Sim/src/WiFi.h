@@ -0,0 +1,41 @@
+#pragma once
+// Host stand-in for the ESP32 WiFi station. Joins at once; the network
+// behind it is whatever PubSubClient::broker models.
+#include "Arduino.h"
+#include "Client.h"
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+#define WIFI_STA 1
+
+class WiFiClass
+{
+public:
+  bool mode(int) { return true; }
+  wl_status_t begin(const char *, const char * = NULL)
+  {
+    status_ = WL_CONNECTED;
+    return status_;
+  }
+  bool setAutoReconnect(bool) { return true; }
+  bool reconnect()
+  {
+    begin(NULL);
+    return true;
+  }
+  wl_status_t status() const { return status_; }
+
+private:
+  wl_status_t status_ = WL_DISCONNECTED;
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient : public Client
+{
+};
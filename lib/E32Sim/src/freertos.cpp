@@ -0,0 +1,107 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "sim_channel.h"
+
+struct SimSemaphore
+{
+  bool given;
+};
+
+static sim_time_t deadlineFromTicks(TickType_t ticks)
+{
+  return ticks == portMAX_DELAY ? ~(sim_time_t)0 : sim().now() + (sim_time_t)ticks * 1000;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+  return new SimSemaphore{false};
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+  if (sem->given)
+    return pdFALSE;
+  sem->given = true;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *higherPriorityTaskWoken)
+{
+  if (higherPriorityTaskWoken)
+    *higherPriorityTaskWoken = pdFALSE;
+  return xSemaphoreGive(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+  sim().waitUntil(deadlineFromTicks(ticks), [sem]
+                  { return sem->given; });
+  if (!sem->given)
+    return pdFALSE;
+  sem->given = false;
+  return pdTRUE;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t, void *param,
+                                   UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+  SimTask *t = sim().taskCreate(name, [fn, param]
+                                { fn(param); });
+  if (handle)
+    *handle = t;
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+  return xTaskCreatePinnedToCore(fn, name, stackDepth, param, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  // Only a task deleting itself is supported
+  if (task == NULL || task == sim().taskCurrent())
+    sim().taskExit();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  sim().advance((sim_time_t)ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount()
+{
+  return (TickType_t)(sim().now() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  return sim().taskCurrent();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  task->notify++;
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken)
+{
+  if (higherPriorityTaskWoken)
+    *higherPriorityTaskWoken = pdFALSE;
+  task->notify++;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks)
+{
+  SimTask *self = sim().taskCurrent();
+  sim().waitUntil(deadlineFromTicks(ticks), [self]
+                  { return self->notify > 0; });
+  uint32_t value = self->notify;
+  if (value)
+    self->notify = clearCountOnExit ? 0 : value - 1;
+  return value;
+}
@@ -0,0 +1,11 @@
+#pragma once
+// Binary semaphores on the simulated clock. xSemaphoreTake() advances
+// virtual time until the semaphore is given or the wait times out.
+#include "FreeRTOS.h"
+
+typedef struct SimSemaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *higherPriorityTaskWoken);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
@@ -0,0 +1,91 @@
+#include "driver/pcnt.h"
+
+struct SimPcntUnit
+{
+  bool configured = false;
+  bool running = false;
+  pcnt_config_t config;
+  int16_t count = 0;
+  uint16_t filter = 0;
+};
+
+static SimPcntUnit units[PCNT_UNIT_MAX];
+
+esp_err_t pcnt_unit_config(const pcnt_config_t *config)
+{
+  if (config->unit >= PCNT_UNIT_MAX || config->counter_h_lim < 0 || config->counter_l_lim > 0)
+    return ESP_ERR_INVALID_ARG;
+  SimPcntUnit &u = units[config->unit];
+  u.configured = true;
+  u.running = true;
+  u.config = *config;
+  u.count = 0;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t *count)
+{
+  if (unit >= PCNT_UNIT_MAX || !units[unit].configured)
+    return ESP_ERR_INVALID_ARG;
+  *count = units[unit].count;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit)
+{
+  if (unit >= PCNT_UNIT_MAX)
+    return ESP_ERR_INVALID_ARG;
+  units[unit].running = false;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit)
+{
+  if (unit >= PCNT_UNIT_MAX)
+    return ESP_ERR_INVALID_ARG;
+  units[unit].running = true;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit)
+{
+  if (unit >= PCNT_UNIT_MAX)
+    return ESP_ERR_INVALID_ARG;
+  units[unit].count = 0;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t filter_val)
+{
+  if (unit >= PCNT_UNIT_MAX || filter_val > 1023)
+    return ESP_ERR_INVALID_ARG;
+  units[unit].filter = filter_val;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit)
+{
+  return unit < PCNT_UNIT_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t pcnt_filter_disable(pcnt_unit_t unit)
+{
+  return unit < PCNT_UNIT_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void sim_pcnt_edge(uint8_t pin, bool level)
+{
+  for (SimPcntUnit &u : units)
+  {
+    if (!u.configured || !u.running || u.config.pulse_gpio_num != pin)
+      continue;
+    pcnt_count_mode_t mode = level ? u.config.pos_mode : u.config.neg_mode;
+    if (mode == PCNT_COUNT_INC)
+      u.count++;
+    else if (mode == PCNT_COUNT_DEC)
+      u.count--;
+    // At a limit the hardware starts over at 0
+    if (u.count >= u.config.counter_h_lim || (u.config.counter_l_lim < 0 && u.count <= u.config.counter_l_lim))
+      u.count = 0;
+  }
+}
@@ -0,0 +1,477 @@
+#include "sim_channel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+static std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+
+// RTC_DATA_ATTR variables (Arduino.h), bounds from the linker; null if
+// the sketch has none
+extern char __start_rtc_data[] __attribute__((weak));
+extern char __stop_rtc_data[] __attribute__((weak));
+
+static void rtcRestore()
+{
+  const char *keep = getenv("SIM_RTC_KEEP");
+  if (!(keep && atoi(keep)) || __start_rtc_data == nullptr)
+    return;
+  size_t size = __stop_rtc_data - __start_rtc_data;
+  if (FILE *f = fopen(sim_fs_path(".rtc_memory").c_str(), "rb"))
+  {
+    // A different build has other variables there
+    std::vector<char> saved(size + 1);
+    if (fread(saved.data(), 1, saved.size(), f) == size)
+      memcpy(__start_rtc_data, saved.data(), size);
+    fclose(f);
+  }
+}
+
+static void rtcSave()
+{
+  if (__start_rtc_data == nullptr)
+    return;
+  if (FILE *f = fopen(sim_fs_path(".rtc_memory").c_str(), "wb"))
+  {
+    fwrite(__start_rtc_data, 1, __stop_rtc_data - __start_rtc_data, f);
+    fclose(f);
+  }
+}
+
+SimChannel &SimChannel::instance()
+{
+  static SimChannel channel;
+  return channel;
+}
+
+void SimChannel::configure(const SimLinkConfig &c)
+{
+  cfg = c;
+  random.seed(cfg.seed);
+  wallStart = std::chrono::steady_clock::now();
+  rtcRestore();
+}
+
+void SimChannel::advanceTo(sim_time_t t)
+{
+  if (tasks.empty())
+    runEvents(t);
+  else
+    waitUntil(t, nullptr);
+}
+
+void SimChannel::runEvents(sim_time_t t)
+{
+  const sim_time_t end = (sim_time_t)cfg.duration_ms * 1000;
+  if (t < now_us)
+    t = now_us;
+  while (!events.empty() && events.top().at <= t)
+  {
+    Event e = events.top();
+    events.pop();
+    if (e.at > now_us)
+      now_us = e.at;
+    if (now_us >= end)
+      finish();
+    e.fn();
+  }
+  now_us = t;
+  if (now_us >= end)
+    finish();
+  // forget AUX low phases that are over
+  aux_low.erase(std::remove_if(aux_low.begin(), aux_low.end(),
+                               [this](const std::pair<sim_time_t, sim_time_t> &iv)
+                               { return iv.second <= now_us; }),
+                aux_low.end());
+}
+
+void SimChannel::waitForEvent(sim_time_t deadline)
+{
+  if (!events.empty() && events.top().at <= deadline)
+    advanceTo(events.top().at);
+  else
+    advanceTo(deadline);
+}
+
+void SimChannel::waitUntil(sim_time_t deadline, std::function<bool()> ready)
+{
+  if (tasks.empty())
+  {
+    while (!(ready && ready()) && now_us < deadline)
+      waitForEvent(deadline);
+    return;
+  }
+  if (ready && ready())
+    return;
+  SimTask *self = current_task;
+  self->wake = deadline;
+  self->ready = ready;
+  taskSwitch(self);
+}
+
+void SimChannel::schedule(sim_time_t at, std::function<void()> fn)
+{
+  events.push(Event{at < now_us ? now_us : at, seq++, std::move(fn)});
+}
+
+sim_time_t SimChannel::Line::push(SimChannel &ch, size_t len)
+{
+  sim_time_t start = busy_until > ch.now() ? busy_until : ch.now();
+  busy_until = start + len * byteUs();
+  // Block the writer until the rest fits into the FIFO
+  if (busy_until - ch.now() > UART_FIFO * byteUs())
+    ch.advanceTo(busy_until - UART_FIFO * byteUs());
+  return busy_until;
+}
+
+void SimChannel::consoleWrite(const uint8_t *data, size_t len)
+{
+  st.console_bytes += len;
+  if (cfg.verbose)
+    fwrite(data, 1, len, stdout);
+  console.push(*this, len);
+}
+
+int SimChannel::consoleRead()
+{
+  if (console_rx.empty())
+    return -1;
+  uint8_t b = console_rx.front();
+  console_rx.pop_front();
+  return b;
+}
+
+void SimChannel::uartWrite(const uint8_t *data, size_t len)
+{
+  if (rx_handled_at)
+  {
+    reply_latency.add(now_us - rx_handled_at);
+    rx_handled_at = 0;
+  }
+  sim_time_t first = (uart.busy_until > now_us ? uart.busy_until : now_us) + uart.byteUs();
+  sim_time_t done = uart.push(*this, len);
+  if (uart.baud != module_baud)
+  {
+    // Module samples garbage at the wrong baud rate
+    st.uart_baud_mismatch++;
+    return;
+  }
+  uart_to_module.add(done - (first - uart.byteUs()));
+  if (!module_tx_pending)
+  {
+    module_tx_pending = true;
+    module_tx_low_from = first;
+    auxWatch(first);
+  }
+  module_tx.insert(module_tx.end(), data, data + len);
+  // Transparent mode: the module starts the air packet once the UART
+  // input has been idle for a few byte times
+  uint32_t generation = ++module_tx_generation;
+  schedule(done + 3 * uart.byteUs(), [this, generation]
+           { moduleFlush(generation); });
+}
+
+int SimChannel::uartRead()
+{
+  if (rx.empty())
+    return -1;
+  RxByte r = rx.front();
+  rx.pop_front();
+  if (r.last)
+  {
+    read_latency.add(now_us - r.at);
+    rx_handled_at = now_us;
+  }
+  return r.b;
+}
+
+void SimChannel::uartDrain()
+{
+  if (uart.busy_until > now_us)
+    advanceTo(uart.busy_until);
+}
+
+void SimChannel::uartOnReceive(std::function<void()> fn, uint8_t timeout_symbols)
+{
+  rx_event = fn;
+  rx_timeout_symbols = timeout_symbols;
+}
+
+void SimChannel::moduleConfigure(uint32_t air_rate, uint32_t baud, bool fec_on, bool fixed)
+{
+  if (air_rate != air_rate_bps)
+  {
+    st.rate_changes++;
+    rate_time[air_rate_bps] += now_us - rate_since;
+    rate_since = now_us;
+  }
+  air_rate_bps = air_rate;
+  module_baud = baud;
+  fec = fec_on;
+  module_fixed = fixed;
+}
+
+bool SimChannel::auxLevel() const
+{
+  if (module_tx_pending && now_us >= module_tx_low_from)
+    return false;
+  for (const auto &iv : aux_low)
+  {
+    if (now_us >= iv.first && now_us < iv.second)
+      return false;
+  }
+  return true;
+}
+
+void SimChannel::auxWatch(sim_time_t at)
+{
+  schedule(at, [this]
+           {
+    bool level = auxLevel();
+    if (level == aux_last)
+      return;
+    aux_last = level;
+    if (aux_edge)
+      aux_edge(level); });
+}
+
+sim_time_t SimChannel::airtimeUs(size_t len, uint32_t rate_bps) const
+{
+  sim_time_t bits = (len + AIR_OVERHEAD_BYTES) * 8ULL;
+  if (fec)
+    bits = bits * 5 / 4;
+  return bits * 1000000ULL / rate_bps;
+}
+
+float SimChannel::marginLoss(uint32_t rate_bps) const
+{
+  if (std::isinf(cfg.margin_db))
+    return 0.0f;
+  double margin = cfg.margin_db;
+  if (!std::isnan(cfg.margin_end_db))
+  {
+    double f = std::min(1.0, now_us / ((double)cfg.duration_ms * 1000.0));
+    margin += (cfg.margin_end_db - cfg.margin_db) * f;
+  }
+  margin -= 3.0 * std::log2(rate_bps / 2400.0);
+  // Bit errors take out a packet over a few dB around zero margin
+  return (float)(1.0 / (1.0 + std::exp(margin / 1.5)));
+}
+
+void SimChannel::moduleFlush(uint32_t generation)
+{
+  if (generation != module_tx_generation || !module_tx_pending)
+    return;
+  std::vector<uint8_t> bytes;
+  bytes.swap(module_tx);
+  module_tx_pending = false;
+  sim_time_t start = device_air_free > now_us ? device_air_free : now_us;
+  device_air_free = start + airtimeUs(bytes.size());
+  aux_low.push_back(std::make_pair(module_tx_low_from, device_air_free));
+  auxWatch(device_air_free);
+  if (start > now_us)
+  {
+    schedule(start, [this, bytes]
+             { airTransmit(true, bytes); });
+  }
+  else
+  {
+    airTransmit(true, bytes);
+  }
+}
+
+void SimChannel::airTransmit(bool from_device, std::vector<uint8_t> bytes)
+{
+  uint32_t rate = from_device ? air_rate_bps : peerAirRate();
+  uint32_t rx_rate = from_device ? peerAirRate() : air_rate_bps;
+  std::shared_ptr<AirTx> tx(
+      new AirTx{now_us, now_us + airtimeUs(bytes.size(), rate), from_device, false, rate, rate != rx_rate});
+  on_air.erase(std::remove_if(on_air.begin(), on_air.end(),
+                              [this](const std::shared_ptr<AirTx> &o)
+                              { return o->end <= now_us; }),
+               on_air.end());
+  for (auto &o : on_air)
+  {
+    o->collided = true;
+    tx->collided = true;
+  }
+  on_air.push_back(tx);
+  st.air_busy_us += tx->end - tx->start;
+
+  schedule(tx->end + cfg.latency_us, [this, tx, bytes]
+           {
+    if (tx->collided)
+    {
+      st.packets_collided++;
+      return;
+    }
+    if (tx->mismatch)
+    {
+      st.rate_mismatch++;
+      return;
+    }
+    float loss = cfg.loss;
+    float margin = marginLoss(tx->rate);
+    if (margin > 0.0f)
+      loss = 1.0f - (1.0f - loss) * (1.0f - margin);
+    if (std::uniform_real_distribution<float>(0.0f, 1.0f)(random) < loss)
+    {
+      st.packets_lost++;
+      return;
+    }
+    if (tx->from_device)
+    {
+      st.packets_to_peer++;
+      packet_start = tx->start;
+      if (peer && module_fixed && bytes.size() >= 3)
+      {
+        packet_target = (uint16_t)(bytes[0] << 8 | bytes[1]);
+        peer->onPacket(bytes.data() + 3, bytes.size() - 3);
+      }
+      else if (peer)
+      {
+        packet_target = 0xFFFF;
+        peer->onPacket(bytes.data(), bytes.size());
+      }
+    }
+    else
+    {
+      st.packets_to_device++;
+      deliverToDevice(bytes);
+    } });
+}
+
+void SimChannel::deliverToDevice(const std::vector<uint8_t> &bytes)
+{
+  // AUX goes LOW about 2 ms before the module starts the UART output
+  const sim_time_t byte_us = 10000000ULL / module_baud;
+  const sim_time_t t0 = now_us + 2000;
+  aux_low.push_back(std::make_pair(now_us, t0 + bytes.size() * byte_us));
+  auxWatch(now_us);
+  if (uart.baud != module_baud)
+  {
+    st.uart_baud_mismatch++;
+    auxWatch(t0 + bytes.size() * byte_us);
+    return;
+  }
+  uart_from_module.add(bytes.size() * byte_us);
+  for (size_t i = 0; i < bytes.size(); ++i)
+  {
+    RxByte r = {bytes[i], i + 1 == bytes.size(), t0 + (i + 1) * byte_us};
+    schedule(r.at, [this, r]
+             {
+      if (rx.size() >= UART_RX_BUFFER)
+        st.uart_overflow_bytes++;
+      else
+        rx.push_back(r);
+      uint32_t generation = ++rx_generation;
+      schedule(now_us + rx_timeout_symbols * uart.byteUs(), [this, generation]
+               {
+        if (generation == rx_generation && rx_event)
+          rx_event(); }); });
+  }
+  // AUX rises once the last byte is out
+  auxWatch(t0 + bytes.size() * byte_us);
+}
+
+void SimChannel::peerSend(const uint8_t *data, size_t len)
+{
+  airTransmit(false, std::vector<uint8_t>(data, data + len));
+}
+
+void SimChannel::finish()
+{
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  double virt = now_us / 1e6;
+  fflush(stdout);
+  printf("\n=== E32 link simulation ===\n");
+  printf("virtual time    : %.3f s (wall %.3f s, %.0fx real time)\n", virt, wall, wall > 0 ? virt / wall : 0.0);
+  printf("air rate / uart : %u bps / %u baud, FEC %s, loss %.1f %%, latency %.1f ms\n",
+         air_rate_bps, module_baud, fec ? "on" : "off", cfg.loss * 100.0, cfg.latency_us / 1000.0);
+  printf("packets         : %u to peer, %u to device, %u lost, %u collided\n",
+         st.packets_to_peer, st.packets_to_device, st.packets_lost, st.packets_collided);
+  printf("air utilisation : %.1f %%\n", virt > 0 ? st.air_busy_us / 1e4 / virt : 0.0);
+  printf("uart            : %u bytes overflow, %u baud mismatches\n", st.uart_overflow_bytes, st.uart_baud_mismatch);
+  printf("module config   : %u EEPROM writes\n", st.config_writes);
+  if (st.rate_changes || st.rate_mismatch)
+  {
+    rate_time[air_rate_bps] += now_us - rate_since;
+    rate_since = now_us;
+    printf("air rate changes: %u, %u packets at another rate than the receiver's\n", st.rate_changes,
+           st.rate_mismatch);
+    printf("time at rate    :");
+    for (const auto &r : rate_time)
+      printf(" %u bps %.1f %%", r.first, now_us ? 100.0 * r.second / now_us : 0.0);
+    printf("\n");
+  }
+  printf("boot to ready   : %.1f ms (setup() returned)\n", st.setup_done_us / 1000.0);
+  printf("console         : %llu bytes\n", (unsigned long long)st.console_bytes);
+  read_latency.print("rx to handler");
+  if (reply_latency.count())
+    reply_latency.print("handler to tx");
+  uart_from_module.print("uart from module");
+  if (uart_to_module.count())
+    uart_to_module.print("uart to module");
+  if (peer)
+    peer->report();
+  fflush(stdout);
+  rtcSave();
+  // Other tasks are parked on task_mutex, skip static destructors
+  std::_Exit(0);
+}
+
+void SimLatency::print(const char *name) const
+{
+  if (samples.empty())
+  {
+    printf("%-16s: n=0\n", name);
+    return;
+  }
+  std::vector<sim_time_t> s(samples);
+  std::sort(s.begin(), s.end());
+  double sum = 0;
+  for (sim_time_t v : s)
+    sum += v;
+  printf("%-16s: n=%zu mean=%.1f p50=%.1f p99=%.1f max=%.1f ms\n", name, s.size(),
+         sum / s.size() / 1000.0, s[s.size() / 2] / 1000.0,
+         s[(s.size() * 99) / 100] / 1000.0, s.back() / 1000.0);
+}
+
+SimLinkConfig sim_config_from_env()
+{
+  SimLinkConfig c;
+  if (const char *v = getenv("SIM_DURATION_S"))
+    c.duration_ms = (uint32_t)(atof(v) * 1000);
+  if (const char *v = getenv("SIM_LOSS"))
+    c.loss = (float)atof(v);
+  if (const char *v = getenv("SIM_LATENCY_MS"))
+    c.latency_us = (uint32_t)(atof(v) * 1000);
+  if (const char *v = getenv("SIM_SEED"))
+    c.seed = (uint32_t)atoi(v);
+  if (const char *v = getenv("SIM_VERBOSE"))
+    c.verbose = atoi(v) != 0;
+  if (const char *v = getenv("SIM_E32_MAX_BAUD"))
+    c.max_uart_baud = (uint32_t)atol(v);
+  if (const char *v = getenv("SIM_LINK_MARGIN_DB"))
+    c.margin_db = (float)atof(v);
+  if (const char *v = getenv("SIM_LINK_MARGIN_END_DB"))
+    c.margin_end_db = (float)atof(v);
+  return c;
+}
+
+std::string sim_fs_path(const char *name)
+{
+  const char *d = getenv("SIM_FS_DIR");
+  std::string dir = d && *d ? d : ".sim_fs";
+  mkdir(dir.c_str(), 0755);
+  return dir + "/" + name;
+}
+
+bool sim_fs_keep()
+{
+  const char *keep = getenv("SIM_FS_KEEP");
+  return keep && atoi(keep);
+}
@@ -0,0 +1,305 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Simulated E32 radio link for the native environment.
+//
+// Everything runs on a virtual clock in microseconds. delay(), blocking
+// Serial writes and the LoRa_E32 stand-in advance that clock, and the
+// events scheduled on it (UART bytes, air packets, peer timers) fire in
+// order. A sketch therefore runs unchanged and thousands of exchanges take
+// only seconds of wall time.
+//
+//   MCU --Serial1 (uart baud)--> E32 module --air (air rate)--> peer
+//   MCU <--Serial1 (uart baud)-- E32 module <--air (air rate)-- peer
+//
+// The peer is the other end of the link (e.g. the rain sensor) and is
+// provided by the scenario in the project's sim/ folder.
+//
+// FreeRTOS tasks are threads that run one at a time: the running task keeps
+// the CPU until it blocks (delay, semaphore, UART read, full console FIFO).
+// Virtual time only advances once every task is blocked, so tasks behave
+// like separate cores on which computation takes no time.
+
+typedef uint64_t sim_time_t; // virtual time in microseconds
+
+// Scenario parameters, see sim_config_from_env()
+struct SimLinkConfig {
+  uint32_t duration_ms = 3600000; // virtual run time, the sim stops afterwards
+  float loss = 0.0f;              // per-packet loss probability (both directions)
+  uint32_t latency_us = 5000;     // module processing + propagation per packet
+  uint32_t seed = 1;
+  bool verbose = false;           // echo Serial console output to stdout
+  uint32_t max_uart_baud = 115200; // module keeps its UART rate when told a faster one
+  float margin_db = INFINITY;     // link margin at 2400 bps, loss grows with the air rate
+  float margin_end_db = NAN;      // margin at the end of the run, ramped; NAN = constant
+};
+
+struct SimStats {
+  uint32_t packets_to_peer = 0;
+  uint32_t packets_to_device = 0;
+  uint32_t packets_lost = 0;
+  uint32_t packets_collided = 0;
+  uint32_t uart_overflow_bytes = 0;
+  uint32_t uart_baud_mismatch = 0;
+  uint32_t config_writes = 0;
+  uint32_t rate_changes = 0;    // module air rate switched
+  uint32_t rate_mismatch = 0;   // packets sent at another rate than the receiver's
+  uint64_t air_busy_us = 0;
+  uint64_t console_bytes = 0;
+  sim_time_t setup_done_us = 0; // setup() returned: ready to receive
+};
+
+// Other end of the radio link
+class SimPeer
+{
+public:
+  virtual ~SimPeer() {}
+  // Called once before setup() runs
+  virtual void begin() {}
+  // A packet sent by the device has been received over the air
+  virtual void onPacket(const uint8_t *data, size_t len) = 0;
+  // Print the scenario specific part of the final report
+  virtual void report() {}
+};
+
+// Latency samples with a percentile summary
+class SimLatency
+{
+public:
+  void add(sim_time_t us) { samples.push_back(us); }
+  size_t count() const { return samples.size(); }
+  // Prints "name: n=.. mean=.. p50=.. p99=.. max=.. ms"
+  void print(const char *name) const;
+
+private:
+  std::vector<sim_time_t> samples;
+};
+
+// A FreeRTOS task; the thread running setup()/loop() becomes "loopTask"
+// as soon as the first task is created
+struct SimTask
+{
+  std::string name;
+  std::function<void()> body;
+  sim_time_t wake = 0;
+  std::function<bool()> ready;
+  bool done = false;
+  uint32_t notify = 0; // ulTaskNotifyTake() counter
+  std::condition_variable cv;
+};
+
+class SimChannel
+{
+public:
+  static SimChannel &instance();
+
+  void configure(const SimLinkConfig &cfg);
+  const SimLinkConfig &config() const { return cfg; }
+  SimStats &stats() { return st; }
+  std::mt19937 &rng() { return random; }
+
+  // --- virtual clock ---
+  sim_time_t now() const { return now_us; }
+  void advance(sim_time_t us) { advanceTo(now_us + us); }
+  void advanceTo(sim_time_t t);
+  // Advance to the next scheduled event, but not past deadline
+  void waitForEvent(sim_time_t deadline);
+  // Block until ready() returns true or deadline passed, other tasks run
+  // meanwhile
+  void waitUntil(sim_time_t deadline, std::function<bool()> ready);
+  void schedule(sim_time_t at, std::function<void()> fn);
+  // Print the report and exit the process
+  [[noreturn]] void finish();
+
+  // --- MCU console (Serial) ---
+  void consoleBegin(uint32_t baud) { console.baud = baud; }
+  void consoleWrite(const uint8_t *data, size_t len);
+  // Bytes arriving from the host on the console, e.g. a request
+  void consoleInput(const uint8_t *data, size_t len) { console_rx.insert(console_rx.end(), data, data + len); }
+  int consoleAvailable() const { return (int)console_rx.size(); }
+  int consoleRead();
+  int consolePeek() const { return console_rx.empty() ? -1 : console_rx.front(); }
+
+  // --- MCU UART to the E32 module (Serial1) ---
+  void uartBegin(uint32_t baud) { uart.baud = baud; }
+  void uartWrite(const uint8_t *data, size_t len);
+  int uartAvailable() const { return (int)rx.size(); }
+  int uartRead();
+  int uartPeek() const { return rx.empty() ? -1 : rx.front().b; }
+  void uartDrain();
+  // ESP32 UART RX event (HardwareSerial::onReceive): fn runs once the line
+  // has been idle for timeout_symbols byte times after received data. The
+  // 120 byte FIFO-full event is not modelled, E32 packets are shorter.
+  void uartOnReceive(std::function<void()> fn, uint8_t timeout_symbols);
+  // Time from the last byte of a packet arriving in the UART RX buffer
+  // until the sketch reads it, i.e. frame arrival to handler
+  const SimLatency &readLatency() const { return read_latency; }
+  // Time from reading the last byte of a packet until the next write to
+  // the module, i.e. the sketch's handling before it answers
+  const SimLatency &replyLatency() const { return reply_latency; }
+  // Time a write to the module and a packet from it spend on the UART,
+  // first bit to last
+  const SimLatency &uartToModule() const { return uart_to_module; }
+  const SimLatency &uartFromModule() const { return uart_from_module; }
+
+  // --- E32 module ---
+  // fixed: fixed transmission, the first 3 bytes of a packet are the
+  // target ADDH ADDL CHAN; the peer gets the rest, packetTarget() the address
+  void moduleConfigure(uint32_t air_rate_bps, uint32_t uart_baud, bool fec, bool fixed = false);
+  uint32_t moduleAirRate() const { return air_rate_bps; }
+  uint32_t moduleBaud() const { return module_baud; }
+  // AUX is LOW while the module buffers, transmits or outputs a packet
+  bool auxLevel() const;
+  // Edge callback on the AUX pin (attachInterrupt), gets the new level
+  void auxOnEdge(std::function<void(bool)> fn) { aux_edge = fn; }
+  // Rough E32 time on air: fixed preamble/header overhead plus the payload
+  // bits at the air data rate, FEC adds a quarter on top
+  sim_time_t airtimeUs(size_t len) const { return airtimeUs(len, air_rate_bps); }
+  sim_time_t airtimeUs(size_t len, uint32_t rate_bps) const;
+  // Loss probability from the link margin at an air rate, 0 without
+  // SIM_LINK_MARGIN_DB: 3 dB less margin per doubling of the rate
+  float marginLoss(uint32_t rate_bps) const;
+
+  // --- FreeRTOS tasks ---
+  SimTask *taskCreate(const char *name, std::function<void()> body);
+  SimTask *taskCurrent();
+  // End the current task, never returns
+  [[noreturn]] void taskExit();
+
+  // --- peer side ---
+  void attachPeer(SimPeer *p) { peer = p; }
+  void peerSend(const uint8_t *data, size_t len);
+  // Air rate of the peer's radio, 0 = always the module's. A packet only
+  // arrives where the receiver runs the rate it was sent at.
+  void peerAirRate(uint32_t rate_bps) { peer_air_rate = rate_bps; }
+  uint32_t peerAirRate() const { return peer_air_rate ? peer_air_rate : air_rate_bps; }
+  // Target address of the packet passed to onPacket(), 0xFFFF in
+  // transparent mode
+  uint16_t packetTarget() const { return packet_target; }
+  // When the packet passed to onPacket() went on air; a receiver asleep
+  // then does not get it
+  sim_time_t packetStart() const { return packet_start; }
+
+private:
+  struct Event
+  {
+    sim_time_t at;
+    uint64_t seq;
+    std::function<void()> fn;
+    bool operator>(const Event &o) const { return at != o.at ? at > o.at : seq > o.seq; }
+  };
+
+  // Serial line with a hardware FIFO; writers block once the FIFO is full
+  struct Line
+  {
+    uint32_t baud = 115200;
+    sim_time_t busy_until = 0;
+    sim_time_t byteUs() const { return 10000000ULL / baud; }
+    // Returns the time the last byte has left the line
+    sim_time_t push(SimChannel &ch, size_t len);
+  };
+
+  struct RxByte
+  {
+    uint8_t b;
+    bool last; // last byte of a packet
+    sim_time_t at;
+  };
+
+  struct AirTx
+  {
+    sim_time_t start;
+    sim_time_t end;
+    bool from_device;
+    bool collided;
+    uint32_t rate;
+    bool mismatch;  // the receiver ran another rate when it started
+  };
+
+  // Process events up to t and move the clock there
+  void runEvents(sim_time_t t);
+  // Hand the CPU to the next ready task, running events until one is ready
+  void taskSwitch(SimTask *self);
+
+  void airTransmit(bool from_device, std::vector<uint8_t> bytes);
+  void moduleFlush(uint32_t generation);
+  void deliverToDevice(const std::vector<uint8_t> &bytes);
+  // Check AUX for an edge at time at
+  void auxWatch(sim_time_t at);
+
+  static const size_t UART_FIFO = 128;
+  static const size_t UART_RX_BUFFER = 256;
+  static const size_t AIR_OVERHEAD_BYTES = 12;
+
+  SimLinkConfig cfg;
+  SimStats st;
+  std::mt19937 random;
+  sim_time_t now_us = 0;
+  uint64_t seq = 0;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+  Line console;
+  std::deque<uint8_t> console_rx;
+  Line uart;
+  std::deque<RxByte> rx;
+  SimLatency read_latency;
+  SimLatency reply_latency;
+  SimLatency uart_to_module;
+  SimLatency uart_from_module;
+  sim_time_t rx_handled_at = 0;
+  std::function<void()> rx_event;
+  uint8_t rx_timeout_symbols = 2;
+  uint32_t rx_generation = 0;
+
+  uint32_t air_rate_bps = 2400;
+  uint32_t peer_air_rate = 0;
+  std::map<uint32_t, sim_time_t> rate_time; // virtual time at each module air rate
+  sim_time_t rate_since = 0;
+  uint32_t module_baud = 9600;
+  bool fec = true;
+  bool module_fixed = false;
+  uint16_t packet_target = 0xFFFF;
+  sim_time_t packet_start = 0;
+  std::vector<uint8_t> module_tx;
+  uint32_t module_tx_generation = 0;
+  sim_time_t module_tx_low_from = 0;
+  bool module_tx_pending = false;
+  sim_time_t device_air_free = 0;
+  std::vector<std::shared_ptr<AirTx>> on_air;
+  std::vector<std::pair<sim_time_t, sim_time_t>> aux_low;
+  std::function<void(bool)> aux_edge;
+  bool aux_last = true;
+
+  std::vector<SimTask *> tasks;
+  SimTask *current_task = nullptr;
+  std::mutex task_mutex;
+
+  SimPeer *peer = nullptr;
+};
+
+static inline SimChannel &sim() { return SimChannel::instance(); }
+
+// Reads SIM_DURATION_S, SIM_LOSS, SIM_LATENCY_MS, SIM_SEED, SIM_VERBOSE,
+// SIM_E32_MAX_BAUD, SIM_LINK_MARGIN_DB and SIM_LINK_MARGIN_END_DB
+SimLinkConfig sim_config_from_env();
+
+// State that outlives a run lives in SIM_FS_DIR (default .sim_fs): the
+// LittleFS files, the module's EEPROM (.e32_eeprom) and RTC memory
+// (.rtc_memory). SIM_FS_KEEP=1 starts from what the last run left, like
+// after a power cycle; SIM_RTC_KEEP=1 keeps RTC_DATA_ATTR variables too,
+// like after a reset or deep sleep.
+std::string sim_fs_path(const char *name);
+bool sim_fs_keep();
@@ -0,0 +1,98 @@
+#include "sim_channel.h"
+
+// Cooperative FreeRTOS task model, see sim_channel.h. Exactly one thread
+// (current_task) runs at a time; the others wait on their condition
+// variable until taskSwitch() hands the CPU to them.
+
+static const sim_time_t NEVER = ~(sim_time_t)0;
+
+SimTask *SimChannel::taskCurrent()
+{
+  if (tasks.empty())
+  {
+    SimTask *main = new SimTask;
+    main->name = "loopTask";
+    main->wake = NEVER;
+    tasks.push_back(main);
+    current_task = main;
+  }
+  return current_task;
+}
+
+SimTask *SimChannel::taskCreate(const char *name, std::function<void()> body)
+{
+  taskCurrent();
+  SimTask *t = new SimTask;
+  t->name = name;
+  t->body = body;
+  t->wake = now_us;
+  tasks.push_back(t);
+  std::thread([this, t]
+              {
+    {
+      std::unique_lock<std::mutex> lock(task_mutex);
+      t->cv.wait(lock, [this, t]
+                 { return current_task == t; });
+    }
+    t->body();
+    taskExit(); })
+      .detach();
+  return t;
+}
+
+void SimChannel::taskExit()
+{
+  SimTask *self = current_task;
+  self->done = true;
+  self->wake = NEVER;
+  self->ready = nullptr;
+  taskSwitch(self);
+  // Not reached: a finished task is never picked again
+  for (;;)
+    std::this_thread::sleep_for(std::chrono::hours(1));
+}
+
+void SimChannel::taskSwitch(SimTask *self)
+{
+  std::unique_lock<std::mutex> lock(task_mutex);
+  for (;;)
+  {
+    // Round robin, starting after the current task
+    size_t start = 0;
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+      if (tasks[i] == self)
+        start = i + 1;
+    }
+    SimTask *next = nullptr;
+    for (size_t i = 0; i < tasks.size() && !next; ++i)
+    {
+      SimTask *t = tasks[(start + i) % tasks.size()];
+      if (!t->done && (t->wake <= now_us || (t->ready && t->ready())))
+        next = t;
+    }
+    if (next)
+    {
+      if (next != self)
+      {
+        current_task = next;
+        next->cv.notify_one();
+        self->cv.wait(lock, [this, self]
+                      { return current_task == self; });
+      }
+      self->wake = NEVER;
+      self->ready = nullptr;
+      return;
+    }
+    // Everybody is blocked: move the clock to the next wakeup or event
+    sim_time_t t = NEVER;
+    for (SimTask *k : tasks)
+    {
+      if (!k->done && k->wake < t)
+        t = k->wake;
+    }
+    if (!events.empty() && events.top().at < t)
+      t = events.top().at;
+    runEvents(t);
+  }
+}
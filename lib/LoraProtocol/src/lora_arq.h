@@ -0,0 +1,302 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lora_frame.h"
+#include "lora_messages.h"
+
+// Selective-repeat ARQ keyed on messageID.
+//
+// The sender keeps up to `window` frames in flight instead of waiting for
+// the answer to each one. The receiver answers a burst with one
+// lora_sack_payload_t: ackNext says every messageID before it arrived,
+// ackBitmap bit i that ackNext + 1 + i arrived as well. The sender drops
+// what is acknowledged and resends only the gaps:
+//   - at once, when a later frame was acknowledged (the gap was lost)
+//   - when the frame's timer runs out, RTO doubling with every retry
+// RTO follows the measured round trip (Jacobson/Karels, RFC 6298):
+// SRTT and RTTVAR from frames acknowledged on their first transmission
+// only (Karn), RTO = SRTT + max(LORA_ARQ_RTO_MARGIN_MS, 4 * RTTVAR) within
+// [minRtoMs, maxRtoMs]. The margin stands in for RFC 6298's clock
+// granularity G: a steady link has RTTVAR 0, and a timer of exactly SRTT
+// would fire for every answer that is a little late.
+//
+// The receiver hands every messageID to accept() once; repeats of frames
+// whose SACK was lost return false and are not handled again.
+//
+// messageIDs are 16 bit and compared with serial arithmetic, so they may
+// wrap. The window is at most 32 frames, the width of ackBitmap.
+// Time is passed in (millis()), so the classes run on the host as well.
+#define LORA_ARQ_MAX_WINDOW 32
+#ifndef LORA_ARQ_RTO_MARGIN_MS
+#define LORA_ARQ_RTO_MARGIN_MS 100
+#endif
+
+static inline bool lora_arq_before(uint16_t a, uint16_t b) { return (int16_t)(a - b) < 0; }
+
+template <size_t SLOTS = 8>
+class LoraArqSender
+{
+    static_assert(SLOTS <= LORA_ARQ_MAX_WINDOW, "window wider than the SACK bitmap");
+
+public:
+    void begin(size_t window_ = SLOTS, uint32_t initialRtoMs = 3000, uint32_t minRtoMs_ = 200,
+               uint32_t maxRtoMs_ = 60000, uint8_t maxRetries_ = 8) {
+        window = window_ > 0 && window_ <= SLOTS ? window_ : SLOTS;
+        rtoMs = initialRtoMs;
+        minRtoMs = minRtoMs_;
+        maxRtoMs = maxRtoMs_;
+        maxRetries = maxRetries_;
+        srttMs = 0;
+        rttvarMs = 0;
+        for (size_t i = 0; i < SLOTS; ++i)
+            slots[i].used = false;
+        inFlight = 0;
+    }
+
+    // The window spans messageIDs, not just a frame count: a new frame may
+    // be at most window - 1 after the oldest one still outstanding, so the
+    // receiver's bitmap always covers everything in flight.
+    bool canSend(uint16_t messageID) const {
+        if (inFlight >= window)
+            return false;
+        for (size_t i = 0; i < SLOTS; ++i) {
+            if (slots[i].used && (uint16_t)(messageID - slots[i].id) >= window)
+                return false;
+        }
+        return true;
+    }
+    size_t outstanding() const { return inFlight; }
+    uint32_t rto() const { return rtoMs; }
+
+    // Track a frame handed to the module. False if the window is full.
+    bool sent(uint16_t messageID, const lora_frame_t &frame, uint32_t nowMs) {
+        if (!canSend(messageID))
+            return false;
+        for (size_t i = 0; i < SLOTS; ++i) {
+            Slot &s = slots[i];
+            if (s.used)
+                continue;
+            s.used = true;
+            s.id = messageID;
+            s.frame = frame;
+            s.sentMs = nowMs;
+            s.retries = 0;
+            s.gap = false;
+            inFlight++;
+            frames++;
+            return true;
+        }
+        return false;
+    }
+
+    // Apply a SACK. Returns the number of frames it acknowledged.
+    size_t acked(const lora_sack_payload_t &sack, uint32_t nowMs) {
+        size_t n = 0;
+        bool newest = false;
+        uint16_t newestId = 0;
+        for (size_t i = 0; i < SLOTS; ++i) {
+            Slot &s = slots[i];
+            if (!s.used || !covers(sack, s.id))
+                continue;
+            if (s.retries == 0)
+                sample(nowMs - s.sentMs);
+            if (!newest || lora_arq_before(newestId, s.id))
+                newestId = s.id;
+            newest = true;
+            s.used = false;
+            inFlight--;
+            n++;
+        }
+        // Older frames still missing after a newer one arrived were lost
+        for (size_t i = 0; i < SLOTS && newest; ++i) {
+            if (slots[i].used && lora_arq_before(slots[i].id, newestId))
+                slots[i].gap = true;
+        }
+        delivered += n;
+        return n;
+    }
+
+    // Next frame to send again, NULL if none is due. Frames that used up
+    // maxRetries are given up and counted in failed.
+    const lora_frame_t *due(uint32_t nowMs, uint16_t *messageID) {
+        for (size_t i = 0; i < SLOTS; ++i) {
+            Slot &s = slots[i];
+            if (!s.used)
+                continue;
+            uint32_t timeout = backoff(s.retries);
+            if (!s.gap && nowMs - s.sentMs < timeout)
+                continue;
+            if (s.retries >= maxRetries) {
+                s.used = false;
+                inFlight--;
+                failed++;
+                continue;
+            }
+            *messageID = s.id;
+            return &s.frame;
+        }
+        return NULL;
+    }
+
+    // The frame returned by due() went out again
+    void resent(uint16_t messageID, uint32_t nowMs) {
+        for (size_t i = 0; i < SLOTS; ++i) {
+            Slot &s = slots[i];
+            if (s.used && s.id == messageID) {
+                s.sentMs = nowMs;
+                s.retries++;
+                s.gap = false;
+                retransmits++;
+                return;
+            }
+        }
+    }
+
+    // Milliseconds until the next timer runs out, UINT32_MAX if none runs
+    uint32_t nextTimeoutMs(uint32_t nowMs) const {
+        uint32_t next = UINT32_MAX;
+        for (size_t i = 0; i < SLOTS; ++i) {
+            const Slot &s = slots[i];
+            if (!s.used)
+                continue;
+            uint32_t age = nowMs - s.sentMs;
+            uint32_t timeout = backoff(s.retries);
+            uint32_t left = s.gap || age >= timeout ? 0 : timeout - age;
+            if (left < next)
+                next = left;
+        }
+        return next;
+    }
+
+    uint32_t frames = 0;       // New frames sent
+    uint32_t retransmits = 0;  // Frames sent again
+    uint32_t delivered = 0;    // Frames acknowledged
+    uint32_t failed = 0;       // Frames given up after maxRetries
+    uint32_t srttMs = 0;       // Smoothed round trip, 0 until the first sample
+    uint32_t rttvarMs = 0;
+
+private:
+    struct Slot {
+        lora_frame_t frame;
+        uint32_t sentMs;
+        uint16_t id;
+        uint8_t retries;
+        bool gap;
+        bool used;
+    };
+
+    static bool covers(const lora_sack_payload_t &sack, uint16_t id) {
+        if (lora_arq_before(id, sack.ackNext))
+            return true;
+        uint16_t bit = (uint16_t)(id - sack.ackNext - 1);
+        return id != sack.ackNext && bit < 32 && (sack.ackBitmap >> bit) & 1;
+    }
+
+    uint32_t backoff(uint8_t retries) const {
+        uint32_t t = rtoMs << (retries < 8 ? retries : 8);
+        return t < maxRtoMs ? t : maxRtoMs;
+    }
+
+    void sample(uint32_t rttMs) {
+        if (srttMs == 0) {
+            srttMs = rttMs;
+            rttvarMs = rttMs / 2;
+        } else {
+            uint32_t err = srttMs > rttMs ? srttMs - rttMs : rttMs - srttMs;
+            rttvarMs = (3 * rttvarMs + err) / 4;
+            srttMs = (7 * srttMs + rttMs) / 8;
+        }
+        uint32_t rto = srttMs + (4 * rttvarMs > LORA_ARQ_RTO_MARGIN_MS ? 4 * rttvarMs : LORA_ARQ_RTO_MARGIN_MS);
+        rtoMs = rto < minRtoMs ? minRtoMs : rto > maxRtoMs ? maxRtoMs : rto;
+    }
+
+    Slot slots[SLOTS];
+    size_t window = SLOTS;
+    size_t inFlight = 0;
+    uint32_t rtoMs = 3000;
+    uint32_t minRtoMs = 200;
+    uint32_t maxRtoMs = 60000;
+    uint8_t maxRetries = 8;
+};
+
+// Receiving side: duplicate suppression and the SACK state
+class LoraArqReceiver
+{
+public:
+    // True the first time a messageID arrives, false for a repeat
+    bool accept(uint16_t id) {
+        if (!started || lora_arq_before(id, (uint16_t)(next - RESTART_DISTANCE)) ||
+            !lora_arq_before(id, (uint16_t)(next + RESTART_DISTANCE))) {
+            // First frame, or far off: the sender restarted its counter.
+            // Frames before this one may still be on their way, so the
+            // window starts behind it; gaps nobody fills are given up later.
+            started = true;
+            next = (uint16_t)(id - (LORA_ARQ_MAX_WINDOW - 1));
+            bitmap = 1UL << (LORA_ARQ_MAX_WINDOW - 2);
+            restarts++;
+            accepted++;
+            return true;
+        }
+        if (lora_arq_before(id, next) || (id != next && isSet(id))) {
+            duplicates++;
+            return false;
+        }
+        // Beyond the bitmap: give up the oldest gaps
+        while (id != next && (uint16_t)(id - next - 1) >= LORA_ARQ_MAX_WINDOW)
+            advance();
+        if (id == next)
+            advance();
+        else
+            bitmap |= 1UL << (uint16_t)(id - next - 1);
+        accepted++;
+        return true;
+    }
+
+    // Fill in the SACK for what arrived so far
+    void sack(lora_sack_payload_t *sack) const {
+        sack->ackNext = next;
+        sack->ackBitmap = bitmap;
+    }
+
+    bool pending() const { return started; }
+
+    uint32_t accepted = 0;    // New messageIDs
+    uint32_t duplicates = 0;  // Repeats suppressed
+    uint32_t restarts = 0;    // Counter jumps taken as a new sender session
+
+private:
+    // A jump this far is a new session, not reordering
+    static const uint16_t RESTART_DISTANCE = 1024;
+
+    bool isSet(uint16_t id) const {
+        uint16_t bit = (uint16_t)(id - next - 1);
+        return bit < LORA_ARQ_MAX_WINDOW && (bitmap >> bit) & 1;
+    }
+
+    // Move ackNext past a received frame or a gap given up, and past
+    // the frames that arrived after it
+    void advance() {
+        bool have;
+        do {
+            next++;
+            have = bitmap & 1;
+            bitmap >>= 1;
+        } while (have);
+    }
+
+    uint16_t next = 0;
+    uint32_t bitmap = 0;
+    bool started = false;
+};
+
+// Usage, sender:
+// if (arq.canSend(id)) { send(frame); arq.sent(id, frame, millis()); }
+// on SACK:           arq.acked(sack, millis());
+// periodically:      while ((f = arq.due(millis(), &id))) { send(*f); arq.resent(id, millis()); }
+//
+// Receiver:
+// if (arqRx.accept(payload.messageID)) handle(payload);
+// after the burst:  lora_sack_payload_t sack = lora_message_init<LORA_EVENT_SACK>(id++);
+//                   arqRx.sack(&sack); lora_message_encode(&frame, &sack); send(frame);
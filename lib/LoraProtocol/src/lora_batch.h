@@ -0,0 +1,193 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lora_checksum.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+
+// Several messages in one E32 packet. Every air packet costs 12 bytes of
+// preamble and header plus the UART transfer and start gap, almost as
+// much as a 14 byte lora_payload_t; three messages in one frame share it.
+//
+// A batch is a frame of its own event ID:
+//   lora_batch_header_t | message | message | ... | checksum (uint16_t)
+// The messages are complete structs of any type in LORA_MESSAGE_LIST,
+// including their own checksum, so handlers validate them as if they had
+// arrived alone. Their size comes from the registry by lora_eventID.
+// The header carries the frame length, which lets the delimiter framing
+// find the end of the variable length frame (LoraFrameDecoder::acceptVariable).
+//
+// LoraBatchWriter collects messages and flushes when the next one does not
+// fit (flush on size) or the oldest has waited maxAgeMs (flush on age).
+// A batch of one message is sent as the plain message, so a receiver that
+// does not know batches still gets single messages.
+#ifndef LORA_EVENT_BATCH
+#define LORA_EVENT_BATCH 0x0100              // Container, outside the RainSensor command range
+#endif
+
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;                   // LORA_EVENT_BATCH
+    uint8_t count;                           // Messages that follow
+    uint8_t length;                          // Payload length including header and checksum
+} lora_batch_header_t;
+
+#define LORA_BATCH_OVERHEAD (sizeof(lora_batch_header_t) + sizeof(uint16_t))
+#define LORA_BATCH_LENGTH_OFFSET offsetof(lora_batch_header_t, length)
+
+class LoraBatchWriter
+{
+public:
+    void begin(uint32_t maxAgeMs_, size_t maxLen_ = LORA_MAX_PAYLOAD_SIZE) {
+        maxAgeMs = maxAgeMs_;
+        maxLen = maxLen_ < sizeof(buf) ? maxLen_ : sizeof(buf);
+        clear();
+    }
+
+    // Add a message (checksum already set). Returns false if it does not
+    // fit any more: flush() first.
+    template <typename T>
+    bool add(const T &msg, uint32_t nowMs) {
+        if (!fits(sizeof(T)))
+            return false;
+        if (count == 0)
+            firstMs = nowMs;
+        memcpy(buf + len, &msg, sizeof(T));
+        len += sizeof(T);
+        count++;
+        return true;
+    }
+
+    // A second message turns the frame into a batch with header and checksum
+    bool fits(size_t size) const { return len + size + (count > 0 ? LORA_BATCH_OVERHEAD : 0) <= maxLen; }
+    bool empty() const { return count == 0; }
+    uint8_t messages() const { return count; }
+
+    // Oldest message has waited maxAgeMs
+    bool due(uint32_t nowMs) const { return count > 0 && nowMs - firstMs >= maxAgeMs; }
+    // Milliseconds until due(), for the caller's wait
+    uint32_t dueInMs(uint32_t nowMs) const {
+        if (count == 0)
+            return UINT32_MAX;
+        uint32_t age = nowMs - firstMs;
+        return age >= maxAgeMs ? 0 : maxAgeMs - age;
+    }
+
+    // Frame the collected messages and start over. Returns the frame length.
+    size_t flush(lora_frame_t *frame, uint16_t messageID) {
+        uint8_t payload[LORA_MAX_PAYLOAD_SIZE];
+        size_t n = take(payload, messageID);
+        return lora_frame_encode(frame, payload, n);
+    }
+
+    // The payload flush() would frame, for senders that put something in
+    // front of it (lora_frame_encode_from()), LORA_MAX_PAYLOAD_SIZE bytes at
+    // most. Starts over. Returns its length.
+    size_t take(uint8_t *payload, uint16_t messageID) {
+        size_t n = len;
+        if (count == 1) {
+            memcpy(payload, buf, len);
+        } else {
+            lora_batch_header_t header = {messageID, LORA_EVENT_BATCH, count, (uint8_t)(len + LORA_BATCH_OVERHEAD)};
+            memcpy(payload, &header, sizeof(header));
+            memcpy(payload + sizeof(header), buf, len);
+            uint16_t checksum = lora_checksum(payload, sizeof(header) + len);
+            memcpy(payload + sizeof(header) + len, &checksum, sizeof(checksum));
+            n = header.length;
+        }
+        clear();
+        return n;
+    }
+
+private:
+    void clear() {
+        len = 0;
+        count = 0;
+    }
+
+    uint8_t buf[LORA_MAX_PAYLOAD_SIZE];
+    size_t len = 0;
+    uint8_t count = 0;
+    uint32_t firstMs = 0;
+    uint32_t maxAgeMs = 0;
+    size_t maxLen = LORA_MAX_PAYLOAD_SIZE;
+};
+
+// Walks the messages of a received payload: the messages of a batch, or
+// the payload itself if it is a single message
+class LoraBatchReader
+{
+public:
+    LoraBatchReader(const uint8_t *payload_, size_t len_) : payload(payload_), len(len_) {
+        if (len >= sizeof(lora_batch_header_t) && lora_message_event(payload) == LORA_EVENT_BATCH) {
+            batch = true;
+            memcpy(&header, payload, sizeof(header));
+            uint16_t checksum;
+            memcpy(&checksum, payload + len - sizeof(checksum), sizeof(checksum));
+            valid = header.length == len && len >= LORA_BATCH_OVERHEAD &&
+                    lora_checksum(payload, len - sizeof(checksum)) == checksum;
+            pos = sizeof(header);
+            end = len - sizeof(checksum);
+            remaining = header.count;
+            // count messages of their registry sizes must fill the batch
+            // exactly, else none is handed out
+            size_t at = pos;
+            for (uint8_t i = 0; valid && i < header.count; ++i) {
+                const lora_message_info_t *info = end - at >= 4 ? lora_message_find(lora_message_event(payload + at)) : NULL;
+                valid = info != NULL && at + info->size <= end;
+                at += valid ? info->size : 0;
+            }
+            valid = valid && header.count > 0 && at == end;
+        } else {
+            valid = len > 0;
+            end = len;
+            remaining = 1;
+        }
+    }
+
+    // Next message, false at the end or if the batch is malformed
+    bool next(const uint8_t **msg, size_t *msgLen) {
+        if (!valid || remaining == 0 || pos >= end)
+            return false;
+        size_t size = end - pos;
+        if (batch) {
+            const lora_message_info_t *info = end - pos >= 4 ? lora_message_find(lora_message_event(payload + pos)) : NULL;
+            if (info == NULL || pos + info->size > end) {
+                valid = false;
+                return false;
+            }
+            size = info->size;
+        }
+        *msg = payload + pos;
+        *msgLen = size;
+        pos += size;
+        remaining--;
+        return true;
+    }
+
+    bool isBatch() const { return batch; }
+    uint16_t messageID() const { return batch ? header.messageID : 0; }
+    bool isValid() const { return valid; }
+
+private:
+    const uint8_t *payload;
+    size_t len;
+    lora_batch_header_t header = {0, 0, 0, 0};
+    size_t pos = 0;
+    size_t end = 0;
+    uint8_t remaining = 0;
+    bool batch = false;
+    bool valid = false;
+};
+
+// Usage:
+// writer.begin(BATCH_MAX_AGE_MS);
+// if (!writer.add(payload, millis())) { writer.flush(&frame, id++); send(frame); writer.add(payload, millis()); }
+// if (writer.due(millis())) { writer.flush(&frame, id++); send(frame); }
+//
+// LoraBatchReader reader(decoder.payload(), decoder.length());
+// const uint8_t *msg; size_t len;
+// while (reader.next(&msg, &len))
+//     handle(msg, len);
@@ -0,0 +1,132 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lora_log.h"
+
+// Capture of the raw radio traffic, to replay it on the host later
+// (LoraSender/sim, SIM_REPLAY). Every frame read from the module and every
+// frame handed to it is logged as a lora_log.h data record:
+//   LOGF_CAPTURE_RX / LOGF_CAPTURE_TX, micros(), status byte, frame bytes
+// RX is every byte read from the UART since the previous frame, garbage
+// and the fixed mode address included, as the frame decoder saw it. TX is
+// the frame given to the module without the address bytes. The status
+// tells what the sketch made of it.
+//
+// The records share the log buffer and the drain task with the other log
+// output, so capturing costs a copy per frame on the radio side and the
+// trace is the binary console output, e.g. pio device monitor --raw >
+// trace.bin (LORA_LOG_OUTPUT_BINARY). Records the buffer drops show up in
+// LOGF_LOG_STATS.
+//
+// LoraCaptureReader picks the capture records out of such a console
+// capture and unfolds micros(): it wraps after 71 minutes and starts over
+// at a reboot (LOGF_BOOT), trace time runs on across both.
+typedef enum {
+    LORA_CAPTURE_RX_OK = 0,            // Handled, answered
+    LORA_CAPTURE_RX_BAD_SIZE = 1,      // No message of a known size
+    LORA_CAPTURE_RX_BAD_BATCH = 2,     // Batch cut short or malformed
+    LORA_CAPTURE_RX_DELTA_DROPPED = 3, // Compact frame without its base
+    LORA_CAPTURE_TX_SENT = 0x10,       // Accepted by the module
+    LORA_CAPTURE_TX_ERROR = 0x11,      // Refused by the module
+    LORA_CAPTURE_TX_SKIPPED = 0x12     // Not sent, channel or duty cycle budget
+} lora_capture_status_t;
+
+// Set in the status when the frame was longer than a record holds
+#define LORA_CAPTURE_TRUNCATED 0x80
+#define LORA_CAPTURE_MAX_DATA (LORA_LOG_MAX_DATA - 1)
+
+static inline void lora_capture(uint16_t format, uint8_t status, const uint8_t *data, size_t len) {
+    uint8_t buf[LORA_LOG_MAX_DATA];
+    if (len > LORA_CAPTURE_MAX_DATA) {
+        status |= LORA_CAPTURE_TRUNCATED;
+        len = LORA_CAPTURE_MAX_DATA;
+    }
+    buf[0] = status;
+    memcpy(buf + 1, data, len);
+    lora_log_data(LORA_LOG_LEVEL_INFO, format, buf, len + 1);
+}
+
+// A frame read from the module
+static inline void lora_capture_rx(uint8_t status, const uint8_t *data, size_t len) {
+    lora_capture(LOGF_CAPTURE_RX, status, data, len);
+}
+
+// A frame given to the module (or skipped)
+static inline void lora_capture_tx(uint8_t status, const uint8_t *data, size_t len) {
+    lora_capture(LOGF_CAPTURE_TX, status, data, len);
+}
+
+typedef struct {
+    uint64_t us;               // Trace time: micros(), unfolded
+    bool tx;                   // LOGF_CAPTURE_TX
+    uint8_t status;            // lora_capture_status_t | LORA_CAPTURE_TRUNCATED
+    uint8_t len;
+    uint8_t data[LORA_CAPTURE_MAX_DATA];
+} lora_capture_entry_t;
+
+// Console capture -> capture entries, one byte at a time (host tools)
+class LoraCaptureReader
+{
+public:
+    // true once entry holds the next capture record
+    bool push(uint8_t b, lora_capture_entry_t *entry) {
+        if (b != 0) {
+            if (len < sizeof(chunk))
+                chunk[len++] = b;
+            else
+                overlong = true;
+            return false;
+        }
+        bool found = len > 0 && !overlong && decode(entry);
+        len = 0;
+        overlong = false;
+        return found;
+    }
+
+    uint32_t records = 0;      // Log records of any kind
+    uint32_t boots = 0;
+
+private:
+    bool decode(lora_capture_entry_t *entry) {
+        lora_log_record_t record;
+        if (!lora_log_record_decode(chunk, len, &record))
+            return false;
+        records++;
+        if (record.format == LOGF_BOOT) {
+            // micros() starts over, the trace time runs on
+            boots++;
+            baseUs = lastUs;
+        } else if ((uint32_t)record.us < lastRaw) {
+            baseUs += 1ULL << 32;
+        }
+        lastRaw = record.us;
+        lastUs = baseUs + record.us;
+        if ((record.format != LOGF_CAPTURE_RX && record.format != LOGF_CAPTURE_TX) ||
+            !(record.level & LORA_LOG_FLAG_DATA) || record.len < 1)
+            return false;
+        entry->us = lastUs;
+        entry->tx = record.format == LOGF_CAPTURE_TX;
+        entry->status = record.data[0];
+        entry->len = (uint8_t)(record.len - 1);
+        memcpy(entry->data, record.data + 1, entry->len);
+        return true;
+    }
+
+    uint8_t chunk[2 * sizeof(lora_log_record_t)];
+    size_t len = 0;
+    bool overlong = false;
+    uint64_t baseUs = 0;
+    uint64_t lastUs = 0;
+    uint32_t lastRaw = 0;
+};
+
+// Usage:
+// device, with -D CAPTURE_MODE=1:
+//   lora_capture_rx(LORA_CAPTURE_RX_OK, raw, rawLen);
+//   lora_capture_tx(LORA_CAPTURE_TX_SENT, frame.data, frame.len);
+// host:
+//   LoraCaptureReader reader;  lora_capture_entry_t e;
+//   while ((c = fgetc(f)) != EOF)
+//     if (reader.push((uint8_t)c, &e)) ... e.us, e.tx, e.status, e.data ...
@@ -0,0 +1,137 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Integrity check over the packed payload structs, selected by LORA_CHECKSUM.
+// Every struct ends with a uint16_t checksum field that covers all bytes
+// before it.
+//
+// LORA_CHECKSUM_SUM (default, what the RainSensor firmware speaks):
+//   16 bit byte sum, same as lora_payload_checksum() and
+//   LORA_CALCULATE_CHECKSUM in communication.h. Misses swapped bytes and
+//   many multi-bit errors.
+// LORA_CHECKSUM_CRC16:
+//   CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), table driven. Detects
+//   all 1-3 bit errors, all odd bit counts and all bursts up to 16 bits.
+// Both ends must be built with the same setting.
+#define LORA_CHECKSUM_SUM 0
+#define LORA_CHECKSUM_CRC16 1
+#ifndef LORA_CHECKSUM
+#define LORA_CHECKSUM LORA_CHECKSUM_SUM
+#endif
+
+#define LORA_CRC16_POLY 0x1021
+#define LORA_CRC16_INIT 0xFFFF
+
+static inline uint16_t lora_sum16(const uint8_t *data, size_t len) {
+    uint16_t sum = 0;
+    for (size_t i = 0; i < len; ++i)
+        sum += data[i];
+    return sum;
+}
+
+// Bit by bit reference, used to check the table
+static inline uint16_t lora_crc16_bitwise(const uint8_t *data, size_t len) {
+    uint16_t crc = LORA_CRC16_INIT;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ LORA_CRC16_POLY) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+#ifdef __cplusplus
+// CRC lookup table generated by the compiler. C++11 constexpr (single
+// return statement) so it also builds with older ESP32 Arduino cores;
+// the table lands in flash, no start-up code.
+constexpr uint16_t lora_crc16_shift(uint16_t crc, int bits) {
+    return bits == 0 ? crc
+                     : lora_crc16_shift((crc & 0x8000) ? (uint16_t)((crc << 1) ^ LORA_CRC16_POLY) : (uint16_t)(crc << 1),
+                                        bits - 1);
+}
+
+constexpr uint16_t lora_crc16_entry(size_t index) {
+    return lora_crc16_shift((uint16_t)(index << 8), 8);
+}
+
+template <size_t... I>
+struct LoraCrc16Table {
+    static constexpr uint16_t table[sizeof...(I)] = {lora_crc16_entry(I)...};
+};
+template <size_t... I>
+constexpr uint16_t LoraCrc16Table<I...>::table[sizeof...(I)];
+
+template <size_t N, size_t... I>
+struct LoraCrc16TableBuilder : LoraCrc16TableBuilder<N - 1, N - 1, I...> {};
+template <size_t... I>
+struct LoraCrc16TableBuilder<0, I...> {
+    typedef LoraCrc16Table<I...> type;
+};
+
+typedef LoraCrc16TableBuilder<256>::type lora_crc16_table;
+static_assert(lora_crc16_table::table[1] == 0x1021, "CRC-16 table");
+static_assert(lora_crc16_table::table[255] == 0x1EF0, "CRC-16 table");
+
+static inline uint16_t lora_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = LORA_CRC16_INIT;
+    for (size_t i = 0; i < len; ++i)
+        crc = (uint16_t)((crc << 8) ^ lora_crc16_table::table[(uint8_t)((crc >> 8) ^ data[i])]);
+    return crc;
+}
+
+// CRC-32 (IEEE 802.3, reflected poly 0xEDB88320), for data that outlives
+// a frame, e.g. the flash log blocks (lora_flash_log.h). Same table trick.
+#define LORA_CRC32_POLY 0xEDB88320u
+
+constexpr uint32_t lora_crc32_shift(uint32_t crc, int bits) {
+    return bits == 0 ? crc : lora_crc32_shift((crc & 1) ? (crc >> 1) ^ LORA_CRC32_POLY : crc >> 1, bits - 1);
+}
+
+template <size_t... I>
+struct LoraCrc32Table {
+    static constexpr uint32_t table[sizeof...(I)] = {lora_crc32_shift((uint32_t)I, 8)...};
+};
+template <size_t... I>
+constexpr uint32_t LoraCrc32Table<I...>::table[sizeof...(I)];
+
+template <size_t N, size_t... I>
+struct LoraCrc32TableBuilder : LoraCrc32TableBuilder<N - 1, N - 1, I...> {};
+template <size_t... I>
+struct LoraCrc32TableBuilder<0, I...> {
+    typedef LoraCrc32Table<I...> type;
+};
+
+typedef LoraCrc32TableBuilder<256>::type lora_crc32_table;
+static_assert(lora_crc32_table::table[1] == 0x77073096, "CRC-32 table");
+static_assert(lora_crc32_table::table[255] == 0x2D02EF8D, "CRC-32 table");
+
+// crc continues an earlier call over the data before
+static inline uint32_t lora_crc32(const uint8_t *data, size_t len, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+        crc = (crc >> 8) ^ lora_crc32_table::table[(uint8_t)(crc ^ data[i])];
+    return ~crc;
+}
+
+// Checksum of len bytes with the configured algorithm
+static inline uint16_t lora_checksum(const void *data, size_t len) {
+#if LORA_CHECKSUM == LORA_CHECKSUM_CRC16
+    return lora_crc16((const uint8_t *)data, len);
+#else
+    return lora_sum16((const uint8_t *)data, len);
+#endif
+}
+
+// Checksum of a packed payload struct, all bytes before the trailing
+// checksum field. Use instead of lora_payload_checksum() /
+// lora_config_payload_checksum() so the protocol flag applies.
+template <typename T>
+static inline uint16_t lora_message_checksum(const T *payload) {
+    return lora_checksum(payload, sizeof(T) - sizeof(uint16_t));
+}
+#endif
+
+// Usage:
+// payload.checksum = lora_message_checksum(&payload);
+// bool ok = lora_message_checksum(&payload) == payload.checksum;
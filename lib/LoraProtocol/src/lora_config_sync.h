@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+
+// Versioned sensor config. Sending the whole lora_config_payload_t every
+// few messages costs a transmission of its own (and a missed ACK) even
+// though the values hardly ever change.
+//
+// Instead the config carries a version in reserved2: a hash of its values,
+// never 0. The sensor echoes the version it applied in its
+// SET_CONFIG_RESPONSE (the same struct with the applied values); a
+// response without it gets the version from its values, which is the same
+// figure. The bridge keeps the version each sensor runs (0 = unknown) and
+// adds the config to the ACK batch (lora_batch.h) only while that differs
+// from the current one. Changing a value changes the version, so every
+// sensor gets the new config with its next ACK and none after echoing it.
+//
+// A 16 bit hash lets two configs share a version once in 65535 changes;
+// the one affected sensor then keeps the older values until the next
+// change.
+
+// Version of the values in a SET_CONFIG / SET_CONFIG_RESPONSE
+// (FNV-1a over the value bytes, folded to 16 bits)
+static inline uint16_t lora_config_version(const lora_config_payload_t *config) {
+    const uint8_t values[] = {
+        config->ulp_pulses_to_wake_up,
+        (uint8_t)config->wakeup_interval_sec, (uint8_t)(config->wakeup_interval_sec >> 8),
+        (uint8_t)config->shutdown_delay_ms, (uint8_t)(config->shutdown_delay_ms >> 8),
+        (uint8_t)config->lora_receive_delay_ms, (uint8_t)(config->lora_receive_delay_ms >> 8),
+    };
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(values); ++i) {
+        h ^= values[i];
+        h *= 16777619u;
+    }
+    uint16_t version = (uint16_t)(h ^ (h >> 16));
+    return version != 0 ? version : 1;
+}
+
+class LoraConfigSync
+{
+public:
+    // New values; true if the version changed
+    bool set(uint8_t ulpPulses, uint16_t wakeupSec, uint16_t shutdownMs, uint16_t loraDelayMs) {
+        config.ulp_pulses_to_wake_up = ulpPulses;
+        config.wakeup_interval_sec = wakeupSec;
+        config.shutdown_delay_ms = shutdownMs;
+        config.lora_receive_delay_ms = loraDelayMs;
+        uint16_t previous = config.reserved2;
+        config.reserved2 = lora_config_version(&config);
+        return config.reserved2 != previous;
+    }
+
+    uint16_t version() const { return config.reserved2; }
+
+    // Whether a sensor running version applied needs the config
+    bool due(uint16_t applied) const { return applied != config.reserved2; }
+
+    // SET_CONFIG to add to an ACK, checksum set
+    lora_config_payload_t message(uint16_t messageID) const {
+        lora_config_payload_t msg = config;
+        msg.messageID = messageID;
+        msg.lora_eventID = LORA_EVENT_SET_CONFIG;
+        msg.checksum = lora_message_checksum(&msg);
+        return msg;
+    }
+
+    // Version a sensor reports with its SET_CONFIG_RESPONSE
+    static uint16_t echoed(const lora_config_payload_t &response) {
+        return response.reserved2 != 0 ? response.reserved2 : lora_config_version(&response);
+    }
+
+private:
+    lora_config_payload_t config = {};
+};
+
+// Usage, bridge:
+// configSync.set(pulses, wakeupSec, shutdownMs, delayMs);
+// on a SET_CONFIG_RESPONSE:  sensorVersion = LoraConfigSync::echoed(response);
+// with the ACK:              if (configSync.due(sensorVersion)) batch.add(configSync.message(id++), 0);
+//
+// Sensor: apply a SET_CONFIG, then send SET_CONFIG_RESPONSE with the
+// applied values and reserved2 copied from it.
@@ -0,0 +1,271 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_checksum.h"
+#include "lora_frame.h"
+#include "lora_messages.h"
+
+// Compact encoding of sensor readings (lora_payload_t, SENSOR_DATA).
+//
+// Consecutive readings differ by small amounts: the elapsed time by about
+// the wake-up interval, the pulse count by a few pulses. A compact frame
+// sends them as varint deltas against a reading the receiver already has:
+//   lora_delta_header_t | varint first ID - base ID |
+//   per reading: varint elapsed delta, varint pulse delta | checksum
+// The first reading is relative to the base (the last acknowledged
+// reading), every further reading to the one before it; message IDs
+// count up by one. The receiver rebuilds complete lora_payload_t structs
+// with checksum, so handlers see no difference.
+//
+// Negotiation is by event ID: a receiver that does not know
+// LORA_EVENT_SENSOR_DELTA does not acknowledge the frame, the sender falls
+// back to the plain message (the keyframe) and resends. A keyframe also
+// goes out every keyframeInterval frames and whenever an acknowledge was
+// missed, so a receiver that lost its base catches up.
+//
+// Sizes (14 byte lora_payload_t, 60 s interval, few pulses):
+//   1 reading 11 bytes, 3 readings 19 bytes (instead of 42), 10 readings 47.
+#ifndef LORA_EVENT_SENSOR_DELTA
+#define LORA_EVENT_SENSOR_DELTA 0x0101       // Compact sensor readings, outside the RainSensor command range
+#endif
+#ifndef LORA_DELTA_HISTORY
+#define LORA_DELTA_HISTORY 8                 // Readings the receiver keeps as possible bases
+#endif
+
+typedef struct __attribute__((packed)) {
+    uint8_t baseID;                          // Low byte of the base reading's messageID
+    uint8_t length;                          // Payload length including header and checksum
+    uint16_t lora_eventID;                   // LORA_EVENT_SENSOR_DELTA, where every message has it
+} lora_delta_header_t;
+
+#define LORA_DELTA_LENGTH_OFFSET offsetof(lora_delta_header_t, length)
+// Most readings one frame can carry (2 bytes each at least)
+#define LORA_DELTA_MAX_READINGS ((LORA_MAX_PAYLOAD_SIZE - sizeof(lora_delta_header_t) - 1 - sizeof(uint16_t)) / 2)
+#define LORA_VARINT_MAX 5
+
+// LEB128: 7 bits per byte, low group first, high bit = more follows
+static inline size_t lora_varint_put(uint8_t *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Returns the bytes consumed, 0 if truncated or longer than 32 bits
+static inline size_t lora_varint_get(const uint8_t *in, size_t len, uint32_t *value) {
+    uint32_t v = 0;
+    for (size_t i = 0; i < len && i < LORA_VARINT_MAX; ++i) {
+        v |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static inline size_t lora_varint_size(uint32_t value) {
+    size_t n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+// Sender side (rain sensor)
+class LoraDeltaEncoder
+{
+public:
+    void begin(uint16_t keyframeInterval_) {
+        keyframeInterval = keyframeInterval_;
+        hasBase = false;
+        sinceKey = 0;
+        pendingCount = 0;
+    }
+
+    // Encode readings[0..n) (SENSOR_DATA, consecutive message IDs) into one
+    // frame. Returns how many readings the frame holds: all that fit for a
+    // compact frame, 1 for a keyframe; the caller sends the rest in the
+    // next frame(s).
+    size_t encode(lora_frame_t *frame, const lora_payload_t *readings, size_t n) {
+        frame->len = 0;
+        if (n == 0)
+            return 0;
+        if (!hasBase || (keyframeInterval && sinceKey >= keyframeInterval) || readings[0].messageID == base.messageID) {
+            lora_payload_t key = readings[0];
+            lora_message_encode(frame, &key);
+            pending = key;
+            pendingCount = 1;
+            keyframe = true;
+            return 1;
+        }
+
+        uint8_t payload[LORA_MAX_PAYLOAD_SIZE];
+        size_t len = sizeof(lora_delta_header_t);
+        len += lora_varint_put(payload + len, (uint16_t)(readings[0].messageID - base.messageID));
+        const lora_payload_t *prev = &base;
+        size_t count = 0;
+        for (; count < n; ++count) {
+            const lora_payload_t &r = readings[count];
+            if (count > 0 && r.messageID != (uint16_t)(prev->messageID + 1))
+                break;
+            uint32_t dt = r.elapsed_time_ms - prev->elapsed_time_ms;
+            uint32_t dp = r.pulse_count - prev->pulse_count;
+            if (len + lora_varint_size(dt) + lora_varint_size(dp) + sizeof(uint16_t) > sizeof(payload))
+                break;
+            len += lora_varint_put(payload + len, dt);
+            len += lora_varint_put(payload + len, dp);
+            prev = &r;
+        }
+        lora_delta_header_t header = {(uint8_t)base.messageID, (uint8_t)(len + sizeof(uint16_t)), LORA_EVENT_SENSOR_DELTA};
+        memcpy(payload, &header, sizeof(header));
+        uint16_t checksum = lora_checksum(payload, len);
+        memcpy(payload + len, &checksum, sizeof(checksum));
+        lora_frame_encode(frame, payload, header.length);
+        pending = *prev;
+        pendingCount = count;
+        keyframe = false;
+        return count;
+    }
+
+    // The last encoded frame was acknowledged: its last reading is the new base
+    void acked() {
+        if (pendingCount == 0)
+            return;
+        base = pending;
+        hasBase = true;
+        if (keyframe) {
+            sinceKey = 0;
+            keyframes++;
+        } else {
+            sinceKey++;
+            deltas++;
+        }
+        pendingCount = 0;
+    }
+
+    // No acknowledge: the receiver may not have the base or not speak the
+    // compact format, the next frame is a keyframe
+    void lost() {
+        if (pendingCount != 0 && !keyframe)
+            fallbacks++;
+        hasBase = false;
+        pendingCount = 0;
+    }
+
+    uint32_t keyframes = 0;  // Acknowledged keyframes
+    uint32_t deltas = 0;     // Acknowledged compact frames
+    uint32_t fallbacks = 0;  // Compact frames not acknowledged
+
+private:
+    lora_payload_t base;
+    lora_payload_t pending;
+    size_t pendingCount = 0;
+    bool hasBase = false;
+    bool keyframe = false;
+    uint16_t keyframeInterval = 16;
+    uint16_t sinceKey = 0;
+};
+
+// Receiver side: remembers the last readings and expands compact frames
+class LoraDeltaDecoder
+{
+public:
+    // A plain SENSOR_DATA reading arrived (keyframe), or one was decoded
+    void remember(const lora_payload_t &reading) {
+        history[next] = reading;
+        next = (next + 1) % LORA_DELTA_HISTORY;
+        if (count < LORA_DELTA_HISTORY)
+            count++;
+    }
+
+    // Expand a compact frame into up to max readings. Returns the number of
+    // readings, 0 if the frame is malformed or its base is unknown (then
+    // do not acknowledge, the sender answers with a keyframe).
+    size_t decode(const uint8_t *payload, size_t len, lora_payload_t *out, size_t max) {
+        lora_delta_header_t header;
+        uint16_t checksum;
+        if (len < sizeof(header) + 1 + sizeof(checksum))
+            return fail(&malformed);
+        memcpy(&header, payload, sizeof(header));
+        memcpy(&checksum, payload + len - sizeof(checksum), sizeof(checksum));
+        if (header.lora_eventID != LORA_EVENT_SENSOR_DELTA || header.length != len ||
+            lora_checksum(payload, len - sizeof(checksum)) != checksum)
+            return fail(&malformed);
+
+        const lora_payload_t *base = find(header.baseID);
+        if (base == NULL)
+            return fail(&missingBase);
+
+        size_t end = len - sizeof(checksum);
+        size_t pos = sizeof(header);
+        uint32_t idDelta;
+        size_t used = lora_varint_get(payload + pos, end - pos, &idDelta);
+        if (used == 0)
+            return fail(&malformed);
+        pos += used;
+        lora_payload_t prev = *base;
+        uint16_t id = (uint16_t)(base->messageID + idDelta);
+        size_t n = 0;
+        while (pos < end && n < max) {
+            uint32_t dt, dp;
+            size_t a = lora_varint_get(payload + pos, end - pos, &dt);
+            size_t b = a ? lora_varint_get(payload + pos + a, end - pos - a, &dp) : 0;
+            if (b == 0)
+                return fail(&malformed);
+            pos += a + b;
+            lora_payload_t r = lora_message_init<LORA_EVENT_SENSOR_DATA>(id++);
+            r.elapsed_time_ms = prev.elapsed_time_ms + dt;
+            r.pulse_count = prev.pulse_count + dp;
+            r.checksum = lora_message_checksum(&r);
+            out[n++] = r;
+            prev = r;
+        }
+        if (pos != end)
+            return fail(&malformed);
+        for (size_t i = 0; i < n; ++i)
+            remember(out[i]);
+        frames++;
+        return n;
+    }
+
+    uint32_t frames = 0;       // Compact frames expanded
+    uint32_t missingBase = 0;  // Base reading not (any more) known
+    uint32_t malformed = 0;    // Bad length, checksum or varint
+
+private:
+    const lora_payload_t *find(uint8_t baseID) const {
+        // Newest first; IDs within the history differ in the low byte
+        for (size_t i = 1; i <= count; ++i) {
+            const lora_payload_t &r = history[(next + LORA_DELTA_HISTORY - i) % LORA_DELTA_HISTORY];
+            if ((uint8_t)r.messageID == baseID)
+                return &r;
+        }
+        return NULL;
+    }
+
+    size_t fail(uint32_t *counter) {
+        (*counter)++;
+        return 0;
+    }
+
+    lora_payload_t history[LORA_DELTA_HISTORY];
+    size_t next = 0;
+    size_t count = 0;
+};
+
+// Usage, sensor:
+// size_t n = delta.encode(&frame, readings, pending);  // send frame, wait for ACK
+// if (ack) { delta.acked(); drop n readings; } else delta.lost();
+//
+// Receiver:
+// if (lora_message_event(payload) == LORA_EVENT_SENSOR_DELTA)
+//     n = delta.decode(payload, len, readings, max);    // 0: no ACK
+// else if (plain SENSOR_DATA) delta.remember(reading);
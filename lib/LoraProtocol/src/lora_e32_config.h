@@ -0,0 +1,181 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "LoRa_E32.h"
+#include "lora_checksum.h"
+#include "lora_tx_scheduler.h"
+
+// E32 parameters at startup without rewriting them every boot. Each
+// setConfiguration(WRITE_CFG_PWR_DWN_SAVE) is an EEPROM write in the
+// module and two mode switches; most boots would write what is already
+// there.
+//
+// lora_e32_config_apply() compares the wanted parameters (ADDH, ADDL,
+// SPED, CHAN, OPTION) with the last ones known to be in the module,
+// cached in RTC memory: RTC_DATA_ATTR survives deep sleep and software
+// resets but not a power cycle, so the cache carries a magic and a CRC and
+// counts only when both match. On a hit the module is not touched at all.
+// Otherwise the parameters are read from the module, written only if they
+// differ and read back to verify; the cache then holds what the module
+// has.
+typedef enum {
+    LORA_E32_CONFIG_CACHED = 0,   // RTC cache matched, module not touched
+    LORA_E32_CONFIG_MATCHED = 1,  // Read from the module, already right
+    LORA_E32_CONFIG_WRITTEN = 2,  // Written and verified
+    LORA_E32_CONFIG_FAILED = 3    // Read, write or verify failed
+} lora_e32_config_result_t;
+
+#define LORA_E32_CONFIG_BYTES 5
+#define LORA_E32_CONFIG_MAGIC 0xE32Cu
+
+typedef struct {
+    uint16_t magic;
+    uint8_t bytes[LORA_E32_CONFIG_BYTES]; // ADDH, ADDL, SPED, CHAN, OPTION
+    uint16_t crc;                         // CRC-16 of magic and bytes
+} lora_e32_config_cache_t;
+
+// The parameter bytes as the module stores them
+static inline void lora_e32_config_bytes(const Configuration &config, uint8_t *bytes) {
+    bytes[0] = config.ADDH;
+    bytes[1] = config.ADDL;
+    memcpy(&bytes[2], &config.SPED, 1);
+    bytes[3] = config.CHAN;
+    memcpy(&bytes[4], &config.OPTION, 1);
+}
+
+static inline uint16_t lora_e32_config_cache_crc(const lora_e32_config_cache_t *cache) {
+    uint8_t data[sizeof(cache->magic) + LORA_E32_CONFIG_BYTES];
+    memcpy(data, &cache->magic, sizeof(cache->magic));
+    memcpy(data + sizeof(cache->magic), cache->bytes, LORA_E32_CONFIG_BYTES);
+    return lora_crc16(data, sizeof(data));
+}
+
+// Read the module's parameters; false if the module did not answer
+template <typename E32>
+static inline bool lora_e32_config_read(E32 &e32, uint8_t *bytes) {
+    ResponseStructContainer c = e32.getConfiguration();
+    bool ok = c.status.code == E32_SUCCESS && c.data != NULL;
+    if (ok)
+        lora_e32_config_bytes(*(const Configuration *)c.data, bytes);
+    c.close();
+    return ok;
+}
+
+// Make the module run wanted, touching it as little as possible.
+// programCommands (if given) counts the commands sent to the module.
+template <typename E32>
+static lora_e32_config_result_t lora_e32_config_apply(E32 &e32, const Configuration &wanted,
+                                                      lora_e32_config_cache_t *cache, uint8_t *programCommands = NULL) {
+    uint8_t want[LORA_E32_CONFIG_BYTES];
+    lora_e32_config_bytes(wanted, want);
+    uint8_t commands = 0;
+    lora_e32_config_result_t result = LORA_E32_CONFIG_FAILED;
+    uint8_t have[LORA_E32_CONFIG_BYTES];
+    if (cache->magic == LORA_E32_CONFIG_MAGIC && cache->crc == lora_e32_config_cache_crc(cache) &&
+        memcmp(cache->bytes, want, sizeof(want)) == 0) {
+        result = LORA_E32_CONFIG_CACHED;
+    } else {
+        commands++;
+        if (lora_e32_config_read(e32, have) && memcmp(have, want, sizeof(want)) == 0) {
+            result = LORA_E32_CONFIG_MATCHED;
+        } else {
+            // Written even if the read failed, the module may still take it
+            commands += 2;
+            ResponseStatus rs = e32.setConfiguration(wanted, WRITE_CFG_PWR_DWN_SAVE);
+            bool ok = rs.code == E32_SUCCESS && lora_e32_config_read(e32, have) && memcmp(have, want, sizeof(want)) == 0;
+            result = ok ? LORA_E32_CONFIG_WRITTEN : LORA_E32_CONFIG_FAILED;
+        }
+    }
+    if (result == LORA_E32_CONFIG_FAILED) {
+        // Ask the module next time
+        cache->magic = 0;
+    } else {
+        cache->magic = LORA_E32_CONFIG_MAGIC;
+        memcpy(cache->bytes, want, sizeof(want));
+        cache->crc = lora_e32_config_cache_crc(cache);
+    }
+    if (programCommands)
+        *programCommands = commands;
+    return result;
+}
+
+// UART rate between MCU and module. The E32 takes parameter commands in
+// sleep mode at 9600 8N1 only, whatever SPED.uartBaudRate holds; that rate
+// applies to normal mode, the radio traffic. A 16 byte frame takes
+// 16.7 ms on the UART at 9600 baud, 1.4 ms at 115200, in each direction.
+//
+// lora_e32_config_negotiate() runs the parameter commands at 9600 and
+// starts with the rate in wanted. It steps down towards 9600 while the
+// module does not read back the rate written (lora_e32_config_apply()
+// verifies every write) or the MCU UART cannot run it within
+// LORA_E32_BAUD_TOLERANCE_PERMILLE. uart then runs the rate the module
+// has; wanted holds it. A rate the cache says the module refused is not
+// tried again until the cache is lost at a power cycle. The air side does
+// not change, the other end of the link needs no update.
+#define LORA_E32_PROGRAM_BAUD 9600
+#define LORA_E32_BAUD_TOLERANCE_PERMILLE 20
+
+// Bits of a SPED byte (lora_e32_config_bytes()), as the compiler packs them
+static inline uint8_t lora_e32_sped_baud(uint8_t sped) {
+    Speed s;
+    memcpy(&s, &sped, 1);
+    return s.uartBaudRate;
+}
+
+template <typename E32, typename Uart>
+static lora_e32_config_result_t lora_e32_config_negotiate(E32 &e32, Uart &uart, Configuration *wanted,
+                                                          lora_e32_config_cache_t *cache,
+                                                          uint8_t *programCommands = NULL, uint8_t *fallbacks = NULL) {
+    uint8_t want[LORA_E32_CONFIG_BYTES];
+    lora_e32_config_bytes(*wanted, want);
+    if (cache->magic == LORA_E32_CONFIG_MAGIC && cache->crc == lora_e32_config_cache_crc(cache)) {
+        // The same parameters at a lower rate: the faster ones were refused
+        uint8_t cached = lora_e32_sped_baud(cache->bytes[2]);
+        Configuration lower = *wanted;
+        lower.SPED.uartBaudRate = cached;
+        lora_e32_config_bytes(lower, want);
+        if (cached < wanted->SPED.uartBaudRate && memcmp(cache->bytes, want, sizeof(want)) == 0)
+            wanted->SPED.uartBaudRate = cached;
+    }
+    uint8_t commands = 0;
+    uint8_t steps = 0;
+    lora_e32_config_result_t result;
+    for (;;) {
+        uint8_t n = 0;
+        uart.updateBaudRate(LORA_E32_PROGRAM_BAUD);
+        result = lora_e32_config_apply(e32, *wanted, cache, &n);
+        commands += n;
+        if (result != LORA_E32_CONFIG_FAILED) {
+            uint32_t baud = lora_uart_bps(wanted->SPED.uartBaudRate);
+            uart.updateBaudRate(baud);
+            uint32_t actual = uart.baudRate();
+            uint32_t error = actual > baud ? actual - baud : baud - actual;
+            if ((uint64_t)error * 1000 <= (uint64_t)baud * LORA_E32_BAUD_TOLERANCE_PERMILLE)
+                break;
+            // The module has it, the MCU cannot run it: write the next one
+            uart.updateBaudRate(LORA_E32_PROGRAM_BAUD);
+            cache->magic = 0;
+        }
+        if (wanted->SPED.uartBaudRate <= UART_BPS_9600)
+            break;
+        wanted->SPED.uartBaudRate--;
+        steps++;
+    }
+    if (programCommands)
+        *programCommands = commands;
+    if (fallbacks)
+        *fallbacks = steps;
+    return result;
+}
+
+// Usage:
+// RTC_DATA_ATTR lora_e32_config_cache_t e32Cache;
+// lora_e32_config_result_t r = lora_e32_config_apply(e32ttl, config, &e32Cache);
+// if (r == LORA_E32_CONFIG_FAILED) ... module not answering or refusing the parameters
+//
+// Serial1.begin(LORA_E32_PROGRAM_BAUD, SERIAL_8N1, RxD, TxD);
+// config.SPED.uartBaudRate = UART_BPS_115200;   // fastest to try
+// r = lora_e32_config_negotiate(e32ttl, Serial1, &config, &e32Cache);
+// ... Serial1 and config.SPED.uartBaudRate now at the rate the module runs
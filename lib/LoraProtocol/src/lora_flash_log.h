@@ -0,0 +1,291 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lora_checksum.h"
+
+// Store-and-forward log for received messages while the uplink (MQTT
+// broker) is away, on the ESP32's flash (LittleFS) instead of RAM.
+//
+// The log file is a ring of LORA_FLASH_LOG_BLOCK byte blocks, written
+// whole at block aligned offsets, so the flash sees one sector erase and
+// program per block and never a read-modify-write of a partial sector:
+//   block:  header | record | record | ... | padding
+//   header: magic, seq, bytes used by records, record count, CRC-32 of
+//           the header and the records
+//   record: length byte, record bytes
+// seq counts the blocks since the log was created; block seq sits at
+// offset (seq % blocks) * LORA_FLASH_LOG_BLOCK. When the ring is full the
+// oldest block is overwritten and its records are counted as lost.
+//
+// append() collects records in a RAM block that is written once full;
+// flush() writes it before that (rewritten in place as it grows) to bound
+// what a power loss takes. The read cursor, the seq of the next block to
+// replay, lives in a second small file with its own CRC and is updated
+// once per replayed block. front() reads the next block, pop() moves past
+// it after its records were delivered: a reset in between sends that block
+// again (at least once, the consumer deduplicates by messageID).
+//
+// After a power loss begin() scans the block headers: the newest valid
+// seq is the head, a block with a bad CRC (torn write) is skipped on
+// replay. The format is plain bytes, little endian; tools/rxlog_dump
+// reads it on Linux.
+//
+// File is the Arduino fs::File API: seek(), read(), write(), flush(),
+// size(); the host builds use a stdio stand-in.
+#ifndef LORA_FLASH_LOG_BLOCK
+#define LORA_FLASH_LOG_BLOCK 4096   // Flash sector
+#endif
+#define LORA_FLASH_LOG_MAGIC 0x4C58524Cu  // "LRXL"
+#define LORA_FLASH_CURSOR_MAGIC 0x43585243u // "CRXC"
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t used;             // record bytes after the header
+    uint16_t count;            // records
+    uint32_t crc;              // CRC-32 of the header up to here and the used bytes
+} lora_flash_block_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;              // next block to replay
+    uint32_t crc;              // CRC-32 of magic and seq
+} lora_flash_cursor_t;
+
+#define LORA_FLASH_LOG_SPACE (LORA_FLASH_LOG_BLOCK - sizeof(lora_flash_block_t))
+
+static inline uint32_t lora_flash_block_crc(const uint8_t *block) {
+    const lora_flash_block_t *header = (const lora_flash_block_t *)block;
+    uint32_t crc = lora_crc32(block, offsetof(lora_flash_block_t, crc));
+    return lora_crc32(block + sizeof(lora_flash_block_t), header->used, crc);
+}
+
+// Whether a block read back from the log is complete and intact
+static inline bool lora_flash_block_valid(const uint8_t *block) {
+    const lora_flash_block_t *header = (const lora_flash_block_t *)block;
+    return header->magic == LORA_FLASH_LOG_MAGIC && header->used <= LORA_FLASH_LOG_SPACE &&
+           lora_flash_block_crc(block) == header->crc;
+}
+
+static inline uint32_t lora_flash_cursor_crc(const lora_flash_cursor_t &cursor) {
+    return lora_crc32((const uint8_t *)&cursor, offsetof(lora_flash_cursor_t, crc));
+}
+
+// Walks the records of a valid block
+class LoraFlashRecordReader
+{
+public:
+    explicit LoraFlashRecordReader(const uint8_t *block)
+        : data(block + sizeof(lora_flash_block_t)), used(((const lora_flash_block_t *)block)->used) {}
+
+    // Next record; false at the end or on a length running past it
+    bool next(const uint8_t **record, size_t *len) {
+        if (offset >= used || offset + 1 + data[offset] > used)
+            return false;
+        *len = data[offset];
+        *record = data + offset + 1;
+        offset += 1 + data[offset];
+        return true;
+    }
+
+private:
+    const uint8_t *data;
+    size_t used;
+    size_t offset = 0;
+};
+
+template <typename File>
+class LoraFlashLog
+{
+public:
+    // log and cursor opened for reading and writing; blocks is the ring size
+    bool begin(File *log_, File *cursorFile_, uint32_t blocks_) {
+        log = log_;
+        cursorFile = cursorFile_;
+        blocks = blocks_;
+        head = 0;
+        bool any = false;
+        uint32_t oldest = 0;
+        // Only the blocks written so far exist, the file grows up to the ring size
+        uint32_t present = (uint32_t)(log->size() / LORA_FLASH_LOG_BLOCK);
+        for (uint32_t i = 0; i < present && i < blocks; ++i) {
+            if (!readBlock(i, readBuf) || !lora_flash_block_valid(readBuf))
+                continue;
+            uint32_t seq = ((const lora_flash_block_t *)readBuf)->seq;
+            if (!any || (int32_t)(seq - head) >= 0)
+                head = seq;
+            if (!any || (int32_t)(seq - oldest) < 0)
+                oldest = seq;
+            any = true;
+        }
+        if (any)
+            head++;
+        lora_flash_cursor_t saved = {};
+        cursorFile->seek(0);
+        bool haveCursor = cursorFile->read((uint8_t *)&saved, sizeof(saved)) == sizeof(saved) &&
+                          saved.magic == LORA_FLASH_CURSOR_MAGIC && saved.crc == lora_flash_cursor_crc(saved);
+        cursor = haveCursor ? saved.seq : oldest;
+        // Cursor behind the oldest block (overwritten) or past the head (log lost)
+        if (any && (int32_t)(cursor - oldest) < 0)
+            cursor = oldest;
+        if ((int32_t)(cursor - head) > 0)
+            cursor = head;
+        firstSeq = head;
+        readSeq = head - 1;
+        readValid = false;
+        open(head);
+        return true;
+    }
+
+    // Add a record, false if it is too long or the block could not be written
+    bool append(const void *record, size_t len) {
+        if (len > 255 || len + 1 > LORA_FLASH_LOG_SPACE)
+            return false;
+        lora_flash_block_t *header = (lora_flash_block_t *)writeBuf;
+        if (header->used + 1 + len > LORA_FLASH_LOG_SPACE && !seal())
+            return false;
+        uint8_t *at = writeBuf + sizeof(lora_flash_block_t) + header->used;
+        at[0] = (uint8_t)len;
+        memcpy(at + 1, record, len);
+        header->used += (uint16_t)(1 + len);
+        header->count++;
+        dirty = true;
+        appended++;
+        return true;
+    }
+
+    // Write the open block as it is; later appends rewrite it
+    bool flush() {
+        if (!dirty)
+            return true;
+        if (!writeBlock())
+            return false;
+        dirty = false;
+        return true;
+    }
+
+    // Nothing left to replay
+    bool empty() const { return cursor == head && openCount() == 0; }
+    // Blocks waiting, the open one included
+    uint32_t backlog() const { return head - cursor + (openCount() ? 1 : 0); }
+
+    // Next block to replay, NULL if none. Reaching the open block closes it.
+    const uint8_t *front() {
+        while (!empty()) {
+            if (cursor == head && !seal())
+                return NULL;
+            if (!readValid || readSeq != cursor) {
+                readSeq = cursor;
+                readValid = readBlock(cursor % blocks, readBuf) && lora_flash_block_valid(readBuf) &&
+                            ((const lora_flash_block_t *)readBuf)->seq == cursor;
+                if (!readValid) {
+                    // Torn or overwritten, nothing to recover
+                    corrupt++;
+                    advance();
+                    continue;
+                }
+            }
+            return readBuf;
+        }
+        return NULL;
+    }
+    uint32_t frontSeq() const { return cursor; }
+    // Whether front() was written since begin(), not by an earlier run
+    bool frontFromThisRun() const { return (int32_t)(cursor - firstSeq) >= 0; }
+
+    // The records of front() were delivered; false if its block has been
+    // overwritten meanwhile
+    bool pop() {
+        if (cursor == head || !readValid || readSeq != cursor)
+            return false;
+        replayed += ((const lora_flash_block_t *)readBuf)->count;
+        return advance();
+    }
+
+    uint32_t appended = 0;      // Records added
+    uint32_t replayed = 0;      // Records in blocks popped
+    uint32_t lost = 0;          // Records overwritten before their replay
+    uint32_t corrupt = 0;       // Blocks skipped for a bad CRC
+    uint32_t writes = 0;        // Blocks written
+    uint32_t writeErrors = 0;
+
+private:
+    uint16_t openCount() const { return ((const lora_flash_block_t *)writeBuf)->count; }
+
+    void open(uint32_t seq) {
+        memset(writeBuf, 0xFF, sizeof(writeBuf));
+        lora_flash_block_t *header = (lora_flash_block_t *)writeBuf;
+        header->magic = LORA_FLASH_LOG_MAGIC;
+        header->seq = seq;
+        header->used = 0;
+        header->count = 0;
+        dirty = false;
+    }
+
+    // Write the open block and start the next one
+    bool seal() {
+        if (openCount() == 0)
+            return true;
+        if (!writeBlock())
+            return false;
+        head++;
+        // The ring is full: the next block overwrites the oldest
+        if (head - cursor >= blocks) {
+            // writeBuf is free until open()
+            if (readBlock(cursor % blocks, writeBuf) && lora_flash_block_valid(writeBuf))
+                lost += ((const lora_flash_block_t *)writeBuf)->count;
+            advance();
+        }
+        open(head);
+        return true;
+    }
+
+    bool writeBlock() {
+        lora_flash_block_t *header = (lora_flash_block_t *)writeBuf;
+        header->crc = lora_flash_block_crc(writeBuf);
+        bool ok = log->seek((header->seq % blocks) * LORA_FLASH_LOG_BLOCK) &&
+                  log->write(writeBuf, LORA_FLASH_LOG_BLOCK) == LORA_FLASH_LOG_BLOCK;
+        log->flush();
+        writes++;
+        if (!ok)
+            writeErrors++;
+        return ok;
+    }
+
+    bool readBlock(uint32_t index, uint8_t *buf) {
+        return log->seek(index * LORA_FLASH_LOG_BLOCK) && log->read(buf, LORA_FLASH_LOG_BLOCK) == LORA_FLASH_LOG_BLOCK;
+    }
+
+    // Move the cursor one block on and save it
+    bool advance() {
+        cursor++;
+        lora_flash_cursor_t saved = {LORA_FLASH_CURSOR_MAGIC, cursor, 0};
+        saved.crc = lora_flash_cursor_crc(saved);
+        bool ok = cursorFile->seek(0) && cursorFile->write((const uint8_t *)&saved, sizeof(saved)) == sizeof(saved);
+        cursorFile->flush();
+        return ok;
+    }
+
+    File *log = NULL;
+    File *cursorFile = NULL;
+    uint32_t blocks = 1;
+    uint32_t head = 0;          // seq of the open block
+    uint32_t cursor = 0;        // seq of the next block to replay
+    uint32_t firstSeq = 0;      // first block of this run
+    uint32_t readSeq = 0;
+    bool readValid = false;
+    bool dirty = false;
+    uint8_t writeBuf[LORA_FLASH_LOG_BLOCK];
+    uint8_t readBuf[LORA_FLASH_LOG_BLOCK];
+};
+
+// Usage:
+// File data = LittleFS.open("/rxlog.bin", "r+"), cur = LittleFS.open("/rxlog.cur", "r+");
+// rxLog.begin(&data, &cur, 256);
+// uplink down:  rxLog.append(&record, sizeof(record));  rxLog.flush() now and then
+// uplink back:  while (const uint8_t *block = rxLog.front()) {
+//                 LoraFlashRecordReader reader(block);  ... publish each record ...
+//                 rxLog.pop();
+//               }
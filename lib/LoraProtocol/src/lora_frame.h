@@ -0,0 +1,389 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lora_checksum.h"
+
+// E32 framing shared by sender and receiver. Frames are built in a fixed
+// buffer and handed to LoRa_E32::sendMessage(const void *, uint8_t), no
+// heap String.
+//
+// LORA_FRAMING_DELIMITER (default, what the RainSensor firmware speaks):
+//   packed payload struct followed by 0x0C 0x0C. The payload is raw binary
+//   and may contain the delimiter itself, so a frame only ends at a
+//   delimiter where the length matches one of the expected payload sizes.
+//   After garbage (a stray byte, a truncated frame) the decoder finds the
+//   next frame at the end of its buffer, by its length and checksum.
+// LORA_FRAMING_COBS:
+//   payload byte-stuffed with COBS followed by a single 0x00. 0x00 never
+//   occurs inside a frame, so framing is unambiguous and the decoder
+//   resynchronises at the next 0x00 after garbage. Overhead is 2 bytes
+//   for payloads up to 254 bytes, the same as the delimiter.
+// Both ends must be built with the same setting.
+#define LORA_FRAMING_DELIMITER 0
+#define LORA_FRAMING_COBS 1
+#ifndef LORA_FRAMING
+#define LORA_FRAMING LORA_FRAMING_DELIMITER
+#endif
+
+// Message delimiter constants
+#define E32_MSG_DELIMITER_1 0x0C    // First byte of message delimiter
+#define E32_MSG_DELIMITER_2 0x0C    // Second byte of message delimiter
+#define E32_MSG_DELIMITER_LEN 2
+#define LORA_COBS_DELIMITER 0x00
+
+// Largest packet the E32 sends in one transmission
+#define E32_MAX_PACKET_SIZE 58
+// Largest payload that fits into one packet with either framing
+#define LORA_MAX_PAYLOAD_SIZE (E32_MAX_PACKET_SIZE - 2)
+
+typedef struct {
+    uint8_t data[E32_MAX_PACKET_SIZE];
+    uint8_t len;                    // Bytes used in data, 0 if encoding failed
+} lora_frame_t;
+
+// COBS encode len bytes from in to out and append the 0x00 delimiter
+// Returns the encoded length, 0 if it does not fit into cap bytes
+static inline size_t lora_cobs_encode(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    if (len + len / 254 + 2 > cap)
+        return 0;
+    size_t code_pos = 0;
+    size_t o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; ++i) {
+        if (in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+        } else {
+            out[o++] = in[i];
+            if (++code == 0xFF) {
+                out[code_pos] = code;
+                code_pos = o++;
+                code = 1;
+            }
+        }
+    }
+    out[code_pos] = code;
+    out[o++] = LORA_COBS_DELIMITER;
+    return o;
+}
+
+// COBS decode len bytes (without the 0x00 delimiter) from in to out
+// Returns the decoded length, 0 if malformed or larger than cap
+static inline size_t lora_cobs_decode(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    size_t o = 0;
+    size_t i = 0;
+    while (i < len) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len)
+            return 0;
+        for (uint8_t k = 1; k < code; ++k) {
+            if (o >= cap)
+                return 0;
+            out[o++] = in[i++];
+        }
+        if (code != 0xFF && i < len) {
+            if (o >= cap)
+                return 0;
+            out[o++] = 0;
+        }
+    }
+    return o;
+}
+
+// Copy payload into frame using the configured framing
+// Returns the frame length, 0 if the payload does not fit into one packet
+static inline size_t lora_frame_encode(lora_frame_t *frame, const void *payload, size_t len) {
+    frame->len = 0;
+    if (len > LORA_MAX_PAYLOAD_SIZE)
+        return 0;
+#if LORA_FRAMING == LORA_FRAMING_COBS
+    frame->len = (uint8_t)lora_cobs_encode((const uint8_t *)payload, len, frame->data, sizeof(frame->data));
+#else
+    memcpy(frame->data, payload, len);
+    frame->data[len] = E32_MSG_DELIMITER_1;
+    frame->data[len + 1] = E32_MSG_DELIMITER_2;
+    frame->len = (uint8_t)(len + E32_MSG_DELIMITER_LEN);
+#endif
+    return frame->len;
+}
+
+#ifdef __cplusplus
+// Every payload of the protocol ends with a checksum over the bytes before
+// it (lora_checksum.h)
+static inline bool lora_frame_checked(const uint8_t *payload, size_t len) {
+    if (len < sizeof(uint16_t))
+        return false;
+    uint16_t checksum;
+    memcpy(&checksum, payload + len - sizeof(checksum), sizeof(checksum));
+    return lora_checksum(payload, len - sizeof(checksum)) == checksum;
+}
+
+// Incremental frame decoder. Feed every byte from the UART as it arrives;
+// push() returns true once a complete frame is available via payload() and
+// length(). The delimiter framing keeps the last E32_MAX_PACKET_SIZE bytes
+// in a ring written twice, N bytes apart, so every frame in it is
+// contiguous: O(1) per byte, nothing is moved. Only at a delimiter are
+// frames looked for: the whole buffer, then the starts the accepted sizes
+// imply (one each) and, with acceptVariable(), the starts whose event ID
+// is tagged; the checksum only where the length fits.
+class LoraFrameDecoder
+{
+public:
+    LoraFrameDecoder() { reset(); }
+
+    // Payload sizes the delimiter framing accepts as frame end (up to 4).
+    // Ignored with COBS framing.
+    void accept(size_t payload_len) {
+        if (acceptCount < sizeof(acceptLen) / sizeof(acceptLen[0]))
+            acceptLen[acceptCount++] = payload_len;
+    }
+
+    // Variable length frames for the delimiter framing: a payload whose
+    // lora_eventID (bytes 2-3) is eventID ends at the delimiter where the
+    // byte at lengthOffset holds the payload length, not at one of the
+    // fixed sizes (up to 2 event IDs). Ignored with COBS.
+    void acceptVariable(uint16_t eventID, size_t lengthOffset) {
+        if (variableCount < sizeof(variableEvent) / sizeof(variableEvent[0])) {
+            variableEvent[variableCount] = eventID;
+            variableOffset[variableCount++] = lengthOffset;
+        }
+    }
+
+    // Every frame starts with a header of n bytes (the sender's address in
+    // fixed transmission mode, lora_nodes.h) before the payload. Sizes and
+    // offsets above count from the payload; payload() skips the header.
+    void header(size_t n) { headerLen = n; }
+
+    bool push(uint8_t b) {
+#if LORA_FRAMING == LORA_FRAMING_COBS
+        if (b == LORA_COBS_DELIMITER) {
+            bool complete = !discarding && len > headerLen && remaining == 0;
+            if (!complete && (discarding || len > 0 || remaining > 0))
+                errors++;
+            frameLen = complete ? len - headerLen : 0;
+            reset();
+            if (complete)
+                frames++;
+            return complete;
+        }
+        if (discarding)
+            return false;
+        if (remaining == 0) {
+            // Code byte: the previous block ended with an implied zero
+            if (pendingZero && !append(0))
+                return false;
+            remaining = (uint8_t)(b - 1);
+            pendingZero = (b != 0xFF);
+            return false;
+        }
+        append(b);
+        remaining--;
+        return false;
+#else
+        if (frameLen) {
+            // Previous frame has been handed out, start over
+            frameLen = 0;
+            len = 0;
+        }
+        if (len == E32_MAX_PACKET_SIZE) {
+            // Longer than any packet: the oldest byte is garbage. The rest
+            // may still end in a frame, so drop just that one.
+            if (!sliding)
+                errors++;
+            sliding = true;
+            len--;
+        }
+        buf[head] = b;
+        buf[head + E32_MAX_PACKET_SIZE] = b;
+        head = head + 1 < E32_MAX_PACKET_SIZE ? head + 1 : 0;
+        len++;
+        const uint8_t *w = window();
+        if (len < E32_MSG_DELIMITER_LEN + headerLen || w[len - 2] != E32_MSG_DELIMITER_1 || w[len - 1] != E32_MSG_DELIMITER_2)
+            return false;
+
+        // The whole buffer as one frame, the usual case
+        size_t payload_len = len - E32_MSG_DELIMITER_LEN - headerLen;
+        bool pending = false;
+        bool whole = matches(0, &pending);
+        if (whole && lora_frame_checked(w + headerLen, payload_len))
+            return complete(0);
+        // Else a frame after garbage in front of it. Only with a checksum
+        // that holds: by its length alone the tail of any longer frame
+        // would pass for a shorter one.
+        for (size_t i = 0; !pending && i < acceptCount; ++i) {
+            if (acceptLen[i] < payload_len && found(payload_len - acceptLen[i]))
+                return true;
+        }
+        for (size_t start = 1; !pending && variableCount > 0 && start + E32_MSG_DELIMITER_LEN + headerLen + 4 <= len; ++start) {
+            if (tagged(w + start + headerLen) && found(start))
+                return true;
+        }
+        // Length right, checksum wrong: the handler reports it
+        if (whole)
+            return complete(0);
+        // The delimiter bytes may be part of a payload (frame not complete
+        // yet); once the buffer is longer than any accepted frame they are
+        // not, and everything up to here is dropped
+        if (!pending && payload_len >= maxAccepted()) {
+            errors++;
+            len = 0;
+            sliding = false;
+        }
+        return false;
+#endif
+    }
+
+    const uint8_t *payload() const { return buf + frameStart + headerLen; }
+    size_t length() const { return frameLen; }
+    // The header of the frame just completed
+    const uint8_t *header() const { return buf + frameStart; }
+
+    uint32_t frames = 0;    // Complete frames decoded
+    uint32_t errors = 0;    // Truncated, oversized or garbled frames dropped
+
+private:
+    // The bytes received since the last frame, oldest first
+    const uint8_t *window() const {
+        return buf + (head >= len ? head - len : head + E32_MAX_PACKET_SIZE - len);
+    }
+
+    // The payload at p has an event ID of acceptVariable()
+    bool tagged(const uint8_t *p) const {
+        for (size_t i = 0; i < variableCount; ++i) {
+            if ((uint16_t)(p[2] | p[3] << 8) == variableEvent[i])
+                return true;
+        }
+        return false;
+    }
+
+    // The bytes from start to the delimiter are a frame with a checksum that
+    // holds; the bytes before it were garbage
+    bool found(size_t start) {
+        bool unused;
+        if (!matches(start, &unused) ||
+            !lora_frame_checked(window() + start + headerLen, len - E32_MSG_DELIMITER_LEN - headerLen - start))
+            return false;
+        errors++;
+        return complete(start);
+    }
+
+    // The bytes from start to the delimiter are a frame by their length:
+    // an accepted size, or a tagged payload whose length field says so.
+    // *pending: the frame at 0 is tagged and not complete yet.
+    bool matches(size_t start, bool *pending) const {
+        size_t payload_len = len - E32_MSG_DELIMITER_LEN - headerLen - start;
+        const uint8_t *p = window() + start + headerLen;
+        *pending = false;
+        // A tagged frame ends only where its length field says so
+        for (size_t i = 0; i < variableCount && payload_len > 3; ++i) {
+            if ((uint16_t)(p[2] | p[3] << 8) != variableEvent[i])
+                continue;
+            if (payload_len > variableOffset[i] && p[variableOffset[i]] == payload_len)
+                return true;
+            *pending = start == 0 && payload_len > variableOffset[i] && p[variableOffset[i]] > payload_len &&
+                       p[variableOffset[i]] <= E32_MAX_PACKET_SIZE - E32_MSG_DELIMITER_LEN - headerLen;
+            return false;
+        }
+        for (size_t i = 0; i < acceptCount; ++i) {
+            if (acceptLen[i] == payload_len)
+                return true;
+        }
+        return false;
+    }
+
+    // Longest payload an accepted frame can have
+    size_t maxAccepted() const {
+        if (variableCount > 0)
+            return E32_MAX_PACKET_SIZE - E32_MSG_DELIMITER_LEN - headerLen;
+        size_t longest = 0;
+        for (size_t i = 0; i < acceptCount; ++i)
+            longest = acceptLen[i] > longest ? acceptLen[i] : longest;
+        return longest;
+    }
+
+    bool complete(size_t start) {
+        frameStart = window() - buf + start;
+        frameLen = len - E32_MSG_DELIMITER_LEN - headerLen - start;
+        sliding = false;
+        frames++;
+        return true;
+    }
+
+    bool append(uint8_t b) {
+        if (len >= E32_MAX_PACKET_SIZE) {
+            discarding = true;
+            return false;
+        }
+        buf[len++] = b;
+        return true;
+    }
+
+    void reset() {
+        len = 0;
+        remaining = 0;
+        pendingZero = false;
+        discarding = false;
+    }
+
+    // COBS: the frame from 0. Delimiter: a ring, byte i at i and i + N.
+    uint8_t buf[2 * E32_MAX_PACKET_SIZE];
+    size_t len = 0;
+    size_t head = 0;        // Delimiter: where the next byte goes
+    size_t frameLen = 0;
+    size_t frameStart = 0;
+    bool sliding = false;
+    uint8_t remaining = 0;
+    bool pendingZero = false;
+    bool discarding = false;
+    size_t acceptLen[4] = {0, 0, 0, 0};
+    size_t acceptCount = 0;
+    uint16_t variableEvent[2] = {0, 0};
+    size_t variableOffset[2] = {0, 0};
+    size_t variableCount = 0;
+    size_t headerLen = 0;
+};
+
+// Decode one complete received frame (e.g. an air packet) into out
+// Returns the payload length, 0 if data is not exactly one valid frame
+static inline size_t lora_frame_unpack(const uint8_t *data, size_t len, uint8_t *out, size_t cap, size_t expected_len = 0) {
+    LoraFrameDecoder decoder;
+    if (expected_len)
+        decoder.accept(expected_len);
+    for (size_t i = 0; i < len; ++i) {
+        if (decoder.push(data[i])) {
+            // Not after bytes that were skipped as garbage
+            if (i + 1 != len || decoder.errors != 0 || decoder.length() > cap)
+                return 0;
+            memcpy(out, decoder.payload(), decoder.length());
+            return decoder.length();
+        }
+    }
+    return 0;
+}
+
+// Typed helpers for the packed payload structs
+template <typename T>
+static inline size_t lora_frame_encode(lora_frame_t *frame, const T &payload) {
+    static_assert(sizeof(T) <= LORA_MAX_PAYLOAD_SIZE, "payload does not fit into one E32 packet");
+    return lora_frame_encode(frame, &payload, sizeof(T));
+}
+
+// Copy the payload of a received frame into a (packed) struct
+template <typename T>
+static inline bool lora_frame_decode(const uint8_t *data, size_t len, T *payload) {
+    return lora_frame_unpack(data, len, (uint8_t *)payload, sizeof(T), sizeof(T)) == sizeof(T);
+}
+#endif
+
+// Usage:
+// static lora_frame_t frame;
+// lora_frame_encode(&frame, payload);
+// e32ttl.sendMessage(frame.data, frame.len);
+//
+// static LoraFrameDecoder decoder;   // decoder.accept(sizeof(lora_payload_t));
+// while (Serial1.available())
+//     if (decoder.push(Serial1.read()))
+//         handle(decoder.payload(), decoder.length());
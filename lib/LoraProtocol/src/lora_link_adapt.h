@@ -0,0 +1,298 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+
+// Air data rate that follows the link (transparent mode, one sensor). A
+// faster rate costs less airtime per frame, and so less of the duty-cycle
+// budget, but needs more signal: where 2.4 kbps gets every frame through,
+// 19.2 kbps may lose every other one.
+//
+// The bridge counts what went wrong over a window of LORA_LINK_WINDOW
+// readings:
+//   - a repeated messageID: the sensor did not get our ACK
+//   - a gap in the messageIDs: readings the sensor gave up on
+//   - a message with a bad checksum, a frame that could not be handled
+// A repeat after an ACK the bridge did not send (duty-cycle budget) is not
+// the link's fault and does not count. A frame lost on its way in and sent
+// again with the same messageID is not seen at all; its ACK takes the same
+// air back, so the ACK losses stand for both directions.
+//
+// At the end of a window the rate goes one step down if
+// LORA_LINK_DOWN_PERMILLE or more were lost, one step up if at most
+// LORA_LINK_UP_PERMILLE were and the up holdoff has run out. The holdoff
+// counts windows; it doubles each time a higher rate did not hold (down
+// again after one window, handshake not answered, fallback) and halves
+// after a window that did, so a link at the edge of a rate does not flap.
+//
+// Both ends switch together, lora_rate_payload_t in the ACK batch:
+//   bridge  ACK + PROPOSE(handshake, rate)   up to LORA_LINK_PROPOSE_TRIES ACKs
+//   sensor  frame + RESPONSE(the same)       it can run that rate
+//   bridge  ACK + COMMIT(handshake, rate)    switches once this ACK is out
+//   sensor  switches on the COMMIT, its next frame at the new rate no
+//           sooner than LORA_LINK_SWITCH_MS later
+// The first frame at the new rate confirms the switch. A lost COMMIT
+// leaves the ends at two rates where neither hears the other; that and
+// any other silence ends at the base rate: the sensor goes back after
+// fallbackFrames frames without an ACK, the bridge after no frame for
+// fallbackFrames + 1 mean intervals between frames, at least silenceMinMs.
+#ifndef LORA_LINK_WINDOW
+#define LORA_LINK_WINDOW 32
+#endif
+#ifndef LORA_LINK_UP_PERMILLE
+#define LORA_LINK_UP_PERMILLE 63
+#endif
+#ifndef LORA_LINK_DOWN_PERMILLE
+#define LORA_LINK_DOWN_PERMILLE 250
+#endif
+#define LORA_LINK_PROPOSE_TRIES 3
+#define LORA_LINK_FALLBACK_FRAMES 3
+#define LORA_LINK_SWITCH_MS 500
+#define LORA_LINK_MAX_HOLDOFF 32
+// messageIDs this far back are repeats, this far ahead a gap; anything
+// else is a sensor that started counting again
+#define LORA_LINK_ID_SPAN 32
+
+typedef enum : uint8_t {
+    LORA_LINK_UP = 0,          // Window with few losses, holdoff over
+    LORA_LINK_DOWN = 1,        // Window with too many losses
+    LORA_LINK_FALLBACK = 2     // Nothing heard, back to the base rate
+} lora_link_reason_t;
+
+class LoraLinkAdapt
+{
+public:
+    // Rates are SPED.airDataRate codes; the module runs base now
+    void begin(uint8_t base, uint8_t lowest, uint8_t highest, uint32_t silenceMinMs_, uint32_t nowMs) {
+        baseRate = current = previous = target = base;
+        minRate = lowest;
+        maxRate = highest;
+        silenceMinMs = silenceMinMs_;
+        lastFrameMs = nowMs;
+        state = STEADY;
+        holdoff = holdLeft = 1;
+    }
+
+    uint8_t rate() const { return current; }
+    uint8_t previousRate() const { return previous; }
+
+    // A frame came in, handled or not
+    void frame(uint32_t nowMs) {
+        if (hasFrame) {
+            uint32_t gap = nowMs - lastFrameMs;
+            meanGapMs = meanGapMs ? meanGapMs - meanGapMs / 8 + gap / 8 : gap;
+        }
+        hasFrame = true;
+        lastFrameMs = nowMs;
+        // Heard at the new rate
+        if (state == PROBATION)
+            state = STEADY;
+    }
+
+    // A sensor reading with a valid checksum
+    void reading(uint16_t messageID) {
+        if (!hasId) {
+            hasId = true;
+            lastId = messageID;
+            count(1, 0);
+            return;
+        }
+        if ((uint16_t)(lastId - messageID) < LORA_LINK_ID_SPAN) {
+            repeats++;
+            count(1, excused ? 0 : 1);
+            return;
+        }
+        uint16_t ahead = (uint16_t)(messageID - lastId);
+        uint16_t gap = ahead <= LORA_LINK_ID_SPAN ? ahead - 1 : 0;
+        lastId = messageID;
+        excused = false;
+        count(1 + gap, gap);
+    }
+
+    // A message with a bad checksum or a frame that could not be handled
+    void corrupt() {
+        corrupted++;
+        count(1, 1);
+    }
+
+    // The answer to the last frame was not sent: its repeat is expected
+    void answerSkipped() { excused = true; }
+
+    // The rate message for the next ACK, false if there is none
+    bool message(uint16_t messageID, lora_rate_payload_t *msg) {
+        if (state == PROPOSING && tries >= LORA_LINK_PROPOSE_TRIES) {
+            // Not answered: stay, and wait longer before the next try
+            refused++;
+            state = STEADY;
+            if (target > current)
+                backOff();
+        }
+        if (state != PROPOSING && state != COMMITTING)
+            return false;
+        if (state == PROPOSING)
+            tries++;
+        *msg = lora_message_init<LORA_EVENT_SET_AIR_RATE>(messageID);
+        msg->handshake = handshake;
+        msg->airDataRate = target;
+        msg->step = state == PROPOSING ? LORA_RATE_PROPOSE : LORA_RATE_COMMIT;
+        msg->fallbackFrames = LORA_LINK_FALLBACK_FRAMES;
+        msg->baseRate = baseRate;
+        msg->checksum = lora_message_checksum(msg);
+        return true;
+    }
+
+    // The sensor's SET_AIR_RATE_RESPONSE; true if it answers the proposal
+    bool response(const lora_rate_payload_t &msg) {
+        if (state != PROPOSING || msg.handshake != handshake || msg.airDataRate != target)
+            return false;
+        state = COMMITTING;
+        return true;
+    }
+
+    // The ACK with the COMMIT is out: true and the rate to switch the
+    // module to now
+    bool committed(uint8_t *rate) {
+        if (state != COMMITTING)
+            return false;
+        previous = current;
+        current = target;
+        state = PROBATION;
+        if (current > previous) {
+            ups++;
+            raised = true;
+        } else {
+            downs++;
+        }
+        restartWindow();
+        *rate = current;
+        return true;
+    }
+
+    // Nothing heard for too long at another rate than the base: true and
+    // the rate to switch the module to now
+    bool silent(uint32_t nowMs, uint8_t *rate) {
+        if (silenceLeftMs(nowMs) != 0)
+            return false;
+        previous = current;
+        current = target = baseRate;
+        state = STEADY;
+        fallbacks++;
+        backOff();
+        restartWindow();
+        lastFrameMs = nowMs;
+        *rate = current;
+        return true;
+    }
+
+    // Until silent() switches back, UINT32_MAX at the base rate
+    uint32_t silenceLeftMs(uint32_t nowMs) const {
+        if (current == baseRate)
+            return UINT32_MAX;
+        uint32_t limit = (LORA_LINK_FALLBACK_FRAMES + 1) * meanGapMs;
+        if (limit < silenceMinMs)
+            limit = silenceMinMs;
+        uint32_t quiet = nowMs - lastFrameMs;
+        return quiet < limit ? limit - quiet : 0;
+    }
+
+    uint32_t proposals = 0;    // Handshakes started
+    uint32_t refused = 0;      // Proposals the sensor did not answer
+    uint32_t ups = 0;
+    uint32_t downs = 0;
+    uint32_t fallbacks = 0;
+    uint32_t repeats = 0;      // Readings received again
+    uint32_t corrupted = 0;
+    uint16_t lossPermille = 0; // Of the last full window
+
+private:
+    enum State : uint8_t { STEADY, PROPOSING, COMMITTING, PROBATION };
+
+    void count(uint32_t attempts, uint32_t lost) {
+        windowAttempts += attempts;
+        windowLost += lost;
+        if (windowAttempts >= LORA_LINK_WINDOW)
+            evaluate();
+    }
+
+    void evaluate() {
+        lossPermille = (uint16_t)(windowLost * 1000 / windowAttempts);
+        restartWindow();
+        // One handshake at a time
+        if (state != STEADY)
+            return;
+        if (lossPermille >= LORA_LINK_DOWN_PERMILLE) {
+            if (raised)
+                backOff();
+            holdLeft = holdoff;
+            if (current > minRate)
+                propose(current - 1);
+            return;
+        }
+        if (raised && holdoff > 1)
+            holdoff /= 2;
+        raised = false;
+        if (holdLeft > 0) {
+            holdLeft--;
+            return;
+        }
+        if (lossPermille <= LORA_LINK_UP_PERMILLE && current < maxRate)
+            propose(current + 1);
+    }
+
+    void propose(uint8_t rate) {
+        target = rate;
+        handshake++;
+        tries = 0;
+        state = PROPOSING;
+        proposals++;
+    }
+
+    void backOff() {
+        if (holdoff < LORA_LINK_MAX_HOLDOFF)
+            holdoff *= 2;
+        holdLeft = holdoff;
+        raised = false;
+    }
+
+    void restartWindow() {
+        windowAttempts = 0;
+        windowLost = 0;
+    }
+
+    State state = STEADY;
+    uint8_t baseRate = 0;
+    uint8_t minRate = 0;
+    uint8_t maxRate = 0;
+    uint8_t current = 0;
+    uint8_t previous = 0;
+    uint8_t target = 0;
+    uint8_t tries = 0;
+    uint16_t handshake = 0;
+    bool raised = false;       // The last switch went up, not yet held a window
+    uint16_t holdoff = 1;      // Windows to wait before going up
+    uint16_t holdLeft = 1;
+    uint32_t windowAttempts = 0;
+    uint32_t windowLost = 0;
+    bool hasId = false;
+    uint16_t lastId = 0;
+    bool excused = false;
+    bool hasFrame = false;
+    uint32_t lastFrameMs = 0;
+    uint32_t meanGapMs = 0;
+    uint32_t silenceMinMs = 0;
+};
+
+// Usage, bridge:
+// linkAdapt.begin(AIR_DATA_RATE_010_24, AIR_DATA_RATE_001_12, AIR_DATA_RATE_101_192, 24000, millis());
+// per frame: linkAdapt.frame(millis()); per reading: linkAdapt.reading(id); bad ones: linkAdapt.corrupt();
+// SET_AIR_RATE_RESPONSE:   linkAdapt.response(msg);
+// with the ACK:            if (linkAdapt.message(id++, &msg)) batch.add(msg, 0);
+// ACK sent:                if (linkAdapt.committed(&rate)) ... module to rate, WRITE_CFG_PWR_DWN_LOSE
+// ACK not sent:            linkAdapt.answerSkipped();
+// waiting for a frame:     if (linkAdapt.silent(millis(), &rate)) ... module to rate
+//
+// Sensor: answer a PROPOSE with a SET_AIR_RATE_RESPONSE (the same fields)
+// in its next frame, switch on the COMMIT, go back to baseRate after
+// fallbackFrames frames without an ACK at another rate.
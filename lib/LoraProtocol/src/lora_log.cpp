@@ -0,0 +1,184 @@
+#include "lora_log.h"
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+
+#include "lora_perf.h"
+#include "lora_spsc_queue.h"
+
+// How often the drain task looks for new records
+#define LORA_LOG_DRAIN_MS 20
+
+// Every task that logs gets a queue of its own on its first call, so it is
+// the only producer and a log call takes no lock. A critical section on
+// the dual core ESP32 masks interrupts and spins on a lock the drain task
+// also takes while it pops; here the radio task pays a task handle lookup
+// and the queue's acquire/release instead. Tasks beyond LORA_LOG_PRODUCERS
+// share the last queue, serialised by logMux. The consumers (drain task,
+// lora_log_flush()) are serialised by logDrainMux, which no producer takes.
+// A queue stays with its task: the tasks here run as long as the program.
+struct LogQueue
+{
+  LoraSpscQueue<lora_log_record_t, LORA_LOG_SLOTS> queue;
+  std::atomic<uint32_t> records{0}; // Producer only
+};
+
+static LogQueue logQueues[LORA_LOG_PRODUCERS + 1];
+static std::atomic<TaskHandle_t> logOwners[LORA_LOG_PRODUCERS];
+static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE logDrainMux = portMUX_INITIALIZER_UNLOCKED;
+static Print *logOut = NULL;
+
+// Index of the calling task's queue, LORA_LOG_PRODUCERS for the shared one
+static size_t logQueueIndex()
+{
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  for (size_t i = 0; i < LORA_LOG_PRODUCERS; ++i)
+  {
+    TaskHandle_t owner = logOwners[i].load(std::memory_order_acquire);
+    if (owner == self)
+      return i;
+    if (owner == NULL && logOwners[i].compare_exchange_strong(owner, self, std::memory_order_acq_rel))
+      return i;
+  }
+  return LORA_LOG_PRODUCERS;
+}
+
+static void logAppend(LogQueue &q, const lora_log_record_t &record)
+{
+  if (q.queue.push(record))
+    q.records.store(q.records.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void logPush(lora_log_record_t &record)
+{
+  record.us = micros();
+  size_t i = logQueueIndex();
+  if (i < LORA_LOG_PRODUCERS)
+  {
+    logAppend(logQueues[i], record);
+    return;
+  }
+  portENTER_CRITICAL(&logMux);
+  logAppend(logQueues[i], record);
+  portEXIT_CRITICAL(&logMux);
+}
+
+void lora_log_write(uint8_t level, uint16_t format, const uint32_t *args, uint8_t argc)
+{
+  uint32_t start = lora_perf_cycles();
+  lora_log_record_t record;
+  record.format = format;
+  record.level = level;
+  record.len = (uint8_t)(argc * sizeof(uint32_t));
+  memcpy(record.data, args, record.len);
+  logPush(record);
+  lora_perf_since(LORA_PERF_LOG, start);
+}
+
+void lora_log_data(uint8_t level, uint16_t format, const void *data, size_t len)
+{
+  uint32_t start = lora_perf_cycles();
+  lora_log_record_t record;
+  record.format = format;
+  record.level = level | LORA_LOG_FLAG_DATA;
+  record.len = (uint8_t)(len < sizeof(record.data) ? len : sizeof(record.data));
+  memcpy(record.data, data, record.len);
+  logPush(record);
+  lora_perf_since(LORA_PERF_LOG, start);
+}
+
+static void logEmit(const lora_log_record_t &record)
+{
+#if LORA_LOG_OUTPUT == LORA_LOG_OUTPUT_TEXT
+  char line[LORA_LOG_LINE_SIZE];
+  size_t n = lora_log_format(&record, line, sizeof(line));
+  logOut->write((const uint8_t *)line, n);
+  logOut->println();
+#else
+  // Leading delimiter separates the record from preceding text output
+  uint8_t frame[1 + sizeof(record) + sizeof(record) / 254 + 2];
+  frame[0] = LORA_COBS_DELIMITER;
+  size_t n = lora_cobs_encode((const uint8_t *)&record, LORA_LOG_HEADER_SIZE + record.len, frame + 1, sizeof(frame) - 1);
+  logOut->write(frame, n + 1);
+#endif
+}
+
+// Take the oldest record of all queues, so the output stays in time order
+static bool logPop(lora_log_record_t *record)
+{
+  LogQueue *oldest = NULL;
+  uint32_t oldestUs = 0;
+  for (LogQueue &q : logQueues)
+  {
+    const lora_log_record_t *front = q.queue.front();
+    if (front != NULL && (oldest == NULL || (int32_t)(front->us - oldestUs) < 0))
+    {
+      oldest = &q;
+      oldestUs = front->us;
+    }
+  }
+  return oldest != NULL && oldest->queue.pop(record);
+}
+
+void lora_log_flush()
+{
+  lora_log_record_t record;
+  if (logOut == NULL)
+    return;
+  for (;;)
+  {
+    portENTER_CRITICAL(&logDrainMux);
+    bool popped = logPop(&record);
+    portEXIT_CRITICAL(&logDrainMux);
+    if (!popped)
+      break;
+    logEmit(record);
+  }
+}
+
+static void logTask(void *)
+{
+  for (;;)
+  {
+    lora_log_flush();
+    vTaskDelay(pdMS_TO_TICKS(LORA_LOG_DRAIN_MS));
+  }
+}
+
+void lora_log_begin(Print &out, bool drainTask)
+{
+  if (logOut != NULL)
+    return;
+  logOut = &out;
+  // Lowest priority above idle, on the core that runs loop()
+  if (drainTask)
+    xTaskCreatePinnedToCore(logTask, "log", 4096, NULL, tskIDLE_PRIORITY + 1, NULL, 1);
+  lora_log(LORA_LOG_LEVEL_INFO, LOGF_BOOT, (uint32_t)LORA_LOG_FORMAT_COUNT);
+}
+
+uint32_t lora_log_records()
+{
+  uint32_t n = 0;
+  for (const LogQueue &q : logQueues)
+    n += q.records.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint32_t lora_log_drops()
+{
+  uint32_t n = 0;
+  for (const LogQueue &q : logQueues)
+    n += q.queue.drops();
+  return n;
+}
+
+uint32_t lora_log_high_water()
+{
+  uint32_t n = 0;
+  for (const LogQueue &q : logQueues)
+    n = q.queue.highWater() > n ? q.queue.highWater() : n;
+  return n;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lora_frame.h"
+#include "lora_log_formats.h"
+
+// Deferred binary logging. A log call copies a format ID and its integer
+// arguments (or a few raw bytes) into a ring buffer and returns; nothing
+// is formatted or written to Serial on the calling task. A low priority
+// task started by lora_log_begin() drains the buffer to the console.
+//
+// Levels are removed at compile time: calls above LORA_LOG_LEVEL are not
+// compiled in and their arguments are not evaluated.
+//
+// LORA_LOG_OUTPUT_BINARY (default):
+//   every record is sent as 0x00, COBS(record), 0x00. A record is a few
+//   bytes instead of a formatted line; tools/log_decode turns a capture
+//   back into text and passes other console output through unchanged.
+// LORA_LOG_OUTPUT_TEXT:
+//   the drain task formats the records itself, readable in any serial
+//   monitor. Still keeps formatting and Serial off the calling task.
+//
+// Every task that logs has a ring of its own (LORA_LOG_PRODUCERS of them,
+// further tasks share one more under a lock), so a log call takes no lock.
+// Records are dropped (and counted) when a ring is full, a log call
+// never blocks. Not for use in ISRs.
+#define LORA_LOG_LEVEL_NONE 0
+#define LORA_LOG_LEVEL_ERROR 1
+#define LORA_LOG_LEVEL_WARN 2
+#define LORA_LOG_LEVEL_INFO 3
+#define LORA_LOG_LEVEL_DEBUG 4
+#ifndef LORA_LOG_LEVEL
+#define LORA_LOG_LEVEL LORA_LOG_LEVEL_INFO
+#endif
+
+#define LORA_LOG_OUTPUT_BINARY 0
+#define LORA_LOG_OUTPUT_TEXT 1
+#ifndef LORA_LOG_OUTPUT
+#define LORA_LOG_OUTPUT LORA_LOG_OUTPUT_BINARY
+#endif
+
+#ifndef LORA_LOG_SLOTS
+#define LORA_LOG_SLOTS 32      // Ring buffer records per task, power of two
+#endif
+#ifndef LORA_LOG_PRODUCERS
+#define LORA_LOG_PRODUCERS 3   // Tasks with a ring of their own; more share one
+#endif
+#define LORA_LOG_MAX_ARGS 6
+#define LORA_LOG_MAX_DATA (E32_MAX_PACKET_SIZE + 6) // Fits a whole frame, with address and capture status
+#define LORA_LOG_LINE_SIZE 256  // Longest formatted record
+
+#define LORA_LOG_FLAG_DATA 0x80 // data holds raw bytes instead of arguments
+#define LORA_LOG_LEVEL_MASK 0x07
+
+typedef struct __attribute__((packed)) {
+    uint32_t us;               // micros() at the log call
+    uint16_t format;           // lora_log_format_t
+    uint8_t level;             // LORA_LOG_LEVEL_* | LORA_LOG_FLAG_DATA
+    uint8_t len;               // bytes used in data
+    uint8_t data[LORA_LOG_MAX_DATA]; // arguments as uint32_t little endian, or raw bytes
+} lora_log_record_t;
+
+#define LORA_LOG_HEADER_SIZE offsetof(lora_log_record_t, data)
+
+#ifdef __cplusplus
+class Print;
+
+// Start the drain task writing to out (usually Serial). Without the task
+// the caller drains with lora_log_flush(), e.g. from loop().
+void lora_log_begin(Print &out, bool drainTask = true);
+// Write everything buffered from the calling task, e.g. before deep sleep
+void lora_log_flush();
+
+void lora_log_write(uint8_t level, uint16_t format, const uint32_t *args, uint8_t argc);
+void lora_log_data(uint8_t level, uint16_t format, const void *data, size_t len);
+
+// Buffer statistics
+uint32_t lora_log_records();
+uint32_t lora_log_drops();
+uint32_t lora_log_high_water();
+
+template <typename... Args>
+static inline void lora_log(uint8_t level, uint16_t format, Args... args) {
+    static_assert(sizeof...(Args) <= LORA_LOG_MAX_ARGS, "too many log arguments");
+    const uint32_t values[] = {0, (uint32_t)args...};
+    lora_log_write(level, format, values + 1, sizeof...(Args));
+}
+
+#define LORA_LOG(level, ...)                  \
+    do {                                      \
+        if ((level) <= LORA_LOG_LEVEL)        \
+            lora_log((level), __VA_ARGS__);   \
+    } while (0)
+#define LORA_LOG_ERROR(...) LORA_LOG(LORA_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LORA_LOG_WARN(...) LORA_LOG(LORA_LOG_LEVEL_WARN, __VA_ARGS__)
+#define LORA_LOG_INFO(...) LORA_LOG(LORA_LOG_LEVEL_INFO, __VA_ARGS__)
+#define LORA_LOG_DEBUG(...) LORA_LOG(LORA_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LORA_LOG_DATA(level, format, data, len)          \
+    do {                                                 \
+        if ((level) <= LORA_LOG_LEVEL)                   \
+            lora_log_data((level), (format), data, len); \
+    } while (0)
+#endif
+
+static inline char lora_log_level_letter(uint8_t level) {
+    static const char letters[] = "-EWID";
+    level &= LORA_LOG_LEVEL_MASK;
+    return level < sizeof(letters) - 1 ? letters[level] : '?';
+}
+
+// Decode a record read from the console, the bytes between two 0x00
+// (host tools). false if they are not a valid record.
+static inline bool lora_log_record_decode(const uint8_t *chunk, size_t len, lora_log_record_t *record) {
+    size_t n = lora_cobs_decode(chunk, len, (uint8_t *)record, sizeof(*record));
+    if (n < LORA_LOG_HEADER_SIZE || n != LORA_LOG_HEADER_SIZE + record->len)
+        return false;
+    uint8_t level = record->level & LORA_LOG_LEVEL_MASK;
+    if (level == LORA_LOG_LEVEL_NONE || level > LORA_LOG_LEVEL_DEBUG || record->format >= LORA_LOG_FORMAT_COUNT)
+        return false;
+    return (record->level & LORA_LOG_FLAG_DATA) || record->len % sizeof(uint32_t) == 0;
+}
+
+// Format the message of a record without time stamp and level. Returns
+// the text length.
+static inline size_t lora_log_format_message(const lora_log_record_t *record, char *out, size_t cap) {
+    const char *format = lora_log_format_string(record->format);
+    int n;
+    if (format == NULL)
+        n = snprintf(out, cap, "unknown format %u", record->format);
+    else if (record->level & LORA_LOG_FLAG_DATA) {
+        n = snprintf(out, cap, "%s [%u bytes]:", format, record->len);
+        for (uint8_t i = 0; i < record->len && n >= 0 && (size_t)n + 4 < cap; ++i)
+            n += snprintf(out + n, cap - n, " %02X", record->data[i]);
+    } else {
+        uint32_t args[LORA_LOG_MAX_ARGS] = {0};
+        memcpy(args, record->data, record->len <= sizeof(args) ? record->len : sizeof(args));
+        n = snprintf(out, cap, format, (unsigned)args[0], (unsigned)args[1], (unsigned)args[2],
+                     (unsigned)args[3], (unsigned)args[4], (unsigned)args[5]);
+    }
+    if (n < 0)
+        n = 0;
+    return (size_t)n < cap ? (size_t)n : cap - 1;
+}
+
+// Format one record as "seconds.micros L message" (no line end) into at
+// least LORA_LOG_LINE_SIZE bytes. Returns the text length.
+static inline size_t lora_log_format(const lora_log_record_t *record, char *out, size_t cap) {
+    int n = snprintf(out, cap, "%5lu.%06lu %c ", (unsigned long)(record->us / 1000000),
+                     (unsigned long)(record->us % 1000000), lora_log_level_letter(record->level));
+    return n + lora_log_format_message(record, out + n, cap - n);
+}
+
+// Usage:
+// lora_log_begin(Serial);
+// LORA_LOG_INFO(LOGF_RX_PAYLOAD, p.messageID, p.lora_eventID, ...);
+// LORA_LOG_DATA(LORA_LOG_LEVEL_INFO, LOGF_TX_FRAME, frame.data, frame.len);
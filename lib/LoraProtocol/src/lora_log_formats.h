@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+
+// Log message formats for lora_log.h, shared by the sketches and the host
+// decoder (tools/). A record carries only the index into this list, so
+// append new entries at the end and never reorder or remove, or older
+// captures decode to the wrong text.
+//
+// Arguments are printf'd as unsigned int: use %u, %d, %X (up to
+// LORA_LOG_MAX_ARGS). Data records (LORA_LOG_DATA) print the format
+// followed by the bytes in hex.
+#define LORA_LOG_FORMATS(X)                                                                      \
+    X(LOGF_BOOT, "boot %u log formats")                                                          \
+    X(LOGF_LOG_STATS, "log records=%u drops=%u max depth=%u")                                    \
+    X(LOGF_LOOP_START, "loop start")                                                             \
+    X(LOGF_RX_DEADLINE, "no message received within %u ms")                                     \
+    X(LOGF_RX_BAD_SIZE, "rx frame size %u, expected %u")                                         \
+    X(LOGF_RX_PAYLOAD, "rx msg=%u event=0x%04X elapsed=%u ms pulses=%u checksum=0x%04X status=%u") \
+    X(LOGF_TX_ACK, "tx ack")                                                                     \
+    X(LOGF_TX_CONFIG, "tx msg=%u event=0x%04X pulses=%u wakeup=%u s shutdown=%u ms delay=%u ms")  \
+    X(LOGF_TX_CONFIG_RANGE, "config field %u value %u outside %u-%u, sent anyway")               \
+    X(LOGF_TX_FRAME, "tx frame")                                                                 \
+    X(LOGF_TX_ERROR, "tx error, response code %u")                                               \
+    X(LOGF_RX_DATA, "rx msg=%u event=0x%04X pulses=%u status=%u output delay=%u ms")             \
+    X(LOGF_RX_ERROR, "rx error, frames dropped=%u")                                              \
+    X(LOGF_RX_STATS, "rx queue depth=%u max=%u drops=%u errors=%u timeouts=%u")                \
+    X(LOGF_TX_SKIPPED, "tx %u bytes skipped, channel or duty-cycle budget busy for %u ms")       \
+    X(LOGF_TX_STATS, "tx frames=%u airtime=%u ms utilisation=%u permille budget used=%u permille deferred=%u skipped=%u") \
+    X(LOGF_RX_MESSAGE, "rx msg=%u event=0x%04X size=%u status=%u output delay=%u ms")         \
+    X(LOGF_RX_FRAMES, "rx frames=%u batches=%u messages=%u")                                     \
+    X(LOGF_RX_BATCH, "rx batch msg=%u of %u messages")                                          \
+    X(LOGF_RX_DELTA, "rx compact frame of %u readings, %u bytes")                               \
+    X(LOGF_RX_DELTA_DROPPED, "rx compact frame not decoded, base missing=%u malformed=%u")      \
+    X(LOGF_RX_DUPLICATE, "rx msg=%u again, not handled twice")                                  \
+    X(LOGF_TX_SACK, "tx sack next=%u bitmap=0x%08X duplicates=%u")                             \
+    X(LOGF_RX_NODE, "rx from node 0x%04X frames=%u duplicates=%u errors=%u")                     \
+    X(LOGF_NODE_CONFIG, "config msg=%u queued for %u nodes")                                     \
+    X(LOGF_NODE_STATS, "nodes=%u of %u added=%u evicted=%u expired=%u max probes=%u")              \
+    X(LOGF_TX_SLOT, "tx slot %u of %u to node 0x%04X delay=%u ms offset=%d ms")                 \
+    X(LOGF_TDMA_LAYOUT, "tdma slots=%u slot=%u ms guard=%u ms drift=%u ppm epoch=%u") \
+    X(LOGF_CONFIG_VERSION, "config version 0x%04X pulses=%u wakeup=%u s shutdown=%u ms delay=%u ms") \
+    X(LOGF_RX_CONFIG_VERSION, "node 0x%04X runs config version 0x%04X, current 0x%04X") \
+    X(LOGF_MQTT_CONNECT, "mqtt not connected, wifi status=%u mqtt state=%d, retry in %u ms") \
+    X(LOGF_MQTT_PUBLISH, "mqtt publish seq=%u records=%u bytes=%u took=%u ms") \
+    X(LOGF_MQTT_PUBLISH_FAILED, "mqtt publish seq=%u of %u bytes failed, state=%d") \
+    X(LOGF_MQTT_STATS, "mqtt publishes=%u records=%u dropped=%u failures=%u connects=%u max publish=%u ms") \
+    X(LOGF_RXLOG_BEGIN, "rxlog ready=%u ring=%u blocks backlog=%u blocks") \
+    X(LOGF_RXLOG_STATS, "rxlog backlog=%u blocks appended=%u replayed=%u lost=%u corrupt=%u writes=%u") \
+    X(LOGF_E32_CONFIG, "e32 config result=%u commands=%u ready=%u ms") \
+    X(LOGF_CAPTURE_RX, "capture rx") \
+    X(LOGF_CAPTURE_TX, "capture tx") \
+    X(LOGF_PERF_REPORT, "perf report") \
+    X(LOGF_E32_UART, "e32 uart %u baud, tried from %u, %u rates refused") \
+    X(LOGF_UART_STATS, "uart %u baud frames=%u module output p50=%u p99=%u max=%u us") \
+    X(LOGF_LINK_RATE, "air rate %u -> %u bps reason=%u loss=%u permille module=%u") \
+    X(LOGF_LINK_STATS, "link %u bps loss=%u permille ups=%u downs=%u fallbacks=%u refused=%u") \
+    X(LOGF_TX_PULSES, "pulses %u new in the ack, total=%u bounces=%u") \
+    X(LOGF_TIME_SYNC, "time sync node 0x%04X offset=%d ms drift=%d ppm round trip=%u ms answer at %u ms, %u late")
+
+#define LORA_LOG_FORMAT_ID(id, text) id,
+enum lora_log_format_t : uint16_t { LORA_LOG_FORMATS(LORA_LOG_FORMAT_ID) LORA_LOG_FORMAT_COUNT };
+#undef LORA_LOG_FORMAT_ID
+
+// Format string of a record, NULL if unknown. Only referenced where
+// records are turned into text, so binary builds keep the strings out of
+// flash.
+static inline const char *lora_log_format_string(uint16_t format) {
+#define LORA_LOG_FORMAT_TEXT(id, text) text,
+    static const char *const formats[] = {LORA_LOG_FORMATS(LORA_LOG_FORMAT_TEXT)};
+#undef LORA_LOG_FORMAT_TEXT
+    return format < LORA_LOG_FORMAT_COUNT ? formats[format] : NULL;
+}
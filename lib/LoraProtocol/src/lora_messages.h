@@ -0,0 +1,391 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_checksum.h"
+#include "lora_frame.h"
+#include "lora_perf.h"
+
+// Message schema registry keyed by lora_eventID.
+//
+// Every payload struct is described once as a list of fields (name, offset,
+// size, print format, valid range). LORA_MESSAGE_LIST maps each event ID to
+// its struct and field list. From that the header generates
+//   - LoraMessage<EVENT>::type        struct type for an event, at compile time
+//   - lora_message_init<EVENT>(id)    zeroed struct with messageID/lora_eventID
+//   - lora_message_encode(&frame, m)  checksum + frame, no copies
+//   - lora_message_find(eventID)      LoraMessageInfo for a received frame
+//   - lora_message_validate()         length, checksum and range check
+//   - lora_message_print(out, ...)    debug printer for Serial or any Print
+// The tables are constexpr and live in flash; no heap, no start-up code.
+//
+// Adding a message type is one line in LORA_MESSAGE_LIST (plus a field
+// list if it uses a new struct).
+
+#ifndef LORA_EVENT_SENSOR_DATA
+#define LORA_EVENT_SENSOR_DATA 0x0000          // Sensor reading, no command
+#endif
+#ifndef LORA_EVENT_RESET_CONFIG_RESPONSE
+#define LORA_EVENT_RESET_CONFIG_RESPONSE 0x1006 // Response: configuration reset (0x0006 + 0x1000)
+#endif
+#ifndef LORA_EVENT_SEND_PROG_PARAMS_RESPONSE
+#define LORA_EVENT_SEND_PROG_PARAMS_RESPONSE 0x1004 // Response: performance summary (0x0004 + 0x1000, lora_perf.h)
+#endif
+#ifndef LORA_EVENT_SACK
+#define LORA_EVENT_SACK 0x0102                 // Selective acknowledge (lora_arq.h)
+#endif
+#ifndef LORA_EVENT_SLOT
+#define LORA_EVENT_SLOT 0x0103                 // Time slot assignment (lora_tdma.h)
+#endif
+#ifndef LORA_EVENT_SET_AIR_RATE
+#define LORA_EVENT_SET_AIR_RATE 0x0104         // Air data rate handshake (lora_link_adapt.h)
+#endif
+#ifndef LORA_EVENT_SET_AIR_RATE_RESPONSE
+#define LORA_EVENT_SET_AIR_RATE_RESPONSE 0x1104 // Response: the sensor takes the proposed rate
+#endif
+#ifndef LORA_EVENT_TIME_SYNC
+#define LORA_EVENT_TIME_SYNC 0x0105            // Clock offset and answer delay (lora_time_sync.h)
+#endif
+#ifndef LORA_EVENT_TIME_SYNC_RESPONSE
+#define LORA_EVENT_TIME_SYNC_RESPONSE 0x1105   // Response: the sensor's times of that exchange
+#endif
+
+// Messages of this library's own protocols, not part of communication.h
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;                     // LORA_EVENT_SACK
+    uint16_t ackNext;                          // Every messageID before this one was received
+    uint32_t ackBitmap;                        // Bit i: ackNext + 1 + i was received
+    uint16_t checksum;
+} lora_sack_payload_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;                     // LORA_EVENT_SLOT
+    uint32_t slotDelayMs;                      // From receiving this until the slot, sensor clock
+    uint32_t periodMs;                         // Slot repeats after this, sensor clock
+    uint16_t slotMs;                           // Length of the slot
+    uint16_t checksum;
+} lora_slot_payload_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;                     // LORA_EVENT_SET_AIR_RATE(_RESPONSE)
+    uint16_t handshake;                        // Same in proposal, response and commit
+    uint8_t airDataRate;                       // SPED.airDataRate code to switch to
+    uint8_t step;                              // LORA_RATE_PROPOSE / LORA_RATE_COMMIT
+    uint8_t fallbackFrames;                    // Unanswered frames before going back to baseRate
+    uint8_t baseRate;                          // SPED.airDataRate code both ends fall back to
+    uint16_t checksum;
+} lora_rate_payload_t;
+#define LORA_RATE_PROPOSE 1                    // Bridge asks, the sensor's response agrees
+#define LORA_RATE_COMMIT 2                     // Bridge switches once this ACK is out
+
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;                     // LORA_EVENT_TIME_SYNC
+    int32_t offsetMs;                          // Bridge clock minus sensor clock
+    int16_t driftPpm;                          // + the sensor clock runs slow
+    uint16_t answerDelayMs;                    // From the end of the sensor's frame on air to the answer on air
+    uint16_t windowMs;                         // The answer starts within +- this
+    uint16_t checksum;
+} lora_time_payload_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;                     // LORA_EVENT_TIME_SYNC_RESPONSE
+    uint16_t syncID;                           // messageID of the sync message answered
+    uint32_t frameEndMs;                       // Sensor clock: its frame was out
+    uint32_t answerEndMs;                      // Sensor clock: the answer with the sync came in
+    uint16_t checksum;
+} lora_time_response_t;
+
+// Field print formats
+#define LORA_FMT_DEC 0
+#define LORA_FMT_HEX 1
+#define LORA_FMT_TIME_MS 2     // milliseconds, also printed as hh:mm:ss
+#define LORA_FMT_PERF_NS 3     // lora_perf_encode_ns(), printed as microseconds
+
+typedef struct {
+    const char *name;
+    uint8_t offset;
+    uint8_t size;              // 1, 2 or 4 bytes, little endian
+    uint8_t format;
+    uint32_t min;              // Valid range, checked if min <= max
+    uint32_t max;
+} lora_field_t;
+
+#define LORA_FIELD_RANGE(type, field, format, lo, hi) \
+    { #field, (uint8_t)offsetof(type, field), (uint8_t)sizeof(((type *)0)->field), format, lo, hi }
+#define LORA_FIELD(type, field, format) LORA_FIELD_RANGE(type, field, format, 1, 0)
+
+// --- Field lists, one per struct layout (and per range set) ---
+
+static constexpr lora_field_t lora_payload_fields[] = {
+    LORA_FIELD(lora_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_payload_t, elapsed_time_ms, LORA_FMT_TIME_MS),
+    LORA_FIELD(lora_payload_t, pulse_count, LORA_FMT_DEC),
+    LORA_FIELD(lora_payload_t, checksum, LORA_FMT_HEX),
+};
+
+static constexpr lora_field_t lora_config_fields[] = {
+    LORA_FIELD(lora_config_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_config_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD_RANGE(lora_config_payload_t, ulp_pulses_to_wake_up, LORA_FMT_DEC, CONFIG_MIN_ULP_PULSES, CONFIG_MAX_ULP_PULSES),
+    LORA_FIELD_RANGE(lora_config_payload_t, wakeup_interval_sec, LORA_FMT_DEC, CONFIG_MIN_WAKEUP_SEC, CONFIG_MAX_WAKEUP_SEC),
+    LORA_FIELD_RANGE(lora_config_payload_t, shutdown_delay_ms, LORA_FMT_DEC, CONFIG_MIN_SHUTDOWN_MS, CONFIG_MAX_SHUTDOWN_MS),
+    LORA_FIELD_RANGE(lora_config_payload_t, lora_receive_delay_ms, LORA_FMT_DEC, CONFIG_MIN_LORA_DELAY_MS, CONFIG_MAX_LORA_DELAY_MS),
+    LORA_FIELD(lora_config_payload_t, checksum, LORA_FMT_HEX),
+};
+
+// Reset carries no values, the config fields are not used
+static constexpr lora_field_t lora_reset_fields[] = {
+    LORA_FIELD(lora_config_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_config_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_config_payload_t, checksum, LORA_FMT_HEX),
+};
+
+static constexpr lora_field_t lora_sack_fields[] = {
+    LORA_FIELD(lora_sack_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_sack_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_sack_payload_t, ackNext, LORA_FMT_DEC),
+    LORA_FIELD(lora_sack_payload_t, ackBitmap, LORA_FMT_HEX),
+    LORA_FIELD(lora_sack_payload_t, checksum, LORA_FMT_HEX),
+};
+
+static constexpr lora_field_t lora_slot_fields[] = {
+    LORA_FIELD(lora_slot_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_slot_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_slot_payload_t, slotDelayMs, LORA_FMT_DEC),
+    LORA_FIELD(lora_slot_payload_t, periodMs, LORA_FMT_DEC),
+    LORA_FIELD(lora_slot_payload_t, slotMs, LORA_FMT_DEC),
+    LORA_FIELD(lora_slot_payload_t, checksum, LORA_FMT_HEX),
+};
+
+static constexpr lora_field_t lora_rate_fields[] = {
+    LORA_FIELD(lora_rate_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_rate_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_rate_payload_t, handshake, LORA_FMT_DEC),
+    LORA_FIELD_RANGE(lora_rate_payload_t, airDataRate, LORA_FMT_DEC, 0, 7),
+    LORA_FIELD_RANGE(lora_rate_payload_t, step, LORA_FMT_DEC, 1, 2),
+    LORA_FIELD(lora_rate_payload_t, fallbackFrames, LORA_FMT_DEC),
+    LORA_FIELD_RANGE(lora_rate_payload_t, baseRate, LORA_FMT_DEC, 0, 7),
+    LORA_FIELD(lora_rate_payload_t, checksum, LORA_FMT_HEX),
+};
+
+static constexpr lora_field_t lora_time_fields[] = {
+    LORA_FIELD(lora_time_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_time_payload_t, offsetMs, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_payload_t, driftPpm, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_payload_t, answerDelayMs, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_payload_t, windowMs, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_payload_t, checksum, LORA_FMT_HEX),
+};
+
+static constexpr lora_field_t lora_time_response_fields[] = {
+    LORA_FIELD(lora_time_response_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_response_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_time_response_t, syncID, LORA_FMT_DEC),
+    LORA_FIELD(lora_time_response_t, frameEndMs, LORA_FMT_TIME_MS),
+    LORA_FIELD(lora_time_response_t, answerEndMs, LORA_FMT_TIME_MS),
+    LORA_FIELD(lora_time_response_t, checksum, LORA_FMT_HEX),
+};
+
+#define LORA_PERF_FIELDS(id, name)                                 \
+    LORA_FIELD(lora_perf_payload_t, name##_p50, LORA_FMT_PERF_NS), \
+    LORA_FIELD(lora_perf_payload_t, name##_p99, LORA_FMT_PERF_NS), \
+    LORA_FIELD(lora_perf_payload_t, name##_max, LORA_FMT_PERF_NS),
+static constexpr lora_field_t lora_perf_fields[] = {
+    LORA_FIELD(lora_perf_payload_t, messageID, LORA_FMT_DEC),
+    LORA_FIELD(lora_perf_payload_t, lora_eventID, LORA_FMT_HEX),
+    LORA_FIELD(lora_perf_payload_t, frames, LORA_FMT_DEC),
+    LORA_FIELD(lora_perf_payload_t, errors, LORA_FMT_DEC),
+    LORA_PERF_STAGES(LORA_PERF_FIELDS)
+    LORA_FIELD(lora_perf_payload_t, checksum, LORA_FMT_HEX),
+};
+#undef LORA_PERF_FIELDS
+
+// --- Registry: X(event ID, name, struct, field list) ---
+#define LORA_MESSAGE_LIST(X)                                                                    \
+    X(LORA_EVENT_SENSOR_DATA, SENSOR_DATA, lora_payload_t, lora_payload_fields)                 \
+    X(LORA_EVENT_RESUME_SLEEP_MODE, RESUME_SLEEP_MODE, lora_payload_t, lora_payload_fields)     \
+    X(LORA_EVENT_DISABLE_SLEEP_MODE, DISABLE_SLEEP_MODE, lora_payload_t, lora_payload_fields)   \
+    X(LORA_EVENT_SEND_LORA_PARAMS, SEND_LORA_PARAMS, lora_payload_t, lora_payload_fields)       \
+    X(LORA_EVENT_SEND_PROG_PARAMS, SEND_PROG_PARAMS, lora_payload_t, lora_payload_fields)       \
+    X(LORA_EVENT_SEND_PROG_PARAMS_RESPONSE, SEND_PROG_PARAMS_RESPONSE, lora_perf_payload_t, lora_perf_fields) \
+    X(LORA_EVENT_SET_CONFIG, SET_CONFIG, lora_config_payload_t, lora_config_fields)             \
+    X(LORA_EVENT_SET_CONFIG_RESPONSE, SET_CONFIG_RESPONSE, lora_config_payload_t, lora_config_fields) \
+    X(LORA_EVENT_RESET_CONFIG, RESET_CONFIG, lora_config_payload_t, lora_reset_fields)          \
+    X(LORA_EVENT_RESET_CONFIG_RESPONSE, RESET_CONFIG_RESPONSE, lora_config_payload_t, lora_reset_fields) \
+    X(LORA_EVENT_SACK, SACK, lora_sack_payload_t, lora_sack_fields)                             \
+    X(LORA_EVENT_SLOT, SLOT, lora_slot_payload_t, lora_slot_fields)                             \
+    X(LORA_EVENT_SET_AIR_RATE, SET_AIR_RATE, lora_rate_payload_t, lora_rate_fields)             \
+    X(LORA_EVENT_SET_AIR_RATE_RESPONSE, SET_AIR_RATE_RESPONSE, lora_rate_payload_t, lora_rate_fields) \
+    X(LORA_EVENT_TIME_SYNC, TIME_SYNC, lora_time_payload_t, lora_time_fields)                   \
+    X(LORA_EVENT_TIME_SYNC_RESPONSE, TIME_SYNC_RESPONSE, lora_time_response_t, lora_time_response_fields)
+
+typedef struct {
+    uint16_t eventID;
+    const char *name;
+    uint8_t size;              // sizeof the payload struct
+    const lora_field_t *fields;
+    uint8_t fieldCount;
+} lora_message_info_t;
+
+#define LORA_MESSAGE_INFO(event, name, type, fields) \
+    {(uint16_t)(event), #name, (uint8_t)sizeof(type), fields, (uint8_t)(sizeof(fields) / sizeof(fields[0]))},
+static constexpr lora_message_info_t lora_messages[] = {LORA_MESSAGE_LIST(LORA_MESSAGE_INFO)};
+#undef LORA_MESSAGE_INFO
+
+// Compile-time event -> struct mapping
+template <uint16_t EventID>
+struct LoraMessage;
+#define LORA_MESSAGE_TYPE(event, msg_name, msg_type, msg_fields)                                    \
+    template <>                                                                                      \
+    struct LoraMessage<event> {                                                                      \
+        typedef msg_type type;                                                                       \
+        static constexpr const char *name() { return #msg_name; }                                    \
+    };                                                                                               \
+    static_assert(offsetof(msg_type, messageID) == 0 && offsetof(msg_type, lora_eventID) == 2,       \
+                  #msg_type " must start with messageID, lora_eventID");                            \
+    static_assert(offsetof(msg_type, checksum) == sizeof(msg_type) - sizeof(uint16_t),              \
+                  #msg_type " must end with the checksum");                                         \
+    static_assert(sizeof(msg_type) <= LORA_MAX_PAYLOAD_SIZE, #msg_type " does not fit into one packet");
+LORA_MESSAGE_LIST(LORA_MESSAGE_TYPE)
+#undef LORA_MESSAGE_TYPE
+
+// --- Encoding ---
+
+// Zeroed message with IDs filled in
+template <uint16_t EventID>
+static inline typename LoraMessage<EventID>::type lora_message_init(uint16_t messageID) {
+    typename LoraMessage<EventID>::type msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.messageID = messageID;
+    msg.lora_eventID = EventID;
+    return msg;
+}
+
+// Set the checksum and frame the message in place
+template <typename T>
+static inline size_t lora_message_encode(lora_frame_t *frame, T *msg) {
+    msg->checksum = lora_message_checksum(msg);
+    return lora_frame_encode(frame, *msg);
+}
+
+// --- Decoding and validation ---
+
+typedef enum {
+    LORA_MSG_OK = 0,
+    LORA_MSG_UNKNOWN_EVENT,
+    LORA_MSG_BAD_LENGTH,
+    LORA_MSG_BAD_CHECKSUM,
+    LORA_MSG_OUT_OF_RANGE,
+} lora_msg_status_t;
+
+static inline const char *lora_msg_status_name(lora_msg_status_t status) {
+    static const char *const names[] = {"OK", "unknown event", "bad length", "bad checksum", "out of range"};
+    return (unsigned)status < sizeof(names) / sizeof(names[0]) ? names[status] : "?";
+}
+
+static inline const lora_message_info_t *lora_message_find(uint16_t eventID) {
+    for (size_t i = 0; i < sizeof(lora_messages) / sizeof(lora_messages[0]); ++i) {
+        if (lora_messages[i].eventID == eventID)
+            return &lora_messages[i];
+    }
+    return NULL;
+}
+
+static inline uint16_t lora_message_event(const void *payload) {
+    uint16_t eventID;
+    memcpy(&eventID, (const uint8_t *)payload + 2, sizeof(eventID));
+    return eventID;
+}
+
+static inline uint32_t lora_field_value(const lora_field_t &field, const void *payload) {
+    uint32_t value = 0;
+    memcpy(&value, (const uint8_t *)payload + field.offset, field.size); // little endian
+    return value;
+}
+
+// Check length, checksum and field ranges of a received payload. On
+// LORA_MSG_OUT_OF_RANGE *badField (if given) is the offending field.
+static inline lora_msg_status_t lora_message_validate(const lora_message_info_t *info, const void *payload, size_t len,
+                                                      const lora_field_t **badField = NULL) {
+    if (info == NULL)
+        return LORA_MSG_UNKNOWN_EVENT;
+    if (len != info->size)
+        return LORA_MSG_BAD_LENGTH;
+    uint16_t checksum;
+    memcpy(&checksum, (const uint8_t *)payload + len - sizeof(checksum), sizeof(checksum));
+    if (lora_checksum(payload, len - sizeof(checksum)) != checksum)
+        return LORA_MSG_BAD_CHECKSUM;
+    for (uint8_t i = 0; i < info->fieldCount; ++i) {
+        const lora_field_t &field = info->fields[i];
+        if (field.min > field.max)
+            continue;
+        uint32_t value = lora_field_value(field, payload);
+        if (value < field.min || value > field.max) {
+            if (badField)
+                *badField = &field;
+            return LORA_MSG_OUT_OF_RANGE;
+        }
+    }
+    return LORA_MSG_OK;
+}
+
+// Look up and validate a received payload by its lora_eventID
+static inline lora_msg_status_t lora_message_decode(const uint8_t *payload, size_t len, const lora_message_info_t **info) {
+    *info = len >= 4 ? lora_message_find(lora_message_event(payload)) : NULL;
+    return lora_message_validate(*info, payload, len);
+}
+
+// --- Debug output ---
+
+// Split milliseconds into hours, minutes and seconds
+static inline void lora_format_time(uint32_t ms, int *hours, int *minutes, int *seconds) {
+    *hours = ms / 3600000;
+    *minutes = (ms % 3600000) / 60000;
+    *seconds = (ms % 60000) / 1000;
+}
+
+// Prints "NAME (0xEVENT)" and one "  field: value" line per field to any
+// Arduino style Print (Serial) or object with print(const char *)
+template <typename Out>
+static void lora_message_print(Out &out, const lora_message_info_t &info, const void *payload) {
+    char line[48];
+    snprintf(line, sizeof(line), "%s (0x%04X)", info.name, info.eventID);
+    out.println(line);
+    for (uint8_t i = 0; i < info.fieldCount; ++i) {
+        const lora_field_t &field = info.fields[i];
+        uint32_t value = lora_field_value(field, payload);
+        if (field.format == LORA_FMT_HEX)
+            snprintf(line, sizeof(line), "  %s: 0x%lX", field.name, (unsigned long)value);
+        else if (field.format == LORA_FMT_TIME_MS) {
+            int hours, minutes, seconds;
+            lora_format_time(value, &hours, &minutes, &seconds);
+            snprintf(line, sizeof(line), "  %s: %lu (%02d:%02d:%02d)", field.name, (unsigned long)value,
+                     hours % 100, minutes, seconds);
+        } else if (field.format == LORA_FMT_PERF_NS) {
+            uint32_t ns = lora_perf_decode_ns((uint16_t)value);
+            snprintf(line, sizeof(line), "  %s: %lu.%03lu us", field.name, (unsigned long)(ns / 1000),
+                     (unsigned long)(ns % 1000));
+        } else
+            snprintf(line, sizeof(line), "  %s: %lu", field.name, (unsigned long)value);
+        out.println(line);
+    }
+}
+
+// Usage:
+// lora_config_payload_t config = lora_message_init<LORA_EVENT_SET_CONFIG>(id);
+// config.wakeup_interval_sec = 60;
+// lora_message_encode(&frame, &config);
+//
+// const lora_message_info_t *info;
+// if (lora_message_decode(payload, len, &info) == LORA_MSG_OK)
+//     lora_message_print(Serial, *info, payload);
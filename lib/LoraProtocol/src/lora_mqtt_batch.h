@@ -0,0 +1,148 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <ArduinoJson.h>
+#include "communication.h"
+#include "lora_messages.h"
+
+// Received messages collected for one MQTT publish. A publish per message
+// costs a broker round trip each, and a DynamicJsonDocument / String per
+// message fragments the heap of a bridge that runs for months.
+//
+// Messages are copied into a fixed array as they arrive. Once
+// maxRecords are collected, or the oldest is maxAgeMs old, the sketch
+// serializes them into one JSON document and publishes it:
+//   {"seq":7,"records":[{"event":"SENSOR_DATA","messageID":12,"lora_eventID":0,
+//     "elapsed_time_ms":60000,"pulse_count":4,"status":0,"age_ms":35}, ...]}
+// The field names come from the lora_messages.h registry (checksum left
+// out), "status" is the lora_msg_status_t of the message, "age_ms" the
+// time from reception until serialization. seq counts the publishes, a
+// gap means a batch was lost.
+//
+// Document and text buffer are sized at compile time for
+// LORA_MQTT_BATCH_RECORDS of the largest message (StaticJsonDocument,
+// ArduinoJson 6); event and field names are stored as pointers to the
+// registry, so serializing allocates nothing. A publish that fails leaves
+// the records in place for the next attempt; messages that arrive while
+// all LORA_MQTT_BATCH_RECORDS are taken are dropped and counted.
+#ifndef LORA_MQTT_BATCH_RECORDS
+#define LORA_MQTT_BATCH_RECORDS 8
+#endif
+// Largest message (lora_config_payload_t) and its JSON text: name, 6
+// fields, status and age at their widest
+#define LORA_MQTT_MESSAGE_MAX 16
+#define LORA_MQTT_RECORD_MEMBERS 9
+#define LORA_MQTT_RECORD_TEXT 232
+#define LORA_MQTT_JSON_CAPACITY \
+    (JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(LORA_MQTT_BATCH_RECORDS) + LORA_MQTT_BATCH_RECORDS * JSON_OBJECT_SIZE(LORA_MQTT_RECORD_MEMBERS))
+#define LORA_MQTT_TEXT_SIZE (32 + LORA_MQTT_BATCH_RECORDS * LORA_MQTT_RECORD_TEXT)
+
+class LoraMqttBatch
+{
+public:
+    void begin(size_t maxRecords_, uint32_t maxAgeMs_) {
+        maxRecords = maxRecords_ > 0 && maxRecords_ <= LORA_MQTT_BATCH_RECORDS ? maxRecords_ : LORA_MQTT_BATCH_RECORDS;
+        maxAgeMs = maxAgeMs_;
+        count = 0;
+    }
+
+    // Copy a received message; false (and counted) if the batch is full
+    bool add(const void *msg, size_t len, uint32_t receivedMs) {
+        if (count >= maxRecords || len > LORA_MQTT_MESSAGE_MAX || len < 4) {
+            dropped++;
+            return false;
+        }
+        record_t &r = records[count++];
+        memcpy(r.data, msg, len);
+        r.len = (uint8_t)len;
+        r.receivedMs = receivedMs;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count >= maxRecords; }
+
+    // Milliseconds from nowMs until the batch should be published,
+    // 0 = now, UINT32_MAX = empty
+    uint32_t dueInMs(uint32_t nowMs) const {
+        if (count == 0)
+            return UINT32_MAX;
+        uint32_t age = nowMs - records[0].receivedMs;
+        return count >= maxRecords || age >= maxAgeMs ? 0 : maxAgeMs - age;
+    }
+
+    // Serialize the records into text(); its length, 0 if empty or the
+    // text did not fit
+    size_t serialize(uint32_t nowMs) {
+        doc.clear();
+        doc["seq"] = seq;
+        JsonArray list = doc.createNestedArray("records");
+        for (size_t i = 0; i < count; ++i) {
+            const record_t &r = records[i];
+            JsonObject obj = list.createNestedObject();
+            const lora_message_info_t *info = lora_message_find(lora_message_event(r.data));
+            obj["event"] = info ? info->name : "UNKNOWN";
+            if (info != NULL) {
+                // Every field list ends with the checksum
+                for (uint8_t f = 0; f + 1 < info->fieldCount && info->fields[f].offset + info->fields[f].size <= r.len; ++f)
+                    obj[info->fields[f].name] = lora_field_value(info->fields[f], r.data);
+            }
+            obj["status"] = (uint8_t)lora_message_validate(info, r.data, r.len);
+            obj["age_ms"] = nowMs - r.receivedMs;
+        }
+        if (doc.overflowed() || measureJson(doc) >= sizeof(buffer)) {
+            overflows++;
+            return 0;
+        }
+        length = serializeJson(doc, buffer, sizeof(buffer));
+        return length;
+    }
+    const char *text() const { return buffer; }
+
+    // After the publish of text() went through
+    void published() {
+        seq++;
+        publishes++;
+        sent += count;
+        count = 0;
+    }
+    // Give up on the records, e.g. after serialize() failed
+    void discard() {
+        dropped += count;
+        count = 0;
+    }
+
+    uint32_t seq = 0;
+    uint32_t publishes = 0;
+    uint32_t sent = 0;          // Records published
+    uint32_t dropped = 0;       // Records lost, batch full or discarded
+    uint32_t overflows = 0;     // Batches that did not fit the buffer
+
+private:
+    typedef struct {
+        uint8_t data[LORA_MQTT_MESSAGE_MAX];
+        uint8_t len;
+        uint32_t receivedMs;
+    } record_t;
+
+    record_t records[LORA_MQTT_BATCH_RECORDS];
+    size_t count = 0;
+    size_t maxRecords = LORA_MQTT_BATCH_RECORDS;
+    uint32_t maxAgeMs = 5000;
+    size_t length = 0;
+    StaticJsonDocument<LORA_MQTT_JSON_CAPACITY> doc;
+    char buffer[LORA_MQTT_TEXT_SIZE];
+};
+
+// Usage, off the radio task:
+// mqttBatch.begin(8, 5000);
+// mqtt.setBufferSize(LORA_MQTT_TEXT_SIZE + 64);   // once, topic and header
+// per received message:  mqttBatch.add(&payload, sizeof(payload), receivedMs);
+// if (mqttBatch.dueInMs(millis()) == 0) {
+//   size_t len = mqttBatch.serialize(millis());
+//   if (len == 0) mqttBatch.discard();
+//   else if (mqtt.publish(topic, (const uint8_t *)mqttBatch.text(), len)) mqttBatch.published();
+// }
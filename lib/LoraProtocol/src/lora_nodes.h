@@ -0,0 +1,209 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_frame.h"
+#include "lora_time_sync.h"
+
+// Many sensors against one bridge in E32 fixed transmission mode.
+//
+// In fixed mode the sender writes ADDH ADDL CHAN in front of the packet and
+// only the module with that address (or 0xFFFF, broadcast) outputs it. The
+// receiving module does not tell where a packet came from, so a sensor
+// puts its own address in front of every payload:
+//   lora_node_header_t | payload   (then framed as usual)
+// LoraFrameDecoder::header(LORA_NODE_HEADER_SIZE) hands the payload out
+// without it, so the handlers stay the same. Answers go back with
+// sendFixedMessage() to that address and carry no header.
+// The 3 address bytes count against the 58 byte E32 packet:
+// LORA_NODE_MAX_PAYLOAD_SIZE is what is left for the payload.
+//
+// LoraNodeTable keeps per node state in a preallocated open addressing
+// hash table keyed by the address: linear probing, at most 3/4 full, so
+// a lookup is a few probes at any size. No heap; when the table is full
+// the node not heard from for the longest time makes room.
+#define LORA_NODE_BROADCAST 0xFFFF
+#define LORA_NODE_HEADER_SIZE sizeof(lora_node_header_t)
+#define LORA_NODE_MAX_PAYLOAD_SIZE (LORA_MAX_PAYLOAD_SIZE - 3 - LORA_NODE_HEADER_SIZE)
+
+typedef struct __attribute__((packed)) {
+    uint16_t address;                        // ADDH << 8 | ADDL of the sending sensor
+} lora_node_header_t;
+
+// Frame a payload with the sender's address in front
+static inline size_t lora_frame_encode_from(lora_frame_t *frame, uint16_t address, const void *payload, size_t len) {
+    uint8_t buf[LORA_MAX_PAYLOAD_SIZE];
+    frame->len = 0;
+    if (len > LORA_NODE_MAX_PAYLOAD_SIZE)
+        return 0;
+    lora_node_header_t header = {address};
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), payload, len);
+    return lora_frame_encode(frame, buf, sizeof(header) + len);
+}
+
+typedef struct {
+    uint16_t address;
+    uint16_t lastMessageID;                  // Last reading handled, repeats are duplicates
+    bool hasMessageID;
+    bool configPending;                      // config goes out after the next ACK
+    uint16_t configVersion;                  // Config version it echoed, 0 = unknown (lora_config_sync.h)
+    lora_config_payload_t config;
+    uint32_t firstSeenMs;
+    uint32_t lastSeenMs;
+    // Link statistics
+    uint32_t frames;                         // Frames received
+    uint32_t duplicates;                     // Readings received again
+    uint32_t errors;                         // Frames with bad size or checksum
+    // Time slot (lora_tdma.h)
+    uint16_t slot;                           // Slot index + 1, 0 = none
+    uint8_t slotEpoch;                       // Schedule epoch the slot was last sent for
+    int32_t driftPpm;                        // Sensor clock against ours, measured
+    uint32_t lastElapsedMs;                  // Sensor clock of the last reading
+    uint32_t lastArrivalMs;                  // Our clock when it arrived
+    // Clock sync and answer delay (lora_time_sync.h)
+    lora_clock_t clock;
+} lora_node_t;
+
+template <size_t CAPACITY = 64>
+class LoraNodeTable
+{
+    static_assert(CAPACITY >= 4 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+public:
+    LoraNodeTable() { clear(); }
+
+    void clear() {
+        for (size_t i = 0; i < CAPACITY; ++i)
+            used[i] = false;
+        count = 0;
+    }
+
+    // Entry of address, NULL if unknown
+    lora_node_t *find(uint16_t address) {
+        size_t i = home(address);
+        for (size_t probes = 1; used[i]; ++probes) {
+            if (slots[i].address == address) {
+                probed(probes);
+                return &slots[i];
+            }
+            i = (i + 1) & MASK;
+        }
+        return NULL;
+    }
+
+    // Entry of address, a new one (zeroed, seen now) if unknown. Never NULL.
+    lora_node_t *lookup(uint16_t address, uint32_t nowMs) {
+        lora_node_t *node = find(address);
+        if (node != NULL)
+            return node;
+        if (count >= MAX_LOAD)
+            evictOldest(nowMs);
+        size_t i = home(address);
+        while (used[i])
+            i = (i + 1) & MASK;
+        used[i] = true;
+        memset(&slots[i], 0, sizeof(slots[i]));
+        slots[i].address = address;
+        slots[i].firstSeenMs = nowMs;
+        slots[i].lastSeenMs = nowMs;
+        count++;
+        added++;
+        return &slots[i];
+    }
+
+    // Drop address; the entries after it in the probe run move up so
+    // lookups never need tombstones
+    bool remove(uint16_t address) {
+        lora_node_t *node = find(address);
+        if (node == NULL)
+            return false;
+        size_t hole = node - slots;
+        used[hole] = false;
+        count--;
+        for (size_t i = (hole + 1) & MASK; used[i]; i = (i + 1) & MASK) {
+            size_t want = home(slots[i].address);
+            // Move the entry if its home is not between the hole and it
+            if (((i - want) & MASK) >= ((i - hole) & MASK)) {
+                slots[hole] = slots[i];
+                used[hole] = true;
+                used[i] = false;
+                hole = i;
+            }
+        }
+        return true;
+    }
+
+    // Drop nodes not heard from for maxAgeMs. Returns how many.
+    size_t expire(uint32_t nowMs, uint32_t maxAgeMs) {
+        size_t n = 0;
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            // remove() may move a later entry into i, look at i again
+            while (used[i] && nowMs - slots[i].lastSeenMs > maxAgeMs) {
+                remove(slots[i].address);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    // Visit every node: fn(lora_node_t &)
+    template <typename F>
+    void forEach(F fn) {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            if (used[i])
+                fn(slots[i]);
+        }
+    }
+
+    size_t size() const { return count; }
+    static constexpr size_t capacity() { return MAX_LOAD; }
+
+    uint32_t added = 0;        // Nodes entered
+    uint32_t evicted = 0;      // Nodes dropped to make room
+    uint32_t maxProbes = 0;    // Longest probe run a hit needed
+
+private:
+    static const size_t MASK = CAPACITY - 1;
+    static const size_t MAX_LOAD = CAPACITY / 4 * 3;
+
+    static constexpr unsigned log2(size_t n) { return n <= 1 ? 0 : 1 + log2(n / 2); }
+    static_assert(log2(CAPACITY) <= 16, "more slots than addresses");
+
+    // Fibonacci hashing (2^16 / golden ratio): consecutive sensor addresses
+    // spread over the table instead of forming one long probe run
+    static size_t home(uint16_t address) { return (uint16_t)(address * 40503u) >> (16 - log2(CAPACITY)); }
+
+    void probed(size_t probes) {
+        if (probes > maxProbes)
+            maxProbes = (uint32_t)probes;
+    }
+
+    void evictOldest(uint32_t nowMs) {
+        size_t oldest = CAPACITY;
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            if (used[i] && (oldest == CAPACITY || nowMs - slots[i].lastSeenMs > nowMs - slots[oldest].lastSeenMs))
+                oldest = i;
+        }
+        if (oldest != CAPACITY && remove(slots[oldest].address))
+            evicted++;
+    }
+
+    lora_node_t slots[CAPACITY];
+    bool used[CAPACITY];
+    size_t count = 0;
+};
+
+// Usage, bridge:
+// static LoraNodeTable<64> nodes;
+// decoder.header(LORA_NODE_HEADER_SIZE);
+// lora_node_header_t from; memcpy(&from, decoder.header(), sizeof(from));
+// lora_node_t *node = nodes.lookup(from.address, millis());
+// node->frames++; node->lastSeenMs = millis();
+// e32ttl.sendFixedMessage(from.address >> 8, from.address & 0xFF, CHAN, ack.data, ack.len);
+//
+// Sensor:
+// lora_frame_encode_from(&frame, MY_ADDRESS, &payload, sizeof(payload));
+// e32ttl.sendFixedMessage(BRIDGE_ADDH, BRIDGE_ADDL, CHAN, frame.data, frame.len);
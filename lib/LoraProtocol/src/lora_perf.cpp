@@ -0,0 +1,57 @@
+#include "lora_perf.h"
+
+#include <Arduino.h>
+
+static LoraPerfHistogram perfStages[LORA_PERF_STAGE_COUNT];
+static std::atomic<uint32_t> perfFrames{0};
+static std::atomic<uint32_t> perfErrors{0};
+
+#if LORA_PERF
+uint32_t lora_perf_cycles()
+{
+  return ESP.getCycleCount();
+}
+
+void lora_perf_record(lora_perf_stage_t stage, uint32_t cycles)
+{
+  perfStages[stage].record(cycles);
+}
+
+void lora_perf_frame(bool ok)
+{
+  perfFrames.fetch_add(1, std::memory_order_relaxed);
+  if (!ok)
+    perfErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void lora_perf_errors(uint32_t n)
+{
+  perfErrors.fetch_add(n, std::memory_order_relaxed);
+}
+#endif
+
+const LoraPerfHistogram &lora_perf_stage(lora_perf_stage_t stage)
+{
+  return perfStages[stage];
+}
+
+static uint16_t perfNs(uint32_t cycles, uint32_t mhz)
+{
+  uint64_t ns = (uint64_t)cycles * 1000 / mhz;
+  return lora_perf_encode_ns(ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+}
+
+void lora_perf_fill(lora_perf_payload_t *report)
+{
+  uint32_t mhz = getCpuFrequencyMhz();
+  if (mhz == 0)
+    mhz = 1;
+  report->frames = (uint16_t)perfFrames.load(std::memory_order_relaxed);
+  report->errors = (uint16_t)perfErrors.load(std::memory_order_relaxed);
+#define LORA_PERF_FILL_STAGE(id, name)                            \
+  report->name##_p50 = perfNs(perfStages[id].percentile(50), mhz); \
+  report->name##_p99 = perfNs(perfStages[id].percentile(99), mhz); \
+  report->name##_max = perfNs(perfStages[id].max(), mhz);
+  LORA_PERF_STAGES(LORA_PERF_FILL_STAGE)
+#undef LORA_PERF_FILL_STAGE
+}
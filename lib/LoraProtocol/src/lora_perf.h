@@ -0,0 +1,183 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Where the time of the radio path goes, measured on the device itself.
+//
+// lora_perf_cycles() reads the CPU cycle counter (ESP.getCycleCount(), a
+// single instruction); a stage is the difference of two reads, recorded
+// into a histogram of that stage. The histograms have fixed log-scale
+// buckets, 4 per power of two (LORA_PERF_SUB_BITS), from 1 cycle to 2^32:
+// recording is a count of leading zeros and an increment, no division and
+// no heap, and a percentile read back is at most 25 % above the true one
+// (the upper bound of its bucket, never above the largest value seen).
+//
+// Stages of a frame, each recorded once per occurrence:
+//   uart      reading its bytes from the UART driver (Serial1.read())
+//   decode    the frame decoder (LoraFrameDecoder::push())
+//   checksum  looking up and validating one message
+//   handler   from the complete frame until it is handled, checksums and
+//             log calls of its messages included
+//   log       one log call (lora_log.h), on any task
+//   answer    building an ACK, SACK, config or report frame
+//   tx        handing a frame to the module, waiting for AUX included
+// The cycle counter is per core: a stage starts and ends on the same task,
+// and the tasks are pinned. Several tasks record into one histogram and
+// another reads it: the counters are relaxed atomics, no lock, and a
+// percentile is taken from the bucket counts alone, so a read during a
+// record is one sample short at worst.
+//
+// LORA_EVENT_SEND_PROG_PARAMS asks for a summary: lora_perf_payload_t
+// with p50, p99 and max per stage in nanoseconds (lora_perf_encode_ns()),
+// frames received and errors since boot. LORA_PERF 0 compiles the
+// measurements out, the summary then reads zeros.
+#ifndef LORA_PERF
+#define LORA_PERF 1
+#endif
+
+#define LORA_PERF_STAGES(X) \
+    X(LORA_PERF_UART, uart) \
+    X(LORA_PERF_DECODE, decode) \
+    X(LORA_PERF_CHECKSUM, checksum) \
+    X(LORA_PERF_HANDLER, handler) \
+    X(LORA_PERF_LOG, log) \
+    X(LORA_PERF_ANSWER, answer) \
+    X(LORA_PERF_TX, tx)
+
+#define LORA_PERF_STAGE_ID(id, name) id,
+enum lora_perf_stage_t : uint8_t { LORA_PERF_STAGES(LORA_PERF_STAGE_ID) LORA_PERF_STAGE_COUNT };
+#undef LORA_PERF_STAGE_ID
+
+#define LORA_PERF_SUB_BITS 2
+#define LORA_PERF_BUCKETS ((32 - LORA_PERF_SUB_BITS + 1) << LORA_PERF_SUB_BITS)
+
+class LoraPerfHistogram
+{
+public:
+    void record(uint32_t value) {
+        counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        uint32_t seen = largest.load(std::memory_order_relaxed);
+        while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint32_t count() const { return samples.load(std::memory_order_relaxed); }
+    uint32_t max() const { return largest.load(std::memory_order_relaxed); }
+
+    // Value at or below which percent of the samples are, 0 without any
+    uint32_t percentile(uint32_t percent) const {
+        // Counts only grow: the second walk reaches the rank of the first
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < LORA_PERF_BUCKETS; ++i)
+            total += counts[i].load(std::memory_order_relaxed);
+        if (total == 0)
+            return 0;
+        uint64_t rank = (total * percent + 99) / 100;
+        if (rank == 0)
+            rank = 1;
+        uint32_t most = max();
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < LORA_PERF_BUCKETS; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return upper(i) < most ? upper(i) : most;
+        }
+        return most;
+    }
+
+    // Not while another task records
+    void reset() {
+        for (uint32_t i = 0; i < LORA_PERF_BUCKETS; ++i)
+            counts[i].store(0, std::memory_order_relaxed);
+        samples.store(0, std::memory_order_relaxed);
+        largest.store(0, std::memory_order_relaxed);
+    }
+
+    // Values below 2^SUB have a bucket each, above that 2^SUB per power of two
+    static uint32_t bucket(uint32_t value) {
+        if (value < (1u << LORA_PERF_SUB_BITS))
+            return value;
+        uint32_t msb = 31 - __builtin_clz(value);
+        uint32_t sub = (value >> (msb - LORA_PERF_SUB_BITS)) & ((1u << LORA_PERF_SUB_BITS) - 1);
+        return ((msb - LORA_PERF_SUB_BITS + 1) << LORA_PERF_SUB_BITS) + sub;
+    }
+
+    // Largest value in bucket i
+    static uint32_t upper(uint32_t i) {
+        if (i < (1u << LORA_PERF_SUB_BITS))
+            return i;
+        uint32_t msb = (i >> LORA_PERF_SUB_BITS) + LORA_PERF_SUB_BITS - 1;
+        uint32_t sub = i & ((1u << LORA_PERF_SUB_BITS) - 1);
+        uint64_t lower = (1ull << msb) + ((uint64_t)sub << (msb - LORA_PERF_SUB_BITS));
+        return (uint32_t)(lower + (1ull << (msb - LORA_PERF_SUB_BITS)) - 1);
+    }
+
+private:
+    std::atomic<uint32_t> counts[LORA_PERF_BUCKETS] = {};
+    std::atomic<uint32_t> samples{0};
+    std::atomic<uint32_t> largest{0};
+};
+
+// Nanoseconds in 16 bits: up to 2047 as they are, above that an 11 bit
+// mantissa and a 5 bit shift, 0.1 % steps up to 4.3 s
+static inline uint16_t lora_perf_encode_ns(uint32_t ns) {
+    if (ns < 2048)
+        return (uint16_t)ns;
+    uint32_t shift = 31 - __builtin_clz(ns) - 10;
+    return (uint16_t)(shift << 11 | ns >> shift);
+}
+
+static inline uint32_t lora_perf_decode_ns(uint16_t value) {
+    return (uint32_t)(value & 0x7FF) << (value >> 11);
+}
+
+// LORA_EVENT_SEND_PROG_PARAMS_RESPONSE (lora_messages.h)
+#define LORA_PERF_PAYLOAD_STAGE(id, name) \
+    uint16_t name##_p50;                  \
+    uint16_t name##_p99;                  \
+    uint16_t name##_max;
+typedef struct __attribute__((packed)) {
+    uint16_t messageID;
+    uint16_t lora_eventID;
+    uint16_t frames;                           // Received since boot, modulo 2^16
+    uint16_t errors;                           // Frames dropped, garbage, TX refused
+    LORA_PERF_STAGES(LORA_PERF_PAYLOAD_STAGE)  // lora_perf_encode_ns()
+    uint16_t checksum;
+} lora_perf_payload_t;
+#undef LORA_PERF_PAYLOAD_STAGE
+
+#ifdef __cplusplus
+#if LORA_PERF
+uint32_t lora_perf_cycles();
+void lora_perf_record(lora_perf_stage_t stage, uint32_t cycles);
+// A received frame, and whether it was handled
+void lora_perf_frame(bool ok);
+// Frames lost before they were one: garbage, TX refused
+void lora_perf_errors(uint32_t n = 1);
+#else
+static inline uint32_t lora_perf_cycles() { return 0; }
+static inline void lora_perf_record(lora_perf_stage_t, uint32_t) {}
+static inline void lora_perf_frame(bool) {}
+static inline void lora_perf_errors(uint32_t = 1) {}
+#endif
+
+// Record the cycles since start
+static inline void lora_perf_since(lora_perf_stage_t stage, uint32_t start) {
+    lora_perf_record(stage, lora_perf_cycles() - start);
+}
+
+// Everything of the summary but messageID, lora_eventID and checksum
+void lora_perf_fill(lora_perf_payload_t *report);
+const LoraPerfHistogram &lora_perf_stage(lora_perf_stage_t stage);
+#endif
+
+// Usage:
+// uint32_t start = lora_perf_cycles();
+// e32ttl.sendMessage(frame.data, frame.len);
+// lora_perf_since(LORA_PERF_TX, start);
+//
+// lora_perf_payload_t report = lora_message_init<LORA_EVENT_SEND_PROG_PARAMS_RESPONSE>(id);
+// lora_perf_fill(&report);
+// lora_message_encode(&frame, &report);
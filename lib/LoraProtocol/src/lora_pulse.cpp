@@ -0,0 +1,99 @@
+#include "lora_pulse.h"
+
+#include <Arduino.h>
+#include <atomic>
+#if LORA_PULSE_PCNT
+#include <driver/pcnt.h>
+#endif
+
+static lora_pulse_count_t pulseCommitted = 0;
+
+#if LORA_PULSE_PCNT
+static const pcnt_unit_t PULSE_UNIT = PCNT_UNIT_0;
+static LoraPulseExtender pulseTotal(LORA_PULSE_PCNT_LIMIT);
+
+bool lora_pulse_begin(uint8_t pin)
+{
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = pin;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.lctrl_mode = PCNT_MODE_KEEP;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.pos_mode = PCNT_COUNT_DIS;
+  config.neg_mode = PCNT_COUNT_INC;
+  config.counter_h_lim = LORA_PULSE_PCNT_LIMIT;
+  config.counter_l_lim = 0;
+  config.unit = PULSE_UNIT;
+  config.channel = PCNT_CHANNEL_0;
+  if (pcnt_unit_config(&config) != ESP_OK)
+    return false;
+  pcnt_set_filter_value(PULSE_UNIT, LORA_PULSE_DEBOUNCE_US * 80);
+  if (LORA_PULSE_DEBOUNCE_US > 0)
+    pcnt_filter_enable(PULSE_UNIT);
+  pcnt_counter_pause(PULSE_UNIT);
+  pcnt_counter_clear(PULSE_UNIT);
+  pcnt_counter_resume(PULSE_UNIT);
+  return true;
+}
+
+lora_pulse_count_t lora_pulse_total()
+{
+  int16_t count = 0;
+  if (pcnt_get_counter_value(PULSE_UNIT, &count) != ESP_OK)
+    return pulseTotal.value();
+  return pulseTotal.update((uint16_t)count);
+}
+
+uint32_t lora_pulse_bounces()
+{
+  return 0;
+}
+#else
+static std::atomic<uint32_t> pulseCount(0);
+static std::atomic<uint32_t> pulseBounces(0);
+static uint32_t pulseLastUs = 0; // ISR only
+static bool pulseSeen = false;   // ISR only
+static LoraPulseExtender pulseTotal;
+
+static void IRAM_ATTR pulseInterrupt()
+{
+  uint32_t now = micros();
+  if (pulseSeen && now - pulseLastUs < LORA_PULSE_DEBOUNCE_US)
+  {
+    pulseBounces.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  pulseSeen = true;
+  pulseLastUs = now;
+  pulseCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool lora_pulse_begin(uint8_t pin)
+{
+  attachInterrupt(digitalPinToInterrupt(pin), pulseInterrupt, FALLING);
+  return true;
+}
+
+lora_pulse_count_t lora_pulse_total()
+{
+  return pulseTotal.update(pulseCount.load(std::memory_order_relaxed));
+}
+
+uint32_t lora_pulse_bounces()
+{
+  return pulseBounces.load(std::memory_order_relaxed);
+}
+#endif
+
+lora_pulse_snapshot_t lora_pulse_snapshot()
+{
+  lora_pulse_snapshot_t snapshot;
+  snapshot.total = lora_pulse_total();
+  snapshot.delta = snapshot.total - pulseCommitted;
+  return snapshot;
+}
+
+void lora_pulse_commit(const lora_pulse_snapshot_t &snapshot)
+{
+  pulseCommitted = snapshot.total;
+}
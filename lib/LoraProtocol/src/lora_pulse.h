@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Pulses of the Hall sensor (rain gauge), counted without a lock.
+//
+// LORA_PULSE_PCNT 1 counts the falling edges in a pulse counter unit of the
+// ESP32-S3: no interrupt per pulse at all. Its glitch filter debounces,
+// up to 1023 APB cycles (12.7 µs). LORA_PULSE_PCNT 0 counts them in a GPIO
+// interrupt with a relaxed atomic increment instead of a critical section;
+// edges closer than LORA_PULSE_DEBOUNCE_US to the last counted one are
+// bounces and dropped, any length.
+//
+// Either counter is narrow and wraps: the PCNT unit at LORA_PULSE_PCNT_LIMIT
+// (16 bit hardware), the atomic at 2^32. Every read adds the change since
+// the previous read, modulo the wrap, to a total of LORA_PULSE_BITS (32 or
+// 64), so nothing is lost as long as reads are less than a wrap apart:
+// 32767 tips of the bucket between two ACKs.
+//
+// A send takes a snapshot: the total and the pulses since the last
+// committed one. Once the frame is out the snapshot is committed; a frame
+// that did not go out leaves its pulses to the next. The ACK carries the
+// total modulo 2^32, a receiver takes the difference to the last one it
+// got, so a lost ACK loses no pulses either (as lora_delta.h does).
+// Total, snapshot and commit belong to one task, the one that sends.
+#ifndef LORA_PULSE_PCNT
+#define LORA_PULSE_PCNT 1
+#endif
+#ifndef LORA_PULSE_BITS
+#define LORA_PULSE_BITS 32
+#endif
+#ifndef LORA_PULSE_DEBOUNCE_US
+#define LORA_PULSE_DEBOUNCE_US 10
+#endif
+#define LORA_PULSE_PCNT_LIMIT 32767
+#define LORA_PULSE_PCNT_MAX_FILTER 1023 // APB cycles, 80 per µs
+
+#if LORA_PULSE_BITS == 64
+typedef uint64_t lora_pulse_count_t;
+#elif LORA_PULSE_BITS == 32
+typedef uint32_t lora_pulse_count_t;
+#else
+#error "LORA_PULSE_BITS is 32 or 64"
+#endif
+#if LORA_PULSE_PCNT && LORA_PULSE_DEBOUNCE_US * 80 > LORA_PULSE_PCNT_MAX_FILTER
+#error "The PCNT glitch filter takes at most 12 us, LORA_PULSE_PCNT 0 debounces longer"
+#endif
+
+// A narrow wrapping counter -> a wide total
+class LoraPulseExtender
+{
+public:
+    // 0: the counter wraps at 2^32
+    explicit LoraPulseExtender(uint32_t modulus_ = 0) : modulus(modulus_) {}
+
+    lora_pulse_count_t update(uint32_t raw) {
+        uint32_t step = raw - last;
+        if (modulus != 0 && raw < last)
+            step = raw + modulus - last;
+        last = raw;
+        total += step;
+        return total;
+    }
+
+    lora_pulse_count_t value() const { return total; }
+
+private:
+    uint32_t modulus;
+    uint32_t last = 0;
+    lora_pulse_count_t total = 0;
+};
+
+typedef struct {
+    lora_pulse_count_t total;  // Since lora_pulse_begin()
+    lora_pulse_count_t delta;  // Since the last committed snapshot
+} lora_pulse_snapshot_t;
+
+#ifdef __cplusplus
+// Count falling edges on pin from now on, false if the counter unit refused
+bool lora_pulse_begin(uint8_t pin);
+lora_pulse_count_t lora_pulse_total();
+lora_pulse_snapshot_t lora_pulse_snapshot();
+// The snapshot's pulses went out
+void lora_pulse_commit(const lora_pulse_snapshot_t &snapshot);
+// Edges dropped as bounces (LORA_PULSE_PCNT 0; the PCNT filter does not count)
+uint32_t lora_pulse_bounces();
+#endif
+
+// Usage:
+// lora_pulse_begin(HSENSD);
+// lora_pulse_snapshot_t pulses = lora_pulse_snapshot();
+// payload.pulse_count = (uint32_t)pulses.total;
+// if (transmitFrame(...)) lora_pulse_commit(pulses);
@@ -0,0 +1,66 @@
+#include "lora_rx_event.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+static SemaphoreHandle_t rxSemaphore = NULL;
+static uint8_t rxAuxPin = 0;
+static volatile uint32_t auxFellAt = 0;
+static volatile uint32_t auxPulseUs = 0;
+static volatile uint32_t auxPulseFellAt = 0;
+static volatile bool auxPulseReady = false;
+
+static void IRAM_ATTR onAuxChange()
+{
+  uint32_t now = micros();
+  if (digitalRead(rxAuxPin) == LOW)
+  {
+    auxFellAt = now;
+    return;
+  }
+  auxPulseUs = now - auxFellAt;
+  auxPulseFellAt = auxFellAt;
+  auxPulseReady = true;
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(rxSemaphore, &woken);
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+// Runs in the UART event task, not in ISR context
+static void onUartReceive()
+{
+  xSemaphoreGive(rxSemaphore);
+}
+
+void lora_rx_begin(HardwareSerial &serial, uint8_t auxPin)
+{
+  if (rxSemaphore == NULL)
+    rxSemaphore = xSemaphoreCreateBinary();
+  serial.setRxTimeout(LORA_RX_TIMEOUT_SYMBOLS);
+  serial.onReceive(onUartReceive, false);
+  rxAuxPin = auxPin;
+  attachInterrupt(digitalPinToInterrupt(auxPin), onAuxChange, CHANGE);
+}
+
+bool lora_rx_wait(HardwareSerial &serial, uint32_t timeout_ms)
+{
+  if (serial.available())
+    return true;
+  // A wakeup left over from earlier data that has already been read
+  // returns early; the caller checks available() and waits again
+  xSemaphoreTake(rxSemaphore, pdMS_TO_TICKS(timeout_ms));
+  return serial.available() > 0;
+}
+
+bool lora_rx_aux_pulse(uint32_t *us, uint32_t *fellAtUs)
+{
+  if (!auxPulseReady)
+    return false;
+  // One reader; a pulse ending in between is taken with the next call
+  auxPulseReady = false;
+  *us = auxPulseUs;
+  if (fellAtUs != NULL)
+    *fellAtUs = auxPulseFellAt;
+  return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <Arduino.h>
+
+// Event driven receive: instead of polling Serial1 with delay(), the loop
+// blocks in lora_rx_wait() until the E32 has output data or a deadline
+// passes. Two wake sources, whichever comes first:
+//   - AUX rising edge: the module has finished writing a packet to the UART
+//   - UART RX event (HardwareSerial::onReceive): the RX line has been idle
+//     for LORA_RX_TIMEOUT_SYMBOLS byte times after received data
+// AUX also rises after our own transmissions; such wakeups find no data
+// and the caller simply waits again.
+
+// Idle byte times after which the UART reports received data
+#define LORA_RX_TIMEOUT_SYMBOLS 2
+
+// Install the AUX interrupt and the UART RX callback
+void lora_rx_begin(HardwareSerial &serial, uint8_t auxPin);
+
+// Wait until serial has data or timeout_ms passed
+// Returns true if data is available
+bool lora_rx_wait(HardwareSerial &serial, uint32_t timeout_ms);
+
+// The last AUX low pulse that ended since the previous call, in µs; false
+// if none. Before a received packet AUX goes low 2-3 ms ahead of the
+// first byte and rises after the last one, so the pulse is the module's
+// UART output of the packet plus that lead. After our own frame it covers
+// the UART input, the air time and the module's settle time. fellAtUs, if
+// given, gets the micros() when it began: a received packet was complete
+// in the module then (lora_time_sync.h takes it as the packet's arrival).
+bool lora_rx_aux_pulse(uint32_t *us, uint32_t *fellAtUs = NULL);
+
+// Usage:
+// uint32_t start = millis();
+// while (!frameComplete(...)) {            // feed LoraFrameDecoder
+//     uint32_t waited = millis() - start;
+//     if (waited >= deadline_ms) break;     // timeout
+//     lora_rx_wait(Serial1, deadline_ms - waited);
+// }
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer for handing items
+// from one task to another (e.g. radio task on core 0 -> output on core 1).
+// Exactly one task may push and exactly one task may pop. No locks, no heap;
+// items are copied in and out. A push into a full queue fails and is
+// counted as a drop, so a slow consumer never blocks the producer.
+template <typename T, size_t N>
+class LoraSpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Producer side
+    bool push(const T &item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if (head - tail >= N) {
+            drops_.store(drops_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        items_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        if (head + 1 - tail > highWater_.load(std::memory_order_relaxed))
+            highWater_.store(head + 1 - tail, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side: the oldest item, left in place, or NULL if empty
+    const T *front() const {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+            return NULL;
+        return &items_[tail & (N - 1)];
+    }
+
+    // Consumer side
+    bool pop(T *item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        if (head == tail)
+            return false;
+        *item = items_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Statistics, safe to read from either side
+    size_t depth() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    uint32_t highWater() const { return highWater_.load(std::memory_order_relaxed); }
+    uint32_t drops() const { return drops_.load(std::memory_order_relaxed); }
+    static constexpr size_t capacity() { return N; }
+
+private:
+    T items_[N];
+    std::atomic<uint32_t> head_{0};      // next slot to write, producer only
+    std::atomic<uint32_t> tail_{0};      // next slot to read, consumer only
+    std::atomic<uint32_t> highWater_{0}; // max depth seen, producer only
+    std::atomic<uint32_t> drops_{0};     // failed pushes, producer only
+};
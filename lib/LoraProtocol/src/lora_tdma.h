@@ -0,0 +1,214 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "communication.h"
+#include "lora_messages.h"
+#include "lora_nodes.h"
+#include "lora_tx_scheduler.h"
+
+// Time slots for many sensors on one channel (fixed transmission mode,
+// lora_nodes.h). Sensors that wake on their own timers send whenever they
+// like (ALOHA): with dozens of them frames overlap and everyone retries.
+//
+// The wake-up period is cut into slots, one per sensor:
+//   | guard | sensor frame | bridge answer | guard |
+// The bridge hands a sensor its slot with the ACK (lora_slot_payload_t in
+// the same lora_batch.h frame): time until the slot and the period, both
+// converted into the sensor's clock. The sensor then transmits only at
+// the start of its slot.
+//
+// The guard covers LORA_TDMA_JITTER_MS of wake-up and UART jitter plus
+// what a sensor's clock may drift within one period. The drift is
+// measured per sensor from its readings: elapsed_time_ms (sensor clock)
+// against the arrival times (bridge clock), smoothed. The guard is sized
+// for the largest drift seen so far; once a sensor drifts more the guard
+// and every slot grow (a new epoch) and each sensor gets its slot again
+// with its next ACK. A sensor whose frame arrives outside its slot window
+// gets it again: up to half a guard late, or up to half a frame time and
+// half a guard early (the frame time is the worst case with the UART
+// transfers at both ends, a sensor may get on air sooner).
+#ifndef LORA_TDMA_JITTER_MS
+#define LORA_TDMA_JITTER_MS 20
+#endif
+#ifndef LORA_TDMA_MAX_SLOTS
+#define LORA_TDMA_MAX_SLOTS 256
+#endif
+// Samples beyond this are not drift but a late (repeated) reading
+#define LORA_TDMA_MAX_DRIFT_PPM 20000
+
+class LoraTdmaSchedule
+{
+public:
+    // frameLen: sensor frame on air, answerLen: the bridge's answer (ACK
+    // with slot) on air, both including address bytes
+    void begin(uint32_t periodMs_, uint32_t airRateBps, uint32_t uartBps, bool fec, size_t frameLen, size_t answerLen,
+               uint32_t nowMs, uint32_t driftPpm_ = 100) {
+        periodMs = periodMs_;
+        LoraTxScheduler timing;
+        timing.begin(airRateBps, uartBps, fec, 0, 0, nowMs);
+        // Module busy from the first UART byte until the last one is out
+        // at the other end: UART in, start gap, air, UART out
+        uint32_t uartOutUs = (uint32_t)((uint64_t)frameLen * 10 * 1000000ULL / uartBps);
+        frameMs = (timing.txTimeUs(frameLen) + uartOutUs + 999) / 1000;
+        answerMs = (timing.txTimeUs(answerLen) + (uint32_t)((uint64_t)answerLen * 10 * 1000000ULL / uartBps) + 999) / 1000;
+        originMs = nowMs;
+        driftPpm = driftPpm_;
+        epoch = 0;
+        layout();
+        for (size_t i = 0; i < sizeof(used) / sizeof(used[0]); ++i)
+            used[i] = 0;
+    }
+
+    uint32_t guardMs() const { return guard; }
+    uint32_t slotMs() const { return slotLen; }
+    size_t slots() const { return count; }
+    uint32_t period() const { return periodMs; }
+    uint32_t answerTimeMs() const { return answerMs; }
+
+    // A free slot, -1 if all are taken. Even slots first, so free ones
+    // stay spread over the period for answers to sensors not in theirs.
+    int assign() {
+        for (size_t n = 0; n < count; ++n) {
+            size_t i = n < (count + 1) / 2 ? 2 * n : 2 * (n - (count + 1) / 2) + 1;
+            if (!isUsed(i)) {
+                take(i);
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+    void take(size_t slot) { used[slot / 32] |= 1UL << (slot % 32); }
+    void release(size_t slot) { used[slot / 32] &= ~(1UL << (slot % 32)); }
+    bool isUsed(size_t slot) const { return (used[slot / 32] >> (slot % 32)) & 1; }
+    // Forget every assignment, e.g. to collect them again from the node table
+    void releaseAll() {
+        for (size_t i = 0; i < sizeof(used) / sizeof(used[0]); ++i)
+            used[i] = 0;
+    }
+
+    // Milliseconds from nowMs until the sensor of slot should start to
+    // transmit, at least minLeadMs away
+    uint32_t nextStartMs(size_t slot, uint32_t nowMs, uint32_t minLeadMs) {
+        rebase(nowMs);
+        uint32_t p = phase(nowMs + minLeadMs - start(slot));
+        return minLeadMs + (p == 0 ? 0 : periodMs - p);
+    }
+
+    // How far a frame completed at arrivalMs is off the slot, ms (+ late)
+    int32_t offsetMs(size_t slot, uint32_t arrivalMs) {
+        rebase(arrivalMs);
+        uint32_t p = phase(arrivalMs - frameMs - start(slot));
+        return p > periodMs / 2 ? (int32_t)p - (int32_t)periodMs : (int32_t)p;
+    }
+
+    // Milliseconds from nowMs until a slot nobody has starts, to answer a
+    // sensor that is not in its slot without hitting someone else's;
+    // UINT32_MAX if every slot is taken
+    uint32_t nextFreeMs(uint32_t nowMs) {
+        uint32_t best = UINT32_MAX;
+        for (size_t i = 0; i < count; ++i) {
+            if (isUsed(i))
+                continue;
+            // The slot begins a guard before its transmit start
+            uint32_t in = nextStartMs(i, nowMs + guard, 0);
+            if (in < best)
+                best = in;
+        }
+        return best;
+    }
+
+    // Whether a frame of the sensor of slot that arrived at arrivalMs was
+    // sent where it should
+    bool onSlot(size_t slot, uint32_t arrivalMs) {
+        int32_t offset = offsetMs(slot, arrivalMs);
+        return offset <= (int32_t)(guard / 2) && offset >= -(int32_t)(frameMs / 2 + guard / 2);
+    }
+
+    // A sensor's measured drift; true if the guard had to grow, then every
+    // slot moved and epoch changed
+    bool observeDrift(int32_t ppm) {
+        uint32_t a = ppm < 0 ? (uint32_t)-ppm : (uint32_t)ppm;
+        if (a <= driftPpm)
+            return false;
+        driftPpm = a + a / 4;
+        layout();
+        epoch++;
+        return true;
+    }
+
+    // Fill in a slot message for a sensor whose clock runs driftPpm
+    // against ours (+ slow): the delay counts from the end of the answer
+    void fill(lora_slot_payload_t *msg, size_t slot, uint32_t nowMs, int32_t sensorDriftPpm) {
+        uint32_t delay = nextStartMs(slot, nowMs, answerMs + LORA_TDMA_JITTER_MS) - answerMs;
+        msg->slotDelayMs = toSensor(delay, sensorDriftPpm);
+        msg->periodMs = toSensor(periodMs, sensorDriftPpm);
+        msg->slotMs = (uint16_t)slotLen;
+    }
+
+    uint8_t epoch = 0;          // Changes whenever the slots move
+    uint32_t driftPpm = 100;    // Drift the guard is sized for
+
+private:
+    void layout() {
+        guard = LORA_TDMA_JITTER_MS + (uint32_t)((uint64_t)driftPpm * periodMs / 1000000);
+        slotLen = 2 * guard + frameMs + answerMs;
+        count = periodMs / slotLen;
+        if (count > LORA_TDMA_MAX_SLOTS)
+            count = LORA_TDMA_MAX_SLOTS;
+    }
+
+    // Transmit start of slot within the period
+    uint32_t start(size_t slot) const { return originMs + (uint32_t)slot * slotLen + guard; }
+
+    // Position within the period of a time relative to a slot start.
+    // Differences are taken signed, so they must stay within 24 days of
+    // the origin; rebase() moves it along in whole periods.
+    uint32_t phase(uint32_t sinceStart) const {
+        int64_t p = (int32_t)sinceStart % (int64_t)periodMs;
+        return (uint32_t)(p < 0 ? p + periodMs : p);
+    }
+    void rebase(uint32_t nowMs) {
+        uint32_t age = nowMs - originMs;
+        if ((int32_t)age > 0 && age >= 1000 * periodMs)
+            originMs += age / periodMs * periodMs;
+    }
+
+    static uint32_t toSensor(uint32_t ms, int32_t ppm) { return (uint32_t)((uint64_t)ms * 1000000 / (uint32_t)(1000000 + ppm)); }
+
+    uint32_t periodMs = 60000;
+    uint32_t frameMs = 0;
+    uint32_t answerMs = 0;
+    uint32_t originMs = 0;
+    uint32_t guard = 0;
+    uint32_t slotLen = 1;
+    size_t count = 0;
+    uint32_t used[LORA_TDMA_MAX_SLOTS / 32];
+};
+
+// Update a node's drift from a reading (its elapsed_time_ms) that arrived
+// at arrivalMs. Returns true if it gave a sample. Readings less than half
+// a period apart are too close for a useful figure.
+static inline bool lora_tdma_measure(lora_node_t *node, uint32_t elapsedMs, uint32_t arrivalMs, uint32_t periodMs) {
+    bool sample = false;
+    uint32_t dS = elapsedMs - node->lastElapsedMs;
+    uint32_t dB = arrivalMs - node->lastArrivalMs;
+    if (node->lastArrivalMs != 0 && (int32_t)dS >= (int32_t)(periodMs / 2)) {
+        int64_t ppm = ((int64_t)dB - dS) * 1000000 / dS;
+        if (ppm > -LORA_TDMA_MAX_DRIFT_PPM && ppm < LORA_TDMA_MAX_DRIFT_PPM) {
+            node->driftPpm = node->driftPpm == 0 ? (int32_t)ppm : (3 * node->driftPpm + (int32_t)ppm) / 4;
+            sample = true;
+        }
+    }
+    node->lastElapsedMs = elapsedMs;
+    node->lastArrivalMs = arrivalMs;
+    return sample;
+}
+
+// Usage, bridge, per reading of a node:
+// if (lora_tdma_measure(node, reading.elapsed_time_ms, arrival, tdma.period())) tdma.observeDrift(node->driftPpm);
+// with the ACK, if the node has no slot, the epoch changed or it arrived off its slot:
+//   lora_slot_payload_t slot = lora_message_init<LORA_EVENT_SLOT>(id++);
+//   tdma.fill(&slot, node->slot - 1, millis(), node->driftPpm);  // add to the ACK batch
+//
+// Sensor: sleep slotDelayMs after receiving it, transmit, then every periodMs.
@@ -0,0 +1,256 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lora_messages.h"
+
+// Sensor clock against the bridge's, and an answer the sensor can wait for
+// just in time.
+//
+// A sensor only knows its own millis(). Now and then (LORA_TIME_SYNC_EVERY
+// ACKs) the bridge puts a lora_time_payload_t in the ACK batch. The sensor
+// answers with a lora_time_response_t in its next frame, the two times it
+// took on its clock. Together with the two the bridge took they make a
+// two-way exchange, as in NTP:
+//   t1  sensor clock   its frame ended on air (its AUX rose after the send)
+//   T2  bridge clock   that frame came out of our module (AUX fell)
+//   T3  bridge clock   our answer ended on air
+//   t4  sensor clock   the answer came out of its module (AUX fell)
+//   offset     = ((T2 - t1) + (T3 - t4)) / 2      bridge minus sensor
+//   round trip = (t4 - t1) - (T3 - T2)           both modules' latency
+// The bridge keeps the offset per sensor and its drift from one exchange
+// to the next (ppm, + the sensor clock runs slow, as in lora_tdma.h), and
+// maps a sensor time onto its own clock with both (lora_time_to_bridge()).
+//
+// The sync message also tells the sensor when the answer comes: the
+// bridge holds every answer until answerDelayMs after the sensor's frame
+// ended on air (T2 + answerDelayMs - half the round trip, written so that
+// it starts on air then), plus or minus windowMs. The sensor may sleep its
+// module until the window opens, and stop listening when it closes
+// instead of after the fixed receive delay. The bridge holds an answer
+// only to a delay the sensor confirmed with a response; one it cannot
+// keep (late) goes out anyway and a longer delay follows with the next ACK.
+#ifndef LORA_TIME_SYNC_EVERY
+#define LORA_TIME_SYNC_EVERY 16
+#endif
+// Until a sensor has answered one, every this many ACKs
+#define LORA_TIME_SYNC_RETRY 4
+// Answer start jitter either side: task wake-up, UART, ms resolution
+#ifndef LORA_TIME_SYNC_JITTER_MS
+#define LORA_TIME_SYNC_JITTER_MS 10
+#endif
+// Added to the slowest answer since the last sync
+#define LORA_TIME_SYNC_MARGIN_MS 5
+// Offset samples closer than this give no drift
+#define LORA_TIME_SYNC_MIN_SPAN_MS 30000
+// An offset this far off the prediction: the sensor started over
+#define LORA_TIME_SYNC_RESET_MS 1000
+#define LORA_TIME_SYNC_MAX_DRIFT_PPM 20000
+// Windows the sensor misses in a row before it listens the usual way again
+#define LORA_TIME_SYNC_MISSES 8
+
+// Per sensor on the bridge; all zero is a sensor never synced
+typedef struct {
+    int32_t offsetMs;                          // Bridge minus sensor at sampleMs
+    uint32_t sampleMs;                         // Bridge clock of the last offset sample
+    int32_t driftPpm;
+    uint16_t roundTripMs;
+    uint8_t samples;                           // Offset samples, saturating
+    uint8_t sinceSync;                         // ACKs since the last sync message
+    uint16_t answerDelayMs;                    // Confirmed by the sensor, 0 = none, from T2
+    uint16_t proposedDelayMs;                  // In the last sync message, from T2
+    uint16_t syncID;                           // messageID of the last sync message
+    bool syncOut;                              // It went out, its T2/T3 are below
+    uint32_t syncRxEndMs;                      // T2 of that exchange
+    uint32_t syncTxEndMs;                      // T3 of that exchange
+    uint16_t slowestMs;                        // Slowest answer since the last sync, from T2
+    uint16_t late;                             // Answers later than the confirmed delay
+} lora_clock_t;
+
+static inline int32_t lora_time_drift_ms(int32_t ppm, uint32_t ms) {
+    return (int32_t)((int64_t)ppm * ms / 1000000);
+}
+
+// Bridge minus sensor at bridge time nowMs
+static inline int32_t lora_time_offset(const lora_clock_t *clock, uint32_t nowMs) {
+    return clock->offsetMs + lora_time_drift_ms(clock->driftPpm, nowMs - clock->sampleMs);
+}
+
+// A sensor time on the bridge's clock
+static inline uint32_t lora_time_to_bridge(const lora_clock_t *clock, uint32_t sensorMs) {
+    uint32_t approx = sensorMs + (uint32_t)clock->offsetMs;
+    return sensorMs + (uint32_t)lora_time_offset(clock, approx);
+}
+
+// The answer to a frame that came out of the module at rxEndMs is ready
+// to be written; leadMs until it would start on air. How long to hold it
+// so it starts at the confirmed delay (0: now, or it is late).
+static inline uint32_t lora_time_hold_ms(lora_clock_t *clock, uint32_t rxEndMs, uint32_t nowMs, uint32_t leadMs) {
+    uint32_t ready = nowMs + leadMs - rxEndMs;
+    if (ready > UINT16_MAX)
+        ready = UINT16_MAX;
+    if (ready > clock->slowestMs)
+        clock->slowestMs = (uint16_t)ready;
+    if (clock->answerDelayMs == 0)
+        return 0;
+    if (ready > clock->answerDelayMs) {
+        clock->late++;
+        return 0;
+    }
+    return clock->answerDelayMs - ready;
+}
+
+// A sync message belongs in this ACK
+static inline bool lora_time_due(const lora_clock_t *clock) {
+    if (clock->answerDelayMs != 0 && clock->slowestMs > clock->answerDelayMs)
+        return true;
+    return clock->sinceSync >= (clock->samples ? LORA_TIME_SYNC_EVERY : LORA_TIME_SYNC_RETRY);
+}
+
+// Fill in the sync message for the answer to the frame of rxEndMs, which
+// would start on air readyMs after rxEndMs if written now; the delay it
+// proposes covers that and the slowest answer since the last sync, and
+// comes down only half way at a time
+static inline void lora_time_fill(lora_clock_t *clock, lora_time_payload_t *msg, uint32_t rxEndMs, uint32_t readyMs) {
+    uint32_t slowest = readyMs > clock->slowestMs ? readyMs : clock->slowestMs;
+    uint32_t delay = slowest + LORA_TIME_SYNC_MARGIN_MS;
+    if (delay < clock->answerDelayMs)
+        delay = clock->answerDelayMs - (clock->answerDelayMs - delay) / 2;
+    if (delay > UINT16_MAX / 2)
+        delay = UINT16_MAX / 2;
+    clock->proposedDelayMs = (uint16_t)delay;
+    clock->syncID = msg->messageID;
+    clock->syncOut = false;
+    clock->syncRxEndMs = rxEndMs;
+    uint32_t drift = (uint32_t)(clock->driftPpm < 0 ? -clock->driftPpm : clock->driftPpm);
+    msg->offsetMs = clock->samples ? lora_time_offset(clock, rxEndMs) : 0;
+    msg->driftPpm = (int16_t)clock->driftPpm;
+    // The sensor counts from its frame's end on air, before our module had it
+    msg->answerDelayMs = (uint16_t)(delay + clock->roundTripMs / 2);
+    msg->windowMs = (uint16_t)(LORA_TIME_SYNC_JITTER_MS + lora_time_drift_ms((int32_t)drift, delay));
+}
+
+// The ACK went out; a sync message in it ended on air at txEndMs
+static inline void lora_time_sent(lora_clock_t *clock, bool withSync, uint32_t txEndMs) {
+    if (!withSync) {
+        if (clock->sinceSync < UINT8_MAX)
+            clock->sinceSync++;
+        return;
+    }
+    clock->sinceSync = 0;
+    clock->slowestMs = 0;
+    clock->syncOut = true;
+    clock->syncTxEndMs = txEndMs;
+}
+
+// The sensor's response: true if it gave an offset sample. It confirms
+// the delay of that sync message, answers are held to it from now on.
+static inline bool lora_time_measure(lora_clock_t *clock, const lora_time_response_t &r) {
+    if (!clock->syncOut || r.syncID != clock->syncID)
+        return false;
+    clock->syncOut = false;
+    clock->answerDelayMs = clock->proposedDelayMs;
+    int32_t out = (int32_t)(clock->syncRxEndMs - r.frameEndMs);
+    int32_t back = (int32_t)(clock->syncTxEndMs - r.answerEndMs);
+    int32_t offset = (int32_t)(((int64_t)out + back) / 2);
+    int32_t trip = out - back;
+    uint32_t span = clock->syncRxEndMs - clock->sampleMs;
+    if (clock->samples > 0) {
+        int32_t predicted = lora_time_offset(clock, clock->syncRxEndMs);
+        int32_t error = offset - predicted;
+        if (error > LORA_TIME_SYNC_RESET_MS || error < -LORA_TIME_SYNC_RESET_MS) {
+            // A sensor that started over: its drift stays, the offset is new
+            clock->samples = 0;
+        } else if (span >= LORA_TIME_SYNC_MIN_SPAN_MS) {
+            int64_t ppm = ((int64_t)offset - clock->offsetMs) * 1000000 / span;
+            if (ppm > -LORA_TIME_SYNC_MAX_DRIFT_PPM && ppm < LORA_TIME_SYNC_MAX_DRIFT_PPM)
+                clock->driftPpm = clock->samples == 1 ? (int32_t)ppm : (3 * clock->driftPpm + (int32_t)ppm) / 4;
+        } else {
+            // Too close for a drift: keep the older sample as its base
+            return true;
+        }
+    }
+    clock->offsetMs = offset;
+    clock->sampleMs = clock->syncRxEndMs;
+    clock->roundTripMs = (uint16_t)(trip < 0 ? 0 : trip > UINT16_MAX ? UINT16_MAX : trip);
+    if (clock->samples < UINT8_MAX)
+        clock->samples++;
+    return true;
+}
+
+// The sensor's side: answers the sync messages, knows when to listen
+class LoraTimeSyncClient
+{
+public:
+    // A sync message came with the answer to the frame that ended on air
+    // at frameEndMs; the answer came out of the module at answerEndMs
+    void synced(const lora_time_payload_t &msg, uint32_t frameEndMs, uint32_t answerEndMs) {
+        response.messageID = 0;
+        response.lora_eventID = LORA_EVENT_TIME_SYNC_RESPONSE;
+        response.syncID = msg.messageID;
+        response.frameEndMs = frameEndMs;
+        response.answerEndMs = answerEndMs;
+        responsePending = true;
+        offsetMs = msg.offsetMs;
+        driftPpm = msg.driftPpm;
+        answerDelayMs = msg.answerDelayMs;
+        windowMs = msg.windowMs;
+        active = true;
+        misses = 0;
+    }
+
+    // The response for the next frame, false if there is none
+    bool respond(uint16_t messageID, lora_time_response_t *msg) {
+        if (!responsePending)
+            return false;
+        *msg = response;
+        msg->messageID = messageID;
+        msg->checksum = lora_message_checksum(msg);
+        return true;
+    }
+
+    // The frame with the response got its answer
+    void acked() { responsePending = false; }
+
+    // Listen for the answer to a frame that ended on air at frameEndMs,
+    // an answer of at most maxAnswerAirMs on air: from openMs until
+    // closeMs. False without a sync: listen at once, the usual delay.
+    bool window(uint32_t frameEndMs, uint32_t maxAnswerAirMs, uint32_t *openMs, uint32_t *closeMs) const {
+        if (!active)
+            return false;
+        uint32_t start = frameEndMs + answerDelayMs;
+        *openMs = start - windowMs;
+        *closeMs = start + windowMs + maxAnswerAirMs + windowMs;
+        return true;
+    }
+
+    // The window closed without an answer
+    void missed() {
+        if (active && ++misses >= LORA_TIME_SYNC_MISSES)
+            active = false;
+    }
+
+    bool active = false;
+    int32_t offsetMs = 0;
+    int16_t driftPpm = 0;
+    uint16_t answerDelayMs = 0;
+    uint16_t windowMs = 0;
+
+private:
+    lora_time_response_t response = {};
+    bool responsePending = false;
+    uint8_t misses = 0;
+};
+
+// Usage, bridge, per sensor (lora_node_t::clock, or one for the sensor):
+// response in a frame:   if (lora_time_measure(&clock, resp)) log offset, drift, round trip
+// building the ACK:      if (lora_time_due(&clock) && batch.fits(sizeof(msg)))
+//                          msg = lora_message_init<LORA_EVENT_TIME_SYNC>(id++);
+//                          lora_time_fill(&clock, &msg, rxEndMs, millis() + leadMs - rxEndMs); ...
+// before writing it:     delay(lora_time_hold_ms(&clock, rxEndMs, millis(), uartAndIdleMs));
+// sent:                  lora_time_sent(&clock, withSync, txStartMs + txTimeMs);
+//
+// Sensor: client.synced(msg, frameEnd, answerEnd) on a sync message,
+// client.respond(id, &resp) into the next frame, client.acked() once it is
+// answered; after a frame sleep until client.window(...) opens, give up
+// when it closes and call client.missed().
@@ -0,0 +1,161 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Transmit scheduling from the E32 time on air instead of fixed delays.
+//
+// Airtime model (the same as lib/E32Sim): LORA_AIR_OVERHEAD_BYTES of
+// preamble and header plus the frame, at the air data rate, FEC adds a
+// quarter. In transparent mode the module starts the air packet once the
+// UART has been idle for LORA_AIR_START_IDLE_BYTES byte times, so a frame
+// occupies the module for its UART time plus that gap plus its airtime.
+//
+// LoraTxScheduler tells the caller how long to wait before a frame may go:
+//   - until our previous frame has left the air (back to back otherwise)
+//   - until the duty-cycle budget has room for the frame's airtime
+// The budget is a token bucket: dutyPermille of the elapsed time accrues
+// as airtime credit, capped at dutyPermille of windowMs. It starts full.
+// EU 868 MHz: 1 % (10 permille) per hour in 863-868.6 MHz, where E32-900
+// channel 6 (868 MHz) lies; 915 MHz FCC has no duty cycle (0 = off).
+//
+// Time is passed in (millis()), so the class runs on the host as well.
+// Not synchronised: sending and reading the statistics belong in one task
+// (airUs and creditUs are 64 bit), other tasks get a copy.
+#define LORA_AIR_OVERHEAD_BYTES 12
+#define LORA_AIR_START_IDLE_BYTES 3
+
+// E32 SPED.airDataRate / SPED.uartBaudRate codes in bit/s
+static inline uint32_t lora_air_rate_bps(uint8_t airDataRate) {
+    static const uint32_t rates[] = {300, 1200, 2400, 4800, 9600, 19200, 19200, 19200};
+    return rates[airDataRate & 0x07];
+}
+
+static inline uint32_t lora_uart_bps(uint8_t uartBaudRate) {
+    static const uint32_t rates[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200};
+    return rates[uartBaudRate & 0x07];
+}
+
+// Time on air of a frame of len bytes
+static inline uint32_t lora_airtime_us(size_t len, uint32_t airRateBps, bool fec) {
+    uint64_t bits = (uint64_t)(len + LORA_AIR_OVERHEAD_BYTES) * 8;
+    if (fec)
+        bits = bits * 5 / 4;
+    return (uint32_t)(bits * 1000000ULL / airRateBps);
+}
+
+class LoraTxScheduler
+{
+public:
+    void begin(uint32_t airRateBps, uint32_t uartBps, bool fec, uint16_t dutyPermille, uint32_t windowMs, uint32_t nowMs) {
+        airRate = airRateBps;
+        uartRate = uartBps;
+        fecOn = fec;
+        duty = dutyPermille;
+        capacityUs = (int64_t)windowMs * dutyPermille;
+        creditUs = capacityUs;
+        lastRefillMs = nowMs;
+        startMs = nowMs;
+        busyUntilMs = nowMs;
+    }
+
+    // The module runs another air rate from now on; budget and counters stay
+    void setAirRate(uint32_t airRateBps) { airRate = airRateBps; }
+
+    uint32_t airtimeUs(size_t len) const { return lora_airtime_us(len, airRate, fecOn); }
+
+    // UART transfer, start gap and airtime: how long the module is busy
+    uint32_t txTimeUs(size_t len) const {
+        uint64_t uartUs = (uint64_t)(len + LORA_AIR_START_IDLE_BYTES) * 10 * 1000000ULL / uartRate;
+        return (uint32_t)uartUs + airtimeUs(len);
+    }
+
+    // Milliseconds to wait before a frame of len bytes may start, 0 = now
+    uint32_t delayMs(size_t len, uint32_t nowMs) {
+        refill(nowMs);
+        uint32_t wait = 0;
+        if ((int32_t)(busyUntilMs - nowMs) > 0)
+            wait = busyUntilMs - nowMs;
+        int64_t missingUs = (int64_t)airtimeUs(len) - creditUs;
+        if (duty != 0 && missingUs > 0) {
+            uint32_t budgetWait = (uint32_t)((missingUs + duty - 1) / duty);
+            if (budgetWait > wait)
+                wait = budgetWait;
+        }
+        return wait;
+    }
+
+    // A frame of len bytes was handed to the module at startMs
+    void sent(size_t len, uint32_t startMs_) {
+        refill(startMs_);
+        uint32_t air = airtimeUs(len);
+        if (duty != 0)
+            creditUs -= air;
+        busyUntilMs = startMs_ + (txTimeUs(len) + 999) / 1000;
+        frames++;
+        airUs += air;
+    }
+
+    // A frame was not sent because the wait would have been too long
+    void skipped() { skips++; }
+    // The caller waited ms before a frame
+    void waited(uint32_t ms) {
+        if (ms) {
+            deferred++;
+            waitMs += ms;
+        }
+    }
+
+    // Airtime since begin() in permille of the elapsed time
+    uint32_t utilisationPermille(uint32_t nowMs) const {
+        uint32_t elapsed = nowMs - startMs;
+        return elapsed ? (uint32_t)(airUs / elapsed) : 0;
+    }
+    // Part of the duty-cycle budget in use, permille
+    uint32_t budgetUsedPermille(uint32_t nowMs) const {
+        int64_t credit = creditAt(nowMs);
+        return capacityUs > 0 ? (uint32_t)((capacityUs - credit) * 1000 / capacityUs) : 0;
+    }
+
+    uint32_t frames = 0;     // Frames sent
+    uint64_t airUs = 0;      // Total time on air
+    uint32_t deferred = 0;   // Frames that had to wait
+    uint32_t waitMs = 0;     // Total wait
+    uint32_t skips = 0;      // Frames dropped because the wait was too long
+
+private:
+    int64_t creditAt(uint32_t nowMs) const {
+        int32_t elapsed = (int32_t)(nowMs - lastRefillMs);
+        if (elapsed <= 0)
+            return creditUs;
+        int64_t credit = creditUs + (int64_t)elapsed * duty;
+        return credit < capacityUs ? credit : capacityUs;
+    }
+
+    void refill(uint32_t nowMs) {
+        // Only forward: sent() gets the start time of a frame that may
+        // lie before the last delayMs() call
+        if ((int32_t)(nowMs - lastRefillMs) <= 0)
+            return;
+        creditUs = creditAt(nowMs);
+        lastRefillMs = nowMs;
+    }
+
+    uint32_t airRate = 2400;
+    uint32_t uartRate = 9600;
+    bool fecOn = true;
+    uint16_t duty = 0;
+    int64_t capacityUs = 0;
+    int64_t creditUs = 0;
+    uint32_t lastRefillMs = 0;
+    uint32_t startMs = 0;
+    uint32_t busyUntilMs = 0;
+};
+
+// Usage:
+// txScheduler.begin(lora_air_rate_bps(cfg.SPED.airDataRate), lora_uart_bps(cfg.SPED.uartBaudRate),
+//                   cfg.OPTION.fec == FEC_1_ON, 10, 3600000UL, millis());
+// uint32_t wait = txScheduler.delayMs(frame.len, millis());
+// delay(wait); txScheduler.waited(wait);
+// uint32_t start = millis();
+// e32ttl.sendMessage(frame.data, frame.len);
+// txScheduler.sent(frame.len, start);
@@ -0,0 +1,124 @@
+/**************************************************************************
+bench_compare
+
+  Puts two result files of the bench project side by side, e.g. of the
+  commit before and after a change (BENCH_OUTPUT=before.csv, see
+  bench/src/bench.h). Prints ns/op and allocations per op of every case
+  found in both files and the change in per cent; cases in only one of
+  them are listed as added or removed.
+
+  bench_compare before.csv after.csv [-t percent]
+  -t  a case this much slower, or with more allocations, is a regression
+      (default 10)
+  Exit code 1 if a file could not be read, 2 if there is a regression.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+struct Result
+{
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+typedef std::map<std::string, Result> Results;
+
+// The CSV of bench_main.cpp: label,benchmark,iterations,ns_per_op,
+// cycles_per_op,allocs_per_op,heap_bytes_per_op,bytes_per_sec
+static bool readResults(const char *path, Results *results, std::string *label)
+{
+  FILE *in = fopen(path, "r");
+  if (in == NULL)
+  {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  bool header = true;
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    if (header)
+    {
+      header = false;
+      if (strncmp(line, "label,benchmark,", 16) != 0)
+      {
+        fprintf(stderr, "%s: not a bench CSV file\n", path);
+        fclose(in);
+        return false;
+      }
+      continue;
+    }
+    char lbl[64], name[96];
+    unsigned long long iterations;
+    double ns, cycles, allocs;
+    if (sscanf(line, "%63[^,],%95[^,],%llu,%lf,%lf,%lf", lbl, name, &iterations, &ns, &cycles, &allocs) != 6)
+    {
+      // No label: the field is empty
+      lbl[0] = '\0';
+      if (sscanf(line, ",%95[^,],%llu,%lf,%lf,%lf", name, &iterations, &ns, &cycles, &allocs) != 5)
+        continue;
+    }
+    *label = lbl;
+    (*results)[name] = Result{ns, allocs};
+  }
+  fclose(in);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const char *paths[2] = {NULL, NULL};
+  double threshold = 10.0;
+  int files = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      threshold = atof(argv[++i]);
+    else if (files < 2)
+      paths[files++] = argv[i];
+  }
+  if (files != 2)
+  {
+    fprintf(stderr, "usage: bench_compare before.csv after.csv [-t percent]\n");
+    return 1;
+  }
+  Results before, after;
+  std::string labelBefore, labelAfter;
+  if (!readResults(paths[0], &before, &labelBefore) || !readResults(paths[1], &after, &labelAfter))
+    return 1;
+
+  printf("%-36s %10s %10s %8s %9s %9s\n", "benchmark",
+         labelBefore.empty() ? "before" : labelBefore.c_str(),
+         labelAfter.empty() ? "after" : labelAfter.c_str(), "change", "allocs", "allocs");
+  unsigned regressions = 0;
+  for (Results::const_iterator it = before.begin(); it != before.end(); ++it)
+  {
+    Results::const_iterator other = after.find(it->first);
+    if (other == after.end())
+    {
+      printf("%-36s %10.1f %10s\n", it->first.c_str(), it->second.nsPerOp, "removed");
+      continue;
+    }
+    const Result &a = it->second;
+    const Result &b = other->second;
+    double change = a.nsPerOp > 0 ? (b.nsPerOp - a.nsPerOp) * 100.0 / a.nsPerOp : 0.0;
+    // Any new allocation counts, the heap is what the ESP32 runs short of
+    bool slower = change > threshold || b.allocsPerOp > a.allocsPerOp + 0.01;
+    regressions += slower;
+    printf("%-36s %10.1f %10.1f %+7.1f%% %9.2f %9.2f%s\n", it->first.c_str(), a.nsPerOp, b.nsPerOp, change,
+           a.allocsPerOp, b.allocsPerOp, slower ? "  REGRESSION" : "");
+  }
+  for (Results::const_iterator it = after.begin(); it != after.end(); ++it)
+  {
+    if (before.find(it->first) == before.end())
+      printf("%-36s %10s %10.1f\n", it->first.c_str(), "added", it->second.nsPerOp);
+  }
+  printf("%u of %u cases more than %.0f%% slower or allocating more\n", regressions, (unsigned)before.size(), threshold);
+  return regressions ? 2 : 0;
+}
@@ -0,0 +1,114 @@
+/**************************************************************************
+log_decode
+
+  Decodes the binary log records of lib/LoraProtocol/src/lora_log.h.
+  Reads a console capture from a file or stdin and writes text to stdout.
+  Records are 0x00, COBS(record), 0x00 on the wire; everything between
+  records is ordinary Serial output and is copied through. A
+  LOGF_PERF_REPORT record (lora_perf.h summary) is printed field by field.
+
+  log_decode [capture.bin]
+  Exit code 1 if the input could not be opened.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lora_log.h"
+#include "lora_messages.h"
+
+static unsigned long decoded = 0;
+static uint64_t wrapUs = 0;         // micros() wraps after 71 minutes
+static uint32_t lastUs = 0;
+
+// lora_message_print() to stdout
+struct StdoutPrint
+{
+  void println(const char *line) { printf("  %s\n", line); }
+};
+
+// Print chunk as a record if it is one
+static bool decodeRecord(const uint8_t *chunk, size_t len)
+{
+  lora_log_record_t record;
+  if (!lora_log_record_decode(chunk, len, &record))
+    return false;
+
+  if (record.format == LOGF_BOOT)
+  {
+    // Device restarted, micros() starts over
+    wrapUs = 0;
+    lastUs = 0;
+    uint32_t formats;
+    memcpy(&formats, record.data, sizeof(formats));
+    if (formats != LORA_LOG_FORMAT_COUNT)
+      fprintf(stderr, "warning: device has %u log formats, decoder %u; rebuild from the same tree\n",
+              (unsigned)formats, (unsigned)LORA_LOG_FORMAT_COUNT);
+  }
+  if (record.us < lastUs)
+    wrapUs += 1ULL << 32;
+  lastUs = record.us;
+
+  char message[LORA_LOG_LINE_SIZE];
+  lora_log_format_message(&record, message, sizeof(message));
+  uint64_t us = wrapUs + record.us;
+  printf("%5llu.%06llu %c %s\n", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000),
+         lora_log_level_letter(record.level), message);
+  const lora_message_info_t *info;
+  if (record.format == LOGF_PERF_REPORT && (record.level & LORA_LOG_FLAG_DATA) &&
+      lora_message_decode(record.data, record.len, &info) == LORA_MSG_OK)
+  {
+    StdoutPrint out;
+    lora_message_print(out, *info, record.data);
+  }
+  decoded++;
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  FILE *in = stdin;
+  if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  // Text passes through as it comes; a chunk after a 0x00 is held back
+  // until the next 0x00 shows whether it is a record
+  static uint8_t chunk[4096];
+  size_t len = 0;
+  bool afterZero = false;
+  int c;
+  while ((c = fgetc(in)) != EOF)
+  {
+    if (c == 0)
+    {
+      if (afterZero && len > 0 && !decodeRecord(chunk, len))
+        fwrite(chunk, 1, len, stdout);
+      len = 0;
+      afterZero = true;
+      continue;
+    }
+    if (!afterZero)
+    {
+      putchar(c);
+      continue;
+    }
+    chunk[len++] = (uint8_t)c;
+    if (len == sizeof(chunk) || len > 1 + sizeof(lora_log_record_t) + 1)
+    {
+      // Too long for a record: text after a lost delimiter
+      fwrite(chunk, 1, len, stdout);
+      len = 0;
+      afterZero = false;
+    }
+  }
+  fwrite(chunk, 1, len, stdout);
+  fflush(stdout);
+  fprintf(stderr, "%lu log records decoded\n", decoded);
+  if (in != stdin)
+    fclose(in);
+  return 0;
+}
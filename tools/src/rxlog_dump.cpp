@@ -0,0 +1,126 @@
+/**************************************************************************
+rxlog_dump
+
+  Reads the store-and-forward log of LoraReceiver (lib/LoraProtocol/src/
+  lora_flash_log.h), e.g. downloaded from the LittleFS partition or left
+  by the host simulation in .sim_fs. Checks every block's CRC, prints a
+  line per block and a summary: head, read cursor, backlog.
+
+  rxlog_dump rxlog.bin [rxlog.cur] [-r]
+  -r  also print the records: received_ms and the message, decoded with
+      the lora_messages.h registry
+  Exit code 1 if the log could not be opened, 2 if a block is corrupt.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "communication.h"
+#include "lora_flash_log.h"
+#include "lora_messages.h"
+
+struct StdoutPrint
+{
+  void println(const char *line) { printf("    %s\n", line); }
+};
+
+static void printRecords(const uint8_t *block)
+{
+  LoraFlashRecordReader reader(block);
+  const uint8_t *entry;
+  size_t len;
+  StdoutPrint out;
+  while (reader.next(&entry, &len))
+  {
+    if (len <= sizeof(uint32_t))
+    {
+      printf("  record of %u bytes, too short\n", (unsigned)len);
+      continue;
+    }
+    uint32_t receivedMs;
+    memcpy(&receivedMs, entry, sizeof(receivedMs));
+    const lora_message_info_t *info;
+    lora_msg_status_t status = lora_message_decode(entry + sizeof(uint32_t), len - sizeof(uint32_t), &info);
+    printf("  received %u ms, %s\n", (unsigned)receivedMs, lora_msg_status_name(status));
+    if (info != NULL)
+      lora_message_print(out, *info, entry + sizeof(uint32_t));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *logPath = NULL;
+  const char *cursorPath = NULL;
+  bool records = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-r") == 0)
+      records = true;
+    else if (logPath == NULL)
+      logPath = argv[i];
+    else
+      cursorPath = argv[i];
+  }
+  if (logPath == NULL)
+  {
+    fprintf(stderr, "usage: rxlog_dump rxlog.bin [rxlog.cur] [-r]\n");
+    return 1;
+  }
+  FILE *in = fopen(logPath, "rb");
+  if (in == NULL)
+  {
+    perror(logPath);
+    return 1;
+  }
+
+  static uint8_t block[LORA_FLASH_LOG_BLOCK];
+  unsigned blocks = 0, valid = 0, corrupt = 0;
+  unsigned long total = 0;
+  uint32_t head = 0, oldest = 0;
+  while (fread(block, 1, sizeof(block), in) == sizeof(block))
+  {
+    const lora_flash_block_t *header = (const lora_flash_block_t *)block;
+    if (!lora_flash_block_valid(block))
+    {
+      // Never written (erased) or torn
+      bool erased = header->magic != LORA_FLASH_LOG_MAGIC;
+      printf("block %4u: %s\n", blocks, erased ? "empty" : "bad CRC");
+      corrupt += !erased;
+      blocks++;
+      continue;
+    }
+    printf("block %4u: seq %u, %u records, %u bytes\n", blocks, (unsigned)header->seq, header->count, header->used);
+    if (valid == 0 || (int32_t)(header->seq - head) > 0)
+      head = header->seq;
+    if (valid == 0 || (int32_t)(header->seq - oldest) < 0)
+      oldest = header->seq;
+    valid++;
+    total += header->count;
+    if (records)
+      printRecords(block);
+    blocks++;
+  }
+  fclose(in);
+
+  printf("%u blocks, %u valid, %u corrupt, %lu records", blocks, valid, corrupt, total);
+  if (valid > 0)
+    printf(", seq %u..%u", (unsigned)oldest, (unsigned)head);
+  printf("\n");
+  if (cursorPath != NULL)
+  {
+    lora_flash_cursor_t cursor;
+    FILE *cur = fopen(cursorPath, "rb");
+    if (cur == NULL)
+      perror(cursorPath);
+    else if (fread(&cursor, 1, sizeof(cursor), cur) != sizeof(cursor) || cursor.magic != LORA_FLASH_CURSOR_MAGIC ||
+             cursor.crc != lora_flash_cursor_crc(cursor))
+      printf("cursor: none or invalid, replay starts at the oldest block\n");
+    else
+      printf("cursor: seq %u, backlog %d blocks\n", (unsigned)cursor.seq,
+             valid > 0 ? (int)(head + 1 - cursor.seq) : 0);
+    if (cur != NULL)
+      fclose(cur);
+  }
+  return corrupt > 0 ? 2 : 0;
+}